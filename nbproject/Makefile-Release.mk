@@ -59,14 +59,44 @@ OBJECTFILES= \
 	${OBJECTDIR}/src/network/Channel.o \
 	${OBJECTDIR}/src/scripting/PokemonObject.o \
 	${OBJECTDIR}/src/database/sha2.o \
-	${OBJECTDIR}/src/shoddybattle/Team.o
+	${OBJECTDIR}/src/shoddybattle/Team.o \
+	${OBJECTDIR}/src/shoddybattle/SimulatedBattle.o \
+	${OBJECTDIR}/src/mechanics/RandomGenerator.o \
+	${OBJECTDIR}/src/shoddybattle/RolloutPool.o \
+	${OBJECTDIR}/src/shoddybattle/MonteCarloPolicy.o \
+	${OBJECTDIR}/src/network/AiClient.o \
+	${OBJECTDIR}/src/shoddybattle/TurnArena.o \
+	${OBJECTDIR}/src/shoddybattle/GamePack.o \
+	${OBJECTDIR}/src/shoddybattle/XmlStream.o \
+	${OBJECTDIR}/src/main/StartupPipeline.o \
+	${OBJECTDIR}/src/shoddybattle/NameTable.o \
+	${OBJECTDIR}/src/network/TeamValidationCache.o \
+	${OBJECTDIR}/src/database/BanCache.o \
+	${OBJECTDIR}/src/database/WriteQueue.o \
+	${OBJECTDIR}/src/database/MySqlStorage.o \
+	${OBJECTDIR}/src/database/SqliteStorage.o
+
+# Simulator Object Files
+SIM_OBJECTFILES= \
+	$(filter-out ${OBJECTDIR}/src/main/main.o,${OBJECTFILES}) \
+	${OBJECTDIR}/src/main/simulator.o
+
+# Benchmark Object Files
+BENCH_OBJECTFILES= \
+	$(filter-out ${OBJECTDIR}/src/main/main.o,${OBJECTFILES}) \
+	${OBJECTDIR}/src/main/benchmark.o
+
+# Packer Object Files
+PACK_OBJECTFILES= \
+	$(filter-out ${OBJECTDIR}/src/main/main.o,${OBJECTFILES}) \
+	${OBJECTDIR}/src/main/packer.o
 
 # C Compiler Flags
 CFLAGS=
 
 # CC Compiler Flags
-CCFLAGS=-Wall -Wextra -lmozjs -lnspr -lxerces-c -lmysqlclient -lmysqlpp -lboost_thread-gcc42-mt -lboost_regex-gcc42-mt -lboost_system-gcc42-mt -lboost_filesystem -lboost_date_time -lboost_program_options-gcc42-mt -ldaemon
-CXXFLAGS=-Wall -Wextra -lmozjs -lnspr -lxerces-c -lmysqlclient -lmysqlpp -lboost_thread-gcc42-mt -lboost_regex-gcc42-mt -lboost_system-gcc42-mt -lboost_filesystem -lboost_date_time -lboost_program_options-gcc42-mt -ldaemon
+CCFLAGS=-Wall -Wextra -lmozjs -lnspr -lxerces-c -lmysqlclient -lmysqlpp -lsqlite3 -lboost_thread-gcc42-mt -lboost_regex-gcc42-mt -lboost_system-gcc42-mt -lboost_filesystem -lboost_date_time -lboost_program_options-gcc42-mt -ldaemon
+CXXFLAGS=-Wall -Wextra -lmozjs -lnspr -lxerces-c -lmysqlclient -lmysqlpp -lsqlite3 -lboost_thread-gcc42-mt -lboost_regex-gcc42-mt -lboost_system-gcc42-mt -lboost_filesystem -lboost_date_time -lboost_program_options-gcc42-mt -ldaemon
 
 # Fortran Compiler Flags
 FFLAGS=
@@ -80,11 +110,26 @@ LDLIBSOPTIONS=-L/usr/lib/mysql -L/usr/lib -L/usr/local/lib
 # Build Targets
 .build-conf: ${BUILD_SUBPROJECTS}
 	${MAKE}  -f nbproject/Makefile-Release.mk dist/Release/GNU-Linux-x86/shoddybattle2
+	${MAKE}  -f nbproject/Makefile-Release.mk dist/Release/GNU-Linux-x86/shoddybattle2-sim
+	${MAKE}  -f nbproject/Makefile-Release.mk dist/Release/GNU-Linux-x86/shoddybattle2-bench
+	${MAKE}  -f nbproject/Makefile-Release.mk dist/Release/GNU-Linux-x86/shoddybattle2-pack
 
 dist/Release/GNU-Linux-x86/shoddybattle2: ${OBJECTFILES}
 	${MKDIR} -p dist/Release/GNU-Linux-x86
 	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/shoddybattle2 ${OBJECTFILES} ${LDLIBSOPTIONS} 
 
+dist/Release/GNU-Linux-x86/shoddybattle2-sim: ${SIM_OBJECTFILES}
+	${MKDIR} -p dist/Release/GNU-Linux-x86
+	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/shoddybattle2-sim ${SIM_OBJECTFILES} ${LDLIBSOPTIONS} 
+
+dist/Release/GNU-Linux-x86/shoddybattle2-bench: ${BENCH_OBJECTFILES}
+	${MKDIR} -p dist/Release/GNU-Linux-x86
+	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/shoddybattle2-bench ${BENCH_OBJECTFILES} ${LDLIBSOPTIONS} 
+
+dist/Release/GNU-Linux-x86/shoddybattle2-pack: ${PACK_OBJECTFILES}
+	${MKDIR} -p dist/Release/GNU-Linux-x86
+	${LINK.cc} -o ${CND_DISTDIR}/${CND_CONF}/${CND_PLATFORM}/shoddybattle2-pack ${PACK_OBJECTFILES} ${LDLIBSOPTIONS} 
+
 ${OBJECTDIR}/src/database/rijndael.h.gch: nbproject/Makefile-${CND_CONF}.mk src/database/rijndael.h 
 	${MKDIR} -p ${OBJECTDIR}/src/database
 	${RM} $@.d
@@ -350,6 +395,96 @@ ${OBJECTDIR}/src/network/ThreadedQueue.h.gch: nbproject/Makefile-${CND_CONF}.mk
 	${RM} $@.d
 	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o $@ src/network/ThreadedQueue.h
 
+${OBJECTDIR}/src/shoddybattle/SimulatedBattle.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/SimulatedBattle.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/SimulatedBattle.o src/shoddybattle/SimulatedBattle.cpp
+
+${OBJECTDIR}/src/main/simulator.o: nbproject/Makefile-${CND_CONF}.mk src/main/simulator.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/main
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/main/simulator.o src/main/simulator.cpp
+
+${OBJECTDIR}/src/main/benchmark.o: nbproject/Makefile-${CND_CONF}.mk src/main/benchmark.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/main
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/main/benchmark.o src/main/benchmark.cpp
+
+${OBJECTDIR}/src/mechanics/RandomGenerator.o: nbproject/Makefile-${CND_CONF}.mk src/mechanics/RandomGenerator.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/mechanics
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/mechanics/RandomGenerator.o src/mechanics/RandomGenerator.cpp
+
+${OBJECTDIR}/src/shoddybattle/RolloutPool.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/RolloutPool.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/RolloutPool.o src/shoddybattle/RolloutPool.cpp
+
+${OBJECTDIR}/src/shoddybattle/MonteCarloPolicy.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/MonteCarloPolicy.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/MonteCarloPolicy.o src/shoddybattle/MonteCarloPolicy.cpp
+
+${OBJECTDIR}/src/network/AiClient.o: nbproject/Makefile-${CND_CONF}.mk src/network/AiClient.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/network
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/network/AiClient.o src/network/AiClient.cpp
+
+${OBJECTDIR}/src/shoddybattle/TurnArena.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/TurnArena.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/TurnArena.o src/shoddybattle/TurnArena.cpp
+
+${OBJECTDIR}/src/main/packer.o: nbproject/Makefile-${CND_CONF}.mk src/main/packer.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/main
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/main/packer.o src/main/packer.cpp
+
+${OBJECTDIR}/src/shoddybattle/GamePack.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/GamePack.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/GamePack.o src/shoddybattle/GamePack.cpp
+
+${OBJECTDIR}/src/shoddybattle/XmlStream.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/XmlStream.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/XmlStream.o src/shoddybattle/XmlStream.cpp
+
+${OBJECTDIR}/src/main/StartupPipeline.o: nbproject/Makefile-${CND_CONF}.mk src/main/StartupPipeline.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/main
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/main/StartupPipeline.o src/main/StartupPipeline.cpp
+
+${OBJECTDIR}/src/shoddybattle/NameTable.o: nbproject/Makefile-${CND_CONF}.mk src/shoddybattle/NameTable.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/shoddybattle
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/shoddybattle/NameTable.o src/shoddybattle/NameTable.cpp
+
+${OBJECTDIR}/src/network/TeamValidationCache.o: nbproject/Makefile-${CND_CONF}.mk src/network/TeamValidationCache.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/network
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/network/TeamValidationCache.o src/network/TeamValidationCache.cpp
+
+${OBJECTDIR}/src/database/BanCache.o: nbproject/Makefile-${CND_CONF}.mk src/database/BanCache.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/database
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/database/BanCache.o src/database/BanCache.cpp
+
+${OBJECTDIR}/src/database/WriteQueue.o: nbproject/Makefile-${CND_CONF}.mk src/database/WriteQueue.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/database
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/database/WriteQueue.o src/database/WriteQueue.cpp
+
+${OBJECTDIR}/src/database/MySqlStorage.o: nbproject/Makefile-${CND_CONF}.mk src/database/MySqlStorage.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/database
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/database/MySqlStorage.o src/database/MySqlStorage.cpp
+
+${OBJECTDIR}/src/database/SqliteStorage.o: nbproject/Makefile-${CND_CONF}.mk src/database/SqliteStorage.cpp 
+	${MKDIR} -p ${OBJECTDIR}/src/database
+	${RM} $@.d
+	$(COMPILE.cc) -O2 -I/usr/local/include/boost-1_38/ -I/usr/local/include/mysql++ -I/usr/include/mysql -MMD -MP -MF $@.d -o ${OBJECTDIR}/src/database/SqliteStorage.o src/database/SqliteStorage.cpp
+
 # Subprojects
 .build-subprojects:
 
@@ -357,6 +492,9 @@ ${OBJECTDIR}/src/network/ThreadedQueue.h.gch: nbproject/Makefile-${CND_CONF}.mk
 .clean-conf:
 	${RM} -r build/Release
 	${RM} dist/Release/GNU-Linux-x86/shoddybattle2
+	${RM} dist/Release/GNU-Linux-x86/shoddybattle2-sim
+	${RM} dist/Release/GNU-Linux-x86/shoddybattle2-bench
+	${RM} dist/Release/GNU-Linux-x86/shoddybattle2-pack
 
 # Subprojects
 .clean-subprojects:
@@ -24,6 +24,7 @@
 
 #include "Authenticator.h"
 #include "DatabaseRegistry.h"
+#include "MySqlStorage.h"
 #include "md5.h"
 #include <string>
 #include <boost/random.hpp>
@@ -41,29 +42,19 @@ namespace shoddybattle { namespace database {
  * DefaultAuthenticator
  ****************************************************************************/
 
-SECRET_PAIR DefaultAuthenticator::getSecret(ScopedConnection &conn,
+SECRET_PAIR DefaultAuthenticator::getSecret(Storage &storage,
         const string &user, const string &) {
-    Query query = conn->query("SELECT password FROM users WHERE name = %0q");
-    query.parse();
-    StoreQueryResult result = query.store(user);
-    if (result.empty()) {
+    string value;
+    if (!storage.getPassword(user, value)) {
         return SECRET_PAIR();
     }
-
-    string value;
-    result[0][0].to_string(value);
     return SECRET_PAIR(value, string());
 }
 
-bool DefaultAuthenticator::registerUser(ScopedConnection &conn,
+bool DefaultAuthenticator::registerUser(Storage &storage,
         const string &user, const string &password, const string &ip) {
     string hexPassword = DatabaseRegistry::getShaHexHash(password);
-    Query query = conn->query(
-            "INSERT INTO users (name, password, activity, ip) "
-            "VALUES (%0q, %1q, now(), %2q)"
-        );
-    query.parse();
-    query.execute(user, hexPassword, ip);
+    storage.addUser(user, hexPassword, ip);
     return true;
 }
 
@@ -78,19 +69,27 @@ VBulletinAuthenticator::VBulletinAuthenticator(const string &login,
             m_loginInfo(login),
             m_registrationInfo(registration) { }
 
-SECRET_PAIR VBulletinAuthenticator::getSecret(ScopedConnection &conn,
+SECRET_PAIR VBulletinAuthenticator::getSecret(Storage &storage,
         const string &user, const string &ip) {
+    // The forum tables can only be reached through a MySQL connection. The
+    // server refuses to start with any other storage, so this is only a
+    // safeguard.
+    MySqlStorage *mysql = dynamic_cast<MySqlStorage *>(&storage);
+    if (!mysql) {
+        return SECRET_PAIR();
+    }
+    ScopedConnection conn(mysql->getPool());
+
     // First check the strike system to make sure the IP is allowed to
     // attempt to log in.
     {
-        Query query = conn->query(
+        Query &query = conn.getStatement(
+                "VBulletinAuthenticator::getStrikes", (
                 "SELECT count(*) AS strikes,"
                     "unix_timestamp() - MAX(striketime) AS lasttime "
                 "FROM " + m_database + ".strikes "
                 "WHERE strikeip = %0q "
-                    "AND striketime > (unix_timestamp() - 3600)"
-            );
-        query.parse();
+                    "AND striketime > (unix_timestamp() - 3600)").c_str());
         StoreQueryResult result = query.store(ip);
         const int strikes = result[0][0];
         const int lastTime = result[0][1].is_null() ? 0 : result[0][1];
@@ -103,13 +102,11 @@ SECRET_PAIR VBulletinAuthenticator::getSecret(ScopedConnection &conn,
         }
     }
     
-    Query query = conn->query(
+    Query &query = conn.getStatement("VBulletinAuthenticator::getSecret", (
             "SELECT password, salt "
             "FROM " + m_database + ".user "
             "WHERE username = %0q "
-                "AND NOT usergroupid IN (3, 8)"
-        );
-    query.parse();
+                "AND NOT usergroupid IN (3, 8)").c_str());
     StoreQueryResult result = query.store(user);
     if (result.empty()) {
         return SECRET_PAIR();
@@ -121,25 +118,27 @@ SECRET_PAIR VBulletinAuthenticator::getSecret(ScopedConnection &conn,
     return SECRET_PAIR(DatabaseRegistry::getShaHexHash(secret), salt);
 }
 
-bool VBulletinAuthenticator::finishAuthentication(ScopedConnection &conn,
+bool VBulletinAuthenticator::finishAuthentication(Storage &storage,
         std::string &user, const std::string &ip, const bool success) {
+    MySqlStorage *mysql = dynamic_cast<MySqlStorage *>(&storage);
+    if (!mysql) {
+        return false;
+    }
+    ScopedConnection conn(mysql->getPool());
     if (!success) {
         // Give a strike to the IP.
-        Query query = conn->query(
+        Query &query = conn.getStatement(
+                "VBulletinAuthenticator::addStrike", (
                 "INSERT INTO " + m_database + ".strikes "
                     "(striketime, strikeip, username) "
-                 "VALUES (unix_timestamp(), %0q, %1q)"
-             );
-        query.parse();
+                 "VALUES (unix_timestamp(), %0q, %1q)").c_str());
         query.execute(ip, user);
         return false;
     }
 
-    Query query = conn->query(
+    Query &query = conn.getStatement("VBulletinAuthenticator::getUser", (
             "SELECT username, userid FROM " + m_database + ".user "
-            "WHERE username = %0q"
-        );
-    query.parse();
+            "WHERE username = %0q").c_str());
     StoreQueryResult result = query.store(user);
     if (result.empty()) {
         // This will happen if the forum account is renamed or deleted at the
@@ -149,12 +148,10 @@ bool VBulletinAuthenticator::finishAuthentication(ScopedConnection &conn,
     result[0][0].to_string(user);
     const int foreignId = result[0][1];
     
-    Query q2 = conn->query(
+    Query &q2 = conn.getStatement("VBulletinAuthenticator::addUser",
             "INSERT INTO users (name, foreign_id, activity, ip) "
             "VALUES (%0q, %1q, now(), %2q) "
-            "ON DUPLICATE KEY UPDATE name=%0q, activity=now()"
-        );
-    q2.parse();
+            "ON DUPLICATE KEY UPDATE name=%0q, activity=now()");
     q2.execute(user, foreignId, ip);
     return true;
 }
@@ -189,36 +186,23 @@ struct SaltAuthenticator::SaltAuthenticatorImpl {
 SaltAuthenticator::SaltAuthenticator():
             m_impl(new SaltAuthenticatorImpl()) { }
 
-SECRET_PAIR SaltAuthenticator::getSecret(ScopedConnection &conn,
+SECRET_PAIR SaltAuthenticator::getSecret(Storage &storage,
         const string &user, const string &) {
-    Query query = conn->query(
-            "SELECT password, salt FROM users "
-            "WHERE name = %0q"
-        );
-    query.parse();
-    StoreQueryResult result = query.store(user);
-    if (result.empty()) {
+    string secret, salt;
+    if (!storage.getSaltedPassword(user, secret, salt)) {
         return SECRET_PAIR();
     }
-    string secret, salt;
-    result[0][0].to_string(secret);
-    result[0][1].to_string(salt);
     return SECRET_PAIR(DatabaseRegistry::getShaHexHash(secret), salt);
 }
 
-bool SaltAuthenticator::registerUser(ScopedConnection &conn,
+bool SaltAuthenticator::registerUser(Storage &storage,
         const string &user, const string &password, const string &ip) {
     const string salt = m_impl->generateSalt(3);
     string hexPassword = DatabaseRegistry::getMd5HexHash(password);
     boost::to_lower(hexPassword);
     string secret = DatabaseRegistry::getMd5HexHash(hexPassword + salt);
     boost::to_lower(secret);
-    Query query = conn->query(
-            "INSERT INTO users (name, password, salt, activity, ip) "
-            "VALUES (%0q, %1q, %2q, now(), %3q)"
-        );
-    query.parse();
-    query.execute(user, secret, salt, ip);
+    storage.addSaltedUser(user, secret, salt, ip);
     return true;
 }
 
@@ -33,7 +33,7 @@ namespace shoddybattle { namespace database {
 
 typedef std::pair<std::string, std::string> SECRET_PAIR;
 
-class ScopedConnection;
+class Storage;
 
 class Authenticator : boost::noncopyable {
 public:
@@ -44,14 +44,14 @@ public:
     };
 
     virtual int getSecretStyle() = 0;
-    virtual SECRET_PAIR getSecret(ScopedConnection &,
+    virtual SECRET_PAIR getSecret(Storage &,
             const std::string &userName,
             const std::string &ipAddress) = 0;
-    virtual bool finishAuthentication(ScopedConnection &,
+    virtual bool finishAuthentication(Storage &,
             std::string &, const std::string &, const bool match) {
         return match;
     }
-    virtual bool registerUser(ScopedConnection &,
+    virtual bool registerUser(Storage &,
             const std::string &, const std::string &, const std::string &) = 0;
     virtual std::string getLoginInfo() const = 0;
     virtual bool allowsRegistration() const = 0;
@@ -62,9 +62,9 @@ public:
 class DefaultAuthenticator : public Authenticator {
 public:
     int getSecretStyle() { return SECRET_UNADORNED; }
-    SECRET_PAIR getSecret(ScopedConnection &, const std::string &,
+    SECRET_PAIR getSecret(Storage &, const std::string &,
             const std::string &);
-    bool registerUser(ScopedConnection &,
+    bool registerUser(Storage &,
             const std::string &, const std::string &, const std::string &);
     std::string getLoginInfo() const { return std::string(); }
     bool allowsRegistration() const { return true; }
@@ -75,9 +75,9 @@ class SaltAuthenticator : public Authenticator {
 public:
     SaltAuthenticator();
     int getSecretStyle() { return SECERT_MD5_SALT; }
-    SECRET_PAIR getSecret(ScopedConnection &, const std::string &,
+    SECRET_PAIR getSecret(Storage &, const std::string &,
             const std::string &);
-    bool registerUser(ScopedConnection &,
+    bool registerUser(Storage &,
             const std::string &, const std::string &, const std::string &);
     std::string getLoginInfo() const { return std::string(); }
     bool allowsRegistration() const { return true; }
@@ -92,11 +92,11 @@ public:
     VBulletinAuthenticator(const std::string &, const std::string &,
             const std::string &database = "vbulletin");
     int getSecretStyle() { return SECERT_MD5_SALT; }
-    SECRET_PAIR getSecret(ScopedConnection &, const std::string &,
+    SECRET_PAIR getSecret(Storage &, const std::string &,
             const std::string &);
-    bool finishAuthentication(ScopedConnection &, std::string &,
+    bool finishAuthentication(Storage &, std::string &,
             const std::string &, const bool);
-    bool registerUser(ScopedConnection &,
+    bool registerUser(Storage &,
             const std::string &, const std::string &, const std::string &) {
         return false;
     }
@@ -0,0 +1,174 @@
+/* 
+ * File:   BanCache.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include "BanCache.h"
+#include <boost/thread/locks.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle { namespace database {
+
+namespace {
+
+string getKey(const string &name) {
+    return algorithm::to_lower_copy(name);
+}
+
+}
+
+void BanCache::insert(const int channel, const int user, const string &name,
+        const string &ip, const BAN &ban) {
+    lock_guard<shared_mutex> lock(m_mutex);
+    USER_MAP::iterator i = m_users.find(user);
+    if (i == m_users.end()) {
+        i = m_users.insert(make_pair(user, USER())).first;
+        i->second.name = name;
+        i->second.ip = ip;
+        m_names[getKey(name)] = user;
+        m_ips[ip].insert(user);
+    }
+    map<int, BAN> &bans = i->second.bans;
+    if (bans.find(channel) == bans.end()) {
+        ++m_size;
+    }
+    bans[channel] = ban;
+}
+
+bool BanCache::remove(const int channel, const string &name) {
+    lock_guard<shared_mutex> lock(m_mutex);
+    NAME_MAP::const_iterator i = m_names.find(getKey(name));
+    if (i == m_names.end())
+        return false;
+    USER_MAP::iterator user = m_users.find(i->second);
+    if (!user->second.bans.erase(channel))
+        return false;
+    --m_size;
+    if (user->second.bans.empty()) {
+        removeUser(user);
+    }
+    return true;
+}
+
+bool BanCache::find(const int channel, const string &name, BAN &ban) {
+    shared_lock<shared_mutex> lock(m_mutex);
+    NAME_MAP::const_iterator i = m_names.find(getKey(name));
+    if (i == m_names.end())
+        return false;
+    const map<int, BAN> &bans = m_users.find(i->second)->second.bans;
+    map<int, BAN>::const_iterator j = bans.find(channel);
+    if (j == bans.end())
+        return false;
+    ban = j->second;
+    return true;
+}
+
+int BanCache::getGlobalBan(const string &name, const string &ip) {
+    shared_lock<shared_mutex> lock(m_mutex);
+    int ret = 0;
+    NAME_MAP::const_iterator i = m_names.find(getKey(name));
+    if (i != m_names.end()) {
+        const map<int, BAN> &bans = m_users.find(i->second)->second.bans;
+        map<int, BAN>::const_iterator j = bans.find(-1);
+        if (j != bans.end()) {
+            ret = j->second.expiry;
+        }
+    }
+    IP_MAP::const_iterator k = m_ips.find(ip);
+    if (k != m_ips.end()) {
+        set<int>::const_iterator j = k->second.begin();
+        for (; j != k->second.end(); ++j) {
+            const map<int, BAN> &bans = m_users.find(*j)->second.bans;
+            map<int, BAN>::const_iterator ban = bans.find(-1);
+            if ((ban != bans.end()) && ban->second.ipBan
+                    && (ban->second.expiry > ret)) {
+                ret = ban->second.expiry;
+            }
+        }
+    }
+    return ret;
+}
+
+void BanCache::setIp(const string &name, const string &ip) {
+    lock_guard<shared_mutex> lock(m_mutex);
+    NAME_MAP::const_iterator i = m_names.find(getKey(name));
+    if (i == m_names.end())
+        return;
+    USER &user = m_users.find(i->second)->second;
+    if (user.ip == ip)
+        return;
+    IP_MAP::iterator j = m_ips.find(user.ip);
+    j->second.erase(i->second);
+    if (j->second.empty()) {
+        m_ips.erase(j);
+    }
+    user.ip = ip;
+    m_ips[ip].insert(i->second);
+}
+
+void BanCache::removeExpired(const int now, vector<BAN_KEY> &removed) {
+    lock_guard<shared_mutex> lock(m_mutex);
+    USER_MAP::iterator i = m_users.begin();
+    while (i != m_users.end()) {
+        map<int, BAN> &bans = i->second.bans;
+        map<int, BAN>::iterator j = bans.begin();
+        while (j != bans.end()) {
+            if (j->second.expiry < now) {
+                removed.push_back(BAN_KEY(j->first, i->first));
+                bans.erase(j++);
+                --m_size;
+            } else {
+                ++j;
+            }
+        }
+        if (bans.empty()) {
+            removeUser(i++);
+        } else {
+            ++i;
+        }
+    }
+}
+
+void BanCache::removeUser(USER_MAP::iterator user) {
+    m_names.erase(getKey(user->second.name));
+    IP_MAP::iterator i = m_ips.find(user->second.ip);
+    i->second.erase(user->first);
+    if (i->second.empty()) {
+        m_ips.erase(i);
+    }
+    m_users.erase(user);
+}
+
+void BanCache::clear() {
+    lock_guard<shared_mutex> lock(m_mutex);
+    m_users.clear();
+    m_names.clear();
+    m_ips.clear();
+    m_size = 0;
+}
+
+size_t BanCache::size() {
+    shared_lock<shared_mutex> lock(m_mutex);
+    return m_size;
+}
+
+}} // namespace shoddybattle::database
@@ -0,0 +1,118 @@
+/* 
+ * File:   BanCache.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _BAN_CACHE_H_
+#define _BAN_CACHE_H_
+
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/unordered_map.hpp>
+
+namespace shoddybattle { namespace database {
+
+/**
+ * Every ban in the bans table, indexed by user id, by user name and by the
+ * IP address of the banned user, so that checking a ban never has to
+ * touch the database. The cache is loaded once at startup and is then
+ * kept up to date by DatabaseRegistry as it writes bans.
+ *
+ * User names are compared without regard to case, as they are by the
+ * database.
+ */
+class BanCache {
+public:
+    struct BAN {
+        int mod;        // Id of the user who set the ban.
+        int expiry;
+        bool ipBan;
+    };
+
+    typedef std::pair<int, int> BAN_KEY;   // channel, user id
+
+    BanCache(): m_size(0) { }
+
+    /**
+     * Record a ban, replacing any ban of the same user on the same channel.
+     */
+    void insert(const int channel, const int user, const std::string &name,
+            const std::string &ip, const BAN &ban);
+
+    /**
+     * Remove a user's ban on a channel. Returns false if there was none.
+     */
+    bool remove(const int channel, const std::string &name);
+
+    /**
+     * Find a user's ban on a channel.
+     */
+    bool find(const int channel, const std::string &name, BAN &ban);
+
+    /**
+     * Get the latest expiry of the global bans that apply to a user name
+     * logging in from an IP address, or 0 if there are none. A global ban
+     * applies to the banned user, and also to any user from the banned
+     * user's IP address if it is an IP ban.
+     */
+    int getGlobalBan(const std::string &name, const std::string &ip);
+
+    /**
+     * Record that a user has a new IP address.
+     */
+    void setIp(const std::string &name, const std::string &ip);
+
+    /**
+     * Remove every ban that expired before the given time, adding the key
+     * of each one to removed.
+     */
+    void removeExpired(const int now, std::vector<BAN_KEY> &removed);
+
+    void clear();
+    size_t size();
+
+private:
+    struct USER {
+        std::string name;
+        std::string ip;
+        std::map<int, BAN> bans;    // by channel
+    };
+    typedef boost::unordered_map<int, USER> USER_MAP;
+    typedef boost::unordered_map<std::string, int> NAME_MAP;
+    typedef boost::unordered_map<std::string, std::set<int> > IP_MAP;
+
+    void removeUser(USER_MAP::iterator user);
+
+    USER_MAP m_users;       // Only users who have a ban.
+    NAME_MAP m_names;       // Lower case name to user id.
+    IP_MAP m_ips;           // IP address to user ids.
+    size_t m_size;
+    boost::shared_mutex m_mutex;
+
+    BanCache(const BanCache &);
+    BanCache &operator=(const BanCache &);
+};
+
+}} // namespace shoddybattle::database
+
+#endif
@@ -27,26 +27,29 @@
 #include "Authenticator.h"
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/random.hpp>
-#include <mysql++/mysql++.h>
-#include <mysql++/ssqls.h>
 #include <string>
-#include <sstream>
+#include <map>
+#include <vector>
 #include <ctime>
+#include <cassert>
+#include <cstring>
+#include <algorithm>
+#include <exception>
 #include "../matchmaking/glicko2.h"
 #include "sha2.h"
 #include "md5.h"
 #include "rijndael.h"
 #include "DatabaseRegistry.h"
+#include "Storage.h"
+#include "MySqlStorage.h"
+#include "BanCache.h"
+#include "WriteQueue.h"
 #include "../matchmaking/MetagameList.h"
-
-/**
- * Warning: The code in here is terrible and it should be improved at some
- *          point. The database schema is also terrible.
- */
+#include "../main/Log.h"
 
 using namespace std;
-using namespace mysqlpp;
 using namespace boost;
 
 namespace shoddybattle { namespace database {
@@ -56,70 +59,33 @@ const double INITIAL_DEVIATION = 350.0;
 const double INITIAL_VOLATILITY = 0.09;
 const double SYSTEM_CONSTANT = 1.2;
 
-const char *TABLE_STATS_PREFIX = "ladder_stats_";
-const char *TABLE_MATCHES_PREFIX = "ladder_matches_";
-
-class ShoddyConnectionPool : public ConnectionPool {
-public:
-    ShoddyConnectionPool() {
+// Queued writes are made once there are this many of them, or once the
+// oldest has waited this many milliseconds.
+const int WRITE_BEHIND_LIMIT = 500;
+const int WRITE_BEHIND_DELAY = 1000;
 
-    }
-    void connect(const string db, const string server,
-            const string user, const string password,
-            const unsigned int port) {
-        m_db = db;
-        m_server = server;
-        m_user = user;
-        m_password = password;
-        m_port = port;
-    }
-    unsigned int max_idle_time() {
-        return 3600;
-    }
-    ~ShoddyConnectionPool() {
-        clear();
-    }
-protected:
-    Connection *create() {
-        Connection *conn = new Connection(false);
-        conn->connect(m_db.c_str(),
-                m_server.c_str(),
-                m_user.c_str(),
-                m_password.c_str(),
-                m_port);
-        return conn;
-    }
-    void destroy(Connection *conn) {
-        delete conn;
-    }
-private:
-    string m_db;
-    string m_server;
-    string m_user;
-    string m_password;
-    unsigned int m_port;
-
-    ShoddyConnectionPool(const ShoddyConnectionPool &);
-    ShoddyConnectionPool &operator=(const ShoddyConnectionPool &);
+/**
+ * A match from the point of view of one of its players, by their indices
+ * in a rating period.
+ */
+struct RATED_MATCH {
+    int player;
+    int opponent;
+    int score;
 };
 
-ScopedConnection::ScopedConnection(ConnectionPool &pool):
-        m_pool(pool) {
-    m_conn = m_pool.grab();
-}
-
-ScopedConnection::~ScopedConnection() {
-    m_pool.release(m_conn);
-}
-
 struct DatabaseRegistry::DatabaseRegistryImpl {
     typedef variate_generator<mt11213b &,
             uniform_int<> > GENERATOR;
-    ShoddyConnectionPool pool;
+    shared_ptr<Storage> storage;
+    BanCache bans;
+    WriteQueue writes;
+    mutex flushMutex;
+    thread writer;
     mt11213b rand;     // used for challenge-response
     mutex randMutex;
     shared_ptr<Authenticator> authenticator;
-    DatabaseRegistryImpl() {
+    DatabaseRegistryImpl(): writes(WRITE_BEHIND_LIMIT) {
         rand = mt11213b(time(NULL));
         authenticator = shared_ptr<Authenticator>(new DefaultAuthenticator());
     }
@@ -134,6 +100,14 @@ struct DatabaseRegistry::DatabaseRegistryImpl {
 DatabaseRegistry::DatabaseRegistry():
         m_impl(new DatabaseRegistryImpl()) { }
 
+DatabaseRegistry::~DatabaseRegistry() {
+    if (m_impl->writer.joinable()) {
+        m_impl->writer.interrupt();
+        m_impl->writer.join();
+        flush();
+    }
+}
+
 shared_ptr<Authenticator> DatabaseRegistry::getAuthenticator() const {
     return m_impl->authenticator;
 }
@@ -143,88 +117,36 @@ void DatabaseRegistry::setAuthenticator(
     m_impl->authenticator = authenticator;
 }
 
+/**
+ * Only the MySQL client library needs to know about each thread.
+ */
 bool DatabaseRegistry::startThread() {
-    return Connection::thread_start();
+    return MySqlStorage::startThread();
 }
 
-namespace {
+void DatabaseRegistry::setStatementCache(const bool enabled) {
+    m_impl->storage->setStatementCache(enabled);
+}
 
-void createChannelsTable(ScopedConnection &conn) {
-    {
-        Query query = conn->query(
-                "CREATE TABLE IF NOT EXISTS channels ("
-                    "id int(11) primary key auto_increment,"
-                    "name varchar(30), "
-                    "topic varchar(200),"
-                    "flags int(11),"
-                    "type int(11))");
-        query.parse();
-        query.execute();
-    }
-    {
-        Query query = conn->query(
-                "SELECT count(id) "
-                "FROM channels "
-                "WHERE name = %0q");
-        query.parse();
-        int count = query.store("main")[0][0];
-        if (count == 0) {
-            Query query2 = conn->query(
-                    "INSERT INTO channels (id, name, topic, flags, type) "
-                    "VALUES (null, %0q, %1q, 0, 0)");
-            query2.parse();
-            query2.execute("main", "main channel");
-        }
-    }
+shared_ptr<Storage> DatabaseRegistry::getStorage() const {
+    return m_impl->storage;
+}
+
+void DatabaseRegistry::setStorage(shared_ptr<Storage> storage) {
+    assert(!m_impl->storage);
+    m_impl->storage = storage;
+    m_impl->writer = thread(boost::bind(
+            &DatabaseRegistry::runWriteBehind, this));
 }
 
-void createUsersTable(ScopedConnection &conn) {
-    Query query = conn->query(
-            "CREATE TABLE IF NOT EXISTS users ("
-                "id int(11) primary key auto_increment,"
-                "name varchar(20),"
-                "password varchar(100),"
-                "activity datetime,"
-                "ip varchar(30),"
-                "message varchar(300))");
-    query.parse();
-    query.execute();
-}
-
-void createChannelUsersTable(ScopedConnection &conn) {
-    Query query = conn->query(
-            "CREATE TABLE IF NOT EXISTS channel_users ("
-                "id int(11) primary key auto_increment,"
-                "channel_id int(11),"
-                "user_id int(11),"
-                "flags int(11),"
-                "UNIQUE KEY channel_user (channel_id ,user_id))");
-    query.parse();
-    query.execute();
-}
-
-void createBansTable(ScopedConnection &conn) {
-    Query query = conn->query(
-            "CREATE TABLE IF NOT EXISTS bans ("
-                "channel_id int(11),"
-                "user_id int(11),"
-                "mod_id int(11),"
-                "expiry datetime,"
-                "ip_ban tinyint(1),"
-                "UNIQUE KEY ban_idx (channel_id, user_id))");
-    query.parse();
-    query.execute();
-}
-
-} //anonymous namespace
+void DatabaseRegistry::connect(const string db, const string server,
+        const string user, const string password, const unsigned int port) {
+    setStorage(shared_ptr<Storage>(
+            new MySqlStorage(db, server, user, password, port)));
+}
 
 void DatabaseRegistry::createDefaultDatabase() {
-    ScopedConnection conn(m_impl->pool);
-    
-    createChannelsTable(conn);
-    createUsersTable(conn);
-    createChannelUsersTable(conn);
-    createBansTable(conn);
+    m_impl->storage->createTables();
 }
 
 static const char *HEX_TABLE = "0123456789ABCDEF";
@@ -277,103 +199,49 @@ string DatabaseRegistry::getMd5HexHash(const string &message) {
 }
 
 bool DatabaseRegistry::userExists(const string name) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select count(id) from users where name = %0q");
-    query.parse();
-    StoreQueryResult res = query.store(name);
-    int count = res[0][0];
-    return (count != 0);
+    return m_impl->storage->userExists(name);
 }
 
 void DatabaseRegistry::getChannelInfo(DatabaseRegistry::CHANNEL_INFO &info) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select * from channels");
-    query.parse();
-    StoreQueryResult res = query.store();
-    const int count = res.num_rows();
-    for (int i = 0; i < count; ++i) {
-        string name, topic;
-        Row row = res[i];
-        const int id = row[0];
-        row[1].to_string(name);
-        row[2].to_string(topic);
-        const int flags = row[3];
-        info[id] = INFO_ELEMENT(name, topic, flags);
-    }
+    m_impl->storage->getChannelInfo(info);
 }
 	
 void DatabaseRegistry::setChannelFlags(const int channel, const int flags) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("update channels set flags=");
-    query << flags << " where id=" << channel;
-    query.execute();
+    m_impl->storage->setChannelFlags(channel, flags);
 }
 
 void DatabaseRegistry::setUserFlags(const int channel, const int idx,
         const int flags) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "INSERT INTO channel_users (channel_id, user_id, flags) "
-            "VALUES (%0q, %1q, %2q) "
-            "ON DUPLICATE KEY UPDATE flags=%2q");
-    query.parse();
-    query.execute(channel, idx, flags);
+    m_impl->writes.setUserFlags(channel, idx, flags);
 }
 
 int DatabaseRegistry::getUserFlags(const int channel, const string &user) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT flags FROM channel_users "
-            "WHERE channel_id=%0q "
-                "AND user_id=(SELECT id FROM users WHERE name=%1q)");
-    query.parse();
-    StoreQueryResult result = query.store(channel, user);
-    if (result.empty())
-        return 0;
-    return result[0][0];
+    if (m_impl->writes.hasUserFlags()) {
+        flush();
+    }
+    return m_impl->storage->getUserFlags(channel, user);
 }
 
 int DatabaseRegistry::getUserFlags(const int channel, const int idx) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT flags FROM channel_users "
-            "WHERE channel_id=%0q AND user_id=%1q");
-    query.parse();
-    StoreQueryResult result = query.store(channel, idx);
-    if (result.empty())
-        return 0;
-    return result[0][0];
+    int flags;
+    if (m_impl->writes.getUserFlags(channel, idx, flags)) {
+        return flags;
+    }
+    return m_impl->storage->getUserFlags(channel, idx);
 }
 
 int DatabaseRegistry::getMaxLevel(const int channel, const string &user) {
     // Note: This function is currently unused, but it is flawed anyway,
     //       because the maximum level is not the numerically highest value
     //       of flags.
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT MAX(flags) FROM channel_users "
-            "WHERE channel_id=%0q "
-                "AND user_id IN (SELECT id FROM users WHERE ip=("
-                    "SELECT ip FROM users WHERE name=%1q"
-                "))");
-    query.parse();
-    StoreQueryResult res = query.store(channel, user);
-    if (res.empty()) {
-        return 0;
+    if (m_impl->writes.hasUserFlags()) {
+        flush();
     }
-    return res[0][0];
+    return m_impl->storage->getMaxLevel(channel, user);
 }
 
 double DatabaseRegistry::getRatingEstimate(const int id, const std::string &ladder) {
-    const string table = TABLE_STATS_PREFIX + ladder;
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select estimate from %0 where user = %1");
-    query.parse();
-    StoreQueryResult result = query.store(table, id);
-    if (result.empty())
-        return -1;
-
-    return result[0][0];
+    return m_impl->storage->getRatingEstimate(ladder, id);
 }
 
 DatabaseRegistry::ESTIMATE_LIST DatabaseRegistry::getEstimates(const int id,
@@ -384,120 +252,210 @@ DatabaseRegistry::ESTIMATE_LIST DatabaseRegistry::getEstimates(const int id,
 }
 
 void DatabaseRegistry::initialiseLadder(const std::string &id) {
-    const string table1 = TABLE_STATS_PREFIX + id;
-    const string table2 = TABLE_MATCHES_PREFIX + id;
-    ScopedConnection conn(m_impl->pool);
-    {
-        Query query = conn->query("show tables like %0q");
-        query.parse();
-        StoreQueryResult result = query.store(table1);
-        if (!result.empty())
-            return;
-    }
-    {
-        Query query = conn->query("create table ");
-        query << table1 << " (user int(11) unique, rating double, ";
-        query << "deviation double, volatility double, estimate double, ";
-        query << "updated_rating double, updated_deviation double, ";
-        query << "updated_volatility double)";
-        query.parse();
-        query.execute();
-    }
-    {
-        Query query = conn->query("create table ");
-        query << table2 << " (player1 int(11), player2 int(11), ";
-        query << "victor int(4))";
-        query.parse();
-        query.execute();
-    }
+    m_impl->storage->initialiseLadder(id);
 }
 
 void DatabaseRegistry::updatePlayerStats(const string &ladder,
         const int id) {
-    const string table1 = TABLE_STATS_PREFIX + ladder;
-    const string table2 = TABLE_MATCHES_PREFIX + ladder;
-    vector<glicko2::MATCH> matches;
-    ScopedConnection conn(m_impl->pool);
-    StoreQueryResult res;
-    {
-        Query q = conn->query("select * from ");
-        q << table2 << " where player1=" << id << " or player2=" << id;
-        q.parse();
-        res = q.store();
+    updatePlayerStats(ladder, vector<int>(1, id));
+}
+
+/**
+ * Recalculate the ratings of a set of players from every one of their
+ * matches, and write all of the new ratings back at once.
+ */
+void DatabaseRegistry::updatePlayerStats(const string &ladder,
+        const vector<int> &ids) {
+    if (ids.empty())
+        return;
+    Storage &storage = *m_impl->storage;
+    vector<Storage::PLAYER_MATCH> rows;
+    storage.getPlayerMatches(ladder, ids, rows);
+    map<int, vector<glicko2::MATCH> > matches;
+    vector<Storage::PLAYER_MATCH>::const_iterator i = rows.begin();
+    for (; i != rows.end(); ++i) {
+        const WriteQueue::MATCH &m = i->match;
+        const int v = m.victor;
+        const int victor = (v == 0) ? m.player0 : m.player1;
+        const int score = (v == -1) ? -1 : (victor == i->player);
+        glicko2::MATCH match = { score, i->rating, i->deviation };
+        matches[i->player].push_back(match);
+    }
+    Storage::RATING_LIST ratings;
+    storage.getRatings(ladder, &ids, ratings);
+    if (ratings.empty())
+        return;
+    Storage::RATING_LIST::iterator j = ratings.begin();
+    for (; j != ratings.end(); ++j) {
+        glicko2::updatePlayer(j->second, matches[j->first], SYSTEM_CONSTANT);
     }
-    StoreQueryResult::iterator i = res.begin();
-    for (; i != res.end(); ++i) {
-        Row &row = *i;
-        const int player0 = row[0];
-        const int player1 = row[1];
-        const int v = row[2];
-        const int score = (v == -1) ? -1 : (int(row[v]) == id);
-        const int opponent = (player0 == id) ? player1 : player0;
-        Query q = conn->query("select rating, deviation from ");
-        q << table1 << " where user=" << opponent;
-        q.parse();
-        StoreQueryResult res2 = q.store();
-        if (!res2.empty()) {
-            Row &r2 = res2[0];
-            const double rating = r2[0];
-            const double deviation = r2[1];
-            glicko2::MATCH match = { score, rating, deviation };
-            matches.push_back(match);
-        }
+    storage.setUpdatedRatings(ladder, ratings);
+}
+
+/**
+ * Run a rating period for a whole ladder. Every rating and match is read
+ * up front, the players are updated in parallel, and the new ratings are
+ * written back together.
+ */
+int DatabaseRegistry::processRatingPeriod(const string &ladder,
+        const int threads) {
+    // The period is written over the whole ladder, so no queued match can be
+    // rated while it runs or its new ratings would be overwritten.
+    lock_guard<mutex> lock(m_impl->flushMutex);
+    flushLocked();
+    Storage &storage = *m_impl->storage;
+    Storage::RATING_LIST ratings;
+    storage.getRatings(ladder, NULL, ratings);
+    if (ratings.empty())
+        return 0;
+    map<int, int> index;
+    const int count = ratings.size();
+    for (int i = 0; i < count; ++i) {
+        index[ratings[i].first] = i;
     }
+
+    // Every match counts once for each of its players who has a rating.
+    vector<RATED_MATCH> matches;
     {
-        Query q = conn->query("select rating, deviation, volatility from ");
-        q << table1 << " where user=" << id;
-        q.parse();
-        res = q.store();
+        vector<WriteQueue::MATCH> rows;
+        storage.getMatches(ladder, rows);
+        matches.reserve(rows.size() * 2);
+        vector<WriteQueue::MATCH>::const_iterator i = rows.begin();
+        for (; i != rows.end(); ++i) {
+            const int player[] = { i->player0, i->player1 };
+            const int v = i->victor;
+            map<int, int>::const_iterator idx[] = {
+                index.find(player[0]), index.find(player[1])
+            };
+            for (int j = 0; j < 2; ++j) {
+                const int k = 1 - j;
+                if ((idx[j] == index.end()) || (idx[k] == index.end()))
+                    continue;
+                if ((j == 1) && (player[0] == player[1]))
+                    continue;
+                const int score = (v == -1) ? -1 : (player[v] == player[j]);
+                const RATED_MATCH match = {
+                    idx[j]->second, idx[k]->second, score
+                };
+                matches.push_back(match);
+            }
+        }
     }
-    if (res.empty())
-        return;
-    Row &r = res[0];
-    const double rating = r[0];
-    const double deviation = r[1];
-    const double volatility = r[2];
-    glicko2::PLAYER player = { rating, deviation, volatility };
-    glicko2::updatePlayer(player, matches, SYSTEM_CONSTANT);
-    const double estimate = glicko2::getRatingEstimate(player.rating,
-            player.deviation);
-    Query q = conn->query("update ");
-    q << table1 << " set updated_rating=" << player.rating
-            << ", updated_deviation=" << player.deviation
-            << ", updated_volatility=" << player.volatility
-            << ", estimate=" << estimate << " where user=" << id;
-    q.parse();
-    q.execute();
+
+    // Group the matches by player. Opponents are rated by the snapshot, not
+    // by each other's new ratings.
+    const int total = matches.size();
+    glicko2::PLAYER_BATCH batch;
+    batch.offset.assign(count + 1, 0);
+    for (int i = 0; i < count; ++i) {
+        const glicko2::PLAYER &player = ratings[i].second;
+        batch.rating.push_back(player.rating);
+        batch.deviation.push_back(player.deviation);
+        batch.volatility.push_back(player.volatility);
+    }
+    for (int i = 0; i < total; ++i) {
+        ++batch.offset[matches[i].player + 1];
+    }
+    for (int i = 0; i < count; ++i) {
+        batch.offset[i + 1] += batch.offset[i];
+    }
+    batch.opponentRating.resize(total);
+    batch.opponentDeviation.resize(total);
+    batch.score.resize(total);
+    vector<int> next(batch.offset.begin(), batch.offset.end() - 1);
+    for (int i = 0; i < total; ++i) {
+        const RATED_MATCH &match = matches[i];
+        const int j = next[match.player]++;
+        const glicko2::PLAYER &opponent = ratings[match.opponent].second;
+        batch.opponentRating[j] = opponent.rating;
+        batch.opponentDeviation[j] = opponent.deviation;
+        batch.score[j] = match.score;
+    }
+
+    glicko2::updateBatch(batch, SYSTEM_CONSTANT, threads);
+
+    for (int i = 0; i < count; ++i) {
+        ratings[i].second = batch.getPlayer(i);
+    }
+    storage.setUpdatedRatings(ladder, ratings);
+    return count;
 }
 
 void DatabaseRegistry::joinLadder(const string &ladder, const int id) {
-    const string table = TABLE_STATS_PREFIX + ladder;
-    ScopedConnection conn(m_impl->pool);
-    {
-        Query query = conn->query("select user from ");
-        query << table << " where user=" << id;
-        query.parse();
-        StoreQueryResult result = query.store();
-        if (!result.empty())
-            return;
-    }
-    Query query = conn->query("insert into ");
-    query << table << " values (" << id << "," << INITIAL_RATING << ","
-            << INITIAL_DEVIATION << "," << INITIAL_VOLATILITY
-            << ",0,0,0,0)";
-    query.parse();
-    query.execute();
+    const glicko2::PLAYER rating = {
+        INITIAL_RATING, INITIAL_DEVIATION, INITIAL_VOLATILITY
+    };
+    m_impl->storage->joinLadder(ladder, id, rating);
 }
 
 void DatabaseRegistry::postLadderMatch(const string &ladder,
         const int player0, const int player1, int victor) {
-    const string table = TABLE_MATCHES_PREFIX + ladder;
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("insert into ");
-    query << table << " values (" << player0 << "," << player1
-            << "," << victor << ")";
-    query.parse();
-    query.execute();
+    const WriteQueue::MATCH match = { player0, player1, victor };
+    m_impl->writes.addMatch(ladder, match);
+}
+
+/**
+ * Make every queued write, and then update the ratings of every player in
+ * the ladder matches that were written, together for each ladder.
+ */
+void DatabaseRegistry::flush() {
+    lock_guard<mutex> lock(m_impl->flushMutex);
+    flushLocked();
+}
+
+void DatabaseRegistry::flushLocked() {
+    const WriteQueue::BATCH &batch = m_impl->writes.take();
+    if (batch.empty()) {
+        m_impl->writes.finish();
+        return;
+    }
+    // A batch that could not be written goes back in the queue to be tried
+    // again on the next flush. Once it has been written, a failure to update
+    // the ratings is only logged.
+    bool written = false;
+    try {
+        m_impl->storage->write(batch);
+        written = true;
+        map<string, vector<WriteQueue::MATCH> >::const_iterator i =
+                batch.matches.begin();
+        for (; i != batch.matches.end(); ++i) {
+            const vector<WriteQueue::MATCH> &matches = i->second;
+            vector<int> ids;
+            vector<WriteQueue::MATCH>::const_iterator j = matches.begin();
+            for (; j != matches.end(); ++j) {
+                ids.push_back(j->player0);
+                ids.push_back(j->player1);
+            }
+            sort(ids.begin(), ids.end());
+            ids.erase(unique(ids.begin(), ids.end()), ids.end());
+            updatePlayerStats(i->first, ids);
+        }
+    } catch (const std::exception &e) {
+        if (written) {
+            Log::out() << "Error: Could not update ratings: " << e.what()
+                    << endl;
+        } else {
+            Log::out() << "Error: Could not write queued writes: "
+                    << e.what() << ". They will be tried again." << endl;
+            m_impl->writes.requeue();
+        }
+    } catch (...) {
+        if (!written) {
+            m_impl->writes.requeue();
+        }
+        m_impl->writes.finish();
+        throw;
+    }
+    m_impl->writes.finish();
+}
+
+void DatabaseRegistry::runWriteBehind() {
+    startThread();
+    while (true) {
+        m_impl->writes.wait(WRITE_BEHIND_DELAY);
+        this_thread::interruption_point();
+        flush();
+    }
 }
 
 DatabaseRegistry::AUTH_PAIR DatabaseRegistry::isResponseValid(
@@ -507,8 +465,9 @@ DatabaseRegistry::AUTH_PAIR DatabaseRegistry::isResponseValid(
         const unsigned char *response) {
     const int responseInt = challenge + 1;
 
-    ScopedConnection conn(m_impl->pool);
-    const SECRET_PAIR secret = m_impl->authenticator->getSecret(conn, name, ip);
+    Storage &storage = *m_impl->storage;
+    const SECRET_PAIR secret =
+            m_impl->authenticator->getSecret(storage, name, ip);
     const string key = fromHex(secret.first);
 
     unsigned char data[16];
@@ -527,20 +486,18 @@ DatabaseRegistry::AUTH_PAIR DatabaseRegistry::isResponseValid(
     rijndael_encrypt(&ctx, middle, correct);
 
     const bool match = (memcmp(response, correct, 16) == 0);
-    if (!m_impl->authenticator->finishAuthentication(conn, name, ip, match)) {
+    if (!m_impl->authenticator->finishAuthentication(storage, name, ip,
+            match)) {
         return DatabaseRegistry::AUTH_PAIR(false, -1);
     }
 
     int id = -1;
     if (match) {
-        Query query = conn->query("select id from users where name = %0q");
-        query.parse();
-        StoreQueryResult result = query.store(name);
-        if (result.empty()) {
+        id = storage.getUserId(name);
+        if (id == -1) {
             // It should be impossible to get here.
             return DatabaseRegistry::AUTH_PAIR(false, -1);
         }
-        id = result[0][0];
     }
     
     return DatabaseRegistry::AUTH_PAIR(match, id);
@@ -548,8 +505,8 @@ DatabaseRegistry::AUTH_PAIR DatabaseRegistry::isResponseValid(
 
 DatabaseRegistry::CHALLENGE_INFO DatabaseRegistry::getAuthChallenge(
         const string &name, const string &ip, unsigned char *challenge) {
-    ScopedConnection conn(m_impl->pool);
-    const SECRET_PAIR secret = m_impl->authenticator->getSecret(conn, name, ip);
+    const SECRET_PAIR secret =
+            m_impl->authenticator->getSecret(*m_impl->storage, name, ip);
     if (secret.first.empty())
         return CHALLENGE_INFO();
 
@@ -573,74 +530,51 @@ DatabaseRegistry::CHALLENGE_INFO DatabaseRegistry::getAuthChallenge(
             m_impl->authenticator->getSecretStyle(), secret.second);
 }
 
-void DatabaseRegistry::connect(const string db, const string server,
-        const string user, const string password, const unsigned int port) {
-    m_impl->pool.connect(db, server, user, password, port);
-}
-
 bool DatabaseRegistry::registerUser(const string name,
         const string password, const string ip) {
     if (userExists(name)) {
         return false;
     }
-    ScopedConnection conn(m_impl->pool);
-    return m_impl->authenticator->registerUser(conn, name, password, ip);
+    return m_impl->authenticator->registerUser(*m_impl->storage, name,
+            password, ip);
+}
+
+void DatabaseRegistry::loadBans() {
+    m_impl->bans.clear();
+    m_impl->storage->loadBans(m_impl->bans);
+}
+
+int DatabaseRegistry::removeExpiredBans() {
+    const int now = time(NULL);
+    vector<BanCache::BAN_KEY> removed;
+    m_impl->bans.removeExpired(now, removed);
+    if (removed.empty())
+        return 0;
+    m_impl->storage->removeExpiredBans(now);
+    return removed.size();
 }
 
 int DatabaseRegistry::getGlobalBan(const std::string &user,
         const std::string &ip) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT expiry "
-            "FROM bans "
-            "WHERE channel_id=-1 "
-                "AND ("
-                    "user_id=(SELECT id FROM users WHERE name=%0q) "
-                    "OR ("
-                        "ip_ban AND user_id IN ("
-                            "SELECT id FROM users WHERE ip=%1q)"
-                    ")"
-                ") "
-            "ORDER BY expiry DESC "
-            "LIMIT 0, 1");
-    query.parse();
-    StoreQueryResult res = query.store(user, ip);
-    if (res.empty()) {
-        return 0;
-    }
-    return (int)DateTime(res[0][0]);
+    return m_impl->bans.getGlobalBan(user, ip);
 }
 
 void DatabaseRegistry::getBan(const int channel, const string &user,
         int &date, int &flags) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT expiry, IF(channel_users.flags, channel_users.flags, 0) "
-            "FROM bans "
-                "LEFT JOIN channel_users "
-                    "ON mod_id=channel_users.user_id "
-                        "AND channel_users.channel_id=bans.channel_id "
-            "WHERE bans.channel_id=%0q "
-                "AND bans.user_id=(SELECT id FROM users WHERE name=%1q)");
-    query.parse();
-    StoreQueryResult res = query.store(channel, user);
-    if (res.empty()) {
+    BanCache::BAN ban;
+    if (!m_impl->bans.find(channel, user, ban)) {
         date = flags = 0;
         return;
     }
-    date = (int)DateTime(res[0][0]);
-    flags = (int)res[0][1];
+    date = ban.expiry;
+    // The flags of the moderator can change after the ban was set.
+    flags = getUserFlags(channel, ban.mod);
 }
 
 void DatabaseRegistry::removeBan(const int channel, const string &user) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "DELETE FROM bans WHERE channel_id=%0q AND user_id=("
-                    "SELECT id FROM users WHERE name=%1q"
-                ")"
-            );
-    query.parse();
-    query.execute(channel, user);
+    if (!m_impl->bans.remove(channel, user))
+        return;
+    m_impl->storage->removeBan(channel, user);
 }
 
 bool DatabaseRegistry::setBan(const int channel, const string &user,
@@ -649,95 +583,58 @@ bool DatabaseRegistry::setBan(const int channel, const string &user,
         // No ban to set.
         return false;
     }
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "INSERT INTO bans "
-                "(channel_id, user_id, mod_id, expiry, ip_ban) "
-            "VALUES (%0q, (SELECT id FROM users WHERE name=%1q), %2q, "
-                "%3q, %4q) "
-            "ON DUPLICATE KEY UPDATE mod_id=%2q, expiry=%3q, ip_ban=%4q");
-    query.parse();
-    query.execute(channel, user, modId, DateTime(date), ipBan);
+    int id;
+    string ip;
+    if (!m_impl->storage->getUser(user, id, ip)) {
+        // No such user to ban.
+        return false;
+    }
+    m_impl->storage->setBan(channel, id, modId, date, ipBan);
+    const BanCache::BAN ban = { modId, (int)date, ipBan };
+    m_impl->bans.insert(channel, id, user, ip, ban);
     return true;
 }
 
 void DatabaseRegistry::updateIp(const string &user, const string &ip) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("update users set ip= %0q where name= %1q");
-    query.parse();
-    query.execute(ip, user);
+    m_impl->writes.setIp(user, ip);
+    m_impl->bans.setIp(user, ip);
 }
 
 string DatabaseRegistry::getIp(const string &user) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select ip from users where name= %0q");
-    query.parse();
-    StoreQueryResult res = query.store(user);
-    if (res.empty()) {
-        return string();
-    } else {
-        string ip;
-        res[0][0].to_string(ip);
+    string ip;
+    if (m_impl->writes.getIp(user, ip)) {
         return ip;
     }
+    return m_impl->storage->getIp(user);
 }
 
 const vector<string> DatabaseRegistry::getAliases(const string &user) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select name from users where ip=");
-    query << "(select ip from users where name= %0q)";
-    query.parse();
-    StoreQueryResult res = query.store(user);
-    vector<string> ret;
-    const int size = res.num_rows();
-    for (int i = 0; i < size; ++i) {
-        string alias;
-        res[i][0].to_string(alias);
-        ret.push_back(alias);
+    if (m_impl->writes.hasIps()) {
+        flush();
     }
+    vector<string> ret;
+    m_impl->storage->getAliases(user, ret);
     return ret;
 }
 
 const DatabaseRegistry::BAN_LIST DatabaseRegistry::getBans(const string &user) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query(
-            "SELECT bans.channel_id, users.name, bans.expiry, bans.ip_ban "
-            "FROM bans "
-                "JOIN users ON users.id=bans.user_id "
-            "WHERE users.ip=(SELECT ip FROM users WHERE name=%0q)");
-    query.parse();
-    StoreQueryResult res = query.store(user);
-    DatabaseRegistry::BAN_LIST bans;
-    const int count = res.num_rows();
-    for (int i = 0; i < count; ++i) {
-        Row r = res[i];
-        const int id = r[0];
-        const string name = string(r[1].c_str());
-        const int date = (int)DateTime(r[2]);
-        const bool ipBan = (bool)r[3];
-        bans.push_back(BAN_ELEMENT(id, name, date, ipBan));
+    if (m_impl->writes.hasIps()) {
+        flush();
     }
+    DatabaseRegistry::BAN_LIST bans;
+    m_impl->storage->getBans(user, bans);
     return bans;
 }
 
 void DatabaseRegistry::setPersonalMessage(const string &user, const string &msg) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("update users set message= %0q where name= %1q");
-    query.parse();
-    query.execute(msg, user);
+    m_impl->writes.setMessage(user, msg);
 }
 
 void DatabaseRegistry::loadPersonalMessage(const string &user, string &msg) {
-    ScopedConnection conn(m_impl->pool);
-    Query query = conn->query("select message from users where name= %0q");
-    query.parse();
-    StoreQueryResult res = query.store(user);
-    if (res.empty() || res[0][0].is_null()) {
-        msg = "";
-    } else {
-        res[0][0].to_string(msg);
+    if (m_impl->writes.getMessage(user, msg)) {
+        return;
     }
+    m_impl->storage->getPersonalMessage(user, msg);
 }
 
 }} // namespace shoddybattle::database
-
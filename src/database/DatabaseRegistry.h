@@ -32,30 +32,10 @@
 #include <boost/shared_ptr.hpp>
 #include "../matchmaking/MetagameList.h"
 
-namespace mysqlpp {
-class ConnectionPool;
-class Connection;
-}
-
 namespace shoddybattle { namespace database {
 
-/** RAII-style Connection **/
-class ScopedConnection {
-public:
-    ScopedConnection(mysqlpp::ConnectionPool &);
-    ~ScopedConnection();
-    mysqlpp::Connection *operator->() {
-        return m_conn;
-    }
-private:
-    mysqlpp::Connection *m_conn;
-    mysqlpp::ConnectionPool &m_pool;
-
-    ScopedConnection(const ScopedConnection &);
-    ScopedConnection &operator=(const ScopedConnection &);
-};
-
 class Authenticator;
+class Storage;
 
 class DatabaseRegistry {
 public:
@@ -70,6 +50,11 @@ public:
 
     DatabaseRegistry();
 
+    /**
+     * Stop the write-behind thread and make any writes still queued.
+     */
+    ~DatabaseRegistry();
+
     boost::shared_ptr<Authenticator> getAuthenticator() const;
     void setAuthenticator(boost::shared_ptr<Authenticator>);
 
@@ -83,7 +68,22 @@ public:
     static bool startThread();
 
     /**
-     * Connect to a database.
+     * Set whether statements are kept for reuse by each connection. This is
+     * on by default and only turned off to measure the difference.
+     */
+    void setStatementCache(const bool enabled);
+
+    boost::shared_ptr<Storage> getStorage() const;
+
+    /**
+     * Store everything in the given storage. This also starts the thread
+     * that makes the writes which are queued instead of being made at once,
+     * and can only be called once.
+     */
+    void setStorage(boost::shared_ptr<Storage>);
+
+    /**
+     * Connect to a MySQL database and use it as the storage.
      */
     void connect(const std::string db,
             const std::string server,
@@ -139,7 +139,7 @@ public:
     int getUserFlags(const int channel, const int idx);
 
     /**
-     * Set a user's flags on a channel.
+     * Set a user's flags on a channel. The write is queued.
      */
     void setUserFlags(const int channel, const int idx, const int flags);
 
@@ -148,6 +148,17 @@ public:
      */
     void setChannelFlags(const int channel, const int flags);
     
+    /**
+     * Load every ban into memory. The ban checks below are answered from
+     * memory and never query the database.
+     */
+    void loadBans();
+
+    /**
+     * Remove every expired ban. Returns the number of bans removed.
+     */
+    int removeExpiredBans();
+
     /**
      * Gets a user's ban length on a channel and the authority
      * of the setter
@@ -174,7 +185,7 @@ public:
     int getMaxLevel(const int channel, const std::string &user);
     
     /**
-     * Updates the user's ip address when they sign on
+     * Updates the user's ip address when they sign on. The write is queued.
      */
     void updateIp(const std::string &user, const std::string &ip);
     
@@ -209,18 +220,52 @@ public:
      */
     void initialiseLadder(const std::string &id);
 
+    /**
+     * Record a ladder match. The write is queued, and the ratings of the
+     * players are updated when it is made.
+     */
     void postLadderMatch(const std::string &ladder, const int player0,
             const int player1, int victor);
 
     void joinLadder(const std::string &, const int);
 
     void updatePlayerStats(const std::string &ladder, const int id);
+
+    /**
+     * Update the ratings of several players in one pass.
+     */
+    void updatePlayerStats(const std::string &ladder,
+            const std::vector<int> &ids);
     
+    /**
+     * Update the ratings of every player on a ladder at the end of a rating
+     * period, using the given number of threads. Returns the number of
+     * players updated.
+     */
+    int processRatingPeriod(const std::string &ladder, const int threads);
+
+    /**
+     * Make every queued write before returning. Queued writes are otherwise
+     * made in the background once enough of them have built up or a short
+     * time has passed.
+     */
+    void flush();
+
+    /**
+     * Set a user's personal message. The write is queued.
+     */
     void setPersonalMessage(const std::string &user, const std::string &message);
     
     void loadPersonalMessage(const std::string &user, std::string &message);
     
 private:
+    void runWriteBehind();
+
+    /**
+     * Make every queued write. The caller must hold the flush mutex.
+     */
+    void flushLocked();
+
     class DatabaseRegistryImpl;
     boost::shared_ptr<DatabaseRegistryImpl> m_impl;
     DatabaseRegistry(const DatabaseRegistry &);
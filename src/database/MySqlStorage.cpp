@@ -0,0 +1,717 @@
+/* 
+ * File:   MySqlStorage.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <mysql++/mysql++.h>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <sstream>
+#include <algorithm>
+#include "MySqlStorage.h"
+
+/**
+ * Warning: The code in here is terrible and it should be improved at some
+ *          point. The database schema is also terrible.
+ */
+
+using namespace std;
+using namespace mysqlpp;
+using namespace boost;
+
+namespace shoddybattle { namespace database {
+
+namespace {
+
+const char *TABLE_STATS_PREFIX = "ladder_stats_";
+const char *TABLE_MATCHES_PREFIX = "ladder_matches_";
+
+// The largest number of rows written by one statement.
+const int ROW_BATCH_SIZE = 1000;
+
+/**
+ * A pooled connection that keeps the parsed statements used on it, keyed by
+ * purpose, for as long as the connection lives.
+ */
+class ShoddyConnection : public Connection {
+public:
+    ShoddyConnection(): Connection(false) { }
+    Query &getStatement(const string &purpose, const char *sql,
+            const bool reuse) {
+        shared_ptr<Query> &statement = m_statements[purpose];
+        if (!statement || !reuse) {
+            statement.reset(new Query(this, throw_exceptions(), sql));
+            statement->parse();
+        }
+        return *statement;
+    }
+private:
+    typedef unordered_map<string, shared_ptr<Query> > STATEMENT_MAP;
+    STATEMENT_MAP m_statements;
+};
+
+class ShoddyConnectionPool : public ConnectionPool {
+public:
+    ShoddyConnectionPool(): m_cacheStatements(true) {
+
+    }
+    void connect(const string db, const string server,
+            const string user, const string password,
+            const unsigned int port) {
+        m_db = db;
+        m_server = server;
+        m_user = user;
+        m_password = password;
+        m_port = port;
+    }
+    unsigned int max_idle_time() {
+        return 3600;
+    }
+    void setStatementCache(const bool enabled) {
+        lock_guard<mutex> lock(m_cacheMutex);
+        m_cacheStatements = enabled;
+    }
+    bool isStatementCache() {
+        lock_guard<mutex> lock(m_cacheMutex);
+        return m_cacheStatements;
+    }
+    ~ShoddyConnectionPool() {
+        clear();
+    }
+protected:
+    Connection *create() {
+        Connection *conn = new ShoddyConnection();
+        conn->connect(m_db.c_str(),
+                m_server.c_str(),
+                m_user.c_str(),
+                m_password.c_str(),
+                m_port);
+        return conn;
+    }
+    void destroy(Connection *conn) {
+        delete conn;
+    }
+private:
+    string m_db;
+    string m_server;
+    string m_user;
+    string m_password;
+    unsigned int m_port;
+    bool m_cacheStatements;
+    mutex m_cacheMutex;
+
+    ShoddyConnectionPool(const ShoddyConnectionPool &);
+    ShoddyConnectionPool &operator=(const ShoddyConnectionPool &);
+};
+
+void createChannelsTable(ScopedConnection &conn) {
+    {
+        Query query = conn->query(
+                "CREATE TABLE IF NOT EXISTS channels ("
+                    "id int(11) primary key auto_increment,"
+                    "name varchar(30), "
+                    "topic varchar(200),"
+                    "flags int(11),"
+                    "type int(11))");
+        query.parse();
+        query.execute();
+    }
+    {
+        Query query = conn->query(
+                "SELECT count(id) "
+                "FROM channels "
+                "WHERE name = %0q");
+        query.parse();
+        int count = query.store("main")[0][0];
+        if (count == 0) {
+            Query query2 = conn->query(
+                    "INSERT INTO channels (id, name, topic, flags, type) "
+                    "VALUES (null, %0q, %1q, 0, 0)");
+            query2.parse();
+            query2.execute("main", "main channel");
+        }
+    }
+}
+
+void createUsersTable(ScopedConnection &conn) {
+    Query query = conn->query(
+            "CREATE TABLE IF NOT EXISTS users ("
+                "id int(11) primary key auto_increment,"
+                "name varchar(20),"
+                "password varchar(100),"
+                "activity datetime,"
+                "ip varchar(30),"
+                "message varchar(300))");
+    query.parse();
+    query.execute();
+}
+
+void createChannelUsersTable(ScopedConnection &conn) {
+    Query query = conn->query(
+            "CREATE TABLE IF NOT EXISTS channel_users ("
+                "id int(11) primary key auto_increment,"
+                "channel_id int(11),"
+                "user_id int(11),"
+                "flags int(11),"
+                "UNIQUE KEY channel_user (channel_id ,user_id))");
+    query.parse();
+    query.execute();
+}
+
+void createBansTable(ScopedConnection &conn) {
+    Query query = conn->query(
+            "CREATE TABLE IF NOT EXISTS bans ("
+                "channel_id int(11),"
+                "user_id int(11),"
+                "mod_id int(11),"
+                "expiry datetime,"
+                "ip_ban tinyint(1),"
+                "UNIQUE KEY ban_idx (channel_id, user_id))");
+    query.parse();
+    query.execute();
+}
+
+string getUserList(const vector<int> &users) {
+    ostringstream list;
+    for (vector<int>::const_iterator i = users.begin(); i != users.end();
+            ++i) {
+        if (i != users.begin()) {
+            list << ",";
+        }
+        list << *i;
+    }
+    return list.str();
+}
+
+} // anonymous namespace
+
+ScopedConnection::ScopedConnection(ConnectionPool &pool):
+        m_pool(pool) {
+    m_conn = m_pool.grab();
+}
+
+ScopedConnection::~ScopedConnection() {
+    m_pool.release(m_conn);
+}
+
+Query &ScopedConnection::getStatement(const string &purpose,
+        const char *sql) {
+    // Every connection in the pool was made by ShoddyConnectionPool.
+    const bool reuse =
+            static_cast<ShoddyConnectionPool &>(m_pool).isStatementCache();
+    return static_cast<ShoddyConnection *>(m_conn)->getStatement(
+            purpose, sql, reuse);
+}
+
+struct MySqlStorage::MySqlStorageImpl {
+    ShoddyConnectionPool pool;
+};
+
+MySqlStorage::MySqlStorage(const string &db, const string &server,
+        const string &user, const string &password, const unsigned int port):
+        m_impl(new MySqlStorageImpl()) {
+    m_impl->pool.connect(db, server, user, password, port);
+}
+
+bool MySqlStorage::startThread() {
+    return Connection::thread_start();
+}
+
+ConnectionPool &MySqlStorage::getPool() {
+    return m_impl->pool;
+}
+
+void MySqlStorage::createTables() {
+    ScopedConnection conn(m_impl->pool);
+    
+    createChannelsTable(conn);
+    createUsersTable(conn);
+    createChannelUsersTable(conn);
+    createBansTable(conn);
+}
+
+void MySqlStorage::setStatementCache(const bool enabled) {
+    m_impl->pool.setStatementCache(enabled);
+}
+
+/**
+ * IP addresses and messages are each written by their own statement, and
+ * the flags and the matches of each ladder by one statement each.
+ */
+void MySqlStorage::write(const WriteQueue::BATCH &batch) {
+    ScopedConnection conn(m_impl->pool);
+    map<string, string>::const_iterator i = batch.ips.begin();
+    for (; i != batch.ips.end(); ++i) {
+        Query &query = conn.getStatement("updateIp",
+                "update users set ip= %0q where name= %1q");
+        query.execute(i->second, i->first);
+    }
+    for (i = batch.messages.begin(); i != batch.messages.end(); ++i) {
+        Query &query = conn.getStatement("setPersonalMessage",
+                "update users set message= %0q where name= %1q");
+        query.execute(i->second, i->first);
+    }
+    if (!batch.flags.empty()) {
+        Query q = conn->query("INSERT INTO channel_users "
+                "(channel_id, user_id, flags) VALUES ");
+        map<WriteQueue::FLAGS_KEY, int>::const_iterator j =
+                batch.flags.begin();
+        for (; j != batch.flags.end(); ++j) {
+            if (j != batch.flags.begin()) {
+                q << ",";
+            }
+            q << "(" << j->first.first << "," << j->first.second << ","
+                    << j->second << ")";
+        }
+        q << " ON DUPLICATE KEY UPDATE flags=VALUES(flags)";
+        q.parse();
+        q.execute();
+    }
+    map<string, vector<WriteQueue::MATCH> >::const_iterator j =
+            batch.matches.begin();
+    for (; j != batch.matches.end(); ++j) {
+        const vector<WriteQueue::MATCH> &matches = j->second;
+        Query q = conn->query("insert into ");
+        q << TABLE_MATCHES_PREFIX << j->first << " values ";
+        vector<WriteQueue::MATCH>::const_iterator k = matches.begin();
+        for (; k != matches.end(); ++k) {
+            if (k != matches.begin()) {
+                q << ",";
+            }
+            q << "(" << k->player0 << "," << k->player1 << ","
+                    << k->victor << ")";
+        }
+        q.parse();
+        q.execute();
+    }
+}
+
+bool MySqlStorage::userExists(const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("userExists",
+            "select count(id) from users where name = %0q");
+    StoreQueryResult res = query.store(user);
+    int count = res[0][0];
+    return (count != 0);
+}
+
+int MySqlStorage::getUserId(const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getUserId",
+            "select id from users where name = %0q");
+    StoreQueryResult result = query.store(user);
+    if (result.empty())
+        return -1;
+    return result[0][0];
+}
+
+bool MySqlStorage::getUser(const string &user, int &id, string &ip) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getUser",
+            "SELECT id, ip FROM users WHERE name=%0q");
+    StoreQueryResult res = query.store(user);
+    if (res.empty())
+        return false;
+    id = res[0][0];
+    res[0][1].to_string(ip);
+    return true;
+}
+
+string MySqlStorage::getIp(const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getIp",
+            "select ip from users where name= %0q");
+    StoreQueryResult res = query.store(user);
+    if (res.empty()) {
+        return string();
+    } else {
+        string ip;
+        res[0][0].to_string(ip);
+        return ip;
+    }
+}
+
+void MySqlStorage::getAliases(const string &user, vector<string> &aliases) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getAliases",
+            "select name from users where ip="
+                "(select ip from users where name= %0q)");
+    StoreQueryResult res = query.store(user);
+    const int size = res.num_rows();
+    for (int i = 0; i < size; ++i) {
+        string alias;
+        res[i][0].to_string(alias);
+        aliases.push_back(alias);
+    }
+}
+
+void MySqlStorage::getPersonalMessage(const string &user, string &msg) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("loadPersonalMessage",
+            "select message from users where name= %0q");
+    StoreQueryResult res = query.store(user);
+    if (res.empty() || res[0][0].is_null()) {
+        msg = "";
+    } else {
+        res[0][0].to_string(msg);
+    }
+}
+
+bool MySqlStorage::getPassword(const string &user, string &password) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getPassword",
+            "SELECT password FROM users WHERE name = %0q");
+    StoreQueryResult result = query.store(user);
+    if (result.empty())
+        return false;
+    result[0][0].to_string(password);
+    return true;
+}
+
+bool MySqlStorage::getSaltedPassword(const string &user, string &password,
+        string &salt) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getSaltedPassword",
+            "SELECT password, salt FROM users "
+            "WHERE name = %0q");
+    StoreQueryResult result = query.store(user);
+    if (result.empty())
+        return false;
+    result[0][0].to_string(password);
+    result[0][1].to_string(salt);
+    return true;
+}
+
+void MySqlStorage::addUser(const string &user, const string &password,
+        const string &ip) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("addUser",
+            "INSERT INTO users (name, password, activity, ip) "
+            "VALUES (%0q, %1q, now(), %2q)");
+    query.execute(user, password, ip);
+}
+
+void MySqlStorage::addSaltedUser(const string &user, const string &password,
+        const string &salt, const string &ip) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("addSaltedUser",
+            "INSERT INTO users (name, password, salt, activity, ip) "
+            "VALUES (%0q, %1q, %2q, now(), %3q)");
+    query.execute(user, password, salt, ip);
+}
+
+void MySqlStorage::getChannelInfo(DatabaseRegistry::CHANNEL_INFO &info) {
+    ScopedConnection conn(m_impl->pool);
+    Query query = conn->query("select * from channels");
+    query.parse();
+    StoreQueryResult res = query.store();
+    const int count = res.num_rows();
+    for (int i = 0; i < count; ++i) {
+        string name, topic;
+        Row row = res[i];
+        const int id = row[0];
+        row[1].to_string(name);
+        row[2].to_string(topic);
+        const int flags = row[3];
+        info[id] = DatabaseRegistry::INFO_ELEMENT(name, topic, flags);
+    }
+}
+
+void MySqlStorage::setChannelFlags(const int channel, const int flags) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("setChannelFlags",
+            "update channels set flags=%0q where id=%1q");
+    query.execute(flags, channel);
+}
+
+int MySqlStorage::getUserFlags(const int channel, const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getUserFlags(name)",
+            "SELECT flags FROM channel_users "
+            "WHERE channel_id=%0q "
+                "AND user_id=(SELECT id FROM users WHERE name=%1q)");
+    StoreQueryResult result = query.store(channel, user);
+    if (result.empty())
+        return 0;
+    return result[0][0];
+}
+
+int MySqlStorage::getUserFlags(const int channel, const int user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getUserFlags(id)",
+            "SELECT flags FROM channel_users "
+            "WHERE channel_id=%0q AND user_id=%1q");
+    StoreQueryResult result = query.store(channel, user);
+    if (result.empty())
+        return 0;
+    return result[0][0];
+}
+
+int MySqlStorage::getMaxLevel(const int channel, const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getMaxLevel",
+            "SELECT MAX(flags) FROM channel_users "
+            "WHERE channel_id=%0q "
+                "AND user_id IN (SELECT id FROM users WHERE ip=("
+                    "SELECT ip FROM users WHERE name=%1q"
+                "))");
+    StoreQueryResult res = query.store(channel, user);
+    if (res.empty()) {
+        return 0;
+    }
+    return res[0][0];
+}
+
+void MySqlStorage::loadBans(BanCache &bans) {
+    ScopedConnection conn(m_impl->pool);
+    Query query = conn->query(
+            "SELECT bans.channel_id, bans.user_id, users.name, users.ip, "
+                "bans.mod_id, bans.expiry, bans.ip_ban "
+            "FROM bans "
+                "JOIN users ON users.id=bans.user_id");
+    query.parse();
+    StoreQueryResult res = query.store();
+    StoreQueryResult::iterator i = res.begin();
+    for (; i != res.end(); ++i) {
+        Row &r = *i;
+        string name, ip;
+        r[2].to_string(name);
+        r[3].to_string(ip);
+        const BanCache::BAN ban = { r[4], (int)DateTime(r[5]), (bool)r[6] };
+        bans.insert(r[0], r[1], name, ip, ban);
+    }
+}
+
+void MySqlStorage::setBan(const int channel, const int user, const int mod,
+        const int expiry, const bool ipBan) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("setBan",
+            "INSERT INTO bans "
+                "(channel_id, user_id, mod_id, expiry, ip_ban) "
+            "VALUES (%0q, %1q, %2q, %3q, %4q) "
+            "ON DUPLICATE KEY UPDATE mod_id=%2q, expiry=%3q, ip_ban=%4q");
+    query.execute(channel, user, mod, DateTime(time_t(expiry)), ipBan);
+}
+
+void MySqlStorage::removeBan(const int channel, const string &user) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("removeBan",
+            "DELETE FROM bans WHERE channel_id=%0q AND user_id=("
+                    "SELECT id FROM users WHERE name=%1q"
+                ")");
+    query.execute(channel, user);
+}
+
+void MySqlStorage::removeExpiredBans(const int now) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("removeExpiredBans",
+            "DELETE FROM bans WHERE expiry < %0q");
+    query.execute(DateTime(time_t(now)));
+}
+
+void MySqlStorage::getBans(const string &user,
+        DatabaseRegistry::BAN_LIST &bans) {
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getBans",
+            "SELECT bans.channel_id, users.name, bans.expiry, bans.ip_ban "
+            "FROM bans "
+                "JOIN users ON users.id=bans.user_id "
+            "WHERE users.ip=(SELECT ip FROM users WHERE name=%0q)");
+    StoreQueryResult res = query.store(user);
+    const int count = res.num_rows();
+    for (int i = 0; i < count; ++i) {
+        Row r = res[i];
+        const int id = r[0];
+        const string name = string(r[1].c_str());
+        const int date = (int)DateTime(r[2]);
+        const bool ipBan = (bool)r[3];
+        bans.push_back(DatabaseRegistry::BAN_ELEMENT(id, name, date, ipBan));
+    }
+}
+
+void MySqlStorage::initialiseLadder(const string &ladder) {
+    const string table1 = TABLE_STATS_PREFIX + ladder;
+    const string table2 = TABLE_MATCHES_PREFIX + ladder;
+    ScopedConnection conn(m_impl->pool);
+    {
+        Query query = conn->query("show tables like %0q");
+        query.parse();
+        StoreQueryResult result = query.store(table1);
+        if (!result.empty())
+            return;
+    }
+    {
+        Query query = conn->query("create table ");
+        query << table1 << " (user int(11) unique, rating double, ";
+        query << "deviation double, volatility double, estimate double, ";
+        query << "updated_rating double, updated_deviation double, ";
+        query << "updated_volatility double)";
+        query.parse();
+        query.execute();
+    }
+    {
+        Query query = conn->query("create table ");
+        query << table2 << " (player1 int(11), player2 int(11), ";
+        query << "victor int(4), index (player1), index (player2))";
+        query.parse();
+        query.execute();
+    }
+}
+
+void MySqlStorage::joinLadder(const string &ladder, const int user,
+        const glicko2::PLAYER &rating) {
+    const string table = TABLE_STATS_PREFIX + ladder;
+    ScopedConnection conn(m_impl->pool);
+    {
+        Query &query = conn.getStatement("isLadderMember " + ladder,
+                ("select user from " + table + " where user=%0q").c_str());
+        StoreQueryResult result = query.store(user);
+        if (!result.empty())
+            return;
+    }
+    Query &query = conn.getStatement("joinLadder " + ladder,
+            ("insert into " + table
+                + " values (%0q,%1q,%2q,%3q,0,0,0,0)").c_str());
+    query.execute(user, rating.rating, rating.deviation, rating.volatility);
+}
+
+double MySqlStorage::getRatingEstimate(const string &ladder, const int user) {
+    const string table = TABLE_STATS_PREFIX + ladder;
+    ScopedConnection conn(m_impl->pool);
+    Query &query = conn.getStatement("getRatingEstimate " + ladder,
+            ("select estimate from " + table + " where user = %0q").c_str());
+    StoreQueryResult result = query.store(user);
+    if (result.empty())
+        return -1;
+
+    return result[0][0];
+}
+
+void MySqlStorage::getRatings(const string &ladder, const vector<int> *users,
+        RATING_LIST &ratings) {
+    if (users && users->empty())
+        return;
+    ScopedConnection conn(m_impl->pool);
+    Query q = conn->query("select user, rating, deviation, volatility ");
+    q << "from " << TABLE_STATS_PREFIX << ladder;
+    if (users) {
+        q << " where user in (" << getUserList(*users) << ")";
+    }
+    q.parse();
+    StoreQueryResult res = q.store();
+    ratings.reserve(ratings.size() + res.size());
+    StoreQueryResult::iterator i = res.begin();
+    for (; i != res.end(); ++i) {
+        Row &r = *i;
+        const int user = r[0];
+        const double rating = r[1];
+        const double deviation = r[2];
+        const double volatility = r[3];
+        const glicko2::PLAYER player = { rating, deviation, volatility };
+        ratings.push_back(RATING(user, player));
+    }
+}
+
+/**
+ * Every match of every user is fetched together with the opponent's rating
+ * in a single query.
+ */
+void MySqlStorage::getPlayerMatches(const string &ladder,
+        const vector<int> &users, vector<PLAYER_MATCH> &matches) {
+    if (users.empty())
+        return;
+    const string table1 = TABLE_STATS_PREFIX + ladder;
+    const string table2 = TABLE_MATCHES_PREFIX + ladder;
+    const string list = getUserList(users);
+    ScopedConnection conn(m_impl->pool);
+    // The last column is the player whose match it is. A match against
+    // oneself is only counted once, as the first player.
+    Query q = conn->query("select m.player1, m.player2, m.victor, ");
+    q << "s.rating, s.deviation, m.player1 from " << table2 << " m join "
+            << table1 << " s on s.user=m.player2 where m.player1 in ("
+            << list << ") union all "
+            << "select m.player1, m.player2, m.victor, "
+            << "s.rating, s.deviation, m.player2 from " << table2
+            << " m join " << table1 << " s on s.user=m.player1 "
+            << "where m.player2 in (" << list
+            << ") and m.player1<>m.player2";
+    q.parse();
+    StoreQueryResult res = q.store();
+    matches.reserve(matches.size() + res.size());
+    StoreQueryResult::iterator i = res.begin();
+    for (; i != res.end(); ++i) {
+        Row &row = *i;
+        const WriteQueue::MATCH match = { row[0], row[1], row[2] };
+        const PLAYER_MATCH playerMatch = { row[5], match, row[3], row[4] };
+        matches.push_back(playerMatch);
+    }
+}
+
+void MySqlStorage::getMatches(const string &ladder,
+        vector<WriteQueue::MATCH> &matches) {
+    ScopedConnection conn(m_impl->pool);
+    Query q = conn->query("select player1, player2, victor from ");
+    q << TABLE_MATCHES_PREFIX << ladder;
+    q.parse();
+    StoreQueryResult res = q.store();
+    matches.reserve(matches.size() + res.size());
+    StoreQueryResult::iterator i = res.begin();
+    for (; i != res.end(); ++i) {
+        Row &row = *i;
+        const WriteQueue::MATCH match = { row[0], row[1], row[2] };
+        matches.push_back(match);
+    }
+}
+
+/**
+ * The ratings are written in batches of ROW_BATCH_SIZE rows. Every row
+ * already exists, so each statement only ever takes the update branch.
+ */
+void MySqlStorage::setUpdatedRatings(const string &ladder,
+        const RATING_LIST &ratings) {
+    const int count = ratings.size();
+    ScopedConnection conn(m_impl->pool);
+    for (int begin = 0; begin < count; begin += ROW_BATCH_SIZE) {
+        const int end = min(begin + ROW_BATCH_SIZE, count);
+        Query q = conn->query("insert into ");
+        q << TABLE_STATS_PREFIX << ladder << " (user, updated_rating, "
+                << "updated_deviation, updated_volatility, estimate) values ";
+        for (int i = begin; i < end; ++i) {
+            const glicko2::PLAYER &player = ratings[i].second;
+            const double estimate = glicko2::getRatingEstimate(
+                    player.rating, player.deviation);
+            if (i != begin) {
+                q << ",";
+            }
+            q << "(" << ratings[i].first << "," << player.rating << ","
+                    << player.deviation << "," << player.volatility << ","
+                    << estimate << ")";
+        }
+        q << " on duplicate key update "
+                << "updated_rating=values(updated_rating), "
+                << "updated_deviation=values(updated_deviation), "
+                << "updated_volatility=values(updated_volatility), "
+                << "estimate=values(estimate)";
+        q.parse();
+        q.execute();
+    }
+}
+
+}} // namespace shoddybattle::database
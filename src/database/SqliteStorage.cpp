@@ -0,0 +1,814 @@
+/* 
+ * File:   SqliteStorage.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <sqlite3.h>
+#include <boost/bind.hpp>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <string>
+#include <vector>
+#include <stdexcept>
+#include "SqliteStorage.h"
+#include "../main/Log.h"
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle { namespace database {
+
+namespace {
+
+const char *TABLE_STATS_PREFIX = "ladder_stats_";
+const char *TABLE_MATCHES_PREFIX = "ladder_matches_";
+
+// Milliseconds to wait for a lock held by another process on the file.
+const int BUSY_TIMEOUT = 5000;
+
+/**
+ * A connection to the database file that keeps the prepared statements used
+ * on it, keyed by purpose, for as long as the connection lives. Only the
+ * thread using the connection may change whether statements are kept.
+ */
+class SqliteConnection : noncopyable {
+public:
+    SqliteConnection(const string &file, const bool cacheStatements):
+            m_cacheStatements(cacheStatements) {
+        if (sqlite3_open(file.c_str(), &m_db) != SQLITE_OK) {
+            logError(file.c_str());
+        }
+        sqlite3_busy_timeout(m_db, BUSY_TIMEOUT);
+    }
+    ~SqliteConnection() {
+        STATEMENT_MAP::iterator i = m_statements.begin();
+        for (; i != m_statements.end(); ++i) {
+            sqlite3_finalize(i->second);
+        }
+        sqlite3_close(m_db);
+    }
+    sqlite3_stmt *getStatement(const string &purpose, const string &sql) {
+        sqlite3_stmt *&statement = m_statements[purpose];
+        if (statement && !m_cacheStatements) {
+            sqlite3_finalize(statement);
+            statement = NULL;
+        }
+        if (!statement) {
+            if (sqlite3_prepare_v2(m_db, sql.c_str(), -1, &statement, NULL)
+                    != SQLITE_OK) {
+                logError(sql.c_str());
+            }
+        }
+        return statement;
+    }
+    void setStatementCache(const bool enabled) {
+        m_cacheStatements = enabled;
+    }
+    bool execute(const string &sql) {
+        if (sqlite3_exec(m_db, sql.c_str(), NULL, NULL, NULL) != SQLITE_OK) {
+            logError(sql.c_str());
+            return false;
+        }
+        return true;
+    }
+    void logError(const char *context) {
+        Log::out() << "SQLite: " << sqlite3_errmsg(m_db) << " (" << context
+                << ")" << endl;
+    }
+private:
+    typedef unordered_map<string, sqlite3_stmt *> STATEMENT_MAP;
+    sqlite3 *m_db;
+    STATEMENT_MAP m_statements;
+    bool m_cacheStatements;
+};
+
+/**
+ * A statement in use on a connection. Parameters are bound in order, and
+ * the statement is reset when it goes out of scope so that the connection
+ * can use it again.
+ */
+class Statement : noncopyable {
+public:
+    Statement(SqliteConnection &conn, const string &purpose,
+            const string &sql):
+            m_conn(conn),
+            m_statement(conn.getStatement(purpose, sql)),
+            m_parameter(0) { }
+    ~Statement() {
+        sqlite3_reset(m_statement);
+    }
+    Statement &bind(const int value) {
+        sqlite3_bind_int(m_statement, ++m_parameter, value);
+        return *this;
+    }
+    Statement &bind(const double value) {
+        sqlite3_bind_double(m_statement, ++m_parameter, value);
+        return *this;
+    }
+    Statement &bind(const string &value) {
+        sqlite3_bind_text(m_statement, ++m_parameter, value.c_str(),
+                value.length(), SQLITE_TRANSIENT);
+        return *this;
+    }
+
+    /**
+     * Step to the next row, returning false once there are no more rows.
+     */
+    bool next() {
+        if (!m_statement)
+            return false;
+        const int result = sqlite3_step(m_statement);
+        if (result == SQLITE_ROW)
+            return true;
+        if (result != SQLITE_DONE) {
+            m_conn.logError(sqlite3_sql(m_statement));
+        }
+        return false;
+    }
+    void execute() {
+        while (next());
+    }
+
+    /**
+     * Reset the statement to be run again with new parameters.
+     */
+    void reset() {
+        sqlite3_reset(m_statement);
+        m_parameter = 0;
+    }
+
+    int getInt(const int column) {
+        return sqlite3_column_int(m_statement, column);
+    }
+    double getDouble(const int column) {
+        return sqlite3_column_double(m_statement, column);
+    }
+    string getString(const int column) {
+        const unsigned char *text = sqlite3_column_text(m_statement, column);
+        if (!text)
+            return string();
+        return string(reinterpret_cast<const char *>(text),
+                sqlite3_column_bytes(m_statement, column));
+    }
+private:
+    SqliteConnection &m_conn;
+    sqlite3_stmt *m_statement;
+    int m_parameter;
+};
+
+/**
+ * Connections for reading, each used by one thread at a time. A connection
+ * takes the pool's statement cache setting when it is grabbed.
+ */
+class SqliteConnectionPool : noncopyable {
+public:
+    SqliteConnectionPool(const string &file):
+            m_file(file),
+            m_cacheStatements(true) { }
+    ~SqliteConnectionPool() {
+        vector<SqliteConnection *>::iterator i = m_idle.begin();
+        for (; i != m_idle.end(); ++i) {
+            delete *i;
+        }
+    }
+    SqliteConnection *grab() {
+        bool cacheStatements;
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (!m_idle.empty()) {
+                SqliteConnection *conn = m_idle.back();
+                m_idle.pop_back();
+                conn->setStatementCache(m_cacheStatements);
+                return conn;
+            }
+            cacheStatements = m_cacheStatements;
+        }
+        return new SqliteConnection(m_file, cacheStatements);
+    }
+    void release(SqliteConnection *conn) {
+        lock_guard<mutex> lock(m_mutex);
+        m_idle.push_back(conn);
+    }
+    void setStatementCache(const bool enabled) {
+        lock_guard<mutex> lock(m_mutex);
+        m_cacheStatements = enabled;
+    }
+private:
+    const string m_file;
+    bool m_cacheStatements;
+    vector<SqliteConnection *> m_idle;
+    mutex m_mutex;
+};
+
+/** RAII-style SqliteConnection **/
+class ScopedReader : noncopyable {
+public:
+    ScopedReader(SqliteConnectionPool &pool):
+            m_pool(pool),
+            m_conn(pool.grab()) { }
+    ~ScopedReader() {
+        m_pool.release(m_conn);
+    }
+    operator SqliteConnection &() {
+        return *m_conn;
+    }
+private:
+    SqliteConnectionPool &m_pool;
+    SqliteConnection *m_conn;
+};
+
+typedef function<void (SqliteConnection &)> WRITE;
+
+struct WRITE_JOB {
+    WRITE write;
+    bool done;
+    bool committed;
+};
+
+void createTables(SqliteConnection &conn) {
+    conn.execute(
+            "CREATE TABLE IF NOT EXISTS channels ("
+                "id INTEGER PRIMARY KEY,"
+                "name TEXT,"
+                "topic TEXT,"
+                "flags INTEGER,"
+                "type INTEGER)");
+    conn.execute(
+            "INSERT INTO channels (name, topic, flags, type) "
+            "SELECT 'main', 'main channel', 0, 0 "
+            "WHERE NOT EXISTS (SELECT id FROM channels WHERE name='main')");
+    conn.execute(
+            "CREATE TABLE IF NOT EXISTS users ("
+                "id INTEGER PRIMARY KEY,"
+                "name TEXT COLLATE NOCASE UNIQUE,"
+                "password TEXT,"
+                "salt TEXT,"
+                "foreign_id INTEGER,"
+                "activity INTEGER,"
+                "ip TEXT,"
+                "message TEXT)");
+    conn.execute("CREATE INDEX IF NOT EXISTS users_ip ON users (ip)");
+    conn.execute(
+            "CREATE TABLE IF NOT EXISTS channel_users ("
+                "channel_id INTEGER,"
+                "user_id INTEGER,"
+                "flags INTEGER,"
+                "PRIMARY KEY (channel_id, user_id))");
+    conn.execute(
+            "CREATE TABLE IF NOT EXISTS bans ("
+                "channel_id INTEGER,"
+                "user_id INTEGER,"
+                "mod_id INTEGER,"
+                "expiry INTEGER,"
+                "ip_ban INTEGER,"
+                "PRIMARY KEY (channel_id, user_id))");
+}
+
+void writeBatch(SqliteConnection &conn, const WriteQueue::BATCH &batch) {
+    map<string, string>::const_iterator i = batch.ips.begin();
+    for (; i != batch.ips.end(); ++i) {
+        Statement(conn, "updateIp", "UPDATE users SET ip=? WHERE name=?")
+                .bind(i->second).bind(i->first).execute();
+    }
+    for (i = batch.messages.begin(); i != batch.messages.end(); ++i) {
+        Statement(conn, "setPersonalMessage",
+                "UPDATE users SET message=? WHERE name=?")
+                .bind(i->second).bind(i->first).execute();
+    }
+    map<WriteQueue::FLAGS_KEY, int>::const_iterator j = batch.flags.begin();
+    for (; j != batch.flags.end(); ++j) {
+        Statement(conn, "setUserFlags",
+                "INSERT OR REPLACE INTO channel_users "
+                    "(channel_id, user_id, flags) VALUES (?, ?, ?)")
+                .bind(j->first.first).bind(j->first.second).bind(j->second)
+                .execute();
+    }
+    map<string, vector<WriteQueue::MATCH> >::const_iterator k =
+            batch.matches.begin();
+    for (; k != batch.matches.end(); ++k) {
+        const string &ladder = k->first;
+        Statement query(conn, "postLadderMatch " + ladder,
+                "INSERT INTO " + (TABLE_MATCHES_PREFIX + ladder)
+                    + " VALUES (?, ?, ?)");
+        vector<WriteQueue::MATCH>::const_iterator m = k->second.begin();
+        for (; m != k->second.end(); ++m) {
+            query.reset();
+            query.bind(m->player0).bind(m->player1).bind(m->victor);
+            query.execute();
+        }
+    }
+}
+
+void addUser(SqliteConnection &conn, const string &user,
+        const string &password, const string &salt, const string &ip) {
+    Statement(conn, "addUser",
+            "INSERT INTO users (name, password, salt, activity, ip) "
+            "VALUES (?, ?, ?, strftime('%s', 'now'), ?)")
+            .bind(user).bind(password).bind(salt).bind(ip).execute();
+}
+
+void setChannelFlags(SqliteConnection &conn, const int channel,
+        const int flags) {
+    Statement(conn, "setChannelFlags",
+            "UPDATE channels SET flags=? WHERE id=?")
+            .bind(flags).bind(channel).execute();
+}
+
+void setBan(SqliteConnection &conn, const int channel, const int user,
+        const int mod, const int expiry, const bool ipBan) {
+    Statement(conn, "setBan",
+            "INSERT OR REPLACE INTO bans "
+                "(channel_id, user_id, mod_id, expiry, ip_ban) "
+            "VALUES (?, ?, ?, ?, ?)")
+            .bind(channel).bind(user).bind(mod).bind(expiry)
+            .bind(int(ipBan)).execute();
+}
+
+void removeBan(SqliteConnection &conn, const int channel,
+        const string &user) {
+    Statement(conn, "removeBan",
+            "DELETE FROM bans WHERE channel_id=? AND user_id=("
+                "SELECT id FROM users WHERE name=?)")
+            .bind(channel).bind(user).execute();
+}
+
+void removeExpiredBans(SqliteConnection &conn, const int now) {
+    Statement(conn, "removeExpiredBans", "DELETE FROM bans WHERE expiry < ?")
+            .bind(now).execute();
+}
+
+void initialiseLadder(SqliteConnection &conn, const string &ladder) {
+    const string table1 = TABLE_STATS_PREFIX + ladder;
+    const string table2 = TABLE_MATCHES_PREFIX + ladder;
+    conn.execute("CREATE TABLE IF NOT EXISTS " + table1 + " ("
+            "user INTEGER PRIMARY KEY, rating REAL, deviation REAL, "
+            "volatility REAL, estimate REAL, updated_rating REAL, "
+            "updated_deviation REAL, updated_volatility REAL)");
+    conn.execute("CREATE TABLE IF NOT EXISTS " + table2 + " ("
+            "player1 INTEGER, player2 INTEGER, victor INTEGER)");
+    conn.execute("CREATE INDEX IF NOT EXISTS " + table2 + "_player1 ON "
+            + table2 + " (player1)");
+    conn.execute("CREATE INDEX IF NOT EXISTS " + table2 + "_player2 ON "
+            + table2 + " (player2)");
+}
+
+void joinLadder(SqliteConnection &conn, const string &ladder,
+        const int user, const glicko2::PLAYER &rating) {
+    Statement(conn, "joinLadder " + ladder,
+            "INSERT OR IGNORE INTO " + (TABLE_STATS_PREFIX + ladder)
+                + " VALUES (?, ?, ?, ?, 0, 0, 0, 0)")
+            .bind(user).bind(rating.rating).bind(rating.deviation)
+            .bind(rating.volatility).execute();
+}
+
+void setUpdatedRatings(SqliteConnection &conn, const string &ladder,
+        const Storage::RATING_LIST &ratings) {
+    Statement query(conn, "setUpdatedRatings " + ladder,
+            "UPDATE " + (TABLE_STATS_PREFIX + ladder) + " SET "
+                "updated_rating=?, updated_deviation=?, "
+                "updated_volatility=?, estimate=? "
+            "WHERE user=?");
+    Storage::RATING_LIST::const_iterator i = ratings.begin();
+    for (; i != ratings.end(); ++i) {
+        const glicko2::PLAYER &player = i->second;
+        const double estimate = glicko2::getRatingEstimate(player.rating,
+                player.deviation);
+        query.reset();
+        query.bind(player.rating).bind(player.deviation)
+                .bind(player.volatility).bind(estimate).bind(i->first);
+        query.execute();
+    }
+}
+
+} // anonymous namespace
+
+struct SqliteStorage::SqliteStorageImpl {
+    SqliteConnectionPool readers;
+    SqliteConnection writer;
+    vector<WRITE_JOB *> jobs;
+    bool stopping;
+    mutex writeMutex;
+    condition_variable writeReady;
+    condition_variable writeDone;
+    thread writeThread;
+
+    SqliteStorageImpl(const string &file):
+            readers(file),
+            writer(file, true),
+            stopping(false) {
+        writer.execute("PRAGMA journal_mode=WAL");
+        writer.execute("PRAGMA synchronous=NORMAL");
+        writeThread = thread(boost::bind(
+                &SqliteStorageImpl::runWriter, this));
+    }
+
+    ~SqliteStorageImpl() {
+        {
+            lock_guard<mutex> lock(writeMutex);
+            stopping = true;
+        }
+        writeReady.notify_one();
+        writeThread.join();
+    }
+
+    /**
+     * Have the writer thread make a write, and wait until its transaction
+     * has ended. Returns false if the transaction was not committed.
+     */
+    bool write(const WRITE &write) {
+        // The job is on the stack, so this must not return before it is done.
+        this_thread::disable_interruption noInterruption;
+        WRITE_JOB job = { write, false, false };
+        unique_lock<mutex> lock(writeMutex);
+        jobs.push_back(&job);
+        writeReady.notify_one();
+        while (!job.done) {
+            writeDone.wait(lock);
+        }
+        return job.committed;
+    }
+
+    /**
+     * Make every write that is waiting in one transaction, for as long as
+     * there are writes.
+     */
+    void runWriter() {
+        vector<WRITE_JOB *> batch;
+        while (true) {
+            {
+                unique_lock<mutex> lock(writeMutex);
+                while (jobs.empty() && !stopping) {
+                    writeReady.wait(lock);
+                }
+                if (jobs.empty())
+                    return;
+                batch.swap(jobs);
+            }
+            // BEGIN IMMEDIATE has already waited out the busy timeout when
+            // it fails, so the jobs fail rather than run outside of a
+            // transaction.
+            bool committed = writer.execute("BEGIN IMMEDIATE");
+            vector<WRITE_JOB *>::iterator i = batch.begin();
+            if (committed) {
+                for (; i != batch.end(); ++i) {
+                    (*i)->write(writer);
+                }
+                committed = writer.execute("COMMIT");
+                if (!committed) {
+                    writer.execute("ROLLBACK");
+                }
+            }
+            {
+                lock_guard<mutex> lock(writeMutex);
+                for (i = batch.begin(); i != batch.end(); ++i) {
+                    (*i)->committed = committed;
+                    (*i)->done = true;
+                }
+            }
+            writeDone.notify_all();
+            batch.clear();
+        }
+    }
+};
+
+SqliteStorage::SqliteStorage(const string &file):
+        m_impl(new SqliteStorageImpl(file)) { }
+
+void SqliteStorage::createTables() {
+    m_impl->write(boost::bind(database::createTables, _1));
+}
+
+void SqliteStorage::setStatementCache(const bool enabled) {
+    // The writer connection is only touched by the writer thread.
+    m_impl->readers.setStatementCache(enabled);
+    m_impl->write(boost::bind(&SqliteConnection::setStatementCache, _1,
+            enabled));
+}
+
+void SqliteStorage::write(const WriteQueue::BATCH &batch) {
+    // DatabaseRegistry puts a batch that throws back in the queue.
+    if (!m_impl->write(boost::bind(writeBatch, _1, cref(batch)))) {
+        throw runtime_error("the transaction was not committed");
+    }
+}
+
+bool SqliteStorage::userExists(const string &user) {
+    return (getUserId(user) != -1);
+}
+
+int SqliteStorage::getUserId(const string &user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getUserId", "SELECT id FROM users WHERE name=?");
+    query.bind(user);
+    if (!query.next())
+        return -1;
+    return query.getInt(0);
+}
+
+bool SqliteStorage::getUser(const string &user, int &id, string &ip) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getUser", "SELECT id, ip FROM users WHERE name=?");
+    query.bind(user);
+    if (!query.next())
+        return false;
+    id = query.getInt(0);
+    ip = query.getString(1);
+    return true;
+}
+
+string SqliteStorage::getIp(const string &user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getIp", "SELECT ip FROM users WHERE name=?");
+    query.bind(user);
+    if (!query.next())
+        return string();
+    return query.getString(0);
+}
+
+void SqliteStorage::getAliases(const string &user, vector<string> &aliases) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getAliases",
+            "SELECT name FROM users WHERE ip="
+                "(SELECT ip FROM users WHERE name=?)");
+    query.bind(user);
+    while (query.next()) {
+        aliases.push_back(query.getString(0));
+    }
+}
+
+void SqliteStorage::getPersonalMessage(const string &user, string &msg) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "loadPersonalMessage",
+            "SELECT message FROM users WHERE name=?");
+    query.bind(user);
+    msg = query.next() ? query.getString(0) : string();
+}
+
+bool SqliteStorage::getPassword(const string &user, string &password) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getPassword",
+            "SELECT password FROM users WHERE name=?");
+    query.bind(user);
+    if (!query.next())
+        return false;
+    password = query.getString(0);
+    return true;
+}
+
+bool SqliteStorage::getSaltedPassword(const string &user, string &password,
+        string &salt) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getSaltedPassword",
+            "SELECT password, salt FROM users WHERE name=?");
+    query.bind(user);
+    if (!query.next())
+        return false;
+    password = query.getString(0);
+    salt = query.getString(1);
+    return true;
+}
+
+void SqliteStorage::addUser(const string &user, const string &password,
+        const string &ip) {
+    addSaltedUser(user, password, string(), ip);
+}
+
+void SqliteStorage::addSaltedUser(const string &user, const string &password,
+        const string &salt, const string &ip) {
+    m_impl->write(boost::bind(database::addUser, _1, cref(user),
+            cref(password), cref(salt), cref(ip)));
+}
+
+void SqliteStorage::getChannelInfo(DatabaseRegistry::CHANNEL_INFO &info) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getChannelInfo",
+            "SELECT id, name, topic, flags FROM channels");
+    while (query.next()) {
+        info[query.getInt(0)] = DatabaseRegistry::INFO_ELEMENT(
+                query.getString(1), query.getString(2), query.getInt(3));
+    }
+}
+
+void SqliteStorage::setChannelFlags(const int channel, const int flags) {
+    m_impl->write(boost::bind(database::setChannelFlags, _1, channel,
+            flags));
+}
+
+int SqliteStorage::getUserFlags(const int channel, const string &user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getUserFlags(name)",
+            "SELECT flags FROM channel_users "
+            "WHERE channel_id=? "
+                "AND user_id=(SELECT id FROM users WHERE name=?)");
+    query.bind(channel).bind(user);
+    if (!query.next())
+        return 0;
+    return query.getInt(0);
+}
+
+int SqliteStorage::getUserFlags(const int channel, const int user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getUserFlags(id)",
+            "SELECT flags FROM channel_users "
+            "WHERE channel_id=? AND user_id=?");
+    query.bind(channel).bind(user);
+    if (!query.next())
+        return 0;
+    return query.getInt(0);
+}
+
+int SqliteStorage::getMaxLevel(const int channel, const string &user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getMaxLevel",
+            "SELECT MAX(flags) FROM channel_users "
+            "WHERE channel_id=? "
+                "AND user_id IN (SELECT id FROM users WHERE ip=("
+                    "SELECT ip FROM users WHERE name=?"
+                "))");
+    query.bind(channel).bind(user);
+    if (!query.next())
+        return 0;
+    return query.getInt(0);
+}
+
+void SqliteStorage::loadBans(BanCache &bans) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "loadBans",
+            "SELECT bans.channel_id, bans.user_id, users.name, users.ip, "
+                "bans.mod_id, bans.expiry, bans.ip_ban "
+            "FROM bans "
+                "JOIN users ON users.id=bans.user_id");
+    while (query.next()) {
+        const BanCache::BAN ban = {
+            query.getInt(4), query.getInt(5), (query.getInt(6) != 0)
+        };
+        bans.insert(query.getInt(0), query.getInt(1), query.getString(2),
+                query.getString(3), ban);
+    }
+}
+
+void SqliteStorage::setBan(const int channel, const int user, const int mod,
+        const int expiry, const bool ipBan) {
+    m_impl->write(boost::bind(database::setBan, _1, channel, user, mod,
+            expiry, ipBan));
+}
+
+void SqliteStorage::removeBan(const int channel, const string &user) {
+    m_impl->write(boost::bind(database::removeBan, _1, channel, cref(user)));
+}
+
+void SqliteStorage::removeExpiredBans(const int now) {
+    m_impl->write(boost::bind(database::removeExpiredBans, _1, now));
+}
+
+void SqliteStorage::getBans(const string &user,
+        DatabaseRegistry::BAN_LIST &bans) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getBans",
+            "SELECT bans.channel_id, users.name, bans.expiry, bans.ip_ban "
+            "FROM bans "
+                "JOIN users ON users.id=bans.user_id "
+            "WHERE users.ip=(SELECT ip FROM users WHERE name=?)");
+    query.bind(user);
+    while (query.next()) {
+        bans.push_back(DatabaseRegistry::BAN_ELEMENT(query.getInt(0),
+                query.getString(1), query.getInt(2), (query.getInt(3) != 0)));
+    }
+}
+
+void SqliteStorage::initialiseLadder(const string &ladder) {
+    m_impl->write(boost::bind(database::initialiseLadder, _1, cref(ladder)));
+}
+
+void SqliteStorage::joinLadder(const string &ladder, const int user,
+        const glicko2::PLAYER &rating) {
+    m_impl->write(boost::bind(database::joinLadder, _1, cref(ladder), user,
+            cref(rating)));
+}
+
+double SqliteStorage::getRatingEstimate(const string &ladder,
+        const int user) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getRatingEstimate " + ladder,
+            "SELECT estimate FROM " + (TABLE_STATS_PREFIX + ladder)
+                + " WHERE user=?");
+    query.bind(user);
+    if (!query.next())
+        return -1;
+    return query.getDouble(0);
+}
+
+/**
+ * Each user is looked up with the same prepared statement, which is as
+ * cheap as a list of users in one query when the database is in-process.
+ */
+void SqliteStorage::getRatings(const string &ladder,
+        const vector<int> *users, RATING_LIST &ratings) {
+    const string table = TABLE_STATS_PREFIX + ladder;
+    ScopedReader conn(m_impl->readers);
+    if (!users) {
+        Statement query(conn, "getRatings " + ladder,
+                "SELECT user, rating, deviation, volatility FROM " + table);
+        while (query.next()) {
+            const glicko2::PLAYER player = {
+                query.getDouble(1), query.getDouble(2), query.getDouble(3)
+            };
+            ratings.push_back(RATING(query.getInt(0), player));
+        }
+        return;
+    }
+    Statement query(conn, "getRating " + ladder,
+            "SELECT rating, deviation, volatility FROM " + table
+                + " WHERE user=?");
+    ratings.reserve(ratings.size() + users->size());
+    vector<int>::const_iterator i = users->begin();
+    for (; i != users->end(); ++i) {
+        query.reset();
+        query.bind(*i);
+        if (query.next()) {
+            const glicko2::PLAYER player = {
+                query.getDouble(0), query.getDouble(1), query.getDouble(2)
+            };
+            ratings.push_back(RATING(*i, player));
+        }
+    }
+}
+
+void SqliteStorage::getPlayerMatches(const string &ladder,
+        const vector<int> &users, vector<PLAYER_MATCH> &matches) {
+    const string table1 = TABLE_STATS_PREFIX + ladder;
+    const string table2 = TABLE_MATCHES_PREFIX + ladder;
+    ScopedReader conn(m_impl->readers);
+    // A match against oneself is only counted once, as the first player.
+    Statement first(conn, "getFirstPlayerMatches " + ladder,
+            "SELECT m.player1, m.player2, m.victor, s.rating, s.deviation "
+            "FROM " + table2 + " m JOIN " + table1 + " s "
+                "ON s.user=m.player2 "
+            "WHERE m.player1=?");
+    Statement second(conn, "getSecondPlayerMatches " + ladder,
+            "SELECT m.player1, m.player2, m.victor, s.rating, s.deviation "
+            "FROM " + table2 + " m JOIN " + table1 + " s "
+                "ON s.user=m.player1 "
+            "WHERE m.player2=? AND m.player1<>m.player2");
+    Statement *queries[] = { &first, &second };
+    vector<int>::const_iterator i = users.begin();
+    for (; i != users.end(); ++i) {
+        for (int j = 0; j < 2; ++j) {
+            Statement &query = *queries[j];
+            query.reset();
+            query.bind(*i);
+            while (query.next()) {
+                const WriteQueue::MATCH match = {
+                    query.getInt(0), query.getInt(1), query.getInt(2)
+                };
+                const PLAYER_MATCH playerMatch = {
+                    *i, match, query.getDouble(3), query.getDouble(4)
+                };
+                matches.push_back(playerMatch);
+            }
+        }
+    }
+}
+
+void SqliteStorage::getMatches(const string &ladder,
+        vector<WriteQueue::MATCH> &matches) {
+    ScopedReader conn(m_impl->readers);
+    Statement query(conn, "getMatches " + ladder,
+            "SELECT player1, player2, victor FROM "
+                + (TABLE_MATCHES_PREFIX + ladder));
+    while (query.next()) {
+        const WriteQueue::MATCH match = {
+            query.getInt(0), query.getInt(1), query.getInt(2)
+        };
+        matches.push_back(match);
+    }
+}
+
+void SqliteStorage::setUpdatedRatings(const string &ladder,
+        const RATING_LIST &ratings) {
+    m_impl->write(boost::bind(database::setUpdatedRatings, _1, cref(ladder),
+            cref(ratings)));
+}
+
+}} // namespace shoddybattle::database
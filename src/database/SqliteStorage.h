@@ -0,0 +1,94 @@
+/* 
+ * File:   SqliteStorage.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _SQLITE_STORAGE_H_
+#define _SQLITE_STORAGE_H_
+
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include "Storage.h"
+
+namespace shoddybattle { namespace database {
+
+/**
+ * Storage in an SQLite database file, for running without a database
+ * server. The file is opened in WAL mode, so that reads on the pooled
+ * connections go on while one thread makes every write. Writes that are
+ * waiting together are committed in a single transaction.
+ */
+class SqliteStorage : public Storage {
+public:
+    SqliteStorage(const std::string &file);
+
+    void createTables();
+    void setStatementCache(const bool enabled);
+    void write(const WriteQueue::BATCH &batch);
+
+    bool userExists(const std::string &user);
+    int getUserId(const std::string &user);
+    bool getUser(const std::string &user, int &id, std::string &ip);
+    std::string getIp(const std::string &user);
+    void getAliases(const std::string &user,
+            std::vector<std::string> &aliases);
+    void getPersonalMessage(const std::string &user, std::string &message);
+    bool getPassword(const std::string &user, std::string &password);
+    bool getSaltedPassword(const std::string &user, std::string &password,
+            std::string &salt);
+    void addUser(const std::string &user, const std::string &password,
+            const std::string &ip);
+    void addSaltedUser(const std::string &user, const std::string &password,
+            const std::string &salt, const std::string &ip);
+
+    void getChannelInfo(DatabaseRegistry::CHANNEL_INFO &info);
+    void setChannelFlags(const int channel, const int flags);
+    int getUserFlags(const int channel, const std::string &user);
+    int getUserFlags(const int channel, const int user);
+    int getMaxLevel(const int channel, const std::string &user);
+
+    void loadBans(BanCache &bans);
+    void setBan(const int channel, const int user, const int mod,
+            const int expiry, const bool ipBan);
+    void removeBan(const int channel, const std::string &user);
+    void removeExpiredBans(const int now);
+    void getBans(const std::string &user, DatabaseRegistry::BAN_LIST &bans);
+
+    void initialiseLadder(const std::string &ladder);
+    void joinLadder(const std::string &ladder, const int user,
+            const glicko2::PLAYER &rating);
+    double getRatingEstimate(const std::string &ladder, const int user);
+    void getRatings(const std::string &ladder, const std::vector<int> *users,
+            RATING_LIST &ratings);
+    void getPlayerMatches(const std::string &ladder,
+            const std::vector<int> &users,
+            std::vector<PLAYER_MATCH> &matches);
+    void getMatches(const std::string &ladder,
+            std::vector<WriteQueue::MATCH> &matches);
+    void setUpdatedRatings(const std::string &ladder,
+            const RATING_LIST &ratings);
+
+private:
+    class SqliteStorageImpl;
+    boost::shared_ptr<SqliteStorageImpl> m_impl;
+};
+
+}} // namespace shoddybattle::database
+
+#endif
@@ -0,0 +1,149 @@
+/* 
+ * File:   Storage.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _STORAGE_H_
+#define _STORAGE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/noncopyable.hpp>
+#include "DatabaseRegistry.h"
+#include "BanCache.h"
+#include "WriteQueue.h"
+#include "../matchmaking/glicko2.h"
+
+namespace shoddybattle { namespace database {
+
+/**
+ * The tables behind DatabaseRegistry. Each method is one read or write of
+ * stored data; the registry does everything else, such as caching bans,
+ * queueing writes and calculating ratings.
+ *
+ * User names are compared without regard to case. Methods may be called
+ * from any thread.
+ */
+class Storage : boost::noncopyable {
+public:
+    typedef std::pair<int, glicko2::PLAYER> RATING;     // user, rating
+    typedef std::vector<RATING> RATING_LIST;
+
+    /**
+     * A ladder match from the point of view of one of its players, with the
+     * rating of the other player.
+     */
+    struct PLAYER_MATCH {
+        int player;
+        WriteQueue::MATCH match;
+        double rating;
+        double deviation;
+    };
+
+    virtual ~Storage() { }
+
+    /**
+     * Create any missing tables, and the main channel.
+     */
+    virtual void createTables() = 0;
+
+    /**
+     * Set whether statements are kept for reuse by each connection.
+     */
+    virtual void setStatementCache(const bool enabled) = 0;
+
+    /**
+     * Make a batch of queued writes. Throws if the batch was not written.
+     */
+    virtual void write(const WriteQueue::BATCH &batch) = 0;
+
+    // Users.
+    virtual bool userExists(const std::string &user) = 0;
+    virtual int getUserId(const std::string &user) = 0;    // -1 if none
+    virtual bool getUser(const std::string &user, int &id,
+            std::string &ip) = 0;
+    virtual std::string getIp(const std::string &user) = 0;
+    virtual void getAliases(const std::string &user,
+            std::vector<std::string> &aliases) = 0;
+    virtual void getPersonalMessage(const std::string &user,
+            std::string &message) = 0;
+    virtual bool getPassword(const std::string &user,
+            std::string &password) = 0;
+    virtual bool getSaltedPassword(const std::string &user,
+            std::string &password, std::string &salt) = 0;
+    virtual void addUser(const std::string &user,
+            const std::string &password, const std::string &ip) = 0;
+    virtual void addSaltedUser(const std::string &user,
+            const std::string &password, const std::string &salt,
+            const std::string &ip) = 0;
+
+    // Channels.
+    virtual void getChannelInfo(DatabaseRegistry::CHANNEL_INFO &info) = 0;
+    virtual void setChannelFlags(const int channel, const int flags) = 0;
+    virtual int getUserFlags(const int channel, const std::string &user) = 0;
+    virtual int getUserFlags(const int channel, const int user) = 0;
+    virtual int getMaxLevel(const int channel, const std::string &user) = 0;
+
+    // Bans. Expiry times are in seconds since the epoch.
+    virtual void loadBans(BanCache &bans) = 0;
+    virtual void setBan(const int channel, const int user, const int mod,
+            const int expiry, const bool ipBan) = 0;
+    virtual void removeBan(const int channel, const std::string &user) = 0;
+    virtual void removeExpiredBans(const int now) = 0;
+    virtual void getBans(const std::string &user,
+            DatabaseRegistry::BAN_LIST &bans) = 0;
+
+    // Ladders.
+    virtual void initialiseLadder(const std::string &ladder) = 0;
+    virtual void joinLadder(const std::string &ladder, const int user,
+            const glicko2::PLAYER &rating) = 0;
+    virtual double getRatingEstimate(const std::string &ladder,
+            const int user) = 0;    // -1 if none
+
+    /**
+     * Get the rating of each of the given users, or of every user on the
+     * ladder if users is NULL.
+     */
+    virtual void getRatings(const std::string &ladder,
+            const std::vector<int> *users, RATING_LIST &ratings) = 0;
+
+    /**
+     * Get every match of each of the given users. A match against oneself
+     * is only returned once, for the first player.
+     */
+    virtual void getPlayerMatches(const std::string &ladder,
+            const std::vector<int> &users,
+            std::vector<PLAYER_MATCH> &matches) = 0;
+
+    virtual void getMatches(const std::string &ladder,
+            std::vector<WriteQueue::MATCH> &matches) = 0;
+
+    /**
+     * Store new ratings, and their rating estimates, as the updated ratings
+     * of the users. The ratings at the start of the period are kept.
+     */
+    virtual void setUpdatedRatings(const std::string &ladder,
+            const RATING_LIST &ratings) = 0;
+};
+
+}} // namespace shoddybattle::database
+
+#endif
@@ -0,0 +1,180 @@
+/* 
+ * File:   WriteQueue.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include "WriteQueue.h"
+#include <boost/thread/locks.hpp>
+#include <boost/thread/thread_time.hpp>
+#include <boost/algorithm/string/case_conv.hpp>
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle { namespace database {
+
+namespace {
+
+/**
+ * User names are compared without regard to case, as they are by the
+ * database.
+ */
+string getKey(const string &name) {
+    return algorithm::to_lower_copy(name);
+}
+
+/**
+ * Restore the values of a batch that was not written, keeping any value
+ * queued since. Returns the number of values restored.
+ */
+template <class K, class V>
+int restoreValues(map<K, V> &queued, const map<K, V> &writing) {
+    int restored = 0;
+    typename map<K, V>::const_iterator i = writing.begin();
+    for (; i != writing.end(); ++i) {
+        if (queued.insert(*i).second) {
+            ++restored;
+        }
+    }
+    return restored;
+}
+
+template <class K, class V>
+bool findValue(const map<K, V> &queued, const map<K, V> &writing,
+        const K &key, V &value) {
+    typename map<K, V>::const_iterator i = queued.find(key);
+    if (i == queued.end()) {
+        i = writing.find(key);
+        if (i == writing.end())
+            return false;
+    }
+    value = i->second;
+    return true;
+}
+
+}
+
+void WriteQueue::added(const bool replaced) {
+    if (!replaced) {
+        ++m_size;
+    }
+    if (m_size >= m_limit) {
+        m_full.notify_one();
+    }
+}
+
+void WriteQueue::setIp(const string &user, const string &ip) {
+    lock_guard<mutex> lock(m_mutex);
+    pair<map<string, string>::iterator, bool> i =
+            m_queued.ips.insert(make_pair(getKey(user), ip));
+    i.first->second = ip;
+    added(!i.second);
+}
+
+void WriteQueue::setMessage(const string &user, const string &message) {
+    lock_guard<mutex> lock(m_mutex);
+    pair<map<string, string>::iterator, bool> i =
+            m_queued.messages.insert(make_pair(getKey(user), message));
+    i.first->second = message;
+    added(!i.second);
+}
+
+void WriteQueue::setUserFlags(const int channel, const int user,
+        const int flags) {
+    lock_guard<mutex> lock(m_mutex);
+    pair<map<FLAGS_KEY, int>::iterator, bool> i = m_queued.flags.insert(
+            make_pair(FLAGS_KEY(channel, user), flags));
+    i.first->second = flags;
+    added(!i.second);
+}
+
+void WriteQueue::addMatch(const string &ladder, const MATCH &match) {
+    lock_guard<mutex> lock(m_mutex);
+    m_queued.matches[ladder].push_back(match);
+    added(false);
+}
+
+bool WriteQueue::getIp(const string &user, string &ip) {
+    lock_guard<mutex> lock(m_mutex);
+    return findValue(m_queued.ips, m_writing.ips, getKey(user), ip);
+}
+
+bool WriteQueue::getMessage(const string &user, string &message) {
+    lock_guard<mutex> lock(m_mutex);
+    return findValue(m_queued.messages, m_writing.messages, getKey(user),
+            message);
+}
+
+bool WriteQueue::getUserFlags(const int channel, const int user,
+        int &flags) {
+    lock_guard<mutex> lock(m_mutex);
+    return findValue(m_queued.flags, m_writing.flags,
+            FLAGS_KEY(channel, user), flags);
+}
+
+bool WriteQueue::hasIps() {
+    lock_guard<mutex> lock(m_mutex);
+    return !m_queued.ips.empty() || !m_writing.ips.empty();
+}
+
+bool WriteQueue::hasUserFlags() {
+    lock_guard<mutex> lock(m_mutex);
+    return !m_queued.flags.empty() || !m_writing.flags.empty();
+}
+
+void WriteQueue::wait(const int ms) {
+    unique_lock<mutex> lock(m_mutex);
+    const system_time end = get_system_time() + posix_time::milliseconds(ms);
+    while (m_size < m_limit) {
+        if (!m_full.timed_wait(lock, end))
+            break;
+    }
+}
+
+const WriteQueue::BATCH &WriteQueue::take() {
+    lock_guard<mutex> lock(m_mutex);
+    m_writing.swap(m_queued);
+    m_size = 0;
+    return m_writing;
+}
+
+void WriteQueue::requeue() {
+    lock_guard<mutex> lock(m_mutex);
+    m_size += restoreValues(m_queued.ips, m_writing.ips);
+    m_size += restoreValues(m_queued.messages, m_writing.messages);
+    m_size += restoreValues(m_queued.flags, m_writing.flags);
+    map<string, vector<MATCH> >::const_iterator i =
+            m_writing.matches.begin();
+    for (; i != m_writing.matches.end(); ++i) {
+        vector<MATCH> &matches = m_queued.matches[i->first];
+        matches.insert(matches.begin(), i->second.begin(), i->second.end());
+        m_size += i->second.size();
+    }
+    if (m_size >= m_limit) {
+        m_full.notify_one();
+    }
+}
+
+void WriteQueue::finish() {
+    BATCH written;
+    lock_guard<mutex> lock(m_mutex);
+    written.swap(m_writing);
+}
+
+}} // namespace shoddybattle::database
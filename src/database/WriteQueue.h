@@ -0,0 +1,131 @@
+/* 
+ * File:   WriteQueue.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _WRITE_QUEUE_H_
+#define _WRITE_QUEUE_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+namespace shoddybattle { namespace database {
+
+/**
+ * Writes that do not have to reach the database before the request that
+ * made them is answered. DatabaseRegistry takes them out of the queue in
+ * batches and writes each batch at once.
+ *
+ * A later write of the same user's IP address, personal message or flags
+ * replaces an earlier one that is still queued. Until a batch has been
+ * written, its values are returned by the lookups below, so that reading
+ * one of these values always gives the last value written.
+ */
+class WriteQueue {
+public:
+    struct MATCH {
+        int player0;
+        int player1;
+        int victor;
+    };
+
+    typedef std::pair<int, int> FLAGS_KEY;  // channel, user id
+
+    struct BATCH {
+        std::map<std::string, std::string> ips;         // by user name
+        std::map<std::string, std::string> messages;    // by user name
+        std::map<FLAGS_KEY, int> flags;
+        std::map<std::string, std::vector<MATCH> > matches; // by ladder
+        bool empty() const {
+            return ips.empty() && messages.empty() && flags.empty()
+                    && matches.empty();
+        }
+        void swap(BATCH &other) {
+            ips.swap(other.ips);
+            messages.swap(other.messages);
+            flags.swap(other.flags);
+            matches.swap(other.matches);
+        }
+    };
+
+    /**
+     * The queue counts as full when it holds the given number of writes.
+     */
+    WriteQueue(const int limit): m_size(0), m_limit(limit) { }
+
+    void setIp(const std::string &user, const std::string &ip);
+    void setMessage(const std::string &user, const std::string &message);
+    void setUserFlags(const int channel, const int user, const int flags);
+    void addMatch(const std::string &ladder, const MATCH &match);
+
+    /**
+     * Look up a value that has not been written yet. Each returns false if
+     * there is no such write.
+     */
+    bool getIp(const std::string &user, std::string &ip);
+    bool getMessage(const std::string &user, std::string &message);
+    bool getUserFlags(const int channel, const int user, int &flags);
+
+    /**
+     * Whether any IP addresses or flags have not been written yet, for
+     * queries that cannot use the lookups above.
+     */
+    bool hasIps();
+    bool hasUserFlags();
+
+    /**
+     * Wait until the queue is full or the given number of milliseconds
+     * has passed.
+     */
+    void wait(const int ms);
+
+    /**
+     * Take every queued write. Its values are still returned by the
+     * lookups until finish() is called once it has been written, and the
+     * batch returned is valid until then. Only one batch can be taken at
+     * a time.
+     */
+    const BATCH &take();
+    void finish();
+
+    /**
+     * Put the batch that was taken back in the queue after it could not be
+     * written, behind any later writes of the same values. finish() must
+     * still be called.
+     */
+    void requeue();
+
+private:
+    void added(const bool replaced);
+
+    BATCH m_queued;
+    BATCH m_writing;
+    int m_size;
+    const int m_limit;
+    boost::mutex m_mutex;
+    boost::condition_variable m_full;
+};
+
+}} // namespace shoddybattle::database
+
+#endif
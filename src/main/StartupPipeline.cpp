@@ -0,0 +1,198 @@
+/* 
+ * File:   StartupPipeline.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <vector>
+#include <exception>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/algorithm/string.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "StartupPipeline.h"
+#include "Log.h"
+
+using namespace std;
+namespace pt = boost::posix_time;
+
+namespace shoddybattle {
+
+class StartupPipeline::StartupPipelineImpl {
+public:
+    enum STATE {
+        S_WAITING,
+        S_RUNNING,
+        S_DONE,
+        S_FAILED,
+        S_SKIPPED
+    };
+
+    struct PHASE_INFO {
+        string name;
+        PHASE phase;
+        vector<int> dependencies;
+        STATE state;
+        pt::time_duration started;
+        pt::time_duration elapsed;
+    };
+
+    vector<PHASE_INFO> phases;
+    boost::mutex lock;
+    boost::condition_variable finished;
+    pt::ptime start;
+
+    int getPhase(const string &name) const {
+        const int count = phases.size();
+        for (int i = 0; i < count; ++i) {
+            if (phases[i].name == name)
+                return i;
+        }
+        return -1;
+    }
+
+    /**
+     * Find the state that a waiting phase can move to from the states of
+     * its dependencies.
+     */
+    STATE getNextState(const PHASE_INFO &info) const {
+        vector<int>::const_iterator i = info.dependencies.begin();
+        for (; i != info.dependencies.end(); ++i) {
+            const STATE state = phases[*i].state;
+            if ((state == S_FAILED) || (state == S_SKIPPED))
+                return S_SKIPPED;
+            if (state != S_DONE)
+                return S_WAITING;
+        }
+        return S_RUNNING;
+    }
+
+    void runPhase(const int idx) {
+        const pt::ptime begin = pt::microsec_clock::universal_time();
+        STATE state = S_DONE;
+        try {
+            // The list of phases does not change while they run.
+            phases[idx].phase();
+        } catch (const exception &e) {
+            Log::out() << "Error: Startup phase " << phases[idx].name
+                    << " failed: " << e.what() << endl;
+            state = S_FAILED;
+        } catch (...) {
+            Log::out() << "Error: Startup phase " << phases[idx].name
+                    << " failed." << endl;
+            state = S_FAILED;
+        }
+        const pt::ptime end = pt::microsec_clock::universal_time();
+
+        boost::lock_guard<boost::mutex> guard(lock);
+        PHASE_INFO &info = phases[idx];
+        info.state = state;
+        info.started = begin - start;
+        info.elapsed = end - begin;
+        finished.notify_one();
+    }
+};
+
+StartupPipeline::StartupPipeline():
+        m_impl(new StartupPipelineImpl()) { }
+
+void StartupPipeline::addPhase(const string &name, PHASE phase,
+        const string &dependencies) {
+    StartupPipelineImpl::PHASE_INFO info;
+    info.name = name;
+    info.phase = phase;
+    info.state = StartupPipelineImpl::S_WAITING;
+
+    vector<string> names;
+    if (!dependencies.empty()) {
+        boost::split(names, dependencies, boost::is_any_of(","));
+    }
+    vector<string>::const_iterator i = names.begin();
+    for (; i != names.end(); ++i) {
+        const string dependency = boost::trim_copy(*i);
+        const int idx = m_impl->getPhase(dependency);
+        if (idx == -1) {
+            Log::out() << "Error: Startup phase " << name
+                    << " depends on unknown phase " << dependency << "."
+                    << endl;
+            info.state = StartupPipelineImpl::S_SKIPPED;
+        } else {
+            info.dependencies.push_back(idx);
+        }
+    }
+    m_impl->phases.push_back(info);
+}
+
+bool StartupPipeline::run() {
+    typedef StartupPipelineImpl::PHASE_INFO PHASE_INFO;
+    vector<PHASE_INFO> &phases = m_impl->phases;
+    const int count = phases.size();
+    boost::thread_group threads;
+    m_impl->start = pt::microsec_clock::universal_time();
+    {
+        boost::unique_lock<boost::mutex> lock(m_impl->lock);
+        while (true) {
+            int running = 0;
+            for (int i = 0; i < count; ++i) {
+                PHASE_INFO &info = phases[i];
+                if (info.state == StartupPipelineImpl::S_WAITING) {
+                    info.state = m_impl->getNextState(info);
+                    if (info.state == StartupPipelineImpl::S_RUNNING) {
+                        threads.create_thread(boost::bind(
+                                &StartupPipelineImpl::runPhase,
+                                m_impl.get(), i));
+                    }
+                }
+                if ((info.state == StartupPipelineImpl::S_WAITING)
+                        || (info.state == StartupPipelineImpl::S_RUNNING)) {
+                    ++running;
+                }
+            }
+            if (running == 0)
+                break;
+            m_impl->finished.wait(lock);
+        }
+    }
+    threads.join_all();
+
+    const pt::time_duration total =
+            pt::microsec_clock::universal_time() - m_impl->start;
+    bool ok = true;
+    Log::out() << "Startup phases:" << endl;
+    for (int i = 0; i < count; ++i) {
+        const PHASE_INFO &info = phases[i];
+        if (info.state == StartupPipelineImpl::S_SKIPPED) {
+            Log::out() << "    " << info.name << ": skipped" << endl;
+            ok = false;
+            continue;
+        }
+        Log::out() << "    " << info.name << ": started at "
+                << info.started.total_milliseconds() << " ms, took "
+                << info.elapsed.total_milliseconds() << " ms"
+                << ((info.state == StartupPipelineImpl::S_FAILED)
+                    ? " (failed)" : "") << endl;
+        if (info.state == StartupPipelineImpl::S_FAILED) {
+            ok = false;
+        }
+    }
+    Log::out() << "Startup took " << total.total_milliseconds() << " ms."
+            << endl;
+    return ok;
+}
+
+}
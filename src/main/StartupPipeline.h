@@ -0,0 +1,68 @@
+/* 
+ * File:   StartupPipeline.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _STARTUP_PIPELINE_H_
+#define _STARTUP_PIPELINE_H_
+
+#include <string>
+#include <boost/function.hpp>
+#include <boost/noncopyable.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace shoddybattle {
+
+/**
+ * Runs the phases of server startup as a dependency graph. Each phase runs
+ * on its own thread as soon as every phase it depends on has finished, so
+ * independent work such as reading data files and connecting to the
+ * database overlaps. When all of the phases are done, the time at which each
+ * one started and how long it took are written to the log.
+ *
+ * A phase fails by throwing an exception. The phases that depend on it are
+ * then skipped, and run() returns false once the rest have finished.
+ */
+class StartupPipeline : boost::noncopyable {
+public:
+    typedef boost::function<void ()> PHASE;
+
+    StartupPipeline();
+
+    /**
+     * Add a phase. The dependencies are a comma separated list of the names
+     * of phases that were added earlier.
+     */
+    void addPhase(const std::string &name, PHASE phase,
+            const std::string &dependencies = std::string());
+
+    /**
+     * Run all of the phases and wait for them to finish. Returns false if
+     * any phase failed or was skipped.
+     */
+    bool run();
+
+private:
+    class StartupPipelineImpl;
+    boost::shared_ptr<StartupPipelineImpl> m_impl;
+};
+
+}
+
+#endif
@@ -0,0 +1,937 @@
+/* 
+ * File:   benchmark.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+/**
+ * shoddybattle2-bench times the hot functions of the battle engine. Every
+ * benchmark is run on the same fixed teams of species from species.xml with
+ * a fixed seed, in singles, in doubles and in a "wide" battle in which every
+ * pokemon on both teams is active at once.
+ *
+ * For each function the time and the number of heap allocations (calls to
+ * operator new; the JavaScript engine's own allocations are not counted)
+ * per call are printed, and --csv writes the same results in a form that
+ * can be compared between builds to catch regressions.
+ *
+ * The glicko2 rating update is also timed on a random rating period, once
+ * one player at a time and once as a batch, and the program fails if the
+ * two disagree.
+ *
+ * Given --mysql.name or --sqlite.file, the database calls made when a user
+ * logs in, and by bans and ladder updates, are timed too, once with the
+ * statements reused by each connection and once with them parsed on every
+ * call. These also report processor time, because most of their elapsed
+ * time is spent waiting on the database. An SQLite file needs no server, so
+ * it gives results that can be reproduced anywhere. A new database is first
+ * given --ladder-matches ladder matches, so that the ladder calls are timed
+ * on a table of realistic size.
+ */
+
+#include <new>
+#include <cstdlib>
+#include <cmath>
+#include <ctime>
+#include <vector>
+#include <set>
+#include <string>
+#include <fstream>
+#include <boost/program_options.hpp>
+#include <boost/function.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/random.hpp>
+#include "../shoddybattle/BattleField.h"
+#include "../shoddybattle/SimulatedBattle.h"
+#include "../shoddybattle/PokemonSpecies.h"
+#include "../shoddybattle/ObjectTeamFile.h"
+#include "../shoddybattle/Team.h"
+#include "../moves/PokemonMove.h"
+#include "../scripting/ScriptMachine.h"
+#include "../mechanics/JewelMechanics.h"
+#include "../matchmaking/MetagameList.h"
+#include "../matchmaking/glicko2.h"
+#include "../database/DatabaseRegistry.h"
+#include "../database/Storage.h"
+#include "../database/SqliteStorage.h"
+#include "Log.h"
+
+using namespace std;
+using namespace shoddybattle;
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+namespace {
+
+/**
+ * The number of calls to operator new so far.
+ */
+volatile long g_allocations = 0;
+
+}
+
+void *operator new(size_t size) throw(std::bad_alloc) {
+    __sync_fetch_and_add(&g_allocations, 1);
+    void *p = malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) throw() {
+    free(p);
+}
+
+namespace {
+
+const int TEAM_LENGTH = 6;
+
+const char *TEAM_SPECIES[TEAM_COUNT][TEAM_LENGTH] = {
+    { "Garchomp", "Metagross", "Tyranitar", "Gengar", "Starmie", "Heatran" },
+    { "Salamence", "Scizor", "Lucario", "Infernape", "Blissey", "Skarmory" }
+};
+
+struct Configuration {
+    const char *name;
+    int partySize;
+};
+
+const Configuration CONFIGURATIONS[] = {
+    { "singles", 1 },
+    { "doubles", 2 },
+    { "wide", TEAM_LENGTH }
+};
+
+const int CONFIGURATION_COUNT =
+        sizeof(CONFIGURATIONS) / sizeof(CONFIGURATIONS[0]);
+
+// The largest number of forks alive at once while timing processTurn.
+const int MAX_FORKS = 64;
+
+// The glicko2 system constant used by the ladders.
+const double GLICKO2_SYSTEM = 1.2;
+
+// The largest difference allowed between the scalar and batch glicko2 paths.
+const double GLICKO2_TOLERANCE = 1e-9;
+
+// The user that the login benchmarks register and log in as.
+const char *LOGIN_USER = "benchmark";
+const char *LOGIN_PASSWORD = "benchmark";
+const char *LOGIN_IP = "127.0.0.1";
+
+// The main channel, which is the first channel in a new database.
+const int LOGIN_CHANNEL = 1;
+
+// The ladder that the ladder benchmarks rate, and the other user in each of
+// its matches, who is also the one banned by the ban benchmarks.
+const char *LADDER = "benchmark";
+const char *LADDER_OPPONENT = "benchmark2";
+
+// The ladder matches are flushed to the database in batches of this size.
+const int LADDER_FLUSH_SIZE = 10000;
+
+/**
+ * Build a pokemon of the given species with neutral stats and the first
+ * four moves in its move list that use the plain damage formula, so that
+ * the benchmarks do not depend on any team file.
+ */
+POKEMON getBenchmarkPokemon(const PokemonSpecies *species) {
+    POKEMON p;
+    p.species = species->getSpeciesName();
+    p.speciesId = species->getSpeciesId();
+    p.level = 100;
+    p.nature = 0;   // Hardy
+    p.shiny = false;
+    const unsigned int genders = species->getPossibleGenders();
+    if (genders & G_MALE) {
+        p.gender = G_MALE;
+    } else if (genders & G_FEMALE) {
+        p.gender = G_FEMALE;
+    } else {
+        p.gender = G_NONE;
+    }
+    p.nickname = p.species;
+    const ABILITY_LIST &abilities = species->getAbilities();
+    if (!abilities.empty()) {
+        p.ability = abilities[0];
+    }
+    for (int i = 0; i < P_STAT_COUNT; ++i) {
+        p.iv[i] = 31;
+        p.ev[i] = 84;
+    }
+    int count = 0;
+    const MOVE_LIST &moves = species->getMoveList();
+    for (MOVE_LIST::const_iterator i = moves.begin();
+            (i != moves.end()) && (count < P_MOVE_COUNT); ++i) {
+        const MoveTemplate *move = i->second;
+        if (!move || (move->getMoveClass() == MC_OTHER)
+                || (move->getPower() == 0)
+                || (move->getTargetClass() != T_NONUSER)
+                || move->getUseFunction()) {
+            continue;
+        }
+        p.moves[count] = move->getName();
+        p.ppUp[count] = 3;
+        ++count;
+    }
+    for (; count < P_MOVE_COUNT; ++count) {
+        p.ppUp[count] = 0;
+    }
+    return p;
+}
+
+/**
+ * Measures the time and the allocations of the code between each call to
+ * start() and stop(), so that a benchmark can leave its setup out.
+ */
+class Stopwatch {
+public:
+    Stopwatch(): m_elapsed(0), m_cpu(0), m_allocations(0) { }
+    void start() {
+        m_allocations -= g_allocations;
+        m_cpu -= clock();
+        m_start = pt::microsec_clock::universal_time();
+    }
+    void stop() {
+        m_elapsed += (pt::microsec_clock::universal_time()
+                - m_start).total_microseconds();
+        m_cpu += clock();
+        m_allocations += g_allocations;
+    }
+    long getElapsed() const {
+        return m_elapsed;
+    }
+    double getCpu() const {
+        return m_cpu * 1000000.0 / CLOCKS_PER_SEC;
+    }
+    long getAllocations() const {
+        return m_allocations;
+    }
+private:
+    pt::ptime m_start;
+    long m_elapsed;     // microseconds
+    clock_t m_cpu;
+    long m_allocations;
+};
+
+/**
+ * A single battle set up with the benchmark teams, ready for its first turn.
+ */
+class Fixture {
+public:
+    Fixture(ScriptMachine &machine, Generation *generation,
+            const int partySize, const RANDOM_SEED seed):
+            m_mech(seed),
+            m_forkMech(RandomGenerator::deriveSeed(seed, 1)) {
+        const SpeciesDatabase *species = machine.getSpeciesDatabase();
+        Pokemon::ARRAY teams[TEAM_COUNT];
+        string trainer[TEAM_COUNT];
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            vector<POKEMON> data;
+            for (int j = 0; j < TEAM_LENGTH; ++j) {
+                const PokemonSpecies *p =
+                        species->getSpecies(TEAM_SPECIES[i][j]);
+                if (p) {
+                    data.push_back(getBenchmarkPokemon(p));
+                }
+            }
+            createTeam(data, *species, teams[i]);
+            trainer[i] = (i == 0) ? "Player 0" : "Player 1";
+        }
+        vector<StatusObject> clauses;
+        m_field.setNarrationEnabled(false);
+        m_field.initialise(&m_mech, generation, &machine, teams, trainer,
+                partySize, clauses);
+        m_field.beginBattle();
+        m_field.getActivePokemon(m_active);
+        getTurns(m_field, m_turns);
+        for (vector<PokemonTurn>::const_iterator i = m_turns.begin();
+                i != m_turns.end(); ++i) {
+            m_order.push_back(&*i);
+        }
+    }
+
+    ~Fixture() {
+        m_field.terminate();
+    }
+
+    /**
+     * Choose the first legal move for each active pokemon on a field.
+     */
+    static void getTurns(BattleField &field, vector<PokemonTurn> &turns) {
+        Pokemon::ARRAY active;
+        field.getActivePokemon(active);
+        for (Pokemon::ARRAY::const_iterator i = active.begin();
+                i != active.end(); ++i) {
+            Pokemon *p = i->get();
+            p->determineLegalActions();
+            PokemonTurn turn;
+            const int moves = p->getMoveCount();
+            for (int j = 0; j < moves; ++j) {
+                if (p->isMoveLegal(j)) {
+                    MoveObjectPtr move = p->getMove(j);
+                    turn = PokemonTurn(TT_MOVE, j,
+                            getDefaultTarget(field, p, move.get()));
+                    break;
+                }
+            }
+            turns.push_back(turn);
+        }
+    }
+
+    void benchmarkProcessTurn(const long count, Stopwatch &watch) {
+        for (long done = 0; done < count; ) {
+            const int size = min(count - done, long(MAX_FORKS));
+            vector<boost::shared_ptr<BattleField> > forks;
+            vector<vector<PokemonTurn> > turns(size);
+            for (int i = 0; i < size; ++i) {
+                forks.push_back(m_field.fork(&m_forkMech));
+                getTurns(*forks[i], turns[i]);
+            }
+            watch.start();
+            for (int i = 0; i < size; ++i) {
+                forks[i]->processTurn(turns[i]);
+            }
+            watch.stop();
+            for (int i = 0; i < size; ++i) {
+                forks[i]->terminate();
+            }
+            done += size;
+        }
+    }
+
+    void benchmarkTickEffects(const long count, Stopwatch &watch) {
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_field.tickEffects();
+        }
+        watch.stop();
+    }
+
+    void benchmarkCalculateDamage(const long count, Stopwatch &watch) {
+        Pokemon *user = m_active.front().get();
+        Pokemon *target = m_active.back().get();
+        MoveObjectPtr move = user->getMove(0);
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_mech.calculateDamage(m_field, *move, *user, *target, 1);
+        }
+        watch.stop();
+    }
+
+    void benchmarkGetStat(const long count, Stopwatch &watch) {
+        Pokemon *p = m_active.front().get();
+        unsigned int total = 0;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            total += p->getStat(S_SPEED);
+        }
+        watch.stop();
+        m_sink = total;
+    }
+
+    void benchmarkVetoExecution(const long count, Stopwatch &watch) {
+        Pokemon *user = m_active.front().get();
+        Pokemon *target = m_active.back().get();
+        MoveObjectPtr move = user->getMove(0);
+        int vetoes = 0;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            vetoes += m_field.vetoExecution(user, target, move.get());
+        }
+        watch.stop();
+        m_sink = vetoes;
+    }
+
+    void benchmarkSortInTurnOrder(const long count, Stopwatch &watch) {
+        Pokemon::ARRAY pokemon = m_active;
+        vector<const PokemonTurn *> order = m_order;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_field.sortInTurnOrder(pokemon, order);
+        }
+        watch.stop();
+    }
+
+    void benchmarkApplyStatus(const long count, Stopwatch &watch) {
+        Pokemon *p = m_active.front().get();
+        StatusObject item = m_field.getContext()->getItem("Leftovers");
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            StatusObjectPtr applied = p->applyStatus(NULL, &item);
+            if (applied) {
+                p->removeStatus(applied.get());
+            }
+            p->removeStatuses();
+        }
+        watch.stop();
+    }
+
+    void benchmarkDetermineVictory(const long count, Stopwatch &watch) {
+        int victories = 0;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            victories += m_field.determineVictory();
+        }
+        watch.stop();
+        m_sink = victories;
+    }
+
+    void benchmarkValidate(const long count, Stopwatch &watch) {
+        const Pokemon::ARRAY &team = m_field.getTeam(0);
+        ScriptContext *cx = m_field.getContext();
+        int violations = 0;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            for (Pokemon::ARRAY::const_iterator j = team.begin();
+                    j != team.end(); ++j) {
+                set<unsigned int> failed;
+                (*j)->validate(cx, failed);
+                violations += failed.size();
+            }
+        }
+        watch.stop();
+        m_sink = violations;
+    }
+
+    /**
+     * Fork the battle while the first active pokemon holds Leftovers, then
+     * tick the item in both battles. Returns false if the forked item is
+     * missing or heals its pokemon differently from the original.
+     */
+    bool checkForkedStatus(const RANDOM_SEED seed) {
+        ScriptContext *cx = m_field.getContext();
+        Pokemon *p = m_active.front().get();
+        StatusObject item = cx->getItem("Leftovers");
+        StatusObjectPtr applied = p->applyStatus(NULL, &item);
+        if (!applied) {
+            return false;
+        }
+        p->setHp(1);
+        JewelMechanics mech(RandomGenerator::deriveSeed(seed, 0));
+        boost::shared_ptr<BattleField> fork = m_field.fork(&mech);
+        ScriptContext *forkCx = fork->getContext();
+        Pokemon::ARRAY active;
+        fork->getActivePokemon(active);
+        Pokemon *q = active.front().get();
+        StatusObjectPtr forked = q->getStatus(applied->getId(cx));
+        bool same = forked
+                && (forked->getTier(forkCx) == applied->getTier(cx))
+                && (forked->getSubtier(forkCx) == applied->getSubtier(cx));
+        if (same) {
+            applied->tick(cx);
+            forked->tick(forkCx);
+            same = (p->getHp() > 1) && (q->getHp() == p->getHp());
+        }
+        fork->terminate();
+        return same;
+    }
+
+    /**
+     * Lay Spikes on the original battle and on a fork of it in turn.
+     * Returns false if the layers laid in the fork show up in the original,
+     * which means that the two battles share the hazards' script state.
+     */
+    bool checkForkedHazards(const RANDOM_SEED seed) {
+        ScriptContext *cx = m_field.getContext();
+        // Add a layer of Spikes on the other side and return its layers.
+        boost::shared_ptr<ScriptFunction> spikes = cx->compileFunction(
+                vector<string>(),
+                "var party = 1 - this.party;"
+                "var effect = getHazardController(this);"
+                "effect.applyHazard(this.field, EntryHazard.SPIKES, party);"
+                "return effect.effects_[party][EntryHazard.SPIKES];",
+                "benchmark", 1);
+        Pokemon *p = m_active.front().get();
+        const int first = cx->callFunction(p->getObject(), spikes.get(),
+                0, NULL).getInt();
+        JewelMechanics mech(RandomGenerator::deriveSeed(seed, 2));
+        boost::shared_ptr<BattleField> fork = m_field.fork(&mech);
+        ScriptContext *forkCx = fork->getContext();
+        Pokemon::ARRAY active;
+        fork->getActivePokemon(active);
+        Pokemon *q = active.front().get();
+        const int forked = forkCx->callFunction(q->getObject(),
+                spikes.get(), 0, NULL).getInt();
+        const int second = cx->callFunction(p->getObject(), spikes.get(),
+                0, NULL).getInt();
+        fork->terminate();
+        return (first == 1) && (forked == 2) && (second == 2);
+    }
+
+private:
+    JewelMechanics m_mech;
+    JewelMechanics m_forkMech;  // shared by the forks, which run in turn
+    BattleField m_field;
+    Pokemon::ARRAY m_active;
+    vector<PokemonTurn> m_turns;
+    vector<const PokemonTurn *> m_order;
+    volatile unsigned int m_sink;
+};
+
+typedef void (Fixture::*BENCHMARK)(const long, Stopwatch &);
+
+struct BenchmarkEntry {
+    const char *name;
+    BENCHMARK function;
+};
+
+const BenchmarkEntry BENCHMARKS[] = {
+    { "BattleField::processTurn", &Fixture::benchmarkProcessTurn },
+    { "BattleField::tickEffects", &Fixture::benchmarkTickEffects },
+    { "JewelMechanics::calculateDamage",
+            &Fixture::benchmarkCalculateDamage },
+    { "Pokemon::getStat", &Fixture::benchmarkGetStat },
+    { "BattleField::vetoExecution", &Fixture::benchmarkVetoExecution },
+    { "BattleField::sortInTurnOrder", &Fixture::benchmarkSortInTurnOrder },
+    { "Pokemon::applyStatus", &Fixture::benchmarkApplyStatus },
+    { "BattleField::determineVictory",
+            &Fixture::benchmarkDetermineVictory },
+    { "Pokemon::validate (team)", &Fixture::benchmarkValidate }
+};
+
+const int BENCHMARK_COUNT = sizeof(BENCHMARKS) / sizeof(BENCHMARKS[0]);
+
+/**
+ * The database calls made while a user logs in and joins the main channel,
+ * in the order that the server makes them, followed by those made to ban a
+ * user and to rate a ladder player.
+ */
+class DatabaseFixture {
+public:
+    DatabaseFixture(database::DatabaseRegistry &registry,
+            const int ladderMatches):
+            m_registry(registry), m_sink(0) {
+        if (!m_registry.userExists(LOGIN_USER)) {
+            m_registry.registerUser(LOGIN_USER, LOGIN_PASSWORD, LOGIN_IP);
+        }
+        const bool newOpponent = !m_registry.userExists(LADDER_OPPONENT);
+        if (newOpponent) {
+            m_registry.registerUser(LADDER_OPPONENT, LOGIN_PASSWORD,
+                    LOGIN_IP);
+        }
+        database::Storage &storage = *m_registry.getStorage();
+        m_user = storage.getUserId(LOGIN_USER);
+        const int opponent = storage.getUserId(LADDER_OPPONENT);
+        m_registry.initialiseLadder(LADDER);
+        m_registry.joinLadder(LADDER, m_user);
+        m_registry.joinLadder(LADDER, opponent);
+        if (newOpponent) {
+            for (int i = 0; i < ladderMatches; ++i) {
+                m_registry.postLadderMatch(LADDER, m_user, opponent, i % 2);
+                if ((i + 1) % LADDER_FLUSH_SIZE == 0) {
+                    m_registry.flush();
+                }
+            }
+            m_registry.flush();
+        }
+    }
+
+    void benchmarkGetAuthChallenge(const long count, Stopwatch &watch) {
+        unsigned char challenge[16];
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.getAuthChallenge(LOGIN_USER, LOGIN_IP, challenge);
+        }
+        watch.stop();
+    }
+
+    void benchmarkIsResponseValid(const long count, Stopwatch &watch) {
+        // A wrong response still reads the secret, which is the usual cost.
+        const unsigned char response[16] = { 0 };
+        string name = LOGIN_USER;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.isResponseValid(name, LOGIN_IP, 0, response);
+        }
+        watch.stop();
+    }
+
+    void benchmarkUpdateIp(const long count, Stopwatch &watch) {
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.updateIp(LOGIN_USER, LOGIN_IP);
+        }
+        watch.stop();
+    }
+
+    void benchmarkLoadPersonalMessage(const long count, Stopwatch &watch) {
+        string message;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.loadPersonalMessage(LOGIN_USER, message);
+        }
+        watch.stop();
+    }
+
+    void benchmarkGetUserFlags(const long count, Stopwatch &watch) {
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_sink += m_registry.getUserFlags(LOGIN_CHANNEL, LOGIN_USER);
+        }
+        watch.stop();
+    }
+
+    // Each op sets a ban and removes it again.
+    void benchmarkSetBan(const long count, Stopwatch &watch) {
+        const long expiry = time(NULL) + 3600;
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.setBan(LOGIN_CHANNEL, LADDER_OPPONENT, m_user, expiry,
+                    false);
+            m_registry.removeBan(LOGIN_CHANNEL, LADDER_OPPONENT);
+        }
+        watch.stop();
+    }
+
+    void benchmarkUpdatePlayerStats(const long count, Stopwatch &watch) {
+        watch.start();
+        for (long i = 0; i < count; ++i) {
+            m_registry.updatePlayerStats(LADDER, m_user);
+        }
+        watch.stop();
+    }
+
+private:
+    database::DatabaseRegistry &m_registry;
+    int m_user;
+    volatile int m_sink;
+};
+
+typedef void (DatabaseFixture::*DATABASE_BENCHMARK)(const long, Stopwatch &);
+
+struct DatabaseBenchmarkEntry {
+    const char *name;
+    DATABASE_BENCHMARK function;
+};
+
+const DatabaseBenchmarkEntry DATABASE_BENCHMARKS[] = {
+    { "DatabaseRegistry::getAuthChallenge",
+            &DatabaseFixture::benchmarkGetAuthChallenge },
+    { "DatabaseRegistry::isResponseValid",
+            &DatabaseFixture::benchmarkIsResponseValid },
+    { "DatabaseRegistry::updateIp", &DatabaseFixture::benchmarkUpdateIp },
+    { "DatabaseRegistry::loadPersonalMessage",
+            &DatabaseFixture::benchmarkLoadPersonalMessage },
+    { "DatabaseRegistry::getUserFlags",
+            &DatabaseFixture::benchmarkGetUserFlags },
+    { "DatabaseRegistry::setBan", &DatabaseFixture::benchmarkSetBan },
+    { "DatabaseRegistry::updatePlayerStats",
+            &DatabaseFixture::benchmarkUpdatePlayerStats }
+};
+
+const int DATABASE_BENCHMARK_COUNT =
+        sizeof(DATABASE_BENCHMARKS) / sizeof(DATABASE_BENCHMARKS[0]);
+
+struct BenchmarkResult {
+    string name;
+    string configuration;
+    long iterations;
+    double nanoseconds;     // per call
+    double cpu;             // nanoseconds of processor time per call
+    double allocations;     // per call
+};
+
+void logResult(const BenchmarkResult &result) {
+    Log::out() << result.configuration << "\t" << result.name
+            << ": " << result.nanoseconds << " ns/op ("
+            << result.cpu << " ns cpu), "
+            << result.allocations << " allocations/op" << endl;
+}
+
+BenchmarkResult getResult(const char *name, const string &configuration,
+        const long count, const Stopwatch &watch) {
+    BenchmarkResult result;
+    result.name = name;
+    result.configuration = configuration;
+    result.iterations = count;
+    result.nanoseconds = watch.getElapsed() * 1000.0 / count;
+    result.cpu = watch.getCpu() * 1000.0 / count;
+    result.allocations = (double)watch.getAllocations() / count;
+    return result;
+}
+
+/**
+ * Run a benchmark with an increasing number of iterations until it takes at
+ * least the given number of milliseconds.
+ */
+BenchmarkResult runBenchmark(const char *name, const string &configuration,
+        const boost::function<void (const long, Stopwatch &)> &function,
+        const int minTime) {
+    long count = 1;
+    Stopwatch watch;
+    while (true) {
+        watch = Stopwatch();
+        function(count, watch);
+        if ((watch.getElapsed() >= minTime * 1000L) || (count >= (1L << 30)))
+            break;
+        count *= 2;
+    }
+    return getResult(name, configuration, count, watch);
+}
+
+/**
+ * Time each database call with and without statement reuse.
+ */
+void benchmarkDatabase(database::DatabaseRegistry &registry,
+        const string &backend, const string &filter, const int minTime,
+        const int ladderMatches, vector<BenchmarkResult> &results) {
+    DatabaseFixture fixture(registry, ladderMatches);
+    for (int i = 0; i < 2; ++i) {
+        const bool cache = (i == 0);
+        const string configuration = backend + (cache ?
+                ", reused statements" : ", parsed statements");
+        registry.setStatementCache(cache);
+        for (int j = 0; j < DATABASE_BENCHMARK_COUNT; ++j) {
+            const DatabaseBenchmarkEntry &entry = DATABASE_BENCHMARKS[j];
+            if (!filter.empty()
+                    && (string(entry.name).find(filter) == string::npos))
+                continue;
+            results.push_back(runBenchmark(entry.name, configuration,
+                    boost::bind(entry.function, &fixture, _1, _2), minTime));
+            logResult(results.back());
+        }
+    }
+    registry.setStatementCache(true);
+}
+
+/**
+ * Time glicko2::updatePlayer on every player of a random rating period,
+ * then glicko2::updateBatch on the same players, and check that both give
+ * the same ratings. Each op is one player. Returns false if they differ.
+ */
+bool benchmarkGlicko2(const int count, const RANDOM_SEED seed,
+        vector<BenchmarkResult> &results) {
+    boost::mt19937 engine(static_cast<boost::uint32_t>(seed));
+    boost::variate_generator<boost::mt19937 &, boost::uniform_real<> >
+            random(engine, boost::uniform_real<>(0.0, 1.0));
+    vector<glicko2::PLAYER> players(count);
+    vector<vector<glicko2::MATCH> > matches(count);
+    for (int i = 0; i < count; ++i) {
+        const glicko2::PLAYER player = { 1000.0 + 1000.0 * random(),
+                30.0 + 320.0 * random(), 0.03 + 0.07 * random() };
+        players[i] = player;
+        const int length = int(random() * 20.0);
+        for (int j = 0; j < length; ++j) {
+            const glicko2::MATCH match = { int(random() * 3.0) - 1,
+                    1000.0 + 1000.0 * random(), 30.0 + 320.0 * random() };
+            matches[i].push_back(match);
+        }
+    }
+    const string configuration = "rating period";
+
+    vector<glicko2::PLAYER> scalar = players;
+    Stopwatch watch;
+    watch.start();
+    for (int i = 0; i < count; ++i) {
+        glicko2::updatePlayer(scalar[i], matches[i], GLICKO2_SYSTEM);
+    }
+    watch.stop();
+    results.push_back(getResult("glicko2::updatePlayer", configuration,
+            count, watch));
+    logResult(results.back());
+
+    glicko2::PLAYER_BATCH batch;
+    for (int i = 0; i < count; ++i) {
+        batch.addPlayer(players[i], matches[i]);
+    }
+    watch = Stopwatch();
+    watch.start();
+    glicko2::updateBatch(batch, GLICKO2_SYSTEM);
+    watch.stop();
+    results.push_back(getResult("glicko2::updateBatch", configuration,
+            count, watch));
+    logResult(results.back());
+
+    double error = 0.0;
+    for (int i = 0; i < count; ++i) {
+        const glicko2::PLAYER p = batch.getPlayer(i);
+        const glicko2::PLAYER &q = scalar[i];
+        error = max(error, fabs(p.rating - q.rating) / q.rating);
+        error = max(error, fabs(p.deviation - q.deviation) / q.deviation);
+        error = max(error, fabs(p.volatility - q.volatility) / q.volatility);
+    }
+    Log::out() << "Largest relative difference between glicko2 paths: "
+            << error << endl;
+    return (error <= GLICKO2_TOLERANCE);
+}
+
+int benchmark(int argc, char **argv) {
+    RANDOM_SEED seed;
+    int minTime, generationIdx, glicko2Players, ladderMatches, databasePort;
+    string csv, filter;
+    string databaseName, databaseHost, databaseUser, databasePassword;
+    string databaseFile;
+
+    po::options_description desc("Options");
+    desc.add_options()
+            ("help", "show this help message")
+            ("seed", po::value<RANDOM_SEED>(&seed)->default_value(1),
+                "random seed for every battle")
+            ("min-time", po::value<int>(&minTime)->default_value(500),
+                "minimum milliseconds to run each benchmark")
+            ("generation",
+                po::value<int>(&generationIdx)->default_value(0),
+                "index of the generation in metagames.xml")
+            ("glicko2-players",
+                po::value<int>(&glicko2Players)->default_value(1000000),
+                "number of players in the glicko2 rating period")
+            ("ladder-matches",
+                po::value<int>(&ladderMatches)->default_value(100000),
+                "number of ladder matches in a new benchmark database")
+            ("mysql.name", po::value<string>(&databaseName),
+                "database to time the login calls on, which must be safe to "
+                "write to")
+            ("mysql.host",
+                po::value<string>(&databaseHost)->default_value(
+                    "localhost"),
+                "database host")
+            ("mysql.port",
+                po::value<int>(&databasePort)->default_value(3306),
+                "database port")
+            ("mysql.user",
+                po::value<string>(&databaseUser)->default_value("root"),
+                "database user")
+            ("mysql.password",
+                po::value<string>(&databasePassword)->default_value(""),
+                "database password")
+            ("sqlite.file", po::value<string>(&databaseFile),
+                "SQLite file to time the database calls on instead, which "
+                "is created if it does not exist")
+            ("filter", po::value<string>(&filter),
+                "run only benchmarks whose name contains this string")
+            ("csv", po::value<string>(&csv),
+                "also write the results to this file as CSV")
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (po::error &e) {
+        Log::out() << "Error reading command line: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        Log::out() << "Usage: shoddybattle2-bench [options]" << endl
+                << desc << endl;
+        return EXIT_SUCCESS;
+    }
+
+    vector<GenerationPtr> generations;
+    Generation::readGenerations("resources/metagames.xml", generations);
+    const int generationCount = generations.size();
+    if ((generationIdx < 0) || (generationIdx >= generationCount)) {
+        Log::out() << "Error: No generation " << generationIdx << "." << endl;
+        return EXIT_FAILURE;
+    }
+
+    ScriptMachine machine;
+    machine.acquireContext()->runFile("resources/main.js");
+    machine.finalise();
+
+    GenerationPtr generation = generations[generationIdx];
+    generation->initialiseMetagames(machine.getSpeciesDatabase());
+
+    {
+        Fixture fixture(machine, generation.get(),
+                CONFIGURATIONS[0].partySize, seed);
+        if (!fixture.checkForkedStatus(seed)) {
+            Log::out() << "Error: A forked status effect does not behave "
+                    "like the original." << endl;
+            return EXIT_FAILURE;
+        }
+        if (!fixture.checkForkedHazards(seed)) {
+            Log::out() << "Error: Entry hazards laid in a forked battle "
+                    "changed the original." << endl;
+            return EXIT_FAILURE;
+        }
+    }
+
+    vector<BenchmarkResult> results;
+    for (int i = 0; i < CONFIGURATION_COUNT; ++i) {
+        const Configuration &config = CONFIGURATIONS[i];
+        for (int j = 0; j < BENCHMARK_COUNT; ++j) {
+            const BenchmarkEntry &entry = BENCHMARKS[j];
+            if (!filter.empty()
+                    && (string(entry.name).find(filter) == string::npos))
+                continue;
+            // Every benchmark starts from a freshly initialised battle.
+            Fixture fixture(machine, generation.get(), config.partySize,
+                    seed);
+            const BenchmarkResult result = runBenchmark(entry.name,
+                    config.name,
+                    boost::bind(entry.function, &fixture, _1, _2), minTime);
+            logResult(result);
+            results.push_back(result);
+        }
+        machine.acquireContext()->gc();
+    }
+
+    bool agreed = true;
+    if (filter.empty() || (string("glicko2::updatePlayer").find(filter)
+            != string::npos) || (string("glicko2::updateBatch").find(filter)
+            != string::npos)) {
+        agreed = benchmarkGlicko2(glicko2Players, seed, results);
+        if (!agreed) {
+            Log::out() << "Error: glicko2::updateBatch does not match "
+                    "glicko2::updatePlayer." << endl;
+        }
+    }
+
+    if (!databaseFile.empty()) {
+        database::DatabaseRegistry registry;
+        registry.setStorage(boost::shared_ptr<database::Storage>(
+                new database::SqliteStorage(databaseFile)));
+        registry.createDefaultDatabase();
+        benchmarkDatabase(registry, "sqlite", filter, minTime,
+                ladderMatches, results);
+    } else if (!databaseName.empty()) {
+        database::DatabaseRegistry registry;
+        registry.connect(databaseName, databaseHost, databaseUser,
+                databasePassword, databasePort);
+        registry.createDefaultDatabase();
+        benchmarkDatabase(registry, "mysql", filter, minTime,
+                ladderMatches, results);
+    }
+
+    if (!csv.empty()) {
+        ofstream file(csv.c_str());
+        if (!file) {
+            Log::out() << "Error: Could not write " << csv << "." << endl;
+            return EXIT_FAILURE;
+        }
+        file << "benchmark,configuration,seed,iterations,"
+                "ns_per_op,cpu_ns_per_op,allocations_per_op" << endl;
+        for (vector<BenchmarkResult>::const_iterator i = results.begin();
+                i != results.end(); ++i) {
+            file << i->name << "," << i->configuration << "," << seed << ","
+                    << i->iterations << "," << i->nanoseconds << ","
+                    << i->cpu << "," << i->allocations << endl;
+        }
+    }
+    return agreed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+}
+
+int main(int argc, char **argv) {
+    return benchmark(argc, argv);
+}
@@ -31,14 +31,20 @@
 #include <boost/shared_array.hpp>
 #include <boost/thread.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 #include <libdaemon/daemon.h>
+#include <xercesc/util/PlatformUtils.hpp>
 #include "../shoddybattle/PokemonSpecies.h"
 #include "../scripting/ScriptMachine.h"
 #include "../database/DatabaseRegistry.h"
 #include "../database/Authenticator.h"
+#include "../database/SqliteStorage.h"
 #include "../network/NetworkBattle.h"
+#include "../mechanics/RandomGenerator.h"
 #include "Log.h"
 #include "LogFile.h"
+#include "StartupPipeline.h"
 
 using namespace std;
 using namespace shoddybattle;
@@ -53,12 +59,53 @@ const char *getPidFileName() {
     return pidFile.c_str();
 }
 
+/**
+ * Run a startup phase that uses the database from its own thread.
+ */
+void runDatabasePhase(StartupPipeline::PHASE phase) {
+    database::DatabaseRegistry::startThread();
+    phase();
+}
+
+/**
+ * Connect to the database and create any missing tables, which also opens
+ * the first pooled connection. An SQLite file is used instead of the MySQL
+ * server if one is given.
+ */
+void initialiseDatabase(database::DatabaseRegistry *registry,
+        const string file, const string name, const string host,
+        const string user, const string password, const int port) {
+    if (file.empty()) {
+        registry->connect(name, host, user, password, port);
+    } else {
+        registry->setStorage(boost::shared_ptr<database::Storage>(
+                new database::SqliteStorage(file)));
+    }
+    registry->createDefaultDatabase();
+    registry->loadBans();
+}
+
+void initialiseChannels(network::Server *server, const string name,
+        const string welcome) {
+    server->initialiseWelcomeMessage(name, welcome);
+    server->initialiseChannels();
+}
+
+void initialiseMatchmaking(network::Server *server) {
+    server->initialiseMetagames();
+    server->initialiseMatchmaking();
+}
+
 int initialise(int argc, char **argv, bool &daemon) {
     string configFile;
-    int port, databasePort, workerThreads, serverUid, userLimit;
+    int port, databasePort, workerThreads, serverUid, userLimit, ratingPeriod;
+    int aiThreads, aiBudget, aiDepth;
     string serverName, welcomeFile, welcomeMessage;
+    string aiName, aiTeam;
     string databaseName, databaseHost, databaseUser, databasePassword;
+    string databaseFile;
     string authParameter, loginParameter, registerParameter;
+    RANDOM_SEED masterSeed;
 
     po::options_description generic("Options");
     generic.add_options()
@@ -91,6 +138,9 @@ int initialise(int argc, char **argv, bool &daemon) {
             ("server.uid",
                 po::value<int>(&serverUid),
                 "UID to run the server process as")
+            ("server.seed",
+                po::value<RANDOM_SEED>(&masterSeed),
+                "master seed from which each battle's random seed is derived")
             ("auth.salt",
                 "use simple salt authentication")
             ("auth.vbulletin",
@@ -123,6 +173,33 @@ int initialise(int argc, char **argv, bool &daemon) {
                 po::value<string>(&databasePassword)->default_value(
                     ""),
                 "MySQL password")
+            ("sqlite.file",
+                po::value<string>(&databaseFile),
+                "SQLite database file, used instead of MySQL if given")
+            ("ladder.period",
+                po::value<int>(&ratingPeriod)->default_value(
+                     60),
+                "minutes between ladder rating periods, or 0 for none")
+            ("ai.team",
+                po::value<string>(&aiTeam),
+                "Shoddy Battle 1 team file for the server's own AI player, "
+                "which is only enabled if this is given")
+            ("ai.name",
+                po::value<string>(&aiName)->default_value(
+                     "Shoddy AI"),
+                "user name of the AI player")
+            ("ai.threads",
+                po::value<int>(&aiThreads)->default_value(
+                     boost::thread::hardware_concurrency()),
+                "number of threads running the AI player's rollouts")
+            ("ai.budget",
+                po::value<int>(&aiBudget)->default_value(
+                     1000),
+                "milliseconds the AI player spends on each move")
+            ("ai.depth",
+                po::value<int>(&aiDepth)->default_value(
+                     20),
+                "maximum number of turns in each of the AI player's rollouts")
     ;
 
     po::options_description hidden("Hidden options");
@@ -202,6 +279,13 @@ int initialise(int argc, char **argv, bool &daemon) {
         Log::out.setMode(Log::MODE_BOTH);
     }
 
+    // The vBulletin tables are read through the MySQL connection.
+    if (vm.count("auth.vbulletin") && !databaseFile.empty()) {
+        Log::out() << "Error: vBulletin authentication cannot be used with "
+                "an SQLite file." << endl;
+        return EXIT_FAILURE;
+    }
+
     const bool serverDetach = vm.count("server.detach");
     const bool serverKill = vm.count("server.kill");
 
@@ -282,19 +366,18 @@ int initialise(int argc, char **argv, bool &daemon) {
         }
     }
 
+    const boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
     network::Server server(port, userLimit);
     server.installSignalHandlers();
-    server.readMetagames("resources/metagames.xml");
-
-    ScriptMachine *machine = server.getMachine();
-    machine->acquireContext()->runFile("resources/main.js");
-    machine->finalise();
+    if (vm.count("server.seed")) {
+        server.setMasterSeed(masterSeed);
+    }
+    server.setRatingPeriod(ratingPeriod);
+    Log::out() << "Master random seed: " << server.getMasterSeed() << endl;
 
     database::DatabaseRegistry *registry = server.getRegistry();
-    registry->connect(databaseName, databaseHost,
-            databaseUser, databasePassword, databasePort);
-    registry->startThread();
-
     if (vm.count("auth.salt")) {
         registry->setAuthenticator(boost::shared_ptr<database::Authenticator>(
                 new database::SaltAuthenticator()));
@@ -306,14 +389,50 @@ int initialise(int argc, char **argv, bool &daemon) {
                         registerParameter, authParameter)));
     }
 
-    registry->createDefaultDatabase();
-    
-    server.initialiseWelcomeMessage(serverName, welcomeMessage);
-    server.initialiseChannels();
-    server.initialiseMetagames();
-    server.initialiseMatchmaking();
-    server.initialiseClauses();
+    // Xerces has to be initialised before more than one thread uses it.
+    xercesc::XMLPlatformUtils::Initialize();
 
+    typedef StartupPipeline::PHASE PHASE;
+    ScriptMachine *machine = server.getMachine();
+    StartupPipeline startup;
+    startup.addPhase("species", boost::bind(&ScriptMachine::prefetchSpecies,
+            machine, "resources/species.xml"));
+    startup.addPhase("moves", boost::bind(&ScriptMachine::prefetchMoves,
+            machine, "resources/moves.xml"));
+    startup.addPhase("text", boost::bind(&ScriptMachine::prefetchText,
+            machine, "languages/english.lang"));
+    startup.addPhase("metagames", boost::bind(&network::Server::readMetagames,
+            &server, "resources/metagames.xml"));
+    startup.addPhase("database", boost::bind(runDatabasePhase,
+            PHASE(boost::bind(initialiseDatabase, registry, databaseFile,
+                databaseName, databaseHost, databaseUser, databasePassword,
+                databasePort))));
+    // The main script builds the species, moves and text that were
+    // prefetched by the earlier phases.
+    startup.addPhase("scripts", boost::bind(&network::Server::runScripts,
+            &server, "resources/main.js"),
+            "species, moves, text");
+    startup.addPhase("channels", boost::bind(runDatabasePhase,
+            PHASE(boost::bind(initialiseChannels, &server, serverName,
+                welcomeMessage))),
+            "database");
+    startup.addPhase("clauses", boost::bind(
+            &network::Server::initialiseClauses, &server),
+            "scripts");
+    startup.addPhase("matchmaking", boost::bind(runDatabasePhase,
+            PHASE(boost::bind(initialiseMatchmaking, &server))),
+            "scripts, metagames, database, clauses");
+    if (vm.count("ai.team")) {
+        startup.addPhase("ai", boost::bind(runDatabasePhase,
+                PHASE(boost::bind(&network::Server::initialiseAi, &server,
+                    aiName, aiTeam, aiThreads, aiBudget, aiDepth))),
+                "database");
+    }
+    if (!startup.run()) {
+        return EXIT_FAILURE;
+    }
+
+    registry->startThread();
     network::NetworkBattle::startTimerThread();
 
     vector<boost::shared_ptr<boost::thread> > threads;
@@ -322,6 +441,12 @@ int initialise(int argc, char **argv, bool &daemon) {
                 boost::bind(&network::Server::run, &server))));
     }
 
+    const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+    Log::out() << "Accepting connections on port " << port << ", "
+            << elapsed.total_milliseconds() << " ms after startup began."
+            << endl;
+
     if (daemon) {
         daemon_retval_send(0); // started up successfully
     }
@@ -0,0 +1,213 @@
+/* 
+ * File:   packer.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+/**
+ * shoddybattle2-pack compiles the game data XML files into the game data
+ * pack ahead of time, so that the first start of the server after the XML
+ * changes does not have to parse it. The server recompiles any stale part of
+ * the pack by itself, so running this tool is optional.
+ *
+ * For each file, the time taken to parse the XML and the time taken to read
+ * the same data back from the pack are printed.
+ *
+ * With --compare-dom, nothing is written; instead the species and moves
+ * files are parsed with both the streaming parser and the DOM parser it
+ * replaced, and the time and peak memory of each are printed. The program
+ * fails if the two parsers produce different records.
+ */
+
+#include <vector>
+#include <string>
+#include <sys/resource.h>
+#include <boost/program_options.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "../shoddybattle/GamePack.h"
+#include "Log.h"
+
+using namespace std;
+using namespace shoddybattle;
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+namespace {
+
+/**
+ * Compile one source file into the pack, then read it back.
+ */
+template <class T>
+bool compile(const string &file, bool (*parse)(const string, vector<T> &)) {
+    vector<T> records;
+    pt::ptime start = pt::microsec_clock::universal_time();
+    const bool ok = parse(file, records);
+    const pt::time_duration parsed =
+            pt::microsec_clock::universal_time() - start;
+    if (!ok || records.empty()) {
+        Log::out() << "Error: Could not read " << file << "." << endl;
+        return false;
+    }
+    if (!GamePack::write(file, records)) {
+        return false;
+    }
+
+    vector<T> packed;
+    start = pt::microsec_clock::universal_time();
+    const bool read = GamePack::read(file, packed);
+    const pt::time_duration loaded =
+            pt::microsec_clock::universal_time() - start;
+    if (!read || (packed.size() != records.size())) {
+        Log::out() << "Error: Could not read " << file
+                << " back from the pack." << endl;
+        return false;
+    }
+    Log::out() << file << ": " << records.size() << " records, "
+            << parsed.total_milliseconds() << " ms from XML, "
+            << loaded.total_milliseconds() << " ms from the pack." << endl;
+    return true;
+}
+
+/**
+ * Get the peak resident set size of this process so far, in kilobytes.
+ */
+long getPeakMemory() {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+/**
+ * Parse a file with one parser, printing the time taken and how far the peak
+ * memory of the process rose. The peak only ever rises, so the parser
+ * expected to use less memory has to run first. Returns false if the file
+ * could not be parsed.
+ */
+template <class T>
+bool measure(const string &file, const char *label,
+        bool (*parse)(const string, vector<T> &), vector<T> &records) {
+    const long memory = getPeakMemory();
+    const pt::ptime start = pt::microsec_clock::universal_time();
+    const bool ok = parse(file, records);
+    const pt::time_duration elapsed =
+            pt::microsec_clock::universal_time() - start;
+    Log::out() << file << ": " << label << ": " << records.size()
+            << " records in " << elapsed.total_milliseconds() << " ms, "
+            << "peak memory +" << (getPeakMemory() - memory) << " kB."
+            << endl;
+    return ok;
+}
+
+/**
+ * Parse a file with the streaming parser and then with the DOM parser, and
+ * check that every field of every record agrees.
+ */
+template <class T>
+bool compare(const string &file, bool (*stream)(const string, vector<T> &),
+        bool (*document)(const string, vector<T> &)) {
+    vector<T> streamed, parsed;
+    if (!measure(file, "stream", stream, streamed)
+            || !measure(file, "DOM", document, parsed)) {
+        return false;
+    }
+    if (streamed.size() != parsed.size()) {
+        Log::out() << "Error: The parsers disagree about the number of "
+                << "records in " << file << "." << endl;
+        return false;
+    }
+    const int size = streamed.size();
+    for (int i = 0; i < size; ++i) {
+        if (GamePack::getEncoding(streamed[i])
+                != GamePack::getEncoding(parsed[i])) {
+            Log::out() << "Error: The parsers disagree about record " << i
+                    << " of " << file << "." << endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Adapt Generation::parseGenerations to the signature of the other parsers.
+ */
+bool parseGenerations(const string file, vector<GENERATION_DATA> &data) {
+    Generation::parseGenerations(file, data);
+    return !data.empty();
+}
+
+int pack(int argc, char **argv) {
+    string path, species, moves, metagames;
+
+    po::options_description desc("Options");
+    desc.add_options()
+            ("help", "show this help message")
+            ("pack", po::value<string>(&path)->default_value(
+                    GamePack::getPath()),
+                "game data pack to write")
+            ("species", po::value<string>(&species)->default_value(
+                    "resources/species.xml"),
+                "species XML file")
+            ("moves", po::value<string>(&moves)->default_value(
+                    "resources/moves.xml"),
+                "moves XML file")
+            ("metagames", po::value<string>(&metagames)->default_value(
+                    "resources/metagames.xml"),
+                "metagames XML file")
+            ("compare-dom", "compare the streaming parser with the DOM "
+                "parser instead of writing the pack")
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (po::error &e) {
+        Log::out() << "Error reading command line: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    po::notify(vm);
+
+    if (vm.count("help")) {
+        Log::out() << "Usage: shoddybattle2-pack [options]" << endl
+                << desc << endl;
+        return EXIT_SUCCESS;
+    }
+
+    if (vm.count("compare-dom")) {
+        const bool ok = compare(species, &PokemonSpecies::parseSpecies,
+                    &PokemonSpecies::parseSpeciesDocument)
+                && compare(moves, &MoveDatabase::parseMoves,
+                    &MoveDatabase::parseMovesDocument);
+        return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    GamePack::setPath(path);
+    const bool ok = compile(species, &PokemonSpecies::parseSpecies)
+            && compile(moves, &MoveDatabase::parseMoves)
+            && compile(metagames, &parseGenerations);
+    if (!ok) {
+        return EXIT_FAILURE;
+    }
+    Log::out() << "Wrote " << path << "." << endl;
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char **argv) {
+    return pack(argc, argv);
+}
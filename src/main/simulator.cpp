@@ -0,0 +1,520 @@
+/* 
+ * File:   simulator.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+/**
+ * shoddybattle2-sim runs large numbers of battles between two teams without
+ * any network clients, for balancing metagames and for measuring the
+ * performance of the battle engine. Battles are spread over a number of
+ * worker threads; since a battle always runs to completion in the thread
+ * that created it, each worker ends up holding exactly one ScriptContext
+ * from the ScriptMachine's pool.
+ *
+ * Every battle is seeded from the master seed and its index, so a run can be
+ * reproduced exactly by passing the same --seed.
+ *
+ * With --forks, a single battle is played for a few turns and then forked
+ * repeatedly instead, to measure the time and memory taken by each fork.
+ *
+ * The montecarlo policy searches on a RolloutPool shared by all of the
+ * battles, whose throughput is reported at the end of the run.
+ */
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <unistd.h>
+#include <boost/program_options.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "../shoddybattle/SimulatedBattle.h"
+#include "../shoddybattle/MonteCarloPolicy.h"
+#include "../shoddybattle/RolloutPool.h"
+#include "../shoddybattle/PokemonSpecies.h"
+#include "../shoddybattle/ObjectTeamFile.h"
+#include "../shoddybattle/Team.h"
+#include "../scripting/ScriptMachine.h"
+#include "../mechanics/JewelMechanics.h"
+#include "../matchmaking/MetagameList.h"
+#include "Log.h"
+
+using namespace std;
+using namespace shoddybattle;
+namespace po = boost::program_options;
+namespace pt = boost::posix_time;
+
+namespace {
+
+enum POLICY_TYPE {
+    PT_RANDOM,
+    PT_GREEDY,
+    PT_MONTE_CARLO
+};
+
+struct SimulationOptions {
+    int battles;
+    int threads;
+    int maxTurns;
+    int partySize;
+    int forks;
+    int forkTurns;
+    int rolloutThreads;
+    MonteCarloOptions search;
+    RANDOM_SEED seed;
+    bool narrate;
+    POLICY_TYPE policy[TEAM_COUNT];
+    vector<POKEMON> teams[TEAM_COUNT];
+    string trainer[TEAM_COUNT];
+};
+
+struct SimulationStatistics {
+    int wins[TEAM_COUNT];
+    int draws;
+    int errors;
+    long long turns;
+    int minTurns;
+    int maxTurns;
+
+    SimulationStatistics():
+            draws(0),
+            errors(0),
+            turns(0),
+            minTurns(-1),
+            maxTurns(0) {
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            wins[i] = 0;
+        }
+    }
+
+    int getBattles() const {
+        int total = draws;
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            total += wins[i];
+        }
+        return total;
+    }
+
+    void addBattle(const int victor, const int turnCount) {
+        if (victor == -1) {
+            ++draws;
+        } else {
+            ++wins[victor];
+        }
+        turns += turnCount;
+        if ((minTurns == -1) || (turnCount < minTurns)) {
+            minTurns = turnCount;
+        }
+        if (turnCount > maxTurns) {
+            maxTurns = turnCount;
+        }
+    }
+
+    void add(const SimulationStatistics &s) {
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            wins[i] += s.wins[i];
+        }
+        draws += s.draws;
+        errors += s.errors;
+        turns += s.turns;
+        if ((minTurns == -1) ||
+                ((s.minTurns != -1) && (s.minTurns < minTurns))) {
+            minTurns = s.minTurns;
+        }
+        if (s.maxTurns > maxTurns) {
+            maxTurns = s.maxTurns;
+        }
+    }
+};
+
+BattlePolicyPtr newPolicy(const SimulationOptions &options,
+        RolloutPool *pool, const int party, const RANDOM_SEED seed) {
+    const POLICY_TYPE type = options.policy[party];
+    if (type == PT_GREEDY) {
+        return BattlePolicyPtr(new GreedyPolicy(seed));
+    } else if (type == PT_MONTE_CARLO) {
+        return BattlePolicyPtr(
+                new MonteCarloPolicy(pool, options.search, seed));
+    }
+    return BattlePolicyPtr(new RandomPolicy(seed));
+}
+
+bool getPolicyType(const string &name, POLICY_TYPE &type) {
+    if (name == "random") {
+        type = PT_RANDOM;
+    } else if (name == "greedy") {
+        type = PT_GREEDY;
+    } else if (name == "montecarlo") {
+        type = PT_MONTE_CARLO;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Get the resident set size of this process in bytes, or zero if it is not
+ * available.
+ */
+long getResidentMemory() {
+    ifstream file("/proc/self/statm");
+    long size = 0, resident = 0;
+    if (!(file >> size >> resident))
+        return 0;
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+class Simulator {
+public:
+    Simulator(ScriptMachine &machine,
+            Generation *generation,
+            const vector<StatusObject> &clauses,
+            const SimulationOptions &options,
+            RolloutPool *pool):
+                m_machine(machine),
+                m_generation(generation),
+                m_clauses(clauses),
+                m_options(options),
+                m_pool(pool),
+                m_next(0) { }
+
+    void run() {
+        vector<boost::shared_ptr<boost::thread> > threads;
+        for (int i = 0; i < m_options.threads; ++i) {
+            threads.push_back(boost::shared_ptr<boost::thread>(
+                    new boost::thread(boost::bind(
+                        &Simulator::runWorker, this))));
+        }
+        for_each(threads.begin(), threads.end(),
+                boost::bind(&boost::thread::join, _1));
+    }
+
+    const SimulationStatistics &getStatistics() const {
+        return m_statistics;
+    }
+
+    /**
+     * Play the first battle for a few turns, then fork it repeatedly,
+     * keeping every fork alive so that their memory can be measured.
+     */
+    bool benchmarkForks() {
+        const RANDOM_SEED seed = RandomGenerator::deriveSeed(m_options.seed, 0);
+        const SpeciesDatabase *species = m_machine.getSpeciesDatabase();
+
+        JewelMechanics mech(seed);
+        // The forks are never played, so they can share one set of mechanics.
+        JewelMechanics forkMech(
+                RandomGenerator::deriveSeed(seed, TEAM_COUNT + 1));
+        BattlePolicyPtr policies[TEAM_COUNT];
+        Pokemon::ARRAY teams[TEAM_COUNT];
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            policies[i] = newPolicy(m_options, m_pool, i,
+                    RandomGenerator::deriveSeed(seed, i + 1));
+            createTeam(m_options.teams[i], *species, teams[i]);
+        }
+        vector<StatusObject> clauses = m_clauses;
+
+        SimulatedBattle field(policies, m_options.maxTurns);
+        vector<boost::shared_ptr<BattleField> > forks;
+        forks.reserve(m_options.forks);
+        try {
+            field.initialise(&mech, m_generation, &m_machine, teams,
+                    m_options.trainer, m_options.partySize, clauses);
+            field.beginBattle();
+            for (int i = 0; i < m_options.forkTurns; ++i) {
+                if (!field.playTurn())
+                    break;
+            }
+
+            m_machine.acquireContext()->gc();
+            const long before = getResidentMemory();
+            const pt::ptime start = pt::microsec_clock::universal_time();
+            for (int i = 0; i < m_options.forks; ++i) {
+                forks.push_back(field.fork(&forkMech));
+            }
+            const double seconds = (pt::microsec_clock::universal_time()
+                    - start).total_microseconds() / 1000000.0;
+            const long after = getResidentMemory();
+
+            Log::out() << "Made " << m_options.forks << " forks after "
+                    << field.getTurnCount() << " turns in " << seconds
+                    << " seconds (" << (seconds > 0.0 ?
+                        m_options.forks / seconds : 0.0)
+                    << " forks per second)." << endl;
+            if (m_options.forks > 0) {
+                Log::out() << "Memory per fork: "
+                        << ((after - before) / m_options.forks) << " bytes"
+                        << endl;
+            }
+        } catch (BattleFieldException &) {
+            Log::out() << "Error: The battle could not be forked." << endl;
+            return false;
+        }
+        for_each(forks.begin(), forks.end(),
+                boost::bind(&BattleField::terminate, _1));
+        field.terminate();
+        return true;
+    }
+
+private:
+    bool nextBattle(int &idx) {
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        if (m_next >= m_options.battles)
+            return false;
+        idx = m_next++;
+        return true;
+    }
+
+    void runWorker() {
+        SimulationStatistics stats;
+        int idx;
+        while (nextBattle(idx)) {
+            runBattle(idx, stats);
+        }
+        boost::lock_guard<boost::mutex> lock(m_mutex);
+        m_statistics.add(stats);
+    }
+
+    void runBattle(const int idx, SimulationStatistics &stats) {
+        const RANDOM_SEED seed =
+                RandomGenerator::deriveSeed(m_options.seed, idx);
+        const SpeciesDatabase *species = m_machine.getSpeciesDatabase();
+
+        JewelMechanics mech(seed);
+        BattlePolicyPtr policies[TEAM_COUNT];
+        Pokemon::ARRAY teams[TEAM_COUNT];
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            policies[i] = newPolicy(m_options, m_pool, i,
+                    RandomGenerator::deriveSeed(seed, i + 1));
+            createTeam(m_options.teams[i], *species, teams[i]);
+        }
+        vector<StatusObject> clauses = m_clauses;
+
+        SimulatedBattle field(policies, m_options.maxTurns);
+        field.setNarrationEnabled(m_options.narrate);
+        try {
+            field.initialise(&mech, m_generation, &m_machine, teams,
+                    m_options.trainer, m_options.partySize, clauses);
+            const int victor = field.run();
+            stats.addBattle(victor, field.getTurnCount());
+            field.terminate();
+        } catch (BattleFieldException &) {
+            ++stats.errors;
+        }
+        m_machine.acquireContext()->maybeGc();
+    }
+
+    ScriptMachine &m_machine;
+    Generation *m_generation;
+    const vector<StatusObject> m_clauses;
+    const SimulationOptions &m_options;
+    RolloutPool *m_pool;
+    SimulationStatistics m_statistics;
+    boost::mutex m_mutex;
+    int m_next;
+};
+
+void printStatistics(const SimulationOptions &options,
+        const SimulationStatistics &stats, const double seconds) {
+    const int battles = stats.getBattles();
+    Log::out() << "Simulated " << battles << " battles in " << seconds
+            << " seconds (" << (seconds > 0.0 ? battles / seconds : 0.0)
+            << " battles per second) on " << options.threads
+            << " threads with seed " << options.seed << "." << endl;
+    if (battles == 0)
+        return;
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        Log::out() << "Player " << i << " (" << options.trainer[i] << "): "
+                << stats.wins[i] << " wins ("
+                << (100.0 * stats.wins[i] / battles) << "%)" << endl;
+    }
+    Log::out() << "Draws: " << stats.draws << " ("
+            << (100.0 * stats.draws / battles) << "%)" << endl;
+    Log::out() << "Turns: mean " << ((double)stats.turns / battles)
+            << ", min " << stats.minTurns
+            << ", max " << stats.maxTurns << endl;
+    if (stats.errors) {
+        Log::out() << "Battles aborted due to errors: " << stats.errors
+                << endl;
+    }
+}
+
+int simulate(int argc, char **argv) {
+    SimulationOptions options;
+    string team[TEAM_COUNT], policy[TEAM_COUNT];
+    int generationIdx, metagameIdx;
+
+    po::options_description desc("Options");
+    desc.add_options()
+            ("help", "show this help message")
+            ("team0", po::value<string>(&team[0]),
+                "Shoddy Battle 1 team file for player 0")
+            ("team1", po::value<string>(&team[1]),
+                "Shoddy Battle 1 team file for player 1")
+            ("policy0",
+                po::value<string>(&policy[0])->default_value("random"),
+                "policy for player 0 (random, greedy or montecarlo)")
+            ("policy1",
+                po::value<string>(&policy[1])->default_value("random"),
+                "policy for player 1 (random, greedy or montecarlo)")
+            ("battles",
+                po::value<int>(&options.battles)->default_value(1000),
+                "number of battles to run")
+            ("threads",
+                po::value<int>(&options.threads)->default_value(
+                    boost::thread::hardware_concurrency()),
+                "number of worker threads")
+            ("seed",
+                po::value<RANDOM_SEED>(&options.seed)->default_value(
+                    RandomGenerator::getEntropySeed()),
+                "master random seed")
+            ("generation",
+                po::value<int>(&generationIdx)->default_value(0),
+                "index of the generation in metagames.xml")
+            ("metagame",
+                po::value<int>(&metagameIdx)->default_value(-1),
+                "index of a metagame whose rules to use (-1 for none)")
+            ("party-size",
+                po::value<int>(&options.partySize)->default_value(1),
+                "active party size when no metagame is given")
+            ("max-turns",
+                po::value<int>(&options.maxTurns)->default_value(500),
+                "turn limit after which a battle is a draw")
+            ("forks",
+                po::value<int>(&options.forks)->default_value(0),
+                "fork one battle this many times and report the cost of "
+                "forking, instead of running battles")
+            ("fork-turns",
+                po::value<int>(&options.forkTurns)->default_value(1),
+                "number of turns to play before forking")
+            ("search-budget",
+                po::value<int>(&options.search.budget)->default_value(100),
+                "milliseconds the montecarlo policy spends on each move")
+            ("search-depth",
+                po::value<int>(&options.search.depth)->default_value(20),
+                "maximum number of turns in each montecarlo rollout")
+            ("rollout-threads",
+                po::value<int>(&options.rolloutThreads)->default_value(
+                    boost::thread::hardware_concurrency()),
+                "number of threads running montecarlo rollouts")
+            ("narrate", "print the battles as they happen")
+    ;
+
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+    } catch (po::error &e) {
+        Log::out() << "Error reading command line: " << e.what() << endl;
+        return EXIT_FAILURE;
+    }
+    po::notify(vm);
+
+    if (vm.count("help") || !vm.count("team0") || !vm.count("team1")) {
+        Log::out() << "Usage: shoddybattle2-sim --team0 file --team1 file "
+                "[options]" << endl << desc << endl;
+        return vm.count("help") ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    options.narrate = vm.count("narrate");
+    if (options.threads < 1) {
+        options.threads = 1;
+    }
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        if (!getPolicyType(policy[i], options.policy[i])) {
+            Log::out() << "Error: Unknown policy " << policy[i] << "." << endl;
+            return EXIT_FAILURE;
+        }
+        if (!readObjectTeamFile(team[i], options.teams[i])
+                || options.teams[i].empty()) {
+            Log::out() << "Error: Could not read team file " << team[i]
+                    << "." << endl;
+            return EXIT_FAILURE;
+        }
+        const string::size_type slash = team[i].find_last_of('/');
+        options.trainer[i] = (slash == string::npos) ?
+                team[i] : team[i].substr(slash + 1);
+    }
+
+    vector<GenerationPtr> generations;
+    Generation::readGenerations("resources/metagames.xml", generations);
+    const int generationCount = generations.size();
+    if ((generationIdx < 0) || (generationIdx >= generationCount)) {
+        Log::out() << "Error: No generation " << generationIdx << "." << endl;
+        return EXIT_FAILURE;
+    }
+
+    ScriptMachine machine;
+    machine.acquireContext()->runFile("resources/main.js");
+    machine.finalise();
+
+    GenerationPtr generation = generations[generationIdx];
+    generation->initialiseMetagames(machine.getSpeciesDatabase());
+
+    vector<StatusObject> clauses;
+    if (metagameIdx != -1) {
+        const vector<MetagamePtr> &metagames = generation->getMetagames();
+        const int metagameCount = metagames.size();
+        if ((metagameIdx < 0) || (metagameIdx >= metagameCount)) {
+            Log::out() << "Error: No metagame " << metagameIdx << "." << endl;
+            return EXIT_FAILURE;
+        }
+        MetagamePtr metagame = metagames[metagameIdx];
+        options.partySize = metagame->getActivePartySize();
+        ScriptContextPtr cx = machine.acquireContext();
+        const vector<string> &names = metagame->getClauses();
+        vector<string>::const_iterator i = names.begin();
+        for (; i != names.end(); ++i) {
+            clauses.push_back(cx->getClause(*i));
+        }
+    }
+
+    boost::scoped_ptr<RolloutPool> pool;
+    if ((options.policy[0] == PT_MONTE_CARLO)
+            || (options.policy[1] == PT_MONTE_CARLO)) {
+        pool.reset(new RolloutPool(&machine, options.rolloutThreads, 0));
+    }
+
+    Simulator simulator(machine, generation.get(), clauses, options,
+            pool.get());
+    if (options.forks > 0) {
+        return simulator.benchmarkForks() ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    const pt::ptime start = pt::microsec_clock::universal_time();
+    simulator.run();
+    const pt::time_duration elapsed =
+            pt::microsec_clock::universal_time() - start;
+
+    printStatistics(options, simulator.getStatistics(),
+            elapsed.total_microseconds() / 1000000.0);
+    if (pool) {
+        Log::out() << "Rollouts: " << pool->getRolloutCount() << " on "
+                << pool->getThreadCount() << " threads ("
+                << pool->getRolloutsPerCoreSecond()
+                << " per second per core)" << endl;
+    }
+    return EXIT_SUCCESS;
+}
+
+}
+
+int main(int argc, char **argv) {
+    return simulate(argc, argv);
+}
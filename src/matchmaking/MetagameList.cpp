@@ -23,6 +23,7 @@
  */
 
 #include "MetagameList.h"
+#include "../shoddybattle/GamePack.h"
 #include "../shoddybattle/PokemonSpecies.h"
 #include "../shoddybattle/BattleField.h"
 #include "../network/network.h"
@@ -56,7 +57,7 @@ struct Metagame::MetagameImpl {
     vector<string> m_clauses;
     network::TimerOptions m_timerOptions;
 
-    void getMetagame(DOMElement *);
+    void setMetagame(const METAGAME_DATA &);
 
     void initialise(SpeciesDatabase *species) {
         set<string>::iterator i = m_banListProto.begin();
@@ -79,7 +80,7 @@ struct Generation::GenerationImpl {
     int m_idx;
     vector<MetagamePtr> m_metagames;
 
-    void getGeneration(DOMElement *);
+    void setGeneration(const GENERATION_DATA &);
 
     void getMetagameClauses(const int idx, vector<string> &ret) {
         const int metagamesize = m_metagames.size();
@@ -121,39 +122,41 @@ int getIntNodeValue(DOMNode *node);
 string getStringNodeValue(DOMNode *node, bool text = false);
 string getTextFromElement(DOMElement *element, bool text = false);
 
-void Metagame::MetagameImpl::getMetagame(DOMElement *node) {
+namespace {
+
+void getMetagame(DOMElement *node, METAGAME_DATA &data) {
     XMLCh tempStr[20];
 
     XMLString::transcode("id", tempStr, 19);
     DOMNode *p = node->getAttributes()->getNamedItem(tempStr);
     if (p) {
-        m_id = getStringNodeValue(p);
+        data.id = getStringNodeValue(p);
     }
 
     XMLString::transcode("name", tempStr, 19);
     DOMNodeList *list = node->getElementsByTagName(tempStr);
     if (list->getLength() != 0) {
-        m_name = getTextFromElement((DOMElement *)list->item(0));
+        data.name = getTextFromElement((DOMElement *)list->item(0));
     }
 
     XMLString::transcode("description", tempStr, 19);
     list = node->getElementsByTagName(tempStr);
     if (list->getLength() != 0) {
-        m_description = getTextFromElement((DOMElement *)list->item(0));
+        data.description = getTextFromElement((DOMElement *)list->item(0));
     }
 
     XMLString::transcode("party-size", tempStr, 19);
     list = node->getElementsByTagName(tempStr);
     if (list->getLength() != 0) {
         const string txt = getTextFromElement((DOMElement *)list->item(0));
-        m_partySize = boost::lexical_cast<int>(txt);
+        data.partySize = boost::lexical_cast<int>(txt);
     }
 
     XMLString::transcode("team-length", tempStr, 19);
     list = node->getElementsByTagName(tempStr);
     if (list->getLength() != 0) {
         const string txt = getTextFromElement((DOMElement *)list->item(0));
-        m_maxTeamLength = boost::lexical_cast<int>(txt);
+        data.teamLength = boost::lexical_cast<int>(txt);
     }
 
     XMLString::transcode("ban-list", tempStr, 19);
@@ -165,8 +168,7 @@ void Metagame::MetagameImpl::getMetagame(DOMElement *node) {
         const int length = list->getLength();
         for (int i = 0; i < length; ++i) {
             DOMElement *pokemon = (DOMElement *)list->item(i);
-            string txt = getTextFromElement(pokemon);
-            m_banListProto.insert(txt);
+            data.banList.push_back(getTextFromElement(pokemon));
         }
     }
 
@@ -179,56 +181,48 @@ void Metagame::MetagameImpl::getMetagame(DOMElement *node) {
         const int length = list->getLength();
         for (int i = 0; i < length; ++i) {
             DOMElement *clause = (DOMElement *)list->item(i);
-            string txt = getTextFromElement(clause);
-            m_clauses.push_back(txt);
+            data.clauses.push_back(getTextFromElement(clause));
         }
     }
     
     XMLString::transcode("timer", tempStr, 19);
     list = node->getElementsByTagName(tempStr);
-    int pool = -1, periods = -1, periodLength = -1; 
     if (list->getLength() != 0) {
         DOMElement *timerOpts = (DOMElement *)list->item(0);
         XMLString::transcode("pool", tempStr, 19);
         list = timerOpts->getElementsByTagName(tempStr);
         if (list->getLength() != 0) {
             const string txt = getTextFromElement((DOMElement *)list->item(0));
-            pool = boost::lexical_cast<int>(txt);
+            data.pool = boost::lexical_cast<int>(txt);
         }
         XMLString::transcode("periods", tempStr, 19);
         list = timerOpts->getElementsByTagName(tempStr);
         if (list->getLength() != 0) {
             const string txt = getTextFromElement((DOMElement *)list->item(0));
-            periods = boost::lexical_cast<int>(txt);
+            data.periods = boost::lexical_cast<int>(txt);
         }
         XMLString::transcode("periodLength", tempStr, 19);
         list = timerOpts->getElementsByTagName(tempStr);
         if (list->getLength() != 0) {
             const string txt = getTextFromElement((DOMElement *)list->item(0));
-            periodLength = boost::lexical_cast<int>(txt);
+            data.periodLength = boost::lexical_cast<int>(txt);
         }
     }
-    if ((pool > 0) && (periods >= 0) && (periodLength > 0)) {
-        m_timerOptions.enabled = true;
-        m_timerOptions.pool = pool;
-        m_timerOptions.periods = periods;
-        m_timerOptions.periodLength = periodLength;
-    }
 }
 
-void Generation::GenerationImpl::getGeneration(DOMElement *node) {
+void getGeneration(DOMElement *node, GENERATION_DATA &data) {
     XMLCh tempStr[20];
 
     XMLString::transcode("id", tempStr, 19);
     DOMNode *p = node->getAttributes()->getNamedItem(tempStr);
     if (p) {
-        m_id = getStringNodeValue(p);
+        data.id = getStringNodeValue(p);
     }
 
     XMLString::transcode("name", tempStr, 19);
     DOMNodeList *list = node->getElementsByTagName(tempStr);
     if (list->getLength() != 0) {
-        m_name = getTextFromElement((DOMElement *)list->item(0));
+        data.name = getTextFromElement((DOMElement *)list->item(0));
     }
 
     XMLString::transcode("metagames", tempStr, 19);
@@ -238,17 +232,70 @@ void Generation::GenerationImpl::getGeneration(DOMElement *node) {
         XMLString::transcode("metagame", tempStr, 19);
         list = metagames->getElementsByTagName(tempStr);
         const int length = list->getLength();
+        data.metagames.resize(length);
         for (int i = 0; i < length; ++i) {
             DOMElement *item = (DOMElement *)list->item(i);
-            MetagamePtr metagame(new Metagame());
-            metagame.get()->m_impl->getMetagame(item);
-            metagame.get()->m_impl->m_idx = i;
-            metagame.get()->m_impl->m_generation = m_owner;
-            m_metagames.push_back(metagame);
+            getMetagame(item, data.metagames[i]);
         }
     }
 }
 
+/**
+ * A metagame id names its ladder tables in the database, so it may only
+ * contain letters, digits and underscores.
+ */
+bool isValidLadderId(const string &id) {
+    if (id.empty()) {
+        return false;
+    }
+    string::const_iterator i = id.begin();
+    for (; i != id.end(); ++i) {
+        const char c = *i;
+        if (!(((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+                || ((c >= '0') && (c <= '9')) || (c == '_'))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // anonymous namespace
+
+void Metagame::MetagameImpl::setMetagame(const METAGAME_DATA &data) {
+    m_id = data.id;
+    m_name = data.name;
+    m_description = data.description;
+    m_partySize = data.partySize;
+    m_maxTeamLength = data.teamLength;
+    m_banListProto.insert(data.banList.begin(), data.banList.end());
+    m_clauses = data.clauses;
+    if ((data.pool > 0) && (data.periods >= 0) && (data.periodLength > 0)) {
+        m_timerOptions.enabled = true;
+        m_timerOptions.pool = data.pool;
+        m_timerOptions.periods = data.periods;
+        m_timerOptions.periodLength = data.periodLength;
+    }
+}
+
+void Generation::GenerationImpl::setGeneration(const GENERATION_DATA &data) {
+    m_id = data.id;
+    m_name = data.name;
+    const int length = data.metagames.size();
+    for (int i = 0; i < length; ++i) {
+        if (!isValidLadderId(data.metagames[i].id)) {
+            Log::out() << "Warning: Ignoring the metagame with invalid id \""
+                    << data.metagames[i].id << "\" in generation " << m_id
+                    << "." << endl;
+            continue;
+        }
+        MetagamePtr metagame(new Metagame());
+        metagame->m_impl->setMetagame(data.metagames[i]);
+        metagame->m_impl->m_idx = m_metagames.size();
+        metagame->m_impl->m_generation = m_owner;
+        m_metagames.push_back(metagame);
+    }
+}
+
 string Metagame::getName() const {
     return m_impl->m_name;
 }
@@ -313,8 +360,8 @@ class GenerationErrorHandler : public HandlerBase {
     }
 };
 
-void Generation::readGenerations(const string &file,
-        vector<GenerationPtr> &generations) {
+void Generation::parseGenerations(const string &file,
+        vector<GENERATION_DATA> &generations) {
     XMLPlatformUtils::Initialize();
     XercesDOMParser parser;
 
@@ -324,19 +371,42 @@ void Generation::readGenerations(const string &file,
 
     parser.parse(file.c_str());
 
+    // A file that could not be parsed gives no generations, so that a reload
+    // rejects it rather than crashing the server.
     DOMDocument *doc = parser.getDocument();
-    DOMElement *root = doc->getDocumentElement();
+    DOMElement *root = doc ? doc->getDocumentElement() : NULL;
+    if ((parser.getErrorCount() != 0) || !root) {
+        Log::out() << "Error: Could not parse " << file << "." << endl;
+        generations.clear();
+        return;
+    }
 
     XMLCh tempStr[12];
     XMLString::transcode("generation", tempStr, 11);
     DOMNodeList *list = root->getElementsByTagName(tempStr);
 
     int length = list->getLength();
+    generations.resize(length);
     for (int i = 0; i < length; ++i) {
         DOMElement *item = (DOMElement *)list->item(i);
+        getGeneration(item, generations[i]);
+    }
+}
+
+void Generation::readGenerations(const string &file,
+        vector<GenerationPtr> &generations) {
+    vector<GENERATION_DATA> data;
+    if (!GamePack::read(file, data)) {
+        parseGenerations(file, data);
+        if (!data.empty()) {
+            GamePack::write(file, data);
+        }
+    }
+    const int length = data.size();
+    for (int i = 0; i < length; ++i) {
         GenerationPtr generation(new Generation());
         generation->m_impl->m_owner = generation.get();
-        generation->m_impl->getGeneration(item);
+        generation->m_impl->setGeneration(data[i]);
         generation->m_impl->m_idx = i;
         generations.push_back(generation);
     }
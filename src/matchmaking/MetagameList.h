@@ -40,6 +40,32 @@ typedef boost::shared_ptr<Generation> GenerationPtr;
 
 class SpeciesDatabase;
 
+/**
+ * A metagame as read from the metagames XML file.
+ */
+struct METAGAME_DATA {
+    std::string id;
+    std::string name;
+    std::string description;
+    int partySize;
+    int teamLength;
+    std::vector<std::string> banList;   // species names
+    std::vector<std::string> clauses;
+    int pool, periods, periodLength;    // timer options, or -1
+
+    METAGAME_DATA(): partySize(0), teamLength(0),
+            pool(-1), periods(-1), periodLength(-1) { }
+};
+
+/**
+ * A generation as read from the metagames XML file.
+ */
+struct GENERATION_DATA {
+    std::string id;
+    std::string name;
+    std::vector<METAGAME_DATA> metagames;
+};
+
 class Metagame {
 public:
     Metagame();
@@ -65,9 +91,22 @@ private:
 
 class Generation {
 public:
+    /**
+     * Read the generations from a metagames XML file. They are read from the
+     * game data pack if it is up to date with the file; otherwise the file
+     * is parsed and the pack is updated. A file that cannot be parsed gives
+     * no generations, and the pack is left alone.
+     */
     static void readGenerations(const std::string &,
             std::vector<GenerationPtr> &);
 
+    /**
+     * Parse a metagames XML file. A file that cannot be parsed gives no
+     * generations.
+     */
+    static void parseGenerations(const std::string &,
+            std::vector<GENERATION_DATA> &);
+
     Generation();
     
     std::string getId() const;
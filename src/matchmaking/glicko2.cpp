@@ -25,6 +25,8 @@
 #include "glicko2.h"
 #include "../main/Log.h"
 #include <cmath>
+#include <boost/thread.hpp>
+#include <boost/bind.hpp>
 
 using namespace std;
 
@@ -184,6 +186,204 @@ void updatePlayer(PLAYER &player,
     player.volatility = volatility;
 }
 
+void PLAYER_BATCH::addPlayer(const PLAYER &player,
+        const vector<MATCH> &matches) {
+    rating.push_back(player.rating);
+    deviation.push_back(player.deviation);
+    volatility.push_back(player.volatility);
+    for (vector<MATCH>::const_iterator i = matches.begin();
+            i != matches.end(); ++i) {
+        opponentRating.push_back(i->opponentRating);
+        opponentDeviation.push_back(i->opponentDeviation);
+        score.push_back(i->score);
+    }
+    offset.push_back(score.size());
+}
+
+PLAYER PLAYER_BATCH::getPlayer(const int i) const {
+    const PLAYER ret = { rating[i], deviation[i], volatility[i] };
+    return ret;
+}
+
+namespace {
+
+// Players are updated in blocks of this many so that the arrays used by
+// each step of the update stay in the cache.
+const int BLOCK_SIZE = 256;
+
+/**
+ * Working arrays for updateBlock, kept from one block to the next.
+ */
+struct BLOCK_STATE {
+    vector<double> g, e;                // for each match
+    vector<double> variance, sum;       // for each player
+    vector<double> volatility;          // for each player
+    vector<int> lane;                   // player in each volatility lane
+    vector<double> x, a, improvement, spread, next;
+    vector<char> done;
+};
+
+/**
+ * Update the players from begin up to end. Each step runs over every
+ * player, or every match, in the block before the next step begins, over
+ * plain arrays, so that the compiler can vectorise the loops. The
+ * volatility iteration advances every unfinished player by one step per
+ * pass, and packs the unfinished players together after each pass.
+ */
+void updateBlock(PLAYER_BATCH &batch, const int begin, const int end,
+        const double system, BLOCK_STATE &s) {
+    const int players = end - begin;
+    const int *offset = &batch.offset[begin];
+    const int base = offset[0];
+    const int matches = offset[players] - base;
+
+    s.g.resize(matches + 1);
+    s.e.resize(matches + 1);
+    const double *opponentRating =
+            matches ? &batch.opponentRating[base] : NULL;
+    const double *opponentDeviation =
+            matches ? &batch.opponentDeviation[base] : NULL;
+    const int *score = matches ? &batch.score[base] : NULL;
+    for (int j = 0; j < matches; ++j) {
+        s.g[j] = getGFactor(getGlicko2Deviation(opponentDeviation[j]));
+    }
+    for (int i = 0; i < players; ++i) {
+        const double rating = getGlicko2Rating(batch.rating[begin + i]);
+        const int last = offset[i + 1] - base;
+        for (int j = offset[i] - base; j < last; ++j) {
+            s.e[j] = getEFactor(rating,
+                    getGlicko2Rating(opponentRating[j]), s.g[j]);
+        }
+    }
+
+    s.variance.resize(players);
+    s.sum.resize(players);
+    for (int i = 0; i < players; ++i) {
+        const int first = offset[i] - base;
+        const int length = offset[i + 1] - offset[i];
+        s.variance[i] = getEstimatedVariance(&s.g[first], &s.e[first],
+                length);
+        s.sum[i] = getImprovementSum(&s.g[first], &s.e[first],
+                score + first, length);
+    }
+
+    // One volatility lane for each player who played a match.
+    s.lane.clear();
+    s.x.clear();
+    s.a.clear();
+    s.improvement.clear();
+    s.spread.clear();
+    for (int i = 0; i < players; ++i) {
+        if (offset[i + 1] == offset[i])
+            continue;
+        const double volatility = batch.volatility[begin + i];
+        const double deviation =
+                getGlicko2Deviation(batch.deviation[begin + i]);
+        const double start = log(volatility * volatility);
+        s.lane.push_back(i);
+        s.x.push_back(start);
+        s.a.push_back(start);
+        s.improvement.push_back(s.sum[i] * s.variance[i]);
+        s.spread.push_back(deviation * deviation + s.variance[i]);
+    }
+    int lanes = s.lane.size();
+    s.next.resize(lanes);
+    s.done.resize(lanes);
+    s.volatility.resize(players);
+    const double squSystem = system * system;
+    while (lanes > 0) {
+        for (int k = 0; k < lanes; ++k) {
+            const double x0 = s.x[k];
+            const double variance = s.variance[s.lane[k]];
+            const double ex = exp(x0);
+            const double d = s.spread[k] + ex;
+            const double squD = d * d;
+            const double i = s.improvement[k] / d;
+            const double h1 = -(x0 - s.a[k]) / squSystem - 0.5 * ex * i * i;
+            const double h2 = -1.0 / squSystem
+                - 0.5 * ex * s.spread[k] / squD
+                + 0.5 * variance * variance * ex
+                    * (s.spread[k] - ex) / (squD * d);
+            s.next[k] = x0 - h1 / h2;
+            s.done[k] = (fabs(x0 - s.next[k]) < 0.000001);
+        }
+        int kept = 0;
+        for (int k = 0; k < lanes; ++k) {
+            if (s.done[k]) {
+                s.volatility[s.lane[k]] = exp(s.next[k] / 2.0);
+                continue;
+            }
+            s.lane[kept] = s.lane[k];
+            s.x[kept] = s.next[k];
+            s.a[kept] = s.a[k];
+            s.improvement[kept] = s.improvement[k];
+            s.spread[kept] = s.spread[k];
+            ++kept;
+        }
+        lanes = kept;
+    }
+
+    for (int i = 0; i < players; ++i) {
+        const int p = begin + i;
+        const double deviation = getGlicko2Deviation(batch.deviation[p]);
+        if (offset[i + 1] == offset[i]) {
+            const double volatility = batch.volatility[p];
+            batch.deviation[p] = getGlickoDeviation(sqrt(
+                    deviation * deviation + volatility * volatility));
+            continue;
+        }
+        const double volatility = s.volatility[i];
+        const double updated = getUpdatedDeviation(deviation, volatility,
+                s.variance[i]);
+        const double rating = getUpdatedRating(
+                getGlicko2Rating(batch.rating[p]), updated, s.sum[i]);
+        batch.rating[p] = getGlickoRating(rating);
+        batch.deviation[p] = getGlickoDeviation(updated);
+        batch.volatility[p] = volatility;
+    }
+}
+
+/**
+ * Update the players from begin up to end, one block at a time.
+ */
+void updateRange(PLAYER_BATCH &batch, const int begin, const int end,
+        const double system) {
+    BLOCK_STATE state;
+    for (int i = begin; i < end; i += BLOCK_SIZE) {
+        updateBlock(batch, i, min(i + BLOCK_SIZE, end), system, state);
+    }
+}
+
+} // anonymous namespace
+
+/**
+ * The same calculation as updatePlayer for every player in the batch, one
+ * block of players at a time. The blocks are shared out between the
+ * threads in contiguous ranges.
+ */
+void updateBatch(PLAYER_BATCH &batch, const double system,
+        const int threads) {
+    const int players = batch.size();
+    const int blocks = (players + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const int ranges = max(1, min(threads, blocks));
+    boost::thread_group group;
+    int first = 0;
+    for (int i = 0; i < ranges; ++i) {
+        const int last = first + blocks / ranges + (i < blocks % ranges);
+        const int begin = first * BLOCK_SIZE;
+        const int end = min(last * BLOCK_SIZE, players);
+        if (i == ranges - 1) {
+            // The calling thread takes the last range.
+            updateRange(batch, begin, end, system);
+        } else {
+            group.create_thread(boost::bind(updateRange, boost::ref(batch),
+                    begin, end, system));
+        }
+        first = last;
+    }
+    group.join_all();
+}
+
 /**
  * Get a rating estimate based on a mean rating and rating deviation using
  * the GLIXARE approach (i.e. returns the chance of a player with the given
@@ -39,6 +39,23 @@ struct PLAYER {
     double rating, deviation, volatility;
 };
 
+/**
+ * Many players and their matches stored as one array per field, so that
+ * updateBatch can run each step of the update over every player at once.
+ * The matches of player i are those from offset[i] up to offset[i + 1].
+ */
+struct PLAYER_BATCH {
+    std::vector<double> rating, deviation, volatility;
+    std::vector<int> offset;
+    std::vector<double> opponentRating, opponentDeviation;
+    std::vector<int> score;
+
+    PLAYER_BATCH(): offset(1, 0) { }
+    int size() const { return rating.size(); }
+    void addPlayer(const PLAYER &player, const std::vector<MATCH> &matches);
+    PLAYER getPlayer(const int i) const;
+};
+
 /**
  * Find a player's new score, deviation, and volatility at the end of
  * the rating period.
@@ -47,6 +64,15 @@ void updatePlayer(PLAYER &player,
         const std::vector<MATCH> &matches,
         const double system);
 
+/**
+ * Update every player in a batch at the end of the rating period, giving
+ * the same results as calling updatePlayer on each player. Each player is
+ * independent of the others, so the players are split between the given
+ * number of threads.
+ */
+void updateBatch(PLAYER_BATCH &batch, const double system,
+        const int threads = 1);
+
 /**
  * Get a rating estimate based on a mean rating and rating deviation using
  * the GLIXARE approach (i.e. returns the chance of a player with the given
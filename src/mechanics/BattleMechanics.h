@@ -35,6 +35,20 @@ class BattleField;
 class MoveObject;
 class PokemonType;
 
+/**
+ * The number of values that the random factor in the damage formula can take.
+ */
+const int DAMAGE_ROLLS = 39;
+
+/**
+ * The damage that a move would do for each value of the random factor, in
+ * ascending order, without and with a critical hit.
+ */
+struct DamageRange {
+    int normal[DAMAGE_ROLLS];
+    int critical[DAMAGE_ROLLS];
+};
+
 /**
  * A general notion of battle mechanics, allowing for the calculation of some
  * fundamental quantities.
@@ -43,9 +57,18 @@ class BattleMechanics {
 public:
     virtual bool getCoinFlip(double = 0.5) const = 0;
     virtual unsigned int calculateStat(const Pokemon &p, const STAT i) const = 0;
+    /**
+     * Calculate a stat as an opponent would estimate it without knowing the
+     * pokemon's nature, IVs or EVs.
+     */
+    virtual unsigned int calculateTypicalStat(const Pokemon &p,
+            const STAT i) const = 0;
     virtual int calculateDamage(BattleField &field, MoveObject &move,
         Pokemon &user, Pokemon &target, const int targets,
         const bool weight = true) const = 0;
+    virtual bool getDamageRange(BattleField &field, MoveObject &move,
+        Pokemon &user, Pokemon &target, const int targets,
+        DamageRange &range) const = 0;
     virtual bool attemptHit(BattleField &field, MoveObject &move,
             Pokemon &user, Pokemon &target) const = 0;
     virtual int getRandomInt(const int lower, const int upper) const = 0;
@@ -22,19 +22,19 @@
  * online at http://gnu.org.
  */
 
-#include <boost/random.hpp>
+#include <cmath>
+#include <algorithm>
 
 #include "JewelMechanics.h"
 #include "PokemonNature.h"
 #include "PokemonType.h"
+#include "RandomGenerator.h"
 #include "../shoddybattle/Pokemon.h"
 #include "../shoddybattle/BattleField.h"
 #include "../moves/PokemonMove.h"
 #include "../scripting/ScriptMachine.h"
 #include "stat.h"
 
-#include <ctime>
-
 using namespace std;
 using namespace boost;
 
@@ -45,15 +45,17 @@ namespace shoddybattle {
  */
 static const double CRITICAL_TABLE[] = { 0.0625, 0.125, 0.25, 0.375, 0.5 };
 
-typedef mt11213b GENERATOR;
-
 struct JewelMechanicsImpl {
-    GENERATOR rand;
+    RandomGenerator rand;
+    JewelMechanicsImpl(const RANDOM_SEED seed): rand(seed) { }
 };
 
 JewelMechanics::JewelMechanics() {
-    m_impl = new JewelMechanicsImpl();
-    m_impl->rand = GENERATOR(time(NULL));
+    m_impl = new JewelMechanicsImpl(RandomGenerator::getEntropySeed());
+}
+
+JewelMechanics::JewelMechanics(const RANDOM_SEED seed) {
+    m_impl = new JewelMechanicsImpl(seed);
 }
 
 JewelMechanics::~JewelMechanics() {
@@ -61,31 +63,50 @@ JewelMechanics::~JewelMechanics() {
 }
 
 /**
- * Calculate a pokemon stat using the Pokemon DPP formula.
+ * Calculate a stat from its parts using the Pokemon DPP formula.
  */
-unsigned int JewelMechanics::calculateStat(
-        const Pokemon &p, const STAT i) const {
-    unsigned int base = p.getBaseStat(i);
+static unsigned int getStatValue(const STAT i, const unsigned int base,
+        const unsigned int iv, const unsigned int ev, const unsigned int level,
+        const double nature) {
     unsigned int common =
             (int)((int)(((2 * base)
-            + p.getIv(i)
-            + (p.getEv(i) / 4)))
-            * p.getLevel() / 100);
+            + iv
+            + (ev / 4)))
+            * level / 100);
     if (i == S_HP) {
         if (base == 1) {    // base 1 hp => 1 hp total
             return 1;
         } else {
-            return common + 10 + p.getLevel();
+            return common + 10 + level;
         }
     }
-    return (int)((common + 5) * p.getNature()->getEffect(i));
+    return (int)((common + 5) * nature);
+}
+
+/**
+ * Calculate a pokemon stat using the Pokemon DPP formula.
+ */
+unsigned int JewelMechanics::calculateStat(
+        const Pokemon &p, const STAT i) const {
+    return getStatValue(i, p.getBaseStat(i), p.getIv(i), p.getEv(i),
+            p.getLevel(), p.getNature()->getEffect(i));
+}
+
+/**
+ * Calculate a pokemon stat as if the pokemon had a neutral nature, perfect
+ * IVs and no EVs.
+ */
+unsigned int JewelMechanics::calculateTypicalStat(
+        const Pokemon &p, const STAT i) const {
+    return getStatValue(i, p.getBaseStat(i), MAX_IV, 0, p.getLevel(), 1.0);
+}
+
+RANDOM_SEED JewelMechanics::getSeed() const {
+    return m_impl->rand.getSeed();
 }
 
 bool JewelMechanics::getCoinFlip(double p) const {
-    bernoulli_distribution<> dist(p);
-    variate_generator<GENERATOR &, bernoulli_distribution<> >
-            coin(m_impl->rand, dist);
-    return coin();
+    return m_impl->rand.getCoinFlip(p);
 }
 
 template <class T>
@@ -169,26 +190,42 @@ inline void multiplyBy(int &damage, const int position, MODIFIERS &mods) {
 }
 
 int JewelMechanics::getRandomInt(const int lower, const int upper) const {
-    boost::uniform_int<> range(lower, upper);
-    variate_generator<GENERATOR &, uniform_int<> > r(m_impl->rand, range);
-    return r();
+    return m_impl->rand.getInt(lower, upper);
 }
 
 double JewelMechanics::getEffectiveness(BattleField &field,
         const PokemonType *type,
         Pokemon *user, Pokemon *target, vector<double> *factors) const {
-    set<const PokemonType *> immunities, vulnerabilities;
+    TYPE_MASK immunities = 0, vulnerabilities = 0;
     field.getImmunities(user, target, immunities, vulnerabilities);
-    if (immunities.find(type) != immunities.end()) {
+    const TYPE_MASK mask = type->getMask();
+    if (immunities & mask) {
         return 0.0;
     }
-    const bool immune = (vulnerabilities.find(type) == vulnerabilities.end());
-    double effectiveness = 1.0;
+    const bool immune = !(vulnerabilities & mask);
+    const bool transform = field.hasEffectivenessTransform();
     const TYPE_ARRAY &types = target->getTypes();
-    
+    const int count = types.size();
+
+    if (immune && !transform && (count <= 2)) {
+        // Common case: read the answer straight out of the dual type table.
+        const int typeless = PokemonType::TYPELESS.getTypeValue();
+        const int type1 = (count > 0) ? types[0]->getTypeValue() : typeless;
+        const int type2 = (count > 1) ? types[1]->getTypeValue() : typeless;
+        if (factors) {
+            for (int i = 0; i < count; ++i) {
+                factors->push_back(type->getMultiplier(*types[i]));
+            }
+        }
+        return PokemonType::getEffectiveness(type->getTypeValue(),
+                type1, type2);
+    }
+
+    double effectiveness = 1.0;
     for (TYPE_ARRAY::const_iterator i = types.begin(); i != types.end(); ++i) {
         double factor;
-        if (!field.getTransformedEffectiveness(type, *i, target, factor)) {
+        if (!transform ||
+                !field.getTransformedEffectiveness(type, *i, target, factor)) {
             factor = type->getMultiplier(**i);
         }
         
@@ -202,13 +239,31 @@ double JewelMechanics::getEffectiveness(BattleField &field,
     return effectiveness;
 }
 
+namespace {
+
+const int MIN_DAMAGE_ROLL = 217;
+const int MAX_DAMAGE_ROLL = MIN_DAMAGE_ROLL + DAMAGE_ROLLS - 1;
+
 /**
- * Calculate damage.
+ * Everything that goes into the damage done by one use of a move, except for
+ * the random factor.
  */
-int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
-        Pokemon &user, Pokemon &target, const int targets,
-        const bool weight) const {
-    
+struct ResolvedDamage {
+    int base;               // damage before the random factor
+    double effectiveness;
+    // Applied in order after the random factor, truncating each time: STAB,
+    // the type effectiveness factors and then "Mod3".
+    vector<double> multipliers;
+};
+
+/**
+ * Resolve the damage done by a move up to the random factor. This runs the
+ * same modifier scripts as an actual use of the move, which may print
+ * messages or change the battle (a resist berry is eaten, for example).
+ */
+void resolveDamage(const JewelMechanics &mech, BattleField &field,
+        MoveObject &move, Pokemon &user, Pokemon &target, const int targets,
+        const bool critical, ResolvedDamage &ret) {
     ScriptContext *cx = field.getContext();
 
     MOVE_CLASS cls = move.getMoveClass(cx);
@@ -217,7 +272,6 @@ int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
     STAT stat0 = (cls == MC_PHYSICAL) ? S_ATTACK : S_SPATTACK;
     STAT stat1 = (cls == MC_PHYSICAL) ? S_DEFENCE : S_SPDEFENCE;
 
-    const bool critical = isCriticalHit(field, move, user, target);
     MODIFIERS mods;
     field.getModifiers(user, target, move, critical, targets, mods);
 
@@ -272,12 +326,7 @@ int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
         damage *= factor;
     }
     multiplyBy(damage, 2, mods); // "Mod2"
-
-    if (weight) {
-        damage *= getRandomInt(217, 255) * 100;
-        damage /= 255;
-        damage /= 100;
-    }
+    ret.base = damage;
 
     const PokemonType *moveType = move.getType(cx);
     if (user.isType(moveType)) {
@@ -286,24 +335,86 @@ int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
         if (!v.failed()) {
             stab = v.getDouble(cx);
         }
-        damage *= stab;
+        ret.multipliers.push_back(stab);
     }
 
-    vector<double> factors;
-    const double effectiveness =
-            getEffectiveness(field, moveType, &user, &target, &factors);
+    ret.effectiveness = mech.getEffectiveness(field, moveType, &user,
+            &target, &ret.multipliers);
 
-    if (effectiveness == 0.0) {
-        vector<string> args;
-        args.push_back(target.getToken());
-        field.print(TextMessage(4, 1, args));
-        return 0;
+    const PRIORITY_MAP &mod3 = mods[3]; // "Mod3"
+    for (PRIORITY_MAP::const_iterator i = mod3.begin(); i != mod3.end(); ++i) {
+        ret.multipliers.push_back(i->second);
     }
+}
 
-    vector<double>::const_iterator i = factors.begin();
-    for (; i != factors.end(); ++i) {
+/**
+ * Finish the damage formula for one value of the random factor, or without
+ * the random factor if roll is zero.
+ */
+int getDamage(const ResolvedDamage &resolved, const int roll) {
+    if (resolved.effectiveness == 0.0)
+        return 0;
+    int damage = resolved.base;
+    if (roll != 0) {
+        damage *= roll * 100;
+        damage /= 255;
+        damage /= 100;
+    }
+    vector<double>::const_iterator i = resolved.multipliers.begin();
+    for (; i != resolved.multipliers.end(); ++i) {
         damage *= *i;
     }
+    if (damage < 1) damage = 1;
+    return damage;
+}
+
+/**
+ * Finish the damage formula for every value of the random factor at once.
+ * Each step is a separate loop over all of the rolls with no branches, so
+ * that the compiler can vectorise it; the results are identical to calling
+ * getDamage for each roll.
+ */
+void getDamageRolls(const ResolvedDamage &resolved,
+        int damage[DAMAGE_ROLLS]) {
+    if (resolved.effectiveness == 0.0) {
+        fill(damage, damage + DAMAGE_ROLLS, 0);
+        return;
+    }
+    const int base = resolved.base;
+    for (int i = 0; i < DAMAGE_ROLLS; ++i) {
+        damage[i] = base * ((MIN_DAMAGE_ROLL + i) * 100) / 255 / 100;
+    }
+    vector<double>::const_iterator i = resolved.multipliers.begin();
+    for (; i != resolved.multipliers.end(); ++i) {
+        const double factor = *i;
+        for (int j = 0; j < DAMAGE_ROLLS; ++j) {
+            damage[j] = int(damage[j] * factor);
+        }
+    }
+    for (int i = 0; i < DAMAGE_ROLLS; ++i) {
+        damage[i] = max(damage[i], 1);
+    }
+}
+
+} // anonymous namespace
+
+/**
+ * Calculate damage.
+ */
+int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
+        Pokemon &user, Pokemon &target, const int targets,
+        const bool weight) const {
+    const bool critical = isCriticalHit(field, move, user, target);
+    ResolvedDamage resolved;
+    resolveDamage(*this, field, move, user, target, targets, critical,
+            resolved);
+
+    const double effectiveness = resolved.effectiveness;
+    if (effectiveness == 0.0) {
+        const string token = target.getToken();
+        field.print(TextMessage(4, 1, &token, 1));
+        return 0;
+    }
 
     if (critical) {
         field.print(TextMessage(4, 9));
@@ -316,10 +427,30 @@ int JewelMechanics::calculateDamage(BattleField &field, MoveObject &move,
         field.print(TextMessage(4, 7));
     }
 
-    multiplyBy(damage, 3, mods); // "Mod3"
+    const int roll = weight ?
+            getRandomInt(MIN_DAMAGE_ROLL, MAX_DAMAGE_ROLL) : 0;
+    return getDamage(resolved, roll);
+}
 
-    if (damage < 1) damage = 1;
-    return damage;
+/**
+ * Calculate every damage that a move could do, with and without a critical
+ * hit, without using up any random numbers. The modifier scripts run just as
+ * they do when the move is used, so to leave a battle untouched this should
+ * be called on a fork of it. Returns false if the move does not do damage
+ * through the damage formula.
+ */
+bool JewelMechanics::getDamageRange(BattleField &field, MoveObject &move,
+        Pokemon &user, Pokemon &target, const int targets,
+        DamageRange &range) const {
+    if (move.getMoveClass(field.getContext()) == MC_OTHER)
+        return false;
+    for (int i = 0; i < 2; ++i) {
+        ResolvedDamage resolved;
+        resolveDamage(*this, field, move, user, target, targets, (i == 1),
+                resolved);
+        getDamageRolls(resolved, (i == 1) ? range.critical : range.normal);
+    }
+    return true;
 }
 
 /*inline unsigned short prev(unsigned long long &n) {
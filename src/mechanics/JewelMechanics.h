@@ -26,6 +26,7 @@
 #define _JEWEL_MECHANICS_H_
 
 #include "BattleMechanics.h"
+#include "RandomGenerator.h"
 
 namespace shoddybattle {
 
@@ -44,12 +45,18 @@ class JewelMechanics : public BattleMechanics {
 public:
     
     JewelMechanics();
+    explicit JewelMechanics(const RANDOM_SEED seed);
     ~JewelMechanics();
+    RANDOM_SEED getSeed() const;
     bool getCoinFlip(double) const;
     unsigned int calculateStat(const Pokemon &p, const STAT i) const;
+    unsigned int calculateTypicalStat(const Pokemon &p, const STAT i) const;
     int calculateDamage(BattleField &field, MoveObject &move,
             Pokemon &user, Pokemon &target, const int targets,
             const bool weight = true) const;
+    bool getDamageRange(BattleField &field, MoveObject &move,
+            Pokemon &user, Pokemon &target, const int targets,
+            DamageRange &range) const;
     bool isCriticalHit(BattleField &field, MoveObject &move,
             Pokemon &user, Pokemon &target) const;
     bool attemptHit(BattleField &field, MoveObject &move,
@@ -97,5 +97,24 @@ const double PokemonType::m_multiplier[18][18] = {
         { 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1 }
     };
 
+/**
+ * Effectiveness of each attacking type against each pair of defending types,
+ * built from the chart above when the program starts.
+ */
+double PokemonType::m_effectiveness[18][18][18];
+
+const bool PokemonType::m_initialised = PokemonType::initialiseEffectiveness();
+
+bool PokemonType::initialiseEffectiveness() {
+    for (int i = 0; i < TYPE_COUNT; ++i) {
+        for (int j = 0; j < TYPE_COUNT; ++j) {
+            for (int k = 0; k < TYPE_COUNT; ++k) {
+                m_effectiveness[i][j][k] =
+                        m_multiplier[i][j] * m_multiplier[i][k];
+            }
+        }
+    }
+    return true;
 }
 
+}
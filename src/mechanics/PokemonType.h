@@ -22,6 +22,9 @@
  * online at http://gnu.org.
  */
 
+#ifndef _POKEMON_TYPE_H_
+#define _POKEMON_TYPE_H_
+
 #include <string>
 
 namespace shoddybattle {
@@ -30,6 +33,11 @@ class Text;
 
 const int TYPE_COUNT = 18;
 
+/**
+ * A set of types, with bit n set for the type whose value is n.
+ */
+typedef unsigned int TYPE_MASK;
+
 class PokemonType {
 public:
     /** Constants for all of the types. */
@@ -56,6 +64,16 @@ public:
         return m_multiplier[m_type][type.m_type];
     }
 
+    /**
+     * Get the combined effectiveness of an attacking type against a pokemon
+     * with the two given types. A pokemon with only one type should pass
+     * TYPELESS as its second type.
+     */
+    static double getEffectiveness(const int attack,
+            const int type1, const int type2) {
+        return m_effectiveness[attack][type1][type2];
+    }
+
     static const PokemonType *getByValue(const int idx) {
         return m_list[idx];
     }
@@ -73,11 +91,19 @@ public:
         return m_type;
     }
 
+    TYPE_MASK getMask() const {
+        return 1 << m_type;
+    }
+
 private:
     unsigned int m_type;
     std::string m_name; // "Canonical name" - not to be displayed to the user
     static const PokemonType *m_list[TYPE_COUNT];
     static const double m_multiplier[TYPE_COUNT][TYPE_COUNT];
+    static double m_effectiveness[TYPE_COUNT][TYPE_COUNT][TYPE_COUNT];
+    static const bool m_initialised;
+
+    static bool initialiseEffectiveness();
 
     PokemonType(int type, const std::string &name):
             m_type(type), m_name(name) { }
@@ -85,3 +111,4 @@ private:
 
 }
 
+#endif
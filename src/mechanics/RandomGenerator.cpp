@@ -0,0 +1,71 @@
+/* 
+ * File:   RandomGenerator.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include "RandomGenerator.h"
+
+using namespace boost;
+
+namespace shoddybattle {
+
+namespace {
+
+/**
+ * One step of the splitmix64 generator, which is used to spread a single
+ * seed across the state of the main generator.
+ */
+uint64_t splitMix(uint64_t &x) {
+    uint64_t z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+}
+
+void RandomGenerator::setSeed(const RANDOM_SEED seed) {
+    m_seed = seed;
+    uint64_t x = seed;
+    for (int i = 0; i < 4; ++i) {
+        m_state[i] = splitMix(x);
+    }
+}
+
+RANDOM_SEED RandomGenerator::deriveSeed(const RANDOM_SEED master,
+        const uint64_t stream) {
+    uint64_t s = stream;
+    uint64_t x = master ^ splitMix(s);
+    return splitMix(x);
+}
+
+RANDOM_SEED RandomGenerator::getEntropySeed() {
+    static mutex m;
+    static uint64_t counter = 0;
+    const posix_time::ptime epoch(gregorian::date(1970, 1, 1));
+    const uint64_t now = (posix_time::microsec_clock::universal_time()
+            - epoch).total_microseconds();
+    lock_guard<mutex> lock(m);
+    return deriveSeed(now, ++counter);
+}
+
+}
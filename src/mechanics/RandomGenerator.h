@@ -0,0 +1,126 @@
+/* 
+ * File:   RandomGenerator.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _RANDOM_GENERATOR_H_
+#define _RANDOM_GENERATOR_H_
+
+#include <boost/cstdint.hpp>
+
+namespace shoddybattle {
+
+typedef boost::uint64_t RANDOM_SEED;
+
+/**
+ * A small, fast pseudorandom number generator (xoshiro256**) used for
+ * everything random that happens in a battle. The whole state is derived
+ * from a single 64-bit seed, so a battle can be replayed exactly given
+ * the seed recorded in its log.
+ *
+ * This class is not thread safe; each battle owns its own generator.
+ */
+class RandomGenerator {
+public:
+    explicit RandomGenerator(const RANDOM_SEED seed = 0) {
+        setSeed(seed);
+    }
+
+    /**
+     * Reset the generator to the start of the stream for the given seed.
+     */
+    void setSeed(const RANDOM_SEED seed);
+
+    /**
+     * Get the seed that this generator was last seeded with.
+     */
+    RANDOM_SEED getSeed() const {
+        return m_seed;
+    }
+
+    /**
+     * Get the next 64 random bits.
+     */
+    boost::uint64_t next() {
+        const boost::uint64_t ret = rotate(m_state[1] * 5, 7) * 9;
+        const boost::uint64_t t = m_state[1] << 17;
+        m_state[2] ^= m_state[0];
+        m_state[3] ^= m_state[1];
+        m_state[1] ^= m_state[2];
+        m_state[0] ^= m_state[3];
+        m_state[2] ^= t;
+        m_state[3] = rotate(m_state[3], 45);
+        return ret;
+    }
+
+    /**
+     * Get a uniformly distributed integer in [lower, upper]. This uses a
+     * multiply and shift rather than a division, and only needs to retry
+     * in the rare case that the result would otherwise be biased.
+     */
+    int getInt(const int lower, const int upper) {
+        if (upper <= lower)
+            return lower;
+        const boost::uint32_t range =
+                boost::uint32_t(upper) - boost::uint32_t(lower) + 1;
+        if (range == 0)
+            return int(boost::uint32_t(next() >> 32));
+        boost::uint64_t m = (next() >> 32) * range;
+        if (boost::uint32_t(m) < range) {
+            const boost::uint32_t threshold = -range % range;
+            while (boost::uint32_t(m) < threshold) {
+                m = (next() >> 32) * range;
+            }
+        }
+        return int(boost::uint32_t(lower) + boost::uint32_t(m >> 32));
+    }
+
+    /**
+     * Return true with probability p.
+     */
+    bool getCoinFlip(const double p) {
+        // 53 random bits give a double uniformly distributed in [0, 1).
+        return (double(next() >> 11) * (1.0 / 9007199254740992.0)) < p;
+    }
+
+    /**
+     * Derive the seed of an independent stream, such as a single battle,
+     * from a master seed and the index of the stream.
+     */
+    static RANDOM_SEED deriveSeed(const RANDOM_SEED master,
+            const boost::uint64_t stream);
+
+    /**
+     * Get a fresh seed from the clock, for when no master seed is supplied.
+     * Calls made within the same microsecond still get different seeds.
+     */
+    static RANDOM_SEED getEntropySeed();
+
+private:
+    static boost::uint64_t rotate(const boost::uint64_t x, const int k) {
+        return (x << k) | (x >> (64 - k));
+    }
+
+    RANDOM_SEED m_seed;
+    boost::uint64_t m_state[4];
+};
+
+}
+
+#endif
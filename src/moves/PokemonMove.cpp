@@ -33,7 +33,11 @@
 #include <map>
 #include <vector>
 
+#include <boost/date_time/posix_time/posix_time.hpp>
+
 #include "PokemonMove.h"
+#include "../shoddybattle/GamePack.h"
+#include "../shoddybattle/XmlStream.h"
 #include "../mechanics/PokemonType.h"
 #include "../scripting/ScriptMachine.h"
 #include "../main/Log.h"
@@ -45,7 +49,7 @@ namespace shoddybattle {
 
 class MoveTemplateImpl {
 public:
-    MoveTemplateImpl(): targetClass(targetClass) {
+    MoveTemplateImpl(): targetClass(T_NONUSER) {
         power = 0;
         moveClass = MC_PHYSICAL;
         pp = 0;
@@ -155,97 +159,45 @@ bool hasChildElement(DOMElement *node, const string child) {
     return (list->getLength() != 0);
 }
 
-void getMove(DOMElement *node, MoveTemplateImpl *pMove,
-        ScriptContextPtr cx) {
-    DOMNamedNodeMap *attributes = node->getAttributes();
-    XMLCh tempStr[20];
-
-    // name
-    XMLString::transcode("name", tempStr, 19);
-    DOMNode *p = attributes->getNamedItem(tempStr);
-    if (p) {
-        pMove->name = getStringNodeValue(p);
-    }
-
-    // id
-    XMLString::transcode("id", tempStr, 19);
-    p = attributes->getNamedItem(tempStr);
-    if (p) {
-        pMove->id = getIntNodeValue(p);
-    }
-
-    // type
-    string type = getElementText(node, "type");
-    if (!type.empty()) {
-        pMove->type = PokemonType::getByCanonicalName(type);
-    }
-
-    // class
-    string cls = getElementText(node, "class");
-    if (!cls.empty()) {
-        MOVE_CLASS mc;
-        if (cls == "Special") {
-            mc = MC_SPECIAL;
-        } else if (cls == "Physical") {
-            mc = MC_PHYSICAL;
-        } else if (cls == "Other") {
-            mc = MC_OTHER;
-        } else {
-            Log::out() << "Error: Invalid move class: " << cls << endl;
-            mc = MC_OTHER;
-        }
-        pMove->moveClass = mc;
-    }
+typedef map<string, string> FIELD_MAP;
 
-    // flags
-    XMLString::transcode("flags", tempStr, 19);
-    DOMNodeList *list = node->getElementsByTagName(tempStr);
-    if (list->getLength() != 0) {
-        pMove->flags[F_CONTACT] = hasChildElement(node, "contact");
-        pMove->flags[F_PROTECT] = hasChildElement(node, "protect");
-        pMove->flags[F_FLINCH] = hasChildElement(node, "flinch");
-        pMove->flags[F_REFLECT] = hasChildElement(node, "reflect");
-        pMove->flags[F_SNATCH] = hasChildElement(node, "snatch");
-        pMove->flags[F_MEMORABLE] = hasChildElement(node, "memorable");
-        pMove->flags[F_HIGH_CRITICAL] = hasChildElement(node, "high-critical");
-        pMove->flags[F_UNIMPLEMENTED] = hasChildElement(node, "unimplemented");
-        pMove->flags[F_INTERNAL] = hasChildElement(node, "internal");
-        pMove->flags[F_NO_CRITICAL] = hasChildElement(node, "no-critical");
-        pMove->flags[F_SOUND] = hasChildElement(node, "sound");
-    }
+/**
+ * Names of the flag elements, in the order of the flags.
+ */
+const char *FLAG_NAMES[] = { "contact", "protect", "flinch", "reflect",
+        "snatch", "memorable", "high-critical", "unimplemented", "internal",
+        "no-critical", "sound" };
 
-    // power
-    string strPower = getElementText(node, "power");
-    if (!strPower.empty()) {
-        int i = atoi(strPower.c_str());
-        pMove->power = i;
-    }
+/**
+ * Names of the elements holding the functions of a move.
+ */
+const char *FUNCTION_NAMES[] = { "init", "use", "attemptHit" };
 
-    // pp
-    string strPp = getElementText(node, "pp");
-    if (!strPp.empty()) {
-        int i = atoi(strPp.c_str());
-        pMove->pp = i;
-    }
+/**
+ * Names of the other elements of a move that hold a value.
+ */
+const char *FIELD_NAMES[] = { "type", "class", "power", "pp", "priority",
+        "accuracy", "target" };
 
-    // priority
-    string strPriority = getElementText(node, "priority");
-    if (!strPriority.empty()) {
-        int i = atoi(strPriority.c_str());
-        pMove->priority = i;
-    } else {
-        pMove->priority = 0;
-    }
+const string &getField(const FIELD_MAP &fields, const string &name) {
+    static const string none;
+    FIELD_MAP::const_iterator i = fields.find(name);
+    return (i == fields.end()) ? none : i->second;
+}
 
-    // accuracy
-    string strAccuracy = getElementText(node, "accuracy");
-    if (!strAccuracy.empty()) {
-        double acc = atof(strAccuracy.c_str());
-        pMove->accuracy = acc;
+MOVE_CLASS moveClassFromName(const string &cls) {
+    if (cls == "Special") {
+        return MC_SPECIAL;
+    } else if (cls == "Physical") {
+        return MC_PHYSICAL;
+    } else if (cls == "Other") {
+        return MC_OTHER;
     }
+    Log::out() << "Error: Invalid move class: " << cls << endl;
+    return MC_OTHER;
+}
 
-    // target
-    string strTarget = getElementText(node, "target");
+TARGET targetFromName(const string &strTarget) {
     TARGET tc = T_NONUSER;
     if (strTarget == "Non-user") {
         tc = T_NONUSER;
@@ -274,39 +226,196 @@ void getMove(DOMElement *node, MoveTemplateImpl *pMove,
     } else {
         Log::out() << "Unknown target class: " << strTarget << endl;
     }
-    pMove->targetClass = tc;
+    return tc;
+}
+
+/**
+ * Fill in a move from the text of its elements, keyed by element name. An
+ * element that is present but empty maps to an empty string, which matters
+ * only for the flags.
+ */
+void setMoveFields(MOVE_DATA *pMove, const FIELD_MAP &fields) {
+    // type
+    pMove->type = getField(fields, "type");
+
+    // class
+    const string &cls = getField(fields, "class");
+    if (!cls.empty()) {
+        pMove->moveClass = moveClassFromName(cls);
+    }
+
+    // flags
+    if (fields.find("flags") != fields.end()) {
+        for (int i = 0; i < FLAG_COUNT; ++i) {
+            pMove->flags[i] = (fields.find(FLAG_NAMES[i]) != fields.end());
+        }
+    }
+
+    // power
+    const string &strPower = getField(fields, "power");
+    if (!strPower.empty()) {
+        pMove->power = atoi(strPower.c_str());
+    }
+
+    // pp
+    const string &strPp = getField(fields, "pp");
+    if (!strPp.empty()) {
+        pMove->pp = atoi(strPp.c_str());
+    }
+
+    // priority
+    const string &strPriority = getField(fields, "priority");
+    if (!strPriority.empty()) {
+        pMove->priority = atoi(strPriority.c_str());
+    } else {
+        pMove->priority = 0;
+    }
+
+    // accuracy
+    const string &strAccuracy = getField(fields, "accuracy");
+    if (!strAccuracy.empty()) {
+        pMove->accuracy = atof(strAccuracy.c_str());
+    }
+
+    // target
+    pMove->targetClass = targetFromName(getField(fields, "target"));
+
+    // functions
+    pMove->initFunction = getField(fields, "init");
+    pMove->useFunction = getField(fields, "use");
+    pMove->attemptHit = getField(fields, "attemptHit");
+}
+
+void getMove(DOMElement *node, MOVE_DATA *pMove) {
+    DOMNamedNodeMap *attributes = node->getAttributes();
+    XMLCh tempStr[20];
+
+    // name
+    XMLString::transcode("name", tempStr, 19);
+    DOMNode *p = attributes->getNamedItem(tempStr);
+    if (p) {
+        pMove->name = getStringNodeValue(p);
+    }
+
+    // id
+    XMLString::transcode("id", tempStr, 19);
+    p = attributes->getNamedItem(tempStr);
+    if (p) {
+        pMove->id = getIntNodeValue(p);
+    }
+
+    FIELD_MAP fields;
+    for (unsigned int i = 0; i < sizeof(FIELD_NAMES) / sizeof(char *); ++i) {
+        fields[FIELD_NAMES[i]] = getElementText(node, FIELD_NAMES[i]);
+    }
+    for (unsigned int i = 0; i < sizeof(FUNCTION_NAMES) / sizeof(char *); ++i) {
+        fields[FUNCTION_NAMES[i]] =
+                getElementText(node, FUNCTION_NAMES[i], true);
+    }
+    if (hasChildElement(node, "flags")) {
+        fields["flags"];
+        for (int i = 0; i < FLAG_COUNT; ++i) {
+            if (hasChildElement(node, FLAG_NAMES[i])) {
+                fields[FLAG_NAMES[i]];
+            }
+        }
+    }
+    setMoveFields(pMove, fields);
+}
+
+/**
+ * Streaming reader for the moves file, which collects the text of the
+ * elements inside each move and then fills in its MOVE_DATA.
+ */
+class MoveHandler : public XmlStreamHandler {
+public:
+    MoveHandler(vector<MOVE_DATA> &moves): m_moves(moves), m_depth(0) { }
+
+protected:
+    void openElement(const string &name, const Attributes &attributes) {
+        if (m_depth == 0) {
+            if (name != "move")
+                return;
+            m_depth = getDepth();
+            m_moves.push_back(MOVE_DATA());
+            MOVE_DATA &move = m_moves.back();
+            move.name = getAttribute(attributes, "name");
+            const string id = getAttribute(attributes, "id");
+            if (!id.empty()) {
+                move.id = atoi(id.c_str());
+            }
+            m_fields.clear();
+        }
+    }
+
+    void closeElement(const string &name, const string &text) {
+        if (m_depth == 0)
+            return;
+        if (getDepth() == m_depth) {
+            setMoveFields(&m_moves.back(), m_fields);
+            m_depth = 0;
+        } else {
+            // The first element of each name wins, as in getMove.
+            m_fields.insert(FIELD_MAP::value_type(name, text));
+        }
+    }
+
+private:
+    vector<MOVE_DATA> &m_moves;
+    FIELD_MAP m_fields;
+    int m_depth;
+};
+
+/**
+ * Build a move from its data, compiling its functions.
+ */
+MoveTemplateImpl *getMoveTemplate(const MOVE_DATA &data, ScriptContextPtr cx) {
+    MoveTemplateImpl *pMove = new MoveTemplateImpl();
+    pMove->name = data.name;
+    pMove->id = data.id;
+    if (!data.type.empty()) {
+        pMove->type = PokemonType::getByCanonicalName(data.type);
+    }
+    pMove->moveClass = data.moveClass;
+    pMove->targetClass = data.targetClass;
+    pMove->power = data.power;
+    pMove->pp = data.pp;
+    pMove->priority = data.priority;
+    pMove->accuracy = data.accuracy;
+    pMove->flags = data.flags;
 
     // init function
-    string body = getElementText(node, "init", true);
-    if (!body.empty()) {
+    if (!data.initFunction.empty()) {
         string error = pMove->name + "::init";
         vector<string> args;
-        pMove->initFunction = cx->compileFunction(args, body, error, 1);
+        pMove->initFunction = cx->compileFunction(args, data.initFunction,
+                error, 1);
     }
 
     // use function
-    body = getElementText(node, "use", true);
-    if (!body.empty()) {
+    if (!data.useFunction.empty()) {
         string error = pMove->name + "::use";
         vector<string> args;
         args.push_back("field");
         args.push_back("user");
         args.push_back("target");
         args.push_back("targets");  // number of targets remaining alive
-        pMove->useFunction = cx->compileFunction(args, body, error, 1);
+        pMove->useFunction = cx->compileFunction(args, data.useFunction,
+                error, 1);
     }
 
     // attemptHit function
-    body = getElementText(node, "attemptHit", true);
-    if (!body.empty()) {
+    if (!data.attemptHit.empty()) {
         string error = pMove->name + "::attemptHit";
         vector<string> args;
         args.push_back("field");
         args.push_back("user");
         args.push_back("target");
-        pMove->attemptHit = cx->compileFunction(args, body, error, 1);
+        pMove->attemptHit = cx->compileFunction(args, data.attemptHit,
+                error, 1);
     }
 
+    return pMove;
 }
 
 MoveTemplate::MoveTemplate(MoveTemplateImpl *p) {
@@ -317,7 +426,20 @@ MoveTemplate::~MoveTemplate() {
     delete m_pImpl;
 }
 
-void MoveDatabase::loadMoves(const string file) {
+bool MoveDatabase::parseMoves(const string file, vector<MOVE_DATA> &moves) {
+    moves.clear();
+    MoveHandler handler(moves);
+    if (!handler.parse(file)) {
+        Log::out() << "Error: Could not parse " << file << "." << endl;
+        moves.clear();
+        return false;
+    }
+    return true;
+}
+
+bool MoveDatabase::parseMovesDocument(const string file,
+        vector<MOVE_DATA> &moves) {
+    moves.clear();
     XMLPlatformUtils::Initialize();
     XercesDOMParser parser;
     //parser.setDoSchema(true);
@@ -330,22 +452,57 @@ void MoveDatabase::loadMoves(const string file) {
     parser.parse(file.c_str());
 
     DOMDocument *doc = parser.getDocument();
-    DOMElement *root = doc->getDocumentElement();
+    DOMElement *root = doc ? doc->getDocumentElement() : NULL;
+    if ((parser.getErrorCount() != 0) || !root) {
+        Log::out() << "Error: Could not parse " << file << "." << endl;
+        return false;
+    }
 
     XMLCh tempStr[12];
     XMLString::transcode("move", tempStr, 11);
     DOMNodeList *list = root->getElementsByTagName(tempStr);
 
+    const int length = list->getLength();
+    moves.resize(length);
+    for (int i = 0; i < length; ++i) {
+        DOMElement *item = (DOMElement *)list->item(i);
+        shoddybattle::getMove(item, &moves[i]);
+    }
+    return true;
+}
+
+bool MoveDatabase::readMoves(const string file, vector<MOVE_DATA> &moves) {
+    const boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
+    // A file that does not parse is never written to the pack, so that its
+    // partial records are not served on later starts.
+    const bool packed = GamePack::read(file, moves);
+    if (!packed && parseMoves(file, moves)) {
+        GamePack::write(file, moves);
+    }
+
+    const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+    Log::out() << "Read " << moves.size() << " moves from "
+            << (packed ? "the game data pack" : file) << " in "
+            << elapsed.total_milliseconds() << " ms." << endl;
+
+    return !moves.empty();
+}
+
+void MoveDatabase::loadMoves(const vector<MOVE_DATA> &moves) {
+    const boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
     ScriptContextPtr cx = m_machine.acquireContext();
 
     Log::out() << "Unimplemented moves:" << endl;
 
     int implemented = 0;
-    int length = list->getLength();
+    const int length = moves.size();
     for (int i = 0; i < length; ++i) {
-        DOMElement *item = (DOMElement *)list->item(i);
-        MoveTemplateImpl *move = new MoveTemplateImpl();
-        shoddybattle::getMove(item, move, cx);
+        MoveTemplateImpl *move = getMoveTemplate(moves[i], cx);
 
         if (!move->flags[F_UNIMPLEMENTED]) {
             ++implemented;
@@ -354,22 +511,45 @@ void MoveDatabase::loadMoves(const string file) {
         }
 
         MoveTemplate *pMove = new MoveTemplate(move);
-        m_data.insert(MOVE_DATABASE::value_type(move->name, pMove));
-        m_intData.insert(INT_MOVE_DATABASE::value_type(move->id, move->name));
+        if (!m_names.insert(
+                MOVE_NAME_INDEX::value_type(move->name, pMove)).second) {
+            Log::out() << "Warning: Duplicate move: " << move->name << endl;
+            delete pMove;
+            continue;
+        }
+        const int id = move->id;
+        if (id < 0) {
+            Log::out() << "Warning: Invalid move ID: " << id << endl;
+            continue;
+        }
+        if (id >= (int)m_data.size()) {
+            m_data.resize(id + 1, NULL);
+        }
+        if (m_data[id] != NULL) {
+            Log::out() << "Warning: Duplicate move ID: " << id << endl;
+            continue;
+        }
+        m_data[id] = pMove;
     }
     Log::out() << implemented << " / " << length << " moves implemented." << endl;
+
+    const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+    Log::out() << "Compiled " << length << " moves in "
+            << elapsed.total_milliseconds() << " ms." << endl;
+}
+
+void MoveDatabase::loadMoves(const string file) {
+    vector<MOVE_DATA> moves;
+    readMoves(file, moves);
+    loadMoves(moves);
 }
 
 MoveDatabase::~MoveDatabase() {
     ScriptContextPtr cx = m_machine.acquireContext();
-    MOVE_DATABASE::iterator i = m_data.begin();
-    for (; i != m_data.end(); ++i) {
-        MoveTemplate *move = i->second;
-        if (move == NULL) {
-            //Log::out() << "Missing move: " << i->first << endl;
-            continue;
-        }
-        delete move;
+    MOVE_NAME_INDEX::iterator i = m_names.begin();
+    for (; i != m_names.end(); ++i) {
+        delete i->second;
     }
 }
 
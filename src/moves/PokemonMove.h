@@ -27,8 +27,10 @@
 
 #include <string>
 #include <map>
+#include <vector>
 #include <bitset>
 #include <boost/shared_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include "../mechanics/stat.h"
 
 namespace shoddybattle {
@@ -67,6 +69,29 @@ class ScriptFunction;
 
 class MoveTemplateImpl;
 
+/**
+ * A move as read from the moves XML file, before its functions are compiled
+ * into a MoveTemplate.
+ */
+struct MOVE_DATA {
+    std::string name;
+    int id;
+    std::string type;
+    MOVE_CLASS moveClass;
+    TARGET targetClass;
+    unsigned int power;
+    unsigned int pp;
+    int priority;
+    double accuracy;
+    std::bitset<FLAG_COUNT> flags;
+    std::string initFunction;       // function bodies
+    std::string useFunction;
+    std::string attemptHit;
+
+    MOVE_DATA(): id(-1), moveClass(MC_PHYSICAL), targetClass(T_NONUSER),
+            power(0), pp(0), priority(0), accuracy(1.00) { }
+};
+
 class MoveTemplate {
 public:
     std::string getName() const;
@@ -93,44 +118,88 @@ private:
     MoveTemplate &operator=(const MoveTemplate &);
 };
 
-typedef std::map<std::string, MoveTemplate *> MOVE_DATABASE;
-typedef std::map<int, std::string> INT_MOVE_DATABASE;
+/** Moves indexed by ID. IDs with no move hold NULL. **/
+typedef std::vector<MoveTemplate *> MOVE_DATABASE;
+typedef boost::unordered_map<std::string, MoveTemplate *> MOVE_NAME_INDEX;
 
 class MoveDatabase {
 public:
     MoveDatabase(ScriptMachine &machine): m_machine(machine) { }
 
     /**
-     * Load moves from an xml file. Can be called more than once.
+     * Load moves from an xml file. Can be called more than once. The moves
+     * are read from the game data pack if it is up to date with the file;
+     * otherwise the file is parsed and the pack is updated.
      */
     void loadMoves(const std::string file);
 
     /**
-     * Get a move by ID.
+     * Build moves that have already been read, compiling their functions.
+     */
+    void loadMoves(const std::vector<MOVE_DATA> &moves);
+
+    /**
+     * Read the moves from a moves XML file without building them, using the
+     * game data pack in the same way as loadMoves. This does not need a
+     * script context, so it can run on any thread. Returns false if no moves
+     * were read.
+     */
+    static bool readMoves(const std::string file,
+            std::vector<MOVE_DATA> &moves);
+
+    /**
+     * Parse a moves XML file, streaming it through a SAX2 reader. Returns
+     * false, with no moves, if the file could not be parsed.
+     */
+    static bool parseMoves(const std::string file,
+            std::vector<MOVE_DATA> &moves);
+
+    /**
+     * Parse a moves XML file by building a DOM tree of the whole file. This
+     * was the original loader; it is kept to compare against the streaming
+     * parser. Returns false if the file could not be parsed.
+     */
+    static bool parseMovesDocument(const std::string file,
+            std::vector<MOVE_DATA> &moves);
+
+    /**
+     * Get the name of a move by ID, or an empty string if there is no move
+     * with that ID.
      */
     std::string getMove(const int id) const {
-        return m_intData[id];
+        const MoveTemplate *move = getMoveById(id);
+        return move ? move->getName() : std::string();
+    }
+
+    /**
+     * Get a move by ID, or NULL if there is no move with that ID.
+     */
+    const MoveTemplate *getMoveById(const int id) const {
+        if ((id < 0) || (id >= (int)m_data.size()))
+            return NULL;
+        return m_data[id];
     }
 
     /**
-     * Get the number of moves.
+     * Get the number of move IDs, which is one more than the highest ID.
      */
     int getMoveCount() const {
-        return m_intData.size();
+        return m_data.size();
     }
 
     /**
-     * Get a move by name.
+     * Get a move by name, or NULL if there is no move with that name.
      */
-    const MoveTemplate *getMove(const std::string name) const {
-        return m_data[name];
+    const MoveTemplate *getMove(const std::string &name) const {
+        MOVE_NAME_INDEX::const_iterator i = m_names.find(name);
+        return (i == m_names.end()) ? NULL : i->second;
     }
 
     ~MoveDatabase();
 
 private:
-    mutable MOVE_DATABASE m_data;
-    mutable INT_MOVE_DATABASE m_intData;
+    MOVE_DATABASE m_data;
+    MOVE_NAME_INDEX m_names;    // owns the moves
     ScriptMachine &m_machine;
     MoveDatabase(const MoveDatabase &);
     MoveDatabase &operator=(const MoveDatabase &);
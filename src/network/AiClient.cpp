@@ -0,0 +1,206 @@
+/* 
+ * File:   AiClient.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <vector>
+#include <cstring>
+#include <arpa/inet.h>
+#include <boost/bind.hpp>
+#include "AiClient.h"
+#include "NetworkBattle.h"
+#include "../shoddybattle/RolloutPool.h"
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle { namespace network {
+
+namespace {
+
+int32_t readInt32(const OutMessageBuffer &buffer, size_t &pos) {
+    int32_t i;
+    memcpy(&i, &buffer[pos], sizeof(int32_t));
+    pos += sizeof(int32_t);
+    return ntohl(i);
+}
+
+void readFlags(const OutMessageBuffer &buffer, size_t &pos,
+        vector<bool> &flags) {
+    const int count = readInt32(buffer, pos);
+    for (int i = 0; i < count; ++i) {
+        flags.push_back(buffer[pos++] != 0);
+    }
+}
+
+int getFirstLegal(const vector<bool> &flags) {
+    const int size = flags.size();
+    for (int i = 0; i < size; ++i) {
+        if (flags[i])
+            return i;
+    }
+    return -1;
+}
+
+/**
+ * Fork a battle under its lock, if it still exists. Only a weak reference is
+ * held, because the battle in turn holds the client that owns the search.
+ */
+boost::shared_ptr<BattleField> forkBattle(weak_ptr<NetworkBattle> battle,
+        const BattleMechanics *mech, boost::shared_ptr<ScriptContext> cx) {
+    NetworkBattle::PTR p = battle.lock();
+    if (!p) {
+        throw BattleFieldException();
+    }
+    return p->forkLocked(mech, cx);
+}
+
+} // anonymous namespace
+
+AiClient::AiClient(RolloutPool *pool,
+        const string &name,
+        const int id,
+        const MonteCarloOptions &options,
+        const RANDOM_SEED seed):
+        m_pool(pool),
+        m_name(name),
+        m_id(id),
+        m_options(options),
+        m_seeds(seed) { }
+
+void AiClient::insertBattle(NetworkBattle::PTR battle) {
+    lock_guard<mutex> guard(m_mutex);
+    m_battles[battle->getId()].battle = battle;
+}
+
+void AiClient::terminateBattle(NetworkBattle::PTR battle, ClientPtr client) {
+    {
+        lock_guard<mutex> guard(m_mutex);
+        BATTLE_MAP::iterator i = m_battles.find(battle->getId());
+        if (i != m_battles.end()) {
+            SEARCH_MAP &searches = i->second.searches;
+            for (SEARCH_MAP::iterator j = searches.begin();
+                    j != searches.end(); ++j) {
+                j->second->cancel();
+            }
+            m_battles.erase(i);
+        }
+    }
+    if (client) {
+        client->terminateBattle(battle, ClientPtr());
+    }
+}
+
+void AiClient::sendMessage(const OutMessage &msg) {
+    const OutMessageBuffer &buffer = msg();
+    if (!buffer.empty() && (buffer[0] == OutMessage::REQUEST_ACTION)) {
+        handleRequest(buffer);
+    }
+}
+
+/**
+ * Respond to a REQUEST_ACTION message. The response is always made from a
+ * pool thread, because the battle sends the request while it is in the
+ * middle of processing the previous action.
+ */
+void AiClient::handleRequest(const OutMessageBuffer &buffer) {
+    size_t pos = HEADER_SIZE;
+    const int32_t id = readInt32(buffer, pos);
+    const int slot = buffer[pos++];
+    ++pos; // position
+    const bool replacement = buffer[pos++];
+    pos += 2; // index and number of sequential requests
+    vector<bool> switches, moves;
+    readFlags(buffer, pos, switches);
+    bool switchLegal = false, forced = false;
+    if (!replacement) {
+        switchLegal = buffer[pos++];
+        forced = buffer[pos++];
+        if (!forced) {
+            readFlags(buffer, pos, moves);
+        }
+    }
+
+    lock_guard<mutex> guard(m_mutex);
+    BATTLE_MAP::iterator i = m_battles.find(id);
+    if (i == m_battles.end())
+        return;
+    NetworkBattle::PTR battle = i->second.battle.lock();
+    if (!battle)
+        return;
+    const int party = battle->getParty(shared_from_this());
+    if (party == -1)
+        return;
+
+    // A new request for a slot replaces any search still running for it.
+    SEARCH_MAP &searches = i->second.searches;
+    SEARCH_MAP::iterator j = searches.find(slot);
+    if (j != searches.end()) {
+        j->second->cancel();
+        searches.erase(j);
+    }
+
+    if (replacement || forced) {
+        const PokemonTurn turn = replacement ?
+                PokemonTurn(TT_SWITCH, getFirstLegal(switches)) :
+                PokemonTurn();
+        m_pool->post(bind(&AiClient::handleChoice, shared_from_this(),
+                id, party, slot, turn));
+        return;
+    }
+
+    // Used only if the search cannot fork the battle.
+    const int move = getFirstLegal(moves);
+    const PokemonTurn fallback = ((move == -1) && switchLegal) ?
+            PokemonTurn(TT_SWITCH, getFirstLegal(switches)) :
+            PokemonTurn(TT_MOVE, move,
+                (1 - party) * battle->getPartySize());
+    // The search may only choose what the request offers, which rules out a
+    // switch to a pokemon that another slot is already switching in.
+    LegalActions legal;
+    legal.moves = moves;
+    legal.switches = switches;
+    if (!switchLegal) {
+        legal.switches.assign(switches.size(), false);
+    }
+    searches[slot] = MonteCarloSearch::begin(m_pool,
+            bind(&forkBattle, i->second.battle, _1, _2), party,
+            slot, m_options, m_seeds.next(), fallback, legal,
+            bind(&AiClient::handleChoice, shared_from_this(), id, party,
+                slot, _1),
+            battle->getSharedMachine());
+}
+
+void AiClient::handleChoice(const int32_t id, const int party,
+        const int slot, const PokemonTurn &turn) {
+    NetworkBattle::PTR battle;
+    {
+        lock_guard<mutex> guard(m_mutex);
+        BATTLE_MAP::iterator i = m_battles.find(id);
+        if (i == m_battles.end())
+            return;
+        i->second.searches.erase(slot);
+        battle = i->second.battle.lock();
+    }
+    if (battle) {
+        battle->handleTurn(party, turn);
+    }
+}
+
+}} // namespace shoddybattle::network
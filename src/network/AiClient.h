@@ -0,0 +1,101 @@
+/* 
+ * File:   AiClient.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _AI_CLIENT_H_
+#define _AI_CLIENT_H_
+
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/thread/mutex.hpp>
+#include "network.h"
+#include "../shoddybattle/MonteCarloPolicy.h"
+
+namespace shoddybattle { namespace network {
+
+class NetworkBattle;
+
+/**
+ * A client played by the server itself. An AiClient is seated in a
+ * NetworkBattle in the same way as a human client, and answers each
+ * REQUEST_ACTION message with a MonteCarloSearch, limited to the actions
+ * that the request offers, run on a RolloutPool that is shared by every
+ * AiClient, so no battle thread is ever blocked by the search. Each search runs on contexts of its battle's own machine, so one
+ * pool serves battles on every data generation. Replacements are chosen in
+ * team order. All other messages are ignored.
+ */
+class AiClient : public Client,
+        public boost::enable_shared_from_this<AiClient> {
+public:
+    typedef boost::shared_ptr<AiClient> PTR;
+
+    AiClient(RolloutPool *pool,
+            const std::string &name,
+            const int id,
+            const MonteCarloOptions &options,
+            const RANDOM_SEED seed);
+
+    /**
+     * Add a battle in which this client is one of the participants.
+     */
+    void insertBattle(boost::shared_ptr<NetworkBattle>);
+
+    void sendMessage(const OutMessage &msg);
+    std::string getName() const {
+        return m_name;
+    }
+    std::string getIp() const {
+        return "127.0.0.1";
+    }
+    int getId() const {
+        return m_id;
+    }
+    void terminateBattle(boost::shared_ptr<NetworkBattle>, ClientPtr);
+    void joinChannel(boost::shared_ptr<Channel>) { }
+    void partChannel(boost::shared_ptr<Channel>) { }
+    void informBanned(int) { }
+
+private:
+    typedef std::map<int, MonteCarloSearch::PTR> SEARCH_MAP;
+    struct BattleState {
+        boost::weak_ptr<NetworkBattle> battle;
+        SEARCH_MAP searches;    // by active slot
+    };
+    typedef std::map<int32_t, BattleState> BATTLE_MAP;
+
+    void handleRequest(const OutMessageBuffer &);
+    void handleChoice(const int32_t id, const int party, const int slot,
+            const PokemonTurn &turn);
+
+    RolloutPool *m_pool;
+    const std::string m_name;
+    const int m_id;
+    const MonteCarloOptions m_options;
+    RandomGenerator m_seeds;
+    boost::mutex m_mutex;
+    BATTLE_MAP m_battles;
+};
+
+}} // namespace shoddybattle::network
+
+#endif
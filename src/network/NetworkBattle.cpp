@@ -164,6 +164,30 @@ string getLogValue(const string &v) {
     return "\"" + ret + "\"";
 }
 
+// Express an amount of hp in 48ths of a pokemon's total hp, in the same way
+// as the approximate BATTLE_HEALTH_CHANGE message.
+int16_t getApproximateHealth(const int hp, const int total) {
+    const int ret = floor(48.0 * (double)hp / (double)total + 0.5);
+    return (ret > 48) ? 48 : ret;
+}
+
+// Make a pokemon in a fork look as it does to its opponent, who cannot know
+// its item or ability and can only estimate its stats from its species and
+// level.
+void concealPokemon(const BattleMechanics &mech, Pokemon &p) {
+    StatusObjectPtr item = p.getItem();
+    if (item) {
+        p.removeStatus(item.get());
+    }
+    StatusObjectPtr ability = p.getAbility();
+    if (ability) {
+        p.removeStatus(ability.get());
+    }
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        p.setRawStat(STAT(i), mech.calculateTypicalStat(p, STAT(i)));
+    }
+}
+
 }
 
 /**
@@ -335,6 +359,9 @@ struct NetworkBattleImpl {
     TimerPtr m_timer;
     BattleLog *m_log;
     ThreadedQueue<TURN_PTR> m_queue;
+    // The last DAMAGE_RANGES message sent to each party, and its turn.
+    boost::shared_ptr<OutMessage> m_damageRanges[TEAM_COUNT];
+    int m_damageRangeTurn[TEAM_COUNT];
 
     static TimerList m_timerList;
     static boost::recursive_mutex m_timerMutex;
@@ -342,6 +369,7 @@ struct NetworkBattleImpl {
 
     NetworkBattleImpl(Server *server, NetworkBattle *p, TimerOptions &t):
             m_server(server),
+            m_mech(server->getBattleSeed()),
             m_field(p),
             m_channel(BattleChannelPtr(
                 BattleChannel::createChannel(server, this))),
@@ -358,6 +386,9 @@ struct NetworkBattleImpl {
         } else {
             m_timer = TimerPtr(new Timer());
         }
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            m_damageRangeTurn[i] = -1;
+        }
     }
     
     ~NetworkBattleImpl() {
@@ -494,7 +525,8 @@ struct NetworkBattleImpl {
         const Text *text = m_field->getScriptMachine()->getText();
         const int natureId = nature->getInternalValue();
         ss << natureId << " ("
-                << getLogValue(text->getText(1, natureId, 0, NULL))
+                << getLogValue(text->getText(1, natureId, 0,
+                        (const char **)NULL))
                 << ")" << endl;
         ss << p->getGender() << endl;
         for (int i = 0; i < STAT_COUNT; ++i) {
@@ -507,8 +539,7 @@ struct NetworkBattleImpl {
         ss << endl;
         const int moves = p->getMoveCount();
         for (int i = 0; i < moves; ++i) {
-            MoveObjectPtr move = p->getMove(i);
-            const MoveTemplate *tpl = move->getTemplate();
+            const MoveTemplate *tpl = p->getMoveTemplate(i);
             if (tpl) {
                 ss << tpl->getId() << " ("
                         << getLogValue(tpl->getName()) << ")" << endl;
@@ -525,7 +556,8 @@ struct NetworkBattleImpl {
             swap(trainer0, trainer1);
         }
         ret << getLogValue(trainer0) << " v. " << getLogValue(trainer1) << endl;
-        ret << "Battle ID: " << m_log->getId() << endl << endl;
+        ret << "Battle ID: " << m_log->getId() << endl;
+        ret << "Seed: " << m_mech.getSeed() << endl << endl;
         for (int i = 0; i < TEAM_COUNT; ++i) {
             ClientPtr client = m_clients[i];
             ret << "Player " << i << ": "
@@ -802,6 +834,99 @@ struct NetworkBattleImpl {
         m_timer->startTimer(party);
     }
 
+    /**
+     * DAMAGE_RANGES
+     *
+     * int32 : field id
+     * byte  : number of active pokemon
+     * for each active pokemon:
+     *      byte : slot
+     *      byte : number of moves
+     *      for each move:
+     *          byte : number of targets (zero if the move does not use the
+     *                 damage formula)
+     *          for each target:
+     *              byte  : slot of the target in the opposing party
+     *              int16 : minimum damage
+     *              int16 : maximum damage
+     *              int16 : minimum damage from a critical hit
+     *              int16 : maximum damage from a critical hit
+     *
+     * Damage is given in 48ths of the target's total hp, as if the move hit
+     * only that target. Moves whose scripts do not use the damage formula
+     * directly may do different damage in practice.
+     *
+     * The moves are tried on a fork of the battle, so that their scripts (a
+     * resist berry being eaten, for example) cannot change the battle. The
+     * opponents in the fork are shown only as far as the player can see
+     * them: without their items and abilities, and with the typical stats
+     * of their species and level. Returns NULL if the battle cannot be
+     * forked.
+     */
+    boost::shared_ptr<OutMessage> getDamageRanges(const int party) {
+        JewelMechanics mech;
+        boost::shared_ptr<BattleField> fork;
+        try {
+            fork = m_field->fork(&mech);
+        } catch (BattleFieldException &) {
+            return boost::shared_ptr<OutMessage>();
+        }
+        const int size = fork->getPartySize();
+        Pokemon::ARRAY users, targets;
+        for (int i = 0; i < size; ++i) {
+            Pokemon::PTR p = fork->getActivePokemon(party, i);
+            if (p && !p->isFainted()) {
+                users.push_back(p);
+            }
+            p = fork->getActivePokemon(1 - party, i);
+            if (p && !p->isFainted()) {
+                concealPokemon(mech, *p);
+                targets.push_back(p);
+            }
+        }
+
+        boost::shared_ptr<OutMessage> msg(
+                new OutMessage(OutMessage::DAMAGE_RANGES));
+        *msg << m_field->getId();
+        *msg << (unsigned char)users.size();
+        const int targetCount = targets.size();
+        vector<DamageRange> ranges(targetCount);
+        for (Pokemon::ARRAY::const_iterator i = users.begin();
+                i != users.end(); ++i) {
+            Pokemon *user = i->get();
+            const int moves = user->getMoveCount();
+            *msg << (unsigned char)user->getSlot();
+            *msg << (unsigned char)moves;
+            for (int j = 0; j < moves; ++j) {
+                MoveObjectPtr move = user->getMove(j);
+                bool damaging = (move.get() != NULL);
+                for (int k = 0; damaging && (k < targetCount); ++k) {
+                    damaging = mech.getDamageRange(*fork, *move, *user,
+                            *targets[k], 1, ranges[k]);
+                }
+                if (!damaging) {
+                    *msg << (unsigned char)0;
+                    continue;
+                }
+                *msg << (unsigned char)targetCount;
+                for (int k = 0; k < targetCount; ++k) {
+                    const DamageRange &range = ranges[k];
+                    const int hp = targets[k]->getRawStat(S_HP);
+                    *msg << (unsigned char)targets[k]->getSlot();
+                    *msg << getApproximateHealth(range.normal[0], hp);
+                    *msg << getApproximateHealth(
+                            range.normal[DAMAGE_ROLLS - 1], hp);
+                    *msg << getApproximateHealth(range.critical[0], hp);
+                    *msg << getApproximateHealth(
+                            range.critical[DAMAGE_ROLLS - 1], hp);
+                }
+            }
+        }
+        msg->finalise();
+        fork->terminate();
+        return msg;
+    }
+
     bool requestReplacements() {
         boost::lock_guard<boost::recursive_mutex> lock(m_mutex);
 
@@ -989,10 +1114,11 @@ void NetworkBattle::terminate() {
     m_impl->m_clients[0]->terminateBattle(p, m_impl->m_clients[1]);
     BattleField::terminate();
     // TODO: Maybe a better way to collect garbage here.
-    m_impl->m_server->getMachine()->acquireContext()->maybeGc();
+    m_machine->acquireContext()->maybeGc();
 }
 
 NetworkBattle::NetworkBattle(Server *server,
+        boost::shared_ptr<ScriptMachine> machine,
         ClientPtr *clients,
         Pokemon::ARRAY *teams,
         Generation *generation,
@@ -1002,7 +1128,8 @@ NetworkBattle::NetworkBattle(Server *server,
         network::TimerOptions t,
         const int metagame,
         const bool rated,
-        boost::shared_ptr<void> &monitor) {
+        boost::shared_ptr<void> &monitor):
+        m_machine(machine) {
     m_impl = boost::shared_ptr<NetworkBattleImpl>(
             new NetworkBattleImpl(server, this, t));
     m_impl->m_maxTeamLength = maxTeamLength;
@@ -1036,11 +1163,17 @@ NetworkBattle::NetworkBattle(Server *server,
             + boost::lexical_cast<string>(int(rated));
     m_impl->m_channel->setTopic(topic); // locks Channel's mutex
 
-    BattleField::initialise(&m_impl->m_mech, generation, server->getMachine(),
+    BattleField::initialise(&m_impl->m_mech, generation, m_machine.get(),
             teams, &m_impl->m_trainer[0], partySize, clauses);
     m_impl->writeLogHeader();
 }
 
+NetworkBattle::~NetworkBattle() {
+    // Release the script objects of the battle while the machine that owns
+    // them is certainly still alive.
+    BattleField::terminate();
+}
+
 int32_t NetworkBattle::getId() const {
     return m_impl->m_channel->getId();
 }
@@ -1078,6 +1211,33 @@ void NetworkBattle::handleCancelTurn(const int party) {
     m_impl->cancelAction(party);
 }
 
+/**
+ * Send a player the damage that each of their active pokemon's moves would do
+ * to each opposing pokemon. This is only possible while moves are being
+ * chosen, and the message is built at most once per turn for each player.
+ */
+void NetworkBattle::handleDamageRangeRequest(const int party) {
+    boost::lock_guard<boost::recursive_mutex> lock(m_impl->m_mutex);
+    if (m_impl->m_terminated || m_impl->m_victory
+            || m_impl->m_replacement || m_impl->m_waiting) {
+        return;
+    }
+    ClientPtr client = m_impl->getClient(party);
+    if (!client) {
+        return;
+    }
+    boost::shared_ptr<OutMessage> &msg = m_impl->m_damageRanges[party];
+    if (!msg || (m_impl->m_damageRangeTurn[party] != m_impl->m_turnCount)) {
+        ScriptContextPtr cx = getContext()->shared_from_this();
+        ScriptContextLock cxLock(cx);
+        msg = m_impl->getDamageRanges(party);
+        m_impl->m_damageRangeTurn[party] = m_impl->m_turnCount;
+    }
+    if (msg) {
+        client->sendMessage(*msg);
+    }
+}
+
 void NetworkBattle::handleTurn(const int party, const PokemonTurn &turn) {
     boost::unique_lock<boost::recursive_mutex> lock(m_impl->m_mutex);
     
@@ -1131,6 +1291,15 @@ void NetworkBattle::handleTurn(const int party, const PokemonTurn &turn) {
     }
 }
 
+boost::shared_ptr<BattleField> NetworkBattle::forkLocked(
+        const BattleMechanics *mech, boost::shared_ptr<ScriptContext> cx) {
+    boost::lock_guard<boost::recursive_mutex> lock(m_impl->m_mutex);
+    if (m_impl->m_terminated) {
+        throw BattleFieldException();
+    }
+    return BattleField::fork(mech, cx);
+}
+
 Pokemon *NetworkBattle::requestInactivePokemon(Pokemon *pokemon) {
     return m_impl->requestInactivePokemon(pokemon);
 }
@@ -1153,11 +1322,10 @@ void NetworkBattle::print(const TextMessage &text) {
     msg << this;
     msg << Entity<unsigned char>(text.getCategory(), "category");
     msg << Entity<int16_t>(text.getMessage(), "message");
-    const vector<string> &args = text.getArgs();
-    const int count = args.size();
+    const int count = text.getArgCount();
     msg << Entity<unsigned char>(count);
     for (int i = 0; i < count; ++i) {
-        msg << ArrayEntity<string>(args[i], "token", i);
+        msg << ArrayEntity<string>(text.getArg(i), "token", i);
     }
     msg.finalise();
     *m_impl->m_log << msg;
@@ -34,6 +34,7 @@
 
 namespace shoddybattle {
     class Pokemon;
+    class ScriptMachine;
 } // namespace shoddybattle
 
 namespace shoddybattle { namespace network {
@@ -50,7 +51,13 @@ public:
     
     static void startTimerThread();
     
+    /**
+     * Create a battle that runs its scripts on the given machine. The battle
+     * holds a reference to the machine until it is destroyed, so a machine
+     * that the server has replaced stays alive until its last battle ends.
+     */
     NetworkBattle(Server *server,
+            boost::shared_ptr<ScriptMachine> machine,
             boost::shared_ptr<network::Client> *clients,
             Pokemon::ARRAY *teams,
             Generation *generation,
@@ -61,12 +68,30 @@ public:
             const int metagame,
             const bool rated,
             boost::shared_ptr<void> &monitor);
+    ~NetworkBattle();
 
     int32_t getId() const;
     int getParty(boost::shared_ptr<network::Client> client) const;
     void beginBattle();
     void handleTurn(const int party, const PokemonTurn &turn);
     void handleCancelTurn(const int party);
+    void handleDamageRangeRequest(const int party);
+
+    /**
+     * Fork the battle while holding its lock, so that no turn runs on
+     * another thread during the fork. Throws BattleFieldException if the
+     * battle has ended. See BattleField::fork.
+     */
+    boost::shared_ptr<BattleField> forkLocked(const BattleMechanics *mech,
+            boost::shared_ptr<ScriptContext> cx);
+
+    /**
+     * Get the machine that runs the scripts of this battle, as a pointer
+     * that keeps the machine alive.
+     */
+    boost::shared_ptr<ScriptMachine> getSharedMachine() const {
+        return m_machine;
+    }
     
 private:
     Pokemon *requestInactivePokemon(Pokemon *);
@@ -83,6 +108,8 @@ private:
     void terminate();
     
     friend class NetworkBattleImpl;
+    // Declared before m_impl so that it is released after it.
+    boost::shared_ptr<ScriptMachine> m_machine;
     boost::shared_ptr<NetworkBattleImpl> m_impl;
 };
 
@@ -0,0 +1,111 @@
+/* 
+ * File:   TeamValidationCache.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include "TeamValidationCache.h"
+
+using namespace std;
+
+namespace shoddybattle { namespace network {
+
+namespace {
+
+void appendKey(string &key, const int value) {
+    key.append(reinterpret_cast<const char *>(&value), sizeof(int));
+}
+
+}
+
+string TeamValidationCache::getKey(const Pokemon::ARRAY &team,
+        const int data, const int generation, const int metagame,
+        const vector<int> &clauses) {
+    string key;
+    appendKey(key, data);
+    appendKey(key, generation);
+    appendKey(key, metagame);
+    if (metagame == -1) {
+        appendKey(key, clauses.size());
+        vector<int>::const_iterator i = clauses.begin();
+        for (; i != clauses.end(); ++i) {
+            appendKey(key, *i);
+        }
+    }
+    appendKey(key, team.size());
+    Pokemon::ARRAY::const_iterator i = team.begin();
+    for (; i != team.end(); ++i) {
+        const string sig = (*i)->getSignature();
+        appendKey(key, sig.size());
+        key.append(sig);
+    }
+    return key;
+}
+
+bool TeamValidationCache::find(const string &key, vector<int> &violations) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    INDEX::iterator i = m_index.find(key);
+    if (i == m_index.end()) {
+        ++m_misses;
+        return false;
+    }
+    ++m_hits;
+    m_entries.splice(m_entries.begin(), m_entries, i->second);
+    violations = i->second->second;
+    return true;
+}
+
+void TeamValidationCache::insert(const string &key,
+        const vector<int> &violations) {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    INDEX::iterator i = m_index.find(key);
+    if (i != m_index.end()) {
+        i->second->second = violations;
+        m_entries.splice(m_entries.begin(), m_entries, i->second);
+        return;
+    }
+    m_entries.push_front(ENTRY(key, violations));
+    m_index[key] = m_entries.begin();
+    if (m_index.size() > m_capacity) {
+        m_index.erase(m_entries.back().first);
+        m_entries.pop_back();
+    }
+}
+
+void TeamValidationCache::clear() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    m_index.clear();
+    m_entries.clear();
+}
+
+int TeamValidationCache::getHits() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_hits;
+}
+
+int TeamValidationCache::getMisses() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_misses;
+}
+
+size_t TeamValidationCache::size() {
+    boost::lock_guard<boost::mutex> lock(m_mutex);
+    return m_index.size();
+}
+
+}} // namespace shoddybattle::network
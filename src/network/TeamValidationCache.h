@@ -0,0 +1,100 @@
+/* 
+ * File:   TeamValidationCache.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _TEAM_VALIDATION_CACHE_H_
+#define _TEAM_VALIDATION_CACHE_H_
+
+#include <list>
+#include <string>
+#include <vector>
+#include <utility>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/locks.hpp>
+#include <boost/unordered_map.hpp>
+#include "../shoddybattle/Pokemon.h"
+
+namespace shoddybattle { namespace network {
+
+/**
+ * A bounded cache of the results of ServerImpl::validateTeam, so that a team
+ * which is submitted again is not validated again. Each entry maps a key,
+ * made of the team and the rules it was checked against, to the list of
+ * violations found. When the cache is full the least recently used entry
+ * is discarded.
+ *
+ * The cache must be cleared whenever anything that validation depends on,
+ * such as the metagames, the clauses or the game data, is reloaded.
+ */
+class TeamValidationCache {
+public:
+    TeamValidationCache(const size_t capacity):
+            m_capacity(capacity),
+            m_hits(0),
+            m_misses(0) { }
+
+    /**
+     * Get the key for a team checked against the given generation and
+     * metagame, or the given list of clauses if metagame is -1, of the
+     * given data generation.
+     */
+    static std::string getKey(const Pokemon::ARRAY &team, const int data,
+            const int generation, const int metagame,
+            const std::vector<int> &clauses);
+
+    /**
+     * Look up a key. On a hit, the cached violations are copied into
+     * violations and true is returned.
+     */
+    bool find(const std::string &key, std::vector<int> &violations);
+
+    /**
+     * Record the violations found for a key.
+     */
+    void insert(const std::string &key, const std::vector<int> &violations);
+
+    /**
+     * Discard every entry. The hit and miss counters are kept.
+     */
+    void clear();
+
+    int getHits();
+    int getMisses();
+    size_t size();
+
+private:
+    typedef std::pair<std::string, std::vector<int> > ENTRY;
+    typedef std::list<ENTRY> ENTRY_LIST;
+    typedef boost::unordered_map<std::string, ENTRY_LIST::iterator> INDEX;
+
+    const size_t m_capacity;
+    ENTRY_LIST m_entries;   // Most recently used first.
+    INDEX m_index;
+    int m_hits;
+    int m_misses;
+    boost::mutex m_mutex;
+
+    TeamValidationCache(const TeamValidationCache &);
+    TeamValidationCache &operator=(const TeamValidationCache &);
+};
+
+}} // namespace shoddybattle::network
+
+#endif
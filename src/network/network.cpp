@@ -45,19 +45,27 @@
 #include <boost/integer_traits.hpp>
 #include <vector>
 #include <deque>
+#include <list>
 #include <set>
 #include <bitset>
 #include <map>
 #include <cstring>
+#include <cstdio>
 #include "network.h"
 #include "Channel.h"
 #include "NetworkBattle.h"
+#include "AiClient.h"
+#include "TeamValidationCache.h"
 #include "../database/Authenticator.h"
 #include "../database/DatabaseRegistry.h"
+#include "../database/Storage.h"
 #include "../text/Text.h"
 #include "../shoddybattle/Pokemon.h"
 #include "../moves/PokemonMove.h"
 #include "../shoddybattle/PokemonSpecies.h"
+#include "../shoddybattle/NameTable.h"
+#include "../shoddybattle/Team.h"
+#include "../shoddybattle/RolloutPool.h"
 #include "../mechanics/PokemonNature.h"
 #include "../scripting/ScriptMachine.h"
 #include "../matchmaking/MetagameList.h"
@@ -77,9 +85,11 @@ namespace shoddybattle { namespace network {
 class ClientImpl;
 class ServerImpl;
 class Channel;
+struct DataGeneration;
 
 typedef shared_ptr<ClientImpl> ClientImplPtr;
 typedef shared_ptr<ServerImpl> ServerImplPtr;
+typedef shared_ptr<DataGeneration> DataGenerationPtr;
 
 typedef set<ClientImplPtr> CLIENT_LIST;
 typedef set<ChannelPtr> CHANNEL_LIST;
@@ -142,6 +152,30 @@ template <class T, class U> void truncate(U &collection) {
     }
 }
 
+/**
+ * Make a password that cannot be guessed from 32 bytes of the system's
+ * entropy pool, written in hex.
+ */
+string getUnguessablePassword() {
+    unsigned char bytes[32];
+    FILE *file = fopen("/dev/urandom", "rb");
+    const bool read = file && (fread(bytes, 1, sizeof(bytes), file)
+            == sizeof(bytes));
+    if (file) {
+        fclose(file);
+    }
+    if (!read) {
+        throw runtime_error("could not read /dev/urandom");
+    }
+    static const char DIGITS[] = "0123456789abcdef";
+    string password;
+    for (size_t i = 0; i < sizeof(bytes); ++i) {
+        password += DIGITS[bytes[i] >> 4];
+        password += DIGITS[bytes[i] & 0x0f];
+    }
+    return password;
+}
+
 }
 
 /**
@@ -177,7 +211,9 @@ public:
         CANCEL_QUEUE = 19,
         CANCEL_BATTLE_ACTION = 20,
         PRIVATE_MESSAGE = 21,
-        IMPORTANT_MESSAGE = 22
+        IMPORTANT_MESSAGE = 22,
+        REQUEST_DAMAGE_RANGES = 23,
+        RELOAD_DATA = 24
     };
 
     InMessage() {
@@ -369,7 +405,7 @@ Pokemon::PTR readPokemon(SpeciesDatabase *speciesData,
     string ability;
     int natureId;
     int moveCount;
-    vector<string> moves;
+    vector<int> moves;
     vector<int> ppUp;
     int ivs[STAT_COUNT];
     int evs[STAT_COUNT];
@@ -387,7 +423,10 @@ Pokemon::PTR readPokemon(SpeciesDatabase *speciesData,
     for (int i = 0; i < moveCount; ++i) {
         int id, pp;
         msg >> id >> pp;
-        moves[i] = moveData->getMove(id);
+        if (!moveData->getMoveById(id)) {
+            throw InMessage::InvalidMessage();
+        }
+        moves[i] = id;
         ppUp[i] = pp;
     }
 
@@ -408,8 +447,8 @@ Pokemon::PTR readPokemon(SpeciesDatabase *speciesData,
     return Pokemon::PTR(new Pokemon(species,
             nickname,
             nature,
-            ability,
-            item,
+            NameTable::getAbilities().getId(ability),
+            NameTable::getItems().getId(item),
             ivs,
             evs,
             level,
@@ -420,6 +459,38 @@ Pokemon::PTR readPokemon(SpeciesDatabase *speciesData,
             ppUp));
 }
 
+/**
+ * Copy a pokemon using the species of another SpeciesDatabase, so that a team
+ * read under one DataGeneration can be used with another. The copy has the
+ * level of the original, which may already have been transformed by a clause.
+ * Returns a null pointer if the species no longer exists.
+ */
+Pokemon::PTR copyPokemon(const Pokemon &p, SpeciesDatabase *speciesData) {
+    const PokemonSpecies *species = speciesData->getSpecies(p.getSpeciesId());
+    if (!species) {
+        return Pokemon::PTR();
+    }
+    int ivs[STAT_COUNT];
+    int evs[STAT_COUNT];
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        ivs[i] = p.getIv((STAT)i);
+        evs[i] = p.getEv((STAT)i);
+    }
+    return Pokemon::PTR(new Pokemon(species,
+            p.getName(),
+            p.getNature(),
+            p.getOriginalAbilityId(),
+            p.getOriginalItemId(),
+            ivs,
+            evs,
+            p.getLevel(),
+            p.getGender(),
+            p.getHappiness(),
+            p.isShiny(),
+            p.getOriginalMoveIds(),
+            p.getPpUps()));
+}
+
 void readTeam(SpeciesDatabase *speciesData,
         MoveDatabase *moveData,
         InMessage &msg,
@@ -434,6 +505,7 @@ void readTeam(SpeciesDatabase *speciesData,
 
 struct Challenge {
     mutex mx;
+    DataGenerationPtr data;     // The data the challenge was made under.
     Pokemon::ARRAY teams[TEAM_COUNT];
     int generation;
     int partySize;
@@ -601,10 +673,13 @@ public:
     typedef pair<ClientImplPtr, Pokemon::ARRAY> QUEUE_ENTRY;
     typedef variate_generator<mt11213b &, uniform_int<> > GENERATOR;
 
-    MetagameQueue(int generation, int metagame, bool rated, ServerImpl *server):
+    MetagameQueue(int generation, int metagame, bool rated, ServerImpl *server,
+            DataGeneration *data):
             m_generation(generation),
             m_metagame(metagame),
             m_rated(rated),
+            m_closed(false),
+            m_data(data),
             m_server(server),
             m_rand(mt11213b(time(NULL))) { }
 
@@ -613,12 +688,30 @@ public:
     void removeClient(ClientImplPtr);
     void startMatches();
 
+    /**
+     * Close this queue, because its DataGeneration has been replaced, and
+     * move the clients waiting in it into entries. Any client queued after
+     * this is passed on to the current queue for the same metagame.
+     */
+    void close(vector<QUEUE_ENTRY> &entries);
+
+    int getGeneration() const { return m_generation; }
+    int getMetagameIdx() const { return m_metagame; }
+    bool isRated() const { return m_rated; }
+
 private:
+    NetworkBattle::PTR startBattle(ClientPtr *, Pokemon::ARRAY *,
+            MetagamePtr, shared_ptr<void> &);
+    bool startAiBattle(QUEUE_ENTRY &, MetagamePtr);
+
     int m_generation;
     int m_metagame;
     bool m_rated;
+    bool m_closed;
+    DataGeneration *m_data;
     CLIENT_LIST m_clients;
     vector<QUEUE_ENTRY> m_queue;
+    ClientImplPtr m_remainder;  // Left unmatched by the last round.
     map<ClientImplPtr, pair<ClientImplPtr, int> > m_generations;
     mutex m_mutex;
     ServerImpl *m_server;
@@ -629,6 +722,91 @@ typedef shared_ptr<MetagameQueue> MetagameQueuePtr;
 typedef pair<int, int> METAGAME;
 typedef pair<METAGAME, bool> METAGAME_PAIR;
 typedef pair<string, string> CLAUSE_PAIR;
+typedef map<METAGAME_PAIR, MetagameQueuePtr> QUEUE_MAP;
+
+/**
+ * Everything the server loads from the scripts and data files: the script
+ * machine, which owns the species, moves and text; the metagames; the
+ * clauses; and the matchmaking queues. Reloading the data builds a new
+ * DataGeneration and makes it current. Each battle holds a reference to the
+ * generation it started in, so a replaced generation is freed once its last
+ * battle ends.
+ */
+struct DataGeneration : public enable_shared_from_this<DataGeneration> {
+    const int id;
+    const ptime created;
+    ScriptMachine machine;  // Declared first, so that it is destroyed last.
+    vector<GenerationPtr> generations;
+    vector<CLAUSE_PAIR> clauses;
+    QUEUE_MAP queues;
+    shared_ptr<OutMessage> metagameList;
+
+    DataGeneration(const int i):
+            id(i),
+            created(microsec_clock::universal_time()) { }
+    ~DataGeneration() {
+        Log::out() << "Freed data generation " << id << ", which had "
+                << (machine.getHeapSize() / 1024) << " KiB of script heap."
+                << endl;
+    }
+
+    /**
+     * Get the script machine as a pointer that keeps this generation alive.
+     */
+    shared_ptr<ScriptMachine> getMachine() {
+        return shared_ptr<ScriptMachine>(shared_from_this(), &machine);
+    }
+
+    MetagameQueuePtr getQueue(const int generation, const int metagame,
+            const bool rated) const {
+        QUEUE_MAP::const_iterator i = queues.find(
+                METAGAME_PAIR(METAGAME(generation, metagame), rated));
+        return (i == queues.end()) ? MetagameQueuePtr() : i->second;
+    }
+
+    /**
+     * Find the queue for a metagame by the id of the metagame and that of
+     * its generation. Unlike their indices, the ids stay the same when a
+     * reload reorders the metagames.
+     */
+    MetagameQueuePtr findQueue(const string &generation,
+            const string &metagame, const bool rated) const {
+        const int count = generations.size();
+        for (int i = 0; i < count; ++i) {
+            if (generations[i]->getId() != generation)
+                continue;
+            const vector<MetagamePtr> &metagames =
+                    generations[i]->getMetagames();
+            const int size = metagames.size();
+            for (int j = 0; j < size; ++j) {
+                if (metagames[j]->getId() == metagame)
+                    return getQueue(i, j, rated);
+            }
+        }
+        return MetagameQueuePtr();
+    }
+
+    bool hasMetagame(const int generation, const int metagame) const {
+        if ((generation < 0) || (generation >= (int)generations.size()))
+            return false;
+        const int count = generations[generation]->getMetagames().size();
+        return (metagame >= -1) && (metagame < count);
+    }
+
+    void fetchClauses(ScriptContextPtr scx, const vector<int> &clauses,
+            vector<StatusObject> &ret) const;
+    void fetchClauses(ScriptContextPtr scx, MetagamePtr metagame,
+            vector<StatusObject> &ret) const;
+    void fetchClauses(ScriptContextPtr scx, const int generation,
+            const int metagame, vector<StatusObject> &ret) const;
+
+private:
+    DataGeneration(const DataGeneration &);
+    DataGeneration &operator=(const DataGeneration &);
+};
+
+/** The number of validated teams whose results are remembered. **/
+const int VALIDATION_CACHE_SIZE = 4096;
 
 class ServerImpl {
 public:
@@ -642,54 +820,125 @@ public:
 
     void readMetagames(const string &);
     void initialiseMetagames();
+    void runScripts(const string &);
 
     void initialiseWelcomeMessage(const std::string &, const std::string &);
     void initialiseChannels();
     void initialiseMatchmaking();
     void initialiseClauses();
 
+    /**
+     * Let the server play battles itself as the given user, with the team in
+     * the given Shoddy Battle 1 team file. The user is registered if it does
+     * not exist yet. Throws runtime_error if the team cannot be read or the
+     * user cannot be registered.
+     */
+    void initialiseAi(const string &name, const string &teamFile,
+            const int threads, const MonteCarloOptions &options);
+
+    /**
+     * Get the server's own player, if there is one and it has the given
+     * name, or if no name is given.
+     */
+    AiClient::PTR getAiClient(const string &name = string());
+
+    /**
+     * Make a team for the server's own player from its team file, and check
+     * it against the clauses and bans of a metagame (or against the given
+     * clauses if the metagame is -1). Returns false if the team is illegal.
+     */
+    bool getAiTeam(DataGeneration &, const int generation, const int metagame,
+            const vector<int> &clauses, const int teamLength,
+            Pokemon::ARRAY &team);
+
+    /**
+     * Get the current data. Callers should hold on to the pointer for the
+     * whole of an operation, so that a reload part way through does not mix
+     * objects from two generations.
+     */
+    DataGenerationPtr getData() {
+        shared_lock<shared_mutex> lock(m_dataMutex);
+        return m_data;
+    }
+
+    /**
+     * Start reloading the scripts and data files in the background. When
+     * the new data is ready, new battles and queues switch over to it while
+     * running battles finish on the old data. Returns false if a reload is
+     * already in progress.
+     */
+    bool reloadData(const string &requester);
+
+    /**
+     * Queue a team that was waiting in a queue of an older generation into
+     * the current queue for the same metagame, which is found by its id and
+     * that of its generation. If the metagame no longer exists, the client
+     * is told that its team was not queued.
+     */
+    void requeueClient(ClientImplPtr, const Pokemon::ARRAY &,
+            const string &generation, const string &metagame,
+            const bool rated);
+
     bool validateTeam(ScriptContextPtr, Pokemon::ARRAY &,
-            vector<StatusObject> &, vector<int> &, const set<unsigned int> &);
+            vector<StatusObject> &, vector<int> &, const set<unsigned int> &,
+            const string &key = string());
+    TeamValidationCache &getValidationCache() { return m_validationCache; }
     database::DatabaseRegistry *getRegistry() { return &m_registry; }
-    ScriptMachine *getMachine() { return &m_machine; }
+    ScriptMachine *getMachine() { return &getData()->machine; }
     ChannelPtr getMainChannel() const { return m_mainChannel; }
     void sendChannelList(ClientImplPtr client);
     void sendMetagameList(ClientImplPtr client);
-    const vector<GenerationPtr> &getGenerations() const {
-        return m_generations;
-    }
     void sendClauseList(ClientImplPtr client);
-    void fetchClauses(ScriptContextPtr scx, vector<int> &clauses,
-            vector<StatusObject> &ret);
-    void fetchClauses(ScriptContextPtr scx, MetagamePtr metagame,
-            vector<StatusObject> &ret);
-    void fetchClauses(ScriptContextPtr scx, const int metagame,
-            const int generation, vector<StatusObject> &ret);
 
     ChannelPtr getChannel(const string &);
     ClientImplPtr getClient(const string &);
     bool authenticateClient(ClientImplPtr client);
     void addChannel(ChannelPtr);
     void removeChannel(ChannelPtr);
-    MetagameQueuePtr getMetagameQueue(const int generation, const int metagame,
-            const bool rated) {
-        return m_queues[METAGAME_PAIR(METAGAME(generation, metagame), rated)];
-    }
     void postLadderMatch(const string &, vector<ClientPtr> &, const int);
     bool commitBan(const int, const string &, const int, const int,
             const bool = false);
     void commitPersonalMessage(const string& user, const string& msg);
     void loadPersonalMessage(const string &user, string &msg);
 
+    void setRatingPeriod(const int minutes) {
+        m_ratingPeriod = minutes;
+    }
+    void setMasterSeed(const RANDOM_SEED seed) {
+        boost::lock_guard<boost::mutex> lock(m_seedMutex);
+        m_masterSeed = seed;
+        m_battleCount = 0;
+    }
+    RANDOM_SEED getMasterSeed() const {
+        return m_masterSeed;
+    }
+    /**
+     * Get a seed for a new battle. Every battle started by this server gets
+     * a distinct seed, determined by the master seed and the order in which
+     * battles are started.
+     */
+    RANDOM_SEED getBattleSeed() {
+        boost::lock_guard<boost::mutex> lock(m_seedMutex);
+        return RandomGenerator::deriveSeed(m_masterSeed, m_battleCount++);
+    }
+
 private:
     void acceptClient();
     void handleAccept(ClientImplPtr client,
             const boost::system::error_code &error);
     void handleMatchmaking();
+    void handleRatingPeriods();
+    void handleBanExpiry();
     void handlePhantomClients();
     void runPopulationServer(const int port);
     static void handleSignal(int signum);
 
+    void initialiseMetagames(DataGeneration &);
+    void initialiseQueues(DataGeneration &);
+    void initialiseClauses(DataGeneration &);
+    void runReload(const string requester);
+    void reportData();
+
     class ChannelList : public OutMessage {
     public:
         ChannelList(ServerImpl *);
@@ -715,15 +964,27 @@ private:
     io_service m_service;
     tcp::acceptor m_acceptor;
     database::DatabaseRegistry m_registry;
-    ScriptMachine m_machine;
-    vector<GenerationPtr> m_generations;
-    map<METAGAME_PAIR, MetagameQueuePtr> m_queues;
+    DataGenerationPtr m_data;
+    shared_mutex m_dataMutex;
+    list<weak_ptr<DataGeneration> > m_dataHistory; // Not yet freed.
+    mutex m_reloadMutex;
+    bool m_reloading;
+    string m_scriptFile;
+    string m_metagameFile;
     thread m_matchmaking;
+    thread m_ratingPeriods;
+    int m_ratingPeriod; // Minutes between rating periods, or 0 for none.
+    thread m_banExpiry;
     thread m_phantomClientWorker;
     thread m_populationThread;
-    shared_ptr<MetagameList> m_metagameList;
-    vector<CLAUSE_PAIR> m_clauses;
+    TeamValidationCache m_validationCache;
     WelcomeMessage m_welcomeMessage;
+    RANDOM_SEED m_masterSeed;
+    boost::uint64_t m_battleCount;
+    boost::mutex m_seedMutex;
+    vector<POKEMON> m_aiTeam;
+    shared_ptr<RolloutPool> m_rollouts;
+    AiClient::PTR m_ai;     // The server's own player, if any.
     Server *m_server;
 
     static ServerImpl *m_blockingServer;
@@ -759,6 +1020,14 @@ void Server::initialiseMetagames() {
     m_impl->initialiseMetagames();
 }
 
+void Server::runScripts(const string &file) {
+    m_impl->runScripts(file);
+}
+
+bool Server::reloadData(const string &requester) {
+    return m_impl->reloadData(requester);
+}
+
 void Server::initialiseWelcomeMessage(const string &name,
         const string &welcome) {
     m_impl->initialiseWelcomeMessage(name, welcome);
@@ -776,6 +1045,14 @@ void Server::initialiseClauses() {
     m_impl->initialiseClauses();
 }
 
+void Server::initialiseAi(const string &name, const string &teamFile,
+        const int threads, const int budget, const int depth) {
+    MonteCarloOptions options;
+    options.budget = budget;
+    options.depth = depth;
+    m_impl->initialiseAi(name, teamFile, threads, options);
+}
+
 ChannelPtr Server::getMainChannel() const {
     return m_impl->getMainChannel();
 }
@@ -785,6 +1062,22 @@ bool Server::commitBan(const int id, const string &user, const int bannerId,
     return m_impl->commitBan(id, user, bannerId, date);
 }
 
+void Server::setRatingPeriod(const int minutes) {
+    m_impl->setRatingPeriod(minutes);
+}
+
+void Server::setMasterSeed(const RANDOM_SEED seed) {
+    m_impl->setMasterSeed(seed);
+}
+
+RANDOM_SEED Server::getMasterSeed() const {
+    return m_impl->getMasterSeed();
+}
+
+RANDOM_SEED Server::getBattleSeed() {
+    return m_impl->getBattleSeed();
+}
+
 Server::~Server() {
     delete m_impl;
 }
@@ -851,6 +1144,9 @@ public:
         if (impl) {
             lock_guard<recursive_mutex> lock(impl->m_battleMutex);
             impl->m_battles.erase(p);
+        } else if (client) {
+            // Some other kind of client, such as an AiClient.
+            client->terminateBattle(p, ClientPtr());
         }
         {
             lock_guard<recursive_mutex> lock(m_battleMutex);
@@ -868,10 +1164,6 @@ public:
         lock_guard<mutex> lock(m_ratingMutex);
         m_server->getRegistry()->joinLadder(ladder, m_id);
     }
-    void updateLadderStats(const string &ladder) {
-        lock_guard<mutex> lock(m_ratingMutex);
-        m_server->getRegistry()->updatePlayerStats(ladder, m_id);
-    }
     
     void informBanned(int date) {
         string d = lexical_cast<string>(date);
@@ -972,6 +1264,11 @@ private:
     void handleRequestChallenge(InMessage &msg) {
         string user;
         msg >> user;
+        if (m_server->getAiClient(user)) {
+            // the server plays as this user itself
+            sendMessage(RegistryResponse(RegistryResponse::USER_ALREADY_ON));
+            return;
+        }
         const int ban = m_server->getRegistry()->getGlobalBan(user, m_ip);
         if (ban > 0) {
             if (ban < time(NULL)) {
@@ -1164,7 +1461,8 @@ private:
         msg >> metagame;        
 
         // Check for bad challenge info
-        const vector<GenerationPtr> &generations = m_server->getGenerations();
+        DataGenerationPtr data = m_server->getData();
+        const vector<GenerationPtr> &generations = data->generations;
         const int generationCount = generations.size();
         if ((generation >= generationCount) || (partySize < 1) ||
                 (teamLength < 1)) {
@@ -1208,6 +1506,7 @@ private:
             }
         }
         
+        challenge->data = data;
         challenge->generation = generation;
         challenge->partySize = partySize;
         challenge->teamLength = teamLength;
@@ -1221,6 +1520,18 @@ private:
 
         ClientImplPtr client = m_server->getClient(opponent);
         if (!client) {
+            if (m_server->getAiClient(opponent)) {
+                // The server's own player answers at once, and accepts if
+                // its team is legal under the challenge.
+                Pokemon::ARRAY team;
+                const bool accept = m_server->getAiTeam(*data, generation,
+                        metagame, challenge->clauses, teamLength, team);
+                if (accept) {
+                    challenge->teams[1] = team;
+                    m_challenges[opponent] = challenge;
+                }
+                sendMessage(FinaliseChallenge(opponent, accept));
+            }
             return;
         } else if (getId() == client->getId()) {
             return;
@@ -1251,7 +1562,8 @@ private:
         }
 
         Pokemon::ARRAY team;
-        ScriptMachine *machine = m_server->getMachine();
+        DataGenerationPtr data = challenge->data;
+        ScriptMachine *machine = &data->machine;
         readTeam(machine->getSpeciesDatabase(),
                 machine->getMoveDatabase(),
                 msg,
@@ -1270,17 +1582,20 @@ private:
         int generation = challenge->generation;
         int metagame = challenge->metagame;
         if (metagame == -1) {
-            m_server->fetchClauses(cx, challenge->clauses, clauses);
+            data->fetchClauses(cx, challenge->clauses, clauses);
         } else {
-            m_server->fetchClauses(cx, generation, metagame, clauses);
+            data->fetchClauses(cx, generation, metagame, clauses);
         }
 
         set<unsigned int> bans;
-        GenerationPtr gen = m_server->getGenerations()[generation];
+        GenerationPtr gen = data->generations[generation];
         gen->getMetagameBans(metagame, bans);
 
+        const string key = TeamValidationCache::getKey(team, data->id,
+                generation, metagame, challenge->clauses);
         vector<int> violations;
-        if (!m_server->validateTeam(cx, team, clauses, violations, bans)) {
+        if (!m_server->validateTeam(cx, team, clauses, violations, bans,
+                key)) {
             sendMessage(InvalidTeamMessage(opponent, size, violations));
             return;
         }
@@ -1300,7 +1615,9 @@ private:
         if (m_challenges.count(opponent) == 0)
             return;
         ClientImplPtr client = m_server->getClient(opponent);
-        if (!client) {
+        AiClient::PTR ai = client ? AiClient::PTR()
+                : m_server->getAiClient(opponent);
+        if (!client && !ai) {
             return;
         }
         
@@ -1310,10 +1627,10 @@ private:
             return;
         }
 
-        const vector<GenerationPtr> &generations = m_server->getGenerations();
-        GenerationPtr generation = generations[challenge->generation];
+        DataGenerationPtr data = challenge->data;
+        GenerationPtr generation = data->generations[challenge->generation];
 
-        ScriptMachine *machine = m_server->getMachine();
+        ScriptMachine *machine = &data->machine;
         readTeam(machine->getSpeciesDatabase(),
                 machine->getMoveDatabase(),
                 msg,
@@ -1332,17 +1649,19 @@ private:
         int generationId = challenge->generation;
         int metagame = challenge->metagame;
         if (metagame == -1) {
-            m_server->fetchClauses(cx, challenge->clauses, clauses);
+            data->fetchClauses(cx, challenge->clauses, clauses);
         } else {
-            m_server->fetchClauses(cx, generationId, metagame, clauses);
+            data->fetchClauses(cx, generationId, metagame, clauses);
         }
 
         set<unsigned int> bans;
         generation->getMetagameBans(metagame, bans);
         
+        const string key = TeamValidationCache::getKey(challenge->teams[0],
+                data->id, generationId, metagame, challenge->clauses);
         vector<int> violations;
         if (!m_server->validateTeam(cx, challenge->teams[0], clauses, 
-                violations, bans)) {
+                violations, bans, key)) {
             sendMessage(InvalidTeamMessage(opponent, size, violations));
             return;
         }
@@ -1366,9 +1685,11 @@ private:
         m_challenges.erase(opponent);
         lock.unlock();
 
-        ClientPtr clients[] = { shared_from_this(), client };
+        ClientPtr other = client ? ClientPtr(client) : ClientPtr(ai);
+        ClientPtr clients[] = { shared_from_this(), other };
         shared_ptr<void> monitor;
         NetworkBattle::PTR field(new NetworkBattle(m_server->getServer(),
+                data->getMachine(),
                 clients,
                 challenge->teams,
                 generation.get(),
@@ -1382,9 +1703,15 @@ private:
 
         lock2.unlock();
 
+        if (ai) {
+            // The AI player has to know the battle before its first request.
+            ai->insertBattle(field);
+        }
         field->beginBattle();
         insertBattle(field);
-        client->insertBattle(field);
+        if (client) {
+            client->insertBattle(field);
+        }
         // monitor goes out of scope here and clients become able to part
         // the battle.
     }
@@ -1395,6 +1722,10 @@ private:
 
         ClientImplPtr client = m_server->getClient(opponent);
         if (!client) {
+            if (m_server->getAiClient(opponent)) {
+                lock_guard<mutex> lock(m_challengeMutex);
+                m_challenges.erase(opponent);
+            }
             return;
         }
 
@@ -1458,13 +1789,13 @@ private:
         unsigned char metagame;
         unsigned char rated;
         msg >> generation >> metagame >> rated;
-        MetagameQueuePtr queue = m_server->getMetagameQueue(generation,
-                metagame, rated);
+        DataGenerationPtr data = m_server->getData();
+        MetagameQueuePtr queue = data->getQueue(generation, metagame, rated);
         if (!queue) {
             return;
         }
         Pokemon::ARRAY team;
-        ScriptMachine *machine = m_server->getMachine();
+        ScriptMachine *machine = &data->machine;
         readTeam(machine->getSpeciesDatabase(),
                 machine->getMoveDatabase(),
                 msg,
@@ -1487,7 +1818,8 @@ private:
         ClientImplPtr client = m_server->getClient(user);
         if (client) {
             const int id = client->getId();
-            const vector<GenerationPtr> &gens = m_server->getGenerations();
+            const vector<GenerationPtr> &gens =
+                    m_server->getData()->generations;
             database::DatabaseRegistry::ESTIMATE_LIST estimates =
                     m_server->getRegistry()->getEstimates(id, gens);
             sendMessage(UserPersonalMessage(user, client->getPersonalMessage(),
@@ -1504,7 +1836,7 @@ private:
         unsigned char metagame;
         unsigned char rated;
         msg >> generation >> metagame >> rated;
-        MetagameQueuePtr queue = m_server->getMetagameQueue(generation,
+        MetagameQueuePtr queue = m_server->getData()->getQueue(generation,
                 metagame, rated);
         if (!queue) {
             return;
@@ -1587,6 +1919,36 @@ private:
         channel->writeLog(logMessage);
     }
 
+    /**
+     * int32 : field id
+     */
+    void handleRequestDamageRanges(InMessage &msg) {
+        int32_t field;
+        msg >> field;
+
+        NetworkBattle::PTR p = getBattle(field);
+        if (p) {
+            const int party = p->getParty(shared_from_this());
+            if (party != -1) {
+                p->handleDamageRangeRequest(party);
+            }
+        }
+    }
+
+    /**
+     * Reload the scripts and data files. Only a protected (+a) user of the
+     * main channel may do this. The message has no body.
+     */
+    void handleReloadData(InMessage &msg) {
+        Channel::FLAGS auth =
+                m_server->getMainChannel()->getStatusFlags(shared_from_this());
+        if (!auth[Channel::PROTECTED]) {
+            sendMessage(ErrorMessage(ErrorMessage::UNAUTHORIZED_ACTION));
+            return;
+        }
+        m_server->reloadData(m_name);
+    }
+
     string m_name;
     int m_id;   // user id
     bool m_authenticated;
@@ -1639,7 +2001,9 @@ const ClientImpl::MESSAGE_HANDLER ClientImpl::m_handlers[] = {
     &ClientImpl::handleCancelQueue,
     &ClientImpl::handleCancelBattleAction,
     &ClientImpl::handlePrivateMessage,
-    &ClientImpl::handleImportantMessage
+    &ClientImpl::handleImportantMessage,
+    &ClientImpl::handleRequestDamageRanges,
+    &ClientImpl::handleReloadData
 };
 
 const int ClientImpl::MESSAGE_COUNT =
@@ -1895,23 +2259,34 @@ bool ServerImpl::commitBan(const int channel, const string &user,
 
 void ServerImpl::postLadderMatch(const string &ladder,
         vector<ClientPtr> &clients, const int victor) {
-    ClientImpl *impl0 = dynamic_cast<ClientImpl *>(clients[0].get());
-    ClientImpl *impl1 = dynamic_cast<ClientImpl *>(clients[1].get());
-    if (!impl0 || !impl1)
-        return;
-    m_registry.postLadderMatch(ladder, impl0->getId(), impl1->getId(), victor);
-    impl0->updateLadderStats(ladder);
-    impl1->updateLadderStats(ladder);
+    // Only users are rated; the AI player has an account of its own.
+    for (int i = 0; i < 2; ++i) {
+        Client *client = clients[i].get();
+        if (!dynamic_cast<ClientImpl *>(client)
+                && !dynamic_cast<AiClient *>(client))
+            return;
+    }
+    // The ratings of both players are updated when the match is written.
+    m_registry.postLadderMatch(ladder, clients[0]->getId(),
+            clients[1]->getId(), victor);
 }
 
 MetagamePtr MetagameQueue::getMetagame() {
-    const vector<GenerationPtr> &generations = m_server->getGenerations();
+    const vector<GenerationPtr> &generations = m_data->generations;
     GenerationPtr generation = generations[m_generation];
     return generation->getMetagames()[m_metagame];
 }
 
 bool MetagameQueue::queueClient(ClientImplPtr client, Pokemon::ARRAY &team) {
-    lock_guard<mutex> lock(m_mutex);
+    unique_lock<mutex> lock(m_mutex);
+    if (m_closed) {
+        lock.unlock();
+        MetagamePtr metagame = getMetagame();
+        m_server->requeueClient(client, team,
+                metagame->getGeneration()->getId(), metagame->getId(),
+                m_rated);
+        return false;
+    }
     if (m_clients.find(client) != m_clients.end())
         return false;
 
@@ -1920,15 +2295,17 @@ bool MetagameQueue::queueClient(ClientImplPtr client, Pokemon::ARRAY &team) {
     if (size > metagame->getMaxTeamLength())
         return false;
         
-    ScriptContextPtr scx = m_server->getMachine()->acquireContext();
+    ScriptContextPtr scx = m_data->machine.acquireContext();
     // This ScriptContext may not be freed in the same thread it was
     // created - ScriptContextLock is necessary!!
     ScriptContextLock cxLock(scx);
     vector<StatusObject> clauses;
-    m_server->fetchClauses(scx, metagame, clauses);
+    m_data->fetchClauses(scx, metagame, clauses);
+    const string key = TeamValidationCache::getKey(team, m_data->id,
+            m_generation, m_metagame, vector<int>());
     vector<int> violations;
     if (!m_server->validateTeam(scx, team, clauses, violations,
-            metagame->getBanList())) {
+            metagame->getBanList(), key)) {
         client->sendMessage(InvalidTeamMessage(string(), size, violations));
         return false;
     }
@@ -1943,6 +2320,9 @@ bool MetagameQueue::queueClient(ClientImplPtr client, Pokemon::ARRAY &team) {
 void MetagameQueue::removeClient(ClientImplPtr client) {
     lock_guard<mutex> lock(m_mutex);
     m_clients.erase(client);
+    if (m_remainder == client) {
+        m_remainder.reset();
+    }
     vector<QUEUE_ENTRY>::iterator i = m_queue.begin();
     for (; i != m_queue.end(); ++i) {
         if (i->first->getId() == client->getId()) {
@@ -1952,9 +2332,58 @@ void MetagameQueue::removeClient(ClientImplPtr client) {
     }
 }
 
+/**
+ * Create a battle in this queue's metagame. The battle has not yet begun.
+ */
+NetworkBattle::PTR MetagameQueue::startBattle(ClientPtr *clients,
+        Pokemon::ARRAY *teams, MetagamePtr metagame,
+        shared_ptr<void> &monitor) {
+    vector<StatusObject> clauses;
+    m_data->fetchClauses(m_data->machine.acquireContext(), metagame,
+            clauses);
+    return NetworkBattle::PTR(new NetworkBattle(
+            m_server->getServer(),
+            m_data->getMachine(),
+            clients,
+            teams,
+            metagame->getGeneration(),
+            metagame->getActivePartySize(),
+            metagame->getMaxTeamLength(),
+            clauses,
+            metagame->getTimerOptions(),
+            metagame->getIdx(),
+            m_rated,
+            monitor));
+}
+
+/**
+ * Match a queued client against the server's own player, if there is one
+ * and its team is legal in this metagame.
+ */
+bool MetagameQueue::startAiBattle(QUEUE_ENTRY &entry, MetagamePtr metagame) {
+    AiClient::PTR ai = m_server->getAiClient();
+    if (!ai)
+        return false;
+    Pokemon::ARRAY teams[] = { entry.second, Pokemon::ARRAY() };
+    if (!m_server->getAiTeam(*m_data, m_generation, m_metagame, vector<int>(),
+            metagame->getMaxTeamLength(), teams[1]))
+        return false;
+    if (m_rated) {
+        m_server->getRegistry()->joinLadder(metagame->getId(), ai->getId());
+    }
+    ClientPtr clients[] = { entry.first, ai };
+    shared_ptr<void> monitor;
+    NetworkBattle::PTR field = startBattle(clients, teams, metagame, monitor);
+    // The AI player has to know the battle before its first request.
+    ai->insertBattle(field);
+    field->beginBattle();
+    entry.first->insertBattle(field);
+    return true;
+}
+
 void MetagameQueue::startMatches() {
     lock_guard<mutex> lock(m_mutex);
-    if (m_queue.size() < 2)
+    if (m_queue.empty())
         return;
     if (m_rated) {
         // TODO: Sort the list of clients by rating.
@@ -1977,22 +2406,9 @@ void MetagameQueue::startMatches() {
         QUEUE_ENTRY &q2 = m_queue[i + 1];
         ClientPtr clients[] = { q1.first, q2.first };
         Pokemon::ARRAY teams[] = { q1.second, q2.second };
-        vector<StatusObject> clauses;
-        m_server->fetchClauses(m_server->getMachine()->acquireContext(),
-                metagame, clauses);
         shared_ptr<void> monitor;
-        NetworkBattle::PTR field(new NetworkBattle(
-                m_server->getServer(),
-                clients,
-                teams,
-                metagame->getGeneration(),
-                metagame->getActivePartySize(),
-                metagame->getMaxTeamLength(),
-                clauses,
-                metagame->getTimerOptions(),
-                metagame->getIdx(),
-                m_rated,
-                monitor));
+        NetworkBattle::PTR field = startBattle(clients, teams, metagame,
+                monitor);
         field->beginBattle();
         q1.first->insertBattle(field);
         q2.first->insertBattle(field);
@@ -2000,39 +2416,55 @@ void MetagameQueue::startMatches() {
     }
     m_clients.clear();
     m_queue.clear();
-    if (hasRemainder) {
+    if (!hasRemainder) {
+        m_remainder.reset();
+    } else if ((remainder.first == m_remainder)
+            && startAiBattle(remainder, metagame)) {
+        // The client was also left over by the last round, so it plays the
+        // AI player instead of waiting any longer.
+        m_remainder.reset();
+    } else {
+        m_remainder = remainder.first;
         m_queue.push_back(remainder);
         m_clients.insert(remainder.first);
     }
 }
 
+void MetagameQueue::close(vector<QUEUE_ENTRY> &entries) {
+    lock_guard<mutex> lock(m_mutex);
+    m_closed = true;
+    entries.insert(entries.end(), m_queue.begin(), m_queue.end());
+    m_queue.clear();
+    m_clients.clear();
+}
+
 void ServerImpl::sendChannelList(ClientImplPtr client) {
     client->sendMessage(ChannelList(this));
 }
 
 void ServerImpl::sendMetagameList(ClientImplPtr client) {
-    client->sendMessage(*m_metagameList);
+    client->sendMessage(*getData()->metagameList);
 }
 
 void ServerImpl::sendClauseList(ClientImplPtr client) {
-    client->sendMessage(ClauseList(m_clauses));
+    client->sendMessage(ClauseList(getData()->clauses));
 }
 
-void ServerImpl::fetchClauses(ScriptContextPtr scx, vector<int> &clauses, 
-                                                vector<StatusObject> &ret) {
-    vector<int>::iterator i = clauses.begin();
-    int size = m_clauses.size();
+void DataGeneration::fetchClauses(ScriptContextPtr scx,
+        const vector<int> &clauses, vector<StatusObject> &ret) const {
+    vector<int>::const_iterator i = clauses.begin();
+    int size = this->clauses.size();
     for (; i != clauses.end(); ++i) {
         int idx = (*i);
         if ((idx < 0) || (idx > size))
             continue;
-        string name = m_clauses[idx].first;
+        string name = this->clauses[idx].first;
         ret.push_back(scx->getClause(name));
     }
 }
 
-void ServerImpl::fetchClauses(ScriptContextPtr scx, MetagamePtr metagame,
-        vector<StatusObject> &ret) {
+void DataGeneration::fetchClauses(ScriptContextPtr scx, MetagamePtr metagame,
+        vector<StatusObject> &ret) const {
     const vector<string> &clauses = metagame->getClauses();
     vector<string>::const_iterator i = clauses.begin();
     for (; i != clauses.end(); ++i) {
@@ -2040,9 +2472,9 @@ void ServerImpl::fetchClauses(ScriptContextPtr scx, MetagamePtr metagame,
     }
 }
 
-void ServerImpl::fetchClauses(ScriptContextPtr scx, const int generation,
-        const int metagame, vector<StatusObject> &ret) {
-    GenerationPtr gen = m_generations[generation];
+void DataGeneration::fetchClauses(ScriptContextPtr scx, const int generation,
+        const int metagame, vector<StatusObject> &ret) const {
+    GenerationPtr gen = generations[generation];
     MetagamePtr meta = gen->getMetagames()[metagame];
     fetchClauses(scx, meta, ret);
 }
@@ -2146,12 +2578,19 @@ ServerImpl::ServerImpl(Server *server, const int port, const int userLimit):
             m_population(0),
             m_userLimit(userLimit),
             m_acceptor(m_service, tcp::endpoint(tcp::v4(), port), true),
+            m_data(new DataGeneration(1)),
+            m_reloading(false),
+            m_ratingPeriod(0),
+            m_validationCache(VALIDATION_CACHE_SIZE),
+            m_masterSeed(RandomGenerator::getEntropySeed()),
+            m_battleCount(0),
             m_server(server) {
     acceptClient();
     m_phantomClientWorker = boost::thread(boost::bind(
             &ServerImpl::handlePhantomClients, this));
     m_populationThread = boost::thread(boost::bind(
             &ServerImpl::runPopulationServer, this, port));
+    m_dataHistory.push_back(m_data);
 }
 
 void ServerImpl::runPopulationServer(const int port) {
@@ -2202,17 +2641,35 @@ ChannelPtr ServerImpl::getChannel(const string &name) {
 }
 
 void ServerImpl::readMetagames(const string& file) {
-    Generation::readGenerations(file, m_generations);
+    m_metagameFile = file;
+    Generation::readGenerations(file, getData()->generations);
+    m_validationCache.clear();
 }
 
 void ServerImpl::initialiseMetagames() {
-    SpeciesDatabase *species = m_machine.getSpeciesDatabase();
-    vector<GenerationPtr>::iterator i = m_generations.begin();
-    for (; i != m_generations.end(); ++i) {
+    initialiseMetagames(*getData());
+}
+
+void ServerImpl::initialiseMetagames(DataGeneration &data) {
+    m_validationCache.clear();
+    SpeciesDatabase *species = data.machine.getSpeciesDatabase();
+    vector<GenerationPtr>::iterator i = data.generations.begin();
+    for (; i != data.generations.end(); ++i) {
         (*i)->initialiseMetagames(species);
     }
 }
 
+/**
+ * Run the main script, which includes the species, moves and text, and
+ * remember it for reloading.
+ */
+void ServerImpl::runScripts(const string &file) {
+    m_scriptFile = file;
+    ScriptMachine *machine = getMachine();
+    machine->acquireContext()->runFile(file);
+    machine->finalise();
+}
+
 void ServerImpl::initialiseWelcomeMessage(const string &name,
         const string &welcome) {
     shared_ptr<database::Authenticator> auth = m_registry.getAuthenticator();
@@ -2247,11 +2704,26 @@ void ServerImpl::initialiseChannels() {
     }
 
     assert(m_mainChannel);
+
+    m_banExpiry = thread(boost::bind(&ServerImpl::handleBanExpiry, this));
 }
 
 void ServerImpl::initialiseMatchmaking() {
-    vector<GenerationPtr>::const_iterator i = m_generations.begin();
-    for (; i != m_generations.end(); ++i) {
+    initialiseQueues(*getData());
+    m_matchmaking = thread(boost::bind(&ServerImpl::handleMatchmaking, this));
+    if (m_ratingPeriod > 0) {
+        m_ratingPeriods = thread(boost::bind(
+                &ServerImpl::handleRatingPeriods, this));
+    }
+}
+
+/**
+ * Create the matchmaking queues and the metagame list for some data, and
+ * make sure that the database has a ladder for each metagame.
+ */
+void ServerImpl::initialiseQueues(DataGeneration &data) {
+    vector<GenerationPtr>::const_iterator i = data.generations.begin();
+    for (; i != data.generations.end(); ++i) {
         GenerationPtr generation = *i;
         const vector<MetagamePtr> &metagames = generation->getMetagames();
         vector<MetagamePtr>::const_iterator j = metagames.begin();
@@ -2262,53 +2734,279 @@ void ServerImpl::initialiseMatchmaking() {
             int metaIdx = (*j)->getIdx();
             METAGAME meta(genIdx, metaIdx);
             // rated queue
-            m_queues[METAGAME_PAIR(meta, true)] = MetagameQueuePtr(
-                    new MetagameQueue(genIdx, metaIdx, true, this));
+            data.queues[METAGAME_PAIR(meta, true)] = MetagameQueuePtr(
+                    new MetagameQueue(genIdx, metaIdx, true, this, &data));
             // unrated queue
-            m_queues[METAGAME_PAIR(meta, false)] = MetagameQueuePtr(
-                    new MetagameQueue(genIdx, metaIdx, false, this));
+            data.queues[METAGAME_PAIR(meta, false)] = MetagameQueuePtr(
+                    new MetagameQueue(genIdx, metaIdx, false, this, &data));
         }
     }
 
-    m_metagameList = shared_ptr<MetagameList>(new MetagameList(m_generations));
-    m_matchmaking = thread(boost::bind(&ServerImpl::handleMatchmaking, this));
+    data.metagameList = shared_ptr<OutMessage>(
+            new MetagameList(data.generations));
 }
 
 void ServerImpl::initialiseClauses() {
-    ScriptContextPtr scx = m_machine.acquireContext();
+    initialiseClauses(*getData());
+}
+
+void ServerImpl::initialiseClauses(DataGeneration &data) {
+    ScriptContextPtr scx = data.machine.acquireContext();
     ScriptContextLock lock(scx);
     vector<StatusObject> clauses;
     scx->getClauseList(clauses);
     vector<StatusObject>::iterator i = clauses.begin();
     for (; i != clauses.end(); ++i) {
-        m_clauses.push_back(
+        data.clauses.push_back(
             CLAUSE_PAIR(i->getId(scx.get()), i->getDescription(scx.get())));
     }
+    m_validationCache.clear();
+}
+
+void ServerImpl::initialiseAi(const string &name, const string &teamFile,
+        const int threads, const MonteCarloOptions &options) {
+    if (!readObjectTeamFile(teamFile, m_aiTeam) || m_aiTeam.empty()) {
+        throw runtime_error("could not read the AI team file " + teamFile);
+    }
+    if (!m_registry.userExists(name)) {
+        // Nobody knows the password, and handleRequestChallenge refuses to
+        // log anyone in as the AI player in any case.
+        m_registry.registerUser(name, getUnguessablePassword(),
+                "127.0.0.1");
+    }
+    const int id = m_registry.getStorage()->getUserId(name);
+    if (id == -1) {
+        throw runtime_error("could not register the AI player " + name);
+    }
+    m_rollouts = shared_ptr<RolloutPool>(new RolloutPool(NULL, threads));
+    m_ai = AiClient::PTR(new AiClient(m_rollouts.get(), name, id, options,
+            getBattleSeed()));
+    Log::out() << "The AI player " << name << " is searching on "
+            << m_rollouts->getThreadCount() << " threads." << endl;
+}
+
+AiClient::PTR ServerImpl::getAiClient(const string &name) {
+    if (!m_ai || (!name.empty() && !iequals(m_ai->getName(), name)))
+        return AiClient::PTR();
+    return m_ai;
+}
+
+bool ServerImpl::getAiTeam(DataGeneration &data, const int generation,
+        const int metagame, const vector<int> &clauseIds,
+        const int teamLength, Pokemon::ARRAY &team) {
+    ScriptMachine *machine = &data.machine;
+    createTeam(m_aiTeam, *machine->getSpeciesDatabase(), team);
+    if ((int)team.size() > teamLength) {
+        team.resize(teamLength);
+    }
+    if (team.empty())
+        return false;
+
+    ScriptContextPtr cx = machine->acquireContext();
+    // This ScriptContext may not be freed in the same thread it was
+    // created - ScriptContextLock is necessary!!
+    ScriptContextLock cxLock(cx);
+    vector<StatusObject> clauses;
+    if (metagame == -1) {
+        data.fetchClauses(cx, clauseIds, clauses);
+    } else {
+        data.fetchClauses(cx, generation, metagame, clauses);
+    }
+    set<unsigned int> bans;
+    data.generations[generation]->getMetagameBans(metagame, bans);
+    const string key = TeamValidationCache::getKey(team, data.id,
+            generation, metagame, clauseIds);
+    vector<int> violations;
+    return validateTeam(cx, team, clauses, violations, bans, key);
+}
+
+bool ServerImpl::reloadData(const string &requester) {
+    lock_guard<mutex> lock(m_reloadMutex);
+    if (m_reloading) {
+        Log::out() << requester << " asked for a reload, but one is already "
+                "in progress." << endl;
+        return false;
+    }
+    m_reloading = true;
+    thread reload(boost::bind(&ServerImpl::runReload, this, requester));
+    reload.detach();
+    return true;
+}
+
+/**
+ * Build a new DataGeneration from the script and metagame files, then make
+ * it current. This runs on its own thread; the server keeps running on the
+ * current data until the switch.
+ */
+void ServerImpl::runReload(const string requester) {
+    const ptime start = microsec_clock::universal_time();
+    Log::out() << requester << " started reloading the scripts and data."
+            << endl;
+    database::DatabaseRegistry::startThread();
+
+    DataGenerationPtr old = getData();
+    DataGenerationPtr data;
+    try {
+        data = DataGenerationPtr(new DataGeneration(old->id + 1));
+    } catch (ScriptMachineException &) {
+        Log::out() << "Reload failed: could not create a script machine."
+                << endl;
+        lock_guard<mutex> lock(m_reloadMutex);
+        m_reloading = false;
+        return;
+    }
+    const bool ran = data->machine.acquireContext()->runFile(m_scriptFile);
+    data->machine.finalise();
+    if (!ran) {
+        Log::out() << "Reload failed: " << m_scriptFile << " did not run. "
+                "Staying on data generation " << old->id << "." << endl;
+        lock_guard<mutex> lock(m_reloadMutex);
+        m_reloading = false;
+        return;
+    }
+    Generation::readGenerations(m_metagameFile, data->generations);
+    if (data->machine.getSpeciesDatabase()->getSpeciesSet().empty()
+            || !data->machine.getMoveDatabase()->getMoveCount()
+            || data->generations.empty()) {
+        Log::out() << "Reload failed: the new data is incomplete. Staying on "
+                "data generation " << old->id << "." << endl;
+        lock_guard<mutex> lock(m_reloadMutex);
+        m_reloading = false;
+        return;
+    }
+    initialiseClauses(*data);
+    initialiseMetagames(*data);
+    initialiseQueues(*data);
+
+    {
+        lock_guard<shared_mutex> lock(m_dataMutex);
+        m_data = data;
+        m_dataHistory.push_back(data);
+    }
+    m_validationCache.clear();
+
+    // Pass everyone who was waiting in the old queues on to the new ones.
+    QUEUE_MAP::iterator i = old->queues.begin();
+    for (; i != old->queues.end(); ++i) {
+        MetagameQueuePtr queue = i->second;
+        vector<MetagameQueue::QUEUE_ENTRY> entries;
+        queue->close(entries);
+        vector<MetagameQueue::QUEUE_ENTRY>::iterator j = entries.begin();
+        MetagamePtr metagame = queue->getMetagame();
+        for (; j != entries.end(); ++j) {
+            requeueClient(j->first, j->second,
+                    metagame->getGeneration()->getId(), metagame->getId(),
+                    queue->isRated());
+        }
+    }
+
+    broadcast(*data->metagameList);
+    broadcast(ClauseList(data->clauses));
+    old.reset();
+
+    const time_duration elapsed = microsec_clock::universal_time() - start;
+    Log::out() << "Switched to data generation " << data->id << " after "
+            << elapsed.total_milliseconds() << " ms." << endl;
+    reportData();
+
+    lock_guard<mutex> lock(m_reloadMutex);
+    m_reloading = false;
+}
+
+void ServerImpl::requeueClient(ClientImplPtr client,
+        const Pokemon::ARRAY &team, const string &generation,
+        const string &metagame, const bool rated) {
+    DataGenerationPtr data = getData();
+    MetagameQueuePtr queue = data->findQueue(generation, metagame, rated);
+    if (!queue) {
+        Log::out() << "Removed " << client->getName() << " from the queue for "
+                << metagame << ", which no longer exists." << endl;
+        client->sendMessage(InvalidTeamMessage(string(), team.size(),
+                vector<int>()));
+        return;
+    }
+    Pokemon::ARRAY copy;
+    SpeciesDatabase *species = data->machine.getSpeciesDatabase();
+    Pokemon::ARRAY::const_iterator i = team.begin();
+    for (; i != team.end(); ++i) {
+        Pokemon::PTR p = copyPokemon(**i, species);
+        if (!p) {
+            client->sendMessage(InvalidTeamMessage(string(), team.size(),
+                    vector<int>()));
+            return;
+        }
+        copy.push_back(p);
+    }
+    queue->queueClient(client, copy);
+}
+
+/**
+ * Log the memory used by each DataGeneration that has not yet been freed.
+ */
+void ServerImpl::reportData() {
+    const ptime now = microsec_clock::universal_time();
+    lock_guard<shared_mutex> lock(m_dataMutex);
+    list<weak_ptr<DataGeneration> >::iterator i = m_dataHistory.begin();
+    while (i != m_dataHistory.end()) {
+        DataGenerationPtr data = i->lock();
+        if (!data) {
+            i = m_dataHistory.erase(i);
+            continue;
+        }
+        const ScriptMachine &machine = data->machine;
+        Log::out() << "Data generation " << data->id
+                << ((data == m_data) ? " (current)" : "") << ": "
+                << (machine.getHeapSize() / 1024) << " KiB script heap, "
+                << machine.getRootCount() << " roots, "
+                << (data.use_count() - 1) << " references, loaded "
+                << (now - data->created).total_seconds() << " s ago."
+                << endl;
+        ++i;
+    }
 }
 
+/**
+ * Validate a team against a set of clauses and bans. If a key from
+ * TeamValidationCache::getKey is given, the result is remembered and a
+ * team with the same key is not checked again; the team is still
+ * initialised and transformed by the clauses as usual.
+ */
 bool ServerImpl::validateTeam(ScriptContextPtr scx, Pokemon::ARRAY &team,
         vector<StatusObject> &clauses, vector<int> &violations,
-        const set<unsigned int> &bans) {
+        const set<unsigned int> &bans, const string &key) {
     Pokemon::ARRAY::iterator i = team.begin();
     for (; i != team.end(); ++i) {
         (*i)->initialise(NULL, scx, 0, 0);
     }
-    bool pass = true;
     ScriptContext *cx = scx.get();
     const int size = clauses.size();
-    for (int i = 0; i < size; ++i) {
-        if (!clauses[i].validateTeam(cx, team)) {
-            pass = false;
-            violations.push_back(clauses[i].getIdx(cx));
+    const bool cached = !key.empty() && m_validationCache.find(key, violations);
+    if (cached && !violations.empty())
+        return false;
+
+    if (!cached) {
+        bool pass = true;
+        for (int i = 0; i < size; ++i) {
+            if (!clauses[i].validateTeam(cx, team)) {
+                pass = false;
+                violations.push_back(clauses[i].getIdx(cx));
+            }
+        }
+        if (!pass) {
+            if (!key.empty()) {
+                m_validationCache.insert(key, violations);
+            }
+            return false;
         }
     }
-    if (!pass)
-        return false;
         
     for (int i = 0; i < size; ++i) {
         clauses[i].transformTeam(cx, team);
     }
 
+    if (cached)
+        return true;
+
     //validate a pokemon with its species and a mechanics set
     //TODO: use the specific mechanics
     JewelMechanics mech;
@@ -2334,20 +3032,65 @@ bool ServerImpl::validateTeam(ScriptContextPtr scx, Pokemon::ARRAY &team,
             violations.push_back(-i - 1 - (partySize * 8));
         }
     }
-    
+
+    if (!key.empty()) {
+        m_validationCache.insert(key, violations);
+    }
     return !violations.size();
 }
 
 void ServerImpl::handleMatchmaking() {
     while (true) {
         this_thread::sleep(posix_time::seconds(15));
-        map<METAGAME_PAIR, MetagameQueuePtr>::iterator i = m_queues.begin();
-        for (; i != m_queues.end(); ++i) {
+        DataGenerationPtr data = getData();
+        QUEUE_MAP::iterator i = data->queues.begin();
+        for (; i != data->queues.end(); ++i) {
             i->second->startMatches();
         }
     }
 }
 
+/**
+ * Run a rating period on every ladder at a fixed interval. This has its own
+ * thread and database connection, so the server never waits for it.
+ */
+void ServerImpl::handleRatingPeriods() {
+    database::DatabaseRegistry::startThread();
+    const int threads = max(1u, thread::hardware_concurrency());
+    while (true) {
+        this_thread::sleep(posix_time::minutes(m_ratingPeriod));
+        DataGenerationPtr data = getData();
+        vector<GenerationPtr>::const_iterator i = data->generations.begin();
+        for (; i != data->generations.end(); ++i) {
+            const vector<MetagamePtr> &metagames = (*i)->getMetagames();
+            vector<MetagamePtr>::const_iterator j = metagames.begin();
+            for (; j != metagames.end(); ++j) {
+                const string ladder = (*j)->getId();
+                const ptime start = microsec_clock::universal_time();
+                const int count = m_registry.processRatingPeriod(ladder,
+                        threads);
+                const long ms = (microsec_clock::universal_time()
+                        - start).total_milliseconds();
+                Log::out() << "Rating period for " << ladder << ": "
+                        << count << " players in " << ms << " ms ("
+                        << (count * 1000L / max(1L, ms)) << " per second)."
+                        << endl;
+            }
+        }
+    }
+}
+
+/**
+ * Remove expired bans from memory and from the database once a minute.
+ */
+void ServerImpl::handleBanExpiry() {
+    database::DatabaseRegistry::startThread();
+    while (true) {
+        this_thread::sleep(posix_time::seconds(60));
+        m_registry.removeExpiredBans();
+    }
+}
+
 void ServerImpl::handlePhantomClients() {
     while (true) {
         this_thread::sleep(posix_time::seconds(60));
@@ -2393,6 +3136,13 @@ void ServerImpl::installSignalHandlers() {
 void ServerImpl::run() {
     m_registry.startThread();
     m_service.run();
+    // stop() runs in a signal handler, so the queued database writes are
+    // made and the cache statistics, which take the cache's lock, are
+    // logged here once the service has stopped.
+    m_registry.flush();
+    Log::out() << "Team validation cache: " << m_validationCache.getHits()
+            << " hits, " << m_validationCache.getMisses() << " misses."
+            << endl;
 }
 
 /** Stop the server. */
@@ -2405,8 +3155,10 @@ void ServerImpl::stop() {
  */
 void ServerImpl::removeClient(ClientImplPtr client) {
     // Remove the client from any metagame queues that the client may be in.
-    map<METAGAME_PAIR, MetagameQueuePtr>::iterator i = m_queues.begin();
-    for (; i != m_queues.end(); ++i) {
+    // The queues of older data are always empty.
+    DataGenerationPtr data = getData();
+    QUEUE_MAP::iterator i = data->queues.begin();
+    for (; i != data->queues.end(); ++i) {
         i->second->removeClient(client);
     }
 
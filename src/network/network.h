@@ -28,6 +28,7 @@
 #include <boost/shared_ptr.hpp>
 #include <vector>
 #include <string>
+#include "../mechanics/RandomGenerator.h"
 
 namespace shoddybattle {
     class ScriptMachine;
@@ -76,16 +77,24 @@ public:
     ScriptMachine *getMachine();
     void readMetagames(const std::string &);
     void initialiseMetagames();
+    void runScripts(const std::string &);
+    bool reloadData(const std::string &);
     void initialiseWelcomeMessage(const std::string &, const std::string &);
     void initialiseChannels();
     void initialiseMatchmaking();
     void initialiseClauses();
+    void initialiseAi(const std::string &name, const std::string &teamFile,
+            const int threads, const int budget, const int depth);
     boost::shared_ptr<Channel> getMainChannel() const;
     void addChannel(boost::shared_ptr<Channel>);
     void removeChannel(boost::shared_ptr<Channel>);
     void postLadderMatch(const std::string &, std::vector<ClientPtr> &,
             const int);
     bool commitBan(const int, const std::string &, const int, const int);
+    void setRatingPeriod(const int);
+    void setMasterSeed(const RANDOM_SEED);
+    RANDOM_SEED getMasterSeed() const;
+    RANDOM_SEED getBattleSeed();
 
 private:
     ServerImpl *m_impl;
@@ -143,7 +152,8 @@ public:
         INVALID_TEAM = 32,
         ERROR_MESSAGE = 33,
         PRIVATE_MESSAGE = 34,
-        IMPORTANT_MESSAGE = 35
+        IMPORTANT_MESSAGE = 35,
+        DAMAGE_RANGES = 36
     };
 
     // variable size message
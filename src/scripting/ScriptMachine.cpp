@@ -27,7 +27,9 @@
 #include <nspr/nspr.h>
 #include <js/jsapi.h>
 #include <set>
+#include <map>
 #include <fstream>
+#include <sstream>
 #include <iostream>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/locks.hpp>
@@ -38,6 +40,7 @@
 #include "../shoddybattle/Pokemon.h"
 #include "../shoddybattle/PokemonSpecies.h"
 #include "../moves/PokemonMove.h"
+#include "../shoddybattle/NameTable.h"
 #include "../network/ThreadedQueue.h"
 #include "../main/Log.h"
 
@@ -89,6 +92,12 @@ struct ScriptMachineImpl {
     GlobalState *state;
     mutex lock;         // lock for contexts set
     RootQueuePtr deadRoots;
+
+    // Data files read ahead of the script that includes them.
+    mutex prefetchLock;
+    map<string, vector<SPECIES_DATA> > prefetchedSpecies;
+    map<string, vector<MOVE_DATA> > prefetchedMoves;
+    map<string, string> prefetchedText;
     ScriptContextPtr deadRootContext;
 
 #if ENABLE_ROOT_COUNT
@@ -210,6 +219,10 @@ unsigned int ScriptMachine::getRootCount() const {
 #endif
 }
 
+unsigned int ScriptMachine::getHeapSize() const {
+    return JS_GetGCParameter(m_impl->runtime, JSGC_BYTES);
+}
+
 Text *ScriptMachine::getText() const {
     return &m_impl->state->text;
 }
@@ -240,8 +253,9 @@ static JSBool include(JSContext *cx,
     JSString *str = JS_ValueToString(cx, val);
     char *pstr = JS_GetStringBytes(str);
     ScriptContext *scx = (ScriptContext *)JS_GetContextPrivate(cx);
-    scx->runFile(pstr);
-    return JS_TRUE;
+    // A failed include stops the script that included it, so the failure
+    // reaches whoever ran the outermost file.
+    return scx->runFile(pstr) ? JS_TRUE : JS_FALSE;
 }
 
 static JSBool includeSpecies(JSContext *cx,
@@ -351,16 +365,77 @@ void ScriptMachine::populateMoveLists() {
     m_impl->state->species.populateMoveLists(m_impl->state->moves);
 }
 
+/**
+ * Take the data prefetched for a file, if there is any.
+ */
+template <class T>
+static bool takePrefetched(mutex &lock, map<string, T> &data,
+        const string &file, T &ret) {
+    lock_guard<mutex> guard(lock);
+    typename map<string, T>::iterator i = data.find(file);
+    if (i == data.end())
+        return false;
+    ret.swap(i->second);
+    data.erase(i);
+    return true;
+}
+
 void ScriptMachine::includeSpecies(const std::string file) {
-    m_impl->state->species.loadSpecies(file);
+    vector<SPECIES_DATA> species;
+    if (takePrefetched(m_impl->prefetchLock, m_impl->prefetchedSpecies,
+            file, species)) {
+        m_impl->state->species.loadSpecies(species);
+    } else {
+        m_impl->state->species.loadSpecies(file);
+    }
 }
 
 void ScriptMachine::loadText(const std::string file, TextLookup &func) {
-    m_impl->state->text.loadFile(file, func);
+    string contents;
+    if (takePrefetched(m_impl->prefetchLock, m_impl->prefetchedText,
+            file, contents)) {
+        istringstream in(contents);
+        m_impl->state->text.load(in, func);
+    } else {
+        m_impl->state->text.loadFile(file, func);
+    }
 }
 
 void ScriptMachine::includeMoves(const std::string file) {
-    m_impl->state->moves.loadMoves(file);
+    vector<MOVE_DATA> moves;
+    if (takePrefetched(m_impl->prefetchLock, m_impl->prefetchedMoves,
+            file, moves)) {
+        m_impl->state->moves.loadMoves(moves);
+    } else {
+        m_impl->state->moves.loadMoves(file);
+    }
+}
+
+bool ScriptMachine::prefetchSpecies(const std::string file) {
+    vector<SPECIES_DATA> species;
+    if (!PokemonSpecies::readSpecies(file, species))
+        return false;
+    lock_guard<mutex> guard(m_impl->prefetchLock);
+    m_impl->prefetchedSpecies[file].swap(species);
+    return true;
+}
+
+bool ScriptMachine::prefetchMoves(const std::string file) {
+    vector<MOVE_DATA> moves;
+    if (!MoveDatabase::readMoves(file, moves))
+        return false;
+    lock_guard<mutex> guard(m_impl->prefetchLock);
+    m_impl->prefetchedMoves[file].swap(moves);
+    return true;
+}
+
+bool ScriptMachine::prefetchText(const std::string file) {
+    string contents;
+    if (!Text::readFile(file, contents))
+        return false;
+    lock_guard<mutex> guard(m_impl->prefetchLock);
+    m_impl->prefetchedText[file].swap(contents);
+    return true;
 }
 
 static void reportError(JSContext * /*cx*/, const char *message,
@@ -458,6 +533,16 @@ void ScriptContext::getClauseList(vector<StatusObject> &clauses) const {
     m_machine->m_impl->getStatusList(cx, "Clause", clauses);
 }
 
+void ScriptContext::getAbilityList(vector<StatusObject> &abilities) const {
+    JSContext *cx = (JSContext *)m_p;
+    m_machine->m_impl->getStatusList(cx, "Ability", abilities);
+}
+
+void ScriptContext::getItemList(vector<StatusObject> &items) const {
+    JSContext *cx = (JSContext *)m_p;
+    m_machine->m_impl->getStatusList(cx, "HoldItem", items);
+}
+
 bool ScriptContext::hasProperty(ScriptObject *obj, const string name) const {
     JSContext *cx = (JSContext *)m_p;
     JS_BeginRequest(cx);
@@ -472,6 +557,68 @@ bool ScriptContext::hasProperty(ScriptObject *obj, const string name) const {
     return ret;
 }
 
+/**
+ * Copy the enumerable properties of src onto dst for a forked battle.
+ * Objects in the copies table are replaced with their counterparts. Other
+ * arrays and plain objects are copied in turn, so that the fork never
+ * shares mutable script state with the original, while functions and
+ * native objects are shared. Each copy is stored in dst before its own
+ * properties are copied so that it is always reachable from a root.
+ */
+static void forkProperties(JSContext *cx, JSObject *src, JSObject *dst,
+        JSClass *plainClass, SCRIPT_OBJECT_MAP &copies) {
+    JSIdArray *ids = JS_Enumerate(cx, src);
+    if (!ids)
+        return;
+    for (int i = 0; i < ids->length; ++i) {
+        jsval val;
+        JS_GetPropertyById(cx, src, ids->vector[i], &val);
+        if (JSVAL_IS_PRIMITIVE(val)) {
+            JS_SetPropertyById(cx, dst, ids->vector[i], &val);
+            continue;
+        }
+        JSObject *obj = JSVAL_TO_OBJECT(val);
+        SCRIPT_OBJECT_MAP::const_iterator j = copies.find(obj);
+        if (j != copies.end()) {
+            val = OBJECT_TO_JSVAL((JSObject *)j->second);
+            JS_SetPropertyById(cx, dst, ids->vector[i], &val);
+            continue;
+        }
+        JSObject *copy = NULL;
+        if (JS_IsArrayObject(cx, obj)) {
+            copy = JS_NewArrayObject(cx, 0, NULL);
+        } else if (JS_GET_CLASS(cx, obj) == plainClass) {
+            copy = JS_NewObject(cx, NULL, JS_GetPrototype(cx, obj),
+                    JS_GetParent(cx, obj));
+        }
+        if (!copy) {
+            JS_SetPropertyById(cx, dst, ids->vector[i], &val);
+            continue;
+        }
+        val = OBJECT_TO_JSVAL(copy);
+        JS_SetPropertyById(cx, dst, ids->vector[i], &val);
+        copies[obj] = copy;
+        forkProperties(cx, obj, copy, plainClass, copies);
+        jsuint length;
+        if (JS_IsArrayObject(cx, obj) && JS_GetArrayLength(cx, obj, &length)) {
+            JS_SetArrayLength(cx, copy, length);
+        }
+    }
+    JS_DestroyIdArray(cx, ids);
+}
+
+void ScriptContext::copyProperties(const ScriptObject *from, ScriptObject *to,
+        const SCRIPT_OBJECT_MAP &remap) {
+    JSContext *cx = (JSContext *)m_p;
+    JSObject *src = (JSObject *)from->getObject();
+    JSObject *dst = (JSObject *)to->getObject();
+    JS_BeginRequest(cx);
+    JSClass *plainClass = JS_GET_CLASS(cx, JS_NewObject(cx, NULL, NULL, NULL));
+    SCRIPT_OBJECT_MAP copies(remap);
+    forkProperties(cx, src, dst, plainClass, copies);
+    JS_EndRequest(cx);
+}
+
 ScriptValue ScriptContext::callFunctionByName(ScriptObject *sobj,
         const string name,
         const int argc, ScriptValue *sargv) {
@@ -576,14 +723,15 @@ void ScriptContext::maybeGc() {
 }
 
 /**
- * Run a file in the scope of the global object.
+ * Run a file in the scope of the global object. Returns false if the file
+ * could not be read or the script failed.
  */
-void ScriptContext::runFile(const string file) {
+bool ScriptContext::runFile(const string file) {
     // Read in the whole file.
     ifstream is(file.c_str());
     if (!is.is_open()) {
         Log::out() << "Cannot find script " << file << endl;
-        return;
+        return false;
     }
     is.seekg(0, ios::end);
     const int length = is.tellg();
@@ -596,7 +744,7 @@ void ScriptContext::runFile(const string file) {
     JSContext *cx = (JSContext *)m_p;
     JS_BeginRequest(cx);
     jsval val;
-    JS_EvaluateScript(cx,
+    const JSBool ok = JS_EvaluateScript(cx,
             m_machine->m_impl->global,
             text,
             length,
@@ -604,6 +752,11 @@ void ScriptContext::runFile(const string file) {
             0,
             &val);
     JS_EndRequest(cx);
+    if (!ok) {
+        Log::out() << "Error: Could not run script " << file << "." << endl;
+        return false;
+    }
+    return true;
 }
 
 bool isAvailable(ScriptContext *cx) {
@@ -645,8 +798,36 @@ void ScriptContext::setContextThread(const int depth) {
     JS_ResumeRequest((JSContext *)m_p, depth);
 }
 
+/**
+ * Give the name of each status in a list an ID in a NameTable.
+ */
+static void internNames(ScriptContext *scx, const vector<StatusObject> &list,
+        NameTable &table) {
+    vector<StatusObject>::const_iterator i = list.begin();
+    for (; i != list.end(); ++i) {
+        table.intern(i->getId(scx));
+    }
+}
+
 void ScriptMachine::finalise() {
     getSpeciesDatabase()->verifyAbilities(this);
+
+    // Give every ability and item defined by the scripts an ID.
+    {
+        ScriptContextPtr scx = acquireContext();
+        vector<StatusObject> list;
+        scx->getAbilityList(list);
+        internNames(scx.get(), list, NameTable::getAbilities());
+        list.clear();
+        scx->getItemList(list);
+        internNames(scx.get(), list, NameTable::getItems());
+    }
+
+    // Drop anything that was prefetched but never included.
+    lock_guard<mutex> guard(m_impl->prefetchLock);
+    m_impl->prefetchedSpecies.clear();
+    m_impl->prefetchedMoves.clear();
+    m_impl->prefetchedText.clear();
 }
 
 static JSFunctionSpec globalFunctions[] = {
@@ -28,6 +28,7 @@
 #include <vector>
 #include <string>
 #include <set>
+#include <map>
 #include <iostream>
 #include <boost/shared_ptr.hpp>
 #include <boost/bind.hpp>
@@ -41,6 +42,11 @@ namespace shoddybattle {
 
 class ScriptMachineImpl;
 
+/**
+ * Maps script objects onto their counterparts in a fork of a BattleField.
+ */
+typedef std::map<void *, void *> SCRIPT_OBJECT_MAP;
+
 class ScriptMachineException {
     
 };
@@ -199,6 +205,14 @@ public:
     boost::shared_ptr<StatusObject> cloneAndRoot(ScriptContext *);
     void disableClone(ScriptContext *);
 
+    /**
+     * Make a deep copy of this status for a forked BattleField. The copy
+     * has the same prototype as this status. Unlike cloneAndRoot, this also
+     * copies statuses whose cloning is disabled.
+     */
+    boost::shared_ptr<StatusObject> forkAndRoot(ScriptContext *,
+            const SCRIPT_OBJECT_MAP &);
+
     // State.
     int getState(ScriptContext *);
     void setState(ScriptContext *, const int);
@@ -300,6 +314,8 @@ public:
     StatusObject getClause(const std::string &) const;
 
     void getClauseList(std::vector<StatusObject> &) const;
+    void getAbilityList(std::vector<StatusObject> &) const;
+    void getItemList(std::vector<StatusObject> &) const;
     
     ScriptValue callFunction(ScriptObject *obj,
             const ScriptFunction *func,
@@ -311,7 +327,20 @@ public:
 
     bool hasProperty(ScriptObject *obj, const std::string name) const;
 
-    void runFile(const std::string file);
+    /**
+     * Copy the enumerable properties of one object onto another. Any value
+     * found in the remapping table is replaced with its counterpart, and
+     * any other array or plain object is copied deeply, so the two objects
+     * share no mutable state.
+     */
+    void copyProperties(const ScriptObject *from, ScriptObject *to,
+            const SCRIPT_OBJECT_MAP &remap);
+
+    /**
+     * Run a script file. Returns false if it could not be read or did not
+     * run to completion.
+     */
+    bool runFile(const std::string file);
 
     ScriptMachine *getMachine() { return m_machine; }
 
@@ -382,6 +411,9 @@ public:
     /** Return the number of active roots. **/
     unsigned int getRootCount() const;
 
+    /** Return the number of bytes in the script heap. **/
+    unsigned int getHeapSize() const;
+
     /** Obtain a new context for running scripts. **/
     ScriptContextPtr acquireContext();
 
@@ -396,6 +428,17 @@ public:
     void includeSpecies(const std::string);
     void populateMoveLists();
 
+    /**
+     * Read a data file ahead of the script that includes it, so that the
+     * include only has to build its objects. These can be called from any
+     * thread, before or while the scripts run; data that no script includes
+     * is dropped by finalise. Each returns false if the file could not be
+     * read, in which case the include reads it again itself.
+     */
+    bool prefetchSpecies(const std::string);
+    bool prefetchMoves(const std::string);
+    bool prefetchText(const std::string);
+
     void finalise();
     
 private:
@@ -273,6 +273,21 @@ StatusObjectPtr StatusObject::cloneAndRoot(ScriptContext *scx) {
     return ret;
 }
 
+StatusObjectPtr StatusObject::forkAndRoot(ScriptContext *scx,
+        const SCRIPT_OBJECT_MAP &remap) {
+    JSContext *cx = (JSContext *)scx->m_p;
+    JS_BeginRequest(cx);
+    // Only the own properties are copied, so the fork has to inherit from
+    // the same prototype (such as a StatusEffect) as this status.
+    JSObject *src = (JSObject *)m_p;
+    JSObject *obj = JS_NewObject(cx, NULL, JS_GetPrototype(cx, src),
+            JS_GetParent(cx, src));
+    StatusObjectPtr ret = scx->addRoot(new StatusObject(obj));
+    scx->copyProperties(this, ret.get(), remap);
+    JS_EndRequest(cx);
+    return ret;
+}
+
 string StatusObject::getId(ScriptContext *scx) const {
     JSContext *cx = (JSContext *)scx->m_p;
     jsval val;
@@ -54,8 +54,14 @@ struct BattleFieldImpl {
     MoveObjectPtr lastMove;
     bool narration;
     int host;
+    TurnArena arena;    // transient containers; reset after each turn
 
-    typedef map<pair<Pokemon *, Pokemon *>, bool> RANDOM_MAP;
+    typedef pair<Pokemon *, Pokemon *> POKEMON_PAIR;
+    typedef map<POKEMON_PAIR, bool, less<POKEMON_PAIR>,
+            ArenaAllocator<pair<const POKEMON_PAIR, bool> > > RANDOM_MAP;
+    typedef vector<Pokemon::PTR, ArenaAllocator<Pokemon::PTR> > ARRAY;
+    typedef vector<const PokemonTurn *,
+            ArenaAllocator<const PokemonTurn *> > TURN_LIST;
 
     BattleFieldImpl():
             mech(NULL),
@@ -64,7 +70,26 @@ struct BattleFieldImpl {
             narration(true),
             host(0) { }
 
-    void sortInTurnOrder(vector<Pokemon::PTR> &, vector<const PokemonTurn *> &);
+    template <class T, class U>
+    void sortInTurnOrder(T &, U &);
+
+    template <class T>
+    void getActivePokemon(T &v, T *inactive) {
+        for (int i = 0; i < TEAM_COUNT; ++i) {
+            PokemonParty &party = *active[i];
+            for (int j = 0; j < partySize; ++j) {
+                Pokemon::PTR p = party[j];
+                if (p) {
+                    if (!p->isFainted()) {
+                        v.push_back(p);
+                    } else if (inactive) {
+                        inactive->push_back(p);
+                    }
+                }
+            }
+        }
+    }
+
     bool speedComparator(RANDOM_MAP &random,
             Pokemon *p1, Pokemon *p2) {
         const int s1 = p1->getStat(S_SPEED);
@@ -111,6 +136,9 @@ struct BattleFieldImpl {
         const std::string trainer[TEAM_COUNT],
         const int activeParty,
         vector<StatusObject> &clauses);
+
+    void fork(BattleField *field, BattleFieldImpl &parent,
+        const BattleMechanics *mech, ScriptContextPtr cx);
     
     void terminate() {
         if (object) {
@@ -211,9 +239,13 @@ ScriptValue BattleField::sendMessage(const string &message,
  */
 template <class T>
 void BattleField::sortBySpeed(T &pokemon) {
+    typedef BattleFieldImpl::RANDOM_MAP RANDOM_MAP;
+    TurnArena::Scope scope(m_impl->arena);
+    RANDOM_MAP random((RANDOM_MAP::key_compare()),
+            RANDOM_MAP::allocator_type(m_impl->arena));
     sort(pokemon.begin(), pokemon.end(),
             boost::bind(&BattleFieldImpl::speedComparator,
-                m_impl, BattleFieldImpl::RANDOM_MAP(), _1, _2));
+                m_impl, boost::ref(random), _1, _2));
 }
 
 /**
@@ -360,7 +392,7 @@ Pokemon *BattleField::getRandomTarget(const int partyIdx) const {
 /**
  * Build a list of targets for a move.
  */
-void BattleField::getTargetList(TARGET mc, std::vector<Pokemon *> &targets,
+void BattleField::getTargetList(TARGET mc, TARGET_LIST &targets,
         Pokemon *user, Pokemon *target) {
     shared_ptr<PokemonParty> *active = m_impl->active;
     if (isTargeted(mc)) {
@@ -432,19 +464,7 @@ shared_ptr<PokemonParty> *BattleField::getActivePokemon() {
  */
 void BattleField::getActivePokemon(Pokemon::ARRAY &v,
         Pokemon::ARRAY *inactive) {
-    for (int i = 0; i < TEAM_COUNT; ++i) {
-        PokemonParty &party = *m_impl->active[i];
-        for (int j = 0; j < m_impl->partySize; ++j) {
-            Pokemon::PTR p = party[j];
-            if (p) {
-                if (!p->isFainted()) {
-                    v.push_back(p);
-                } else if (inactive) {
-                    inactive->push_back(p);
-                }
-            }
-        }
-    }
+    m_impl->getActivePokemon(v, inactive);
 }
 
 namespace {
@@ -511,12 +531,15 @@ bool turnOrderComparator(BattleFieldImpl *impl,
 /**
  * Sort a list of pokemon in turn order.
  */
-void BattleFieldImpl::sortInTurnOrder(vector<Pokemon::PTR> &pokemon,
-        vector<const PokemonTurn *> &turns) {
-    vector<TurnOrderEntity> entities;
+template <class T, class U>
+void BattleFieldImpl::sortInTurnOrder(T &pokemon, U &turns) {
+    TurnArena::Scope scope(arena);
+    vector<TurnOrderEntity, ArenaAllocator<TurnOrderEntity> > entities(
+            (ArenaAllocator<TurnOrderEntity>(arena)));
 
     const int count = pokemon.size();
     assert(count == (int)turns.size());
+    entities.reserve(count);
     for (int i = 0; i < count; ++i) {
         TurnOrderEntity entity;
         Pokemon::PTR p = pokemon[i];
@@ -537,9 +560,10 @@ void BattleFieldImpl::sortInTurnOrder(vector<Pokemon::PTR> &pokemon,
     }
 
     // sort the entities
+    RANDOM_MAP random((RANDOM_MAP::key_compare()),
+            RANDOM_MAP::allocator_type(arena));
     sort(entities.begin(), entities.end(),
-            boost::bind(turnOrderComparator, this,
-                BattleFieldImpl::RANDOM_MAP(), _1, _2));
+            boost::bind(turnOrderComparator, this, boost::ref(random), _1, _2));
 
     // reorder the parameter vectors
     for (int i = 0; i < count; ++i) {
@@ -549,9 +573,18 @@ void BattleFieldImpl::sortInTurnOrder(vector<Pokemon::PTR> &pokemon,
     }
 }
 
+void BattleField::sortInTurnOrder(Pokemon::ARRAY &pokemon,
+        vector<const PokemonTurn *> &turns) {
+    m_impl->sortInTurnOrder(pokemon, turns);
+}
+
 BattleField::BattleField():
         m_impl(shared_ptr<BattleFieldImpl>(new BattleFieldImpl())) { }
 
+TurnArena &BattleField::getArena() {
+    return m_impl->arena;
+}
+
 ScriptMachine *BattleField::getScriptMachine() {
     return m_impl->machine;
 }
@@ -641,18 +674,15 @@ void BattleField::print(const TextMessage &msg) {
     if (!isNarrationEnabled())
         return;
 
-    const vector<string> &args = msg.getArgs();
-    const int argc = args.size();
-    const char *argv[argc];
-    for (int i = 0; i < argc; ++i) {
-        argv[i] = args[i].c_str();
-    }
-    string message = m_impl->machine->getText(
-            msg.getCategory(), msg.getMessage(), argc, argv);
+    string message = m_impl->machine->getText()->getText(
+            msg.getCategory(), msg.getMessage(),
+            msg.getArgCount(), msg.getArgs());
     Log::out() << message << endl;
 }
 
 void BattleField::informSendOut(Pokemon *p) {
+    if (!isNarrationEnabled())
+        return;
     const int party = p->getParty();
     const string trainer = m_impl->active[party]->getName();
     Log::out() << trainer << " sent out " << p->getName()
@@ -661,17 +691,23 @@ void BattleField::informSendOut(Pokemon *p) {
 }
 
 void BattleField::informWithdraw(Pokemon *p) {
+    if (!isNarrationEnabled())
+        return;
     const int party = p->getParty();
     const string trainer = m_impl->active[party]->getName();
     Log::out() << trainer << " withdrew " << p->getName() << "!" << endl;
 }
 
 void BattleField::informUseMove(Pokemon *p, MoveObject *move) {
+    if (!isNarrationEnabled())
+        return;
     Log::out() << p->getName() << " used "
             << move->getName(m_impl->context) << "!" << endl;
 }
 
 void BattleField::informHealthChange(Pokemon *p, const int delta) {
+    if (!isNarrationEnabled())
+        return;
     const int numerator = floor(48.0 * (double)delta
             / (double)p->getRawStat(S_HP) + 0.5);
     Log::out() << p->getName() << " lost " << numerator << "/48 of its health!"
@@ -679,6 +715,8 @@ void BattleField::informHealthChange(Pokemon *p, const int delta) {
 }
 
 void BattleField::informFainted(Pokemon *p) {
+    if (!isNarrationEnabled())
+        return;
     Log::out() << p->getName() << " fainted!" << endl;
 }
 
@@ -745,7 +783,9 @@ bool vetoExecutionPredicate(Pokemon::PTR p1, Pokemon::PTR p2, Pokemon *user) {
  */
 bool BattleField::vetoExecution(Pokemon *user, Pokemon *target,
         MoveObject *move) {
-    Pokemon::ARRAY pokemon;
+    TurnArena::Scope scope(m_impl->arena);
+    BattleFieldImpl::ARRAY pokemon(
+            (ArenaAllocator<Pokemon::PTR>(m_impl->arena)));
     for (int i = 0; i < TEAM_COUNT; ++i) {
         for (int j = 0; j < m_impl->partySize; ++j) {
             Pokemon::PTR p = (*m_impl->active[i])[j];
@@ -756,7 +796,7 @@ bool BattleField::vetoExecution(Pokemon *user, Pokemon *target,
     }
     sort(pokemon.begin(), pokemon.end(),
             boost::bind(vetoExecutionPredicate, _1, _2, user));
-    for (Pokemon::ARRAY::iterator i = pokemon.begin();
+    for (BattleFieldImpl::ARRAY::iterator i = pokemon.begin();
             i != pokemon.end(); ++i) {
         if ((*i)->vetoExecution(user, target, move)) {
             return true;
@@ -843,6 +883,7 @@ bool fieldEffectComparator(const FieldEffectEntity &e1,
  */
 void BattleField::tickEffects() {
     ScriptContext *cx = m_impl->context;
+    TurnArena::Scope scope(m_impl->arena);
 
     for (STATUSES::const_iterator i = m_impl->effects.begin();
             i != m_impl->effects.end(); ++i) {
@@ -853,7 +894,8 @@ void BattleField::tickEffects() {
         cx->callFunctionByName(i->get(), "beginTick", 1, argv);
     }
 
-    vector<EffectEntity> effects;
+    vector<EffectEntity, ArenaAllocator<EffectEntity> > effects(
+            (ArenaAllocator<EffectEntity>(m_impl->arena)));
     for (int i = 0; i < TEAM_COUNT; ++i) {
         PokemonParty &party = *m_impl->active[i];
         for (int j = 0; j < m_impl->partySize; ++j) {
@@ -888,7 +930,8 @@ void BattleField::tickEffects() {
             m_impl->descendingSpeed, _1, _2));
 
     int tier = -1;
-    for (vector<EffectEntity>::iterator i = effects.begin();
+    for (vector<EffectEntity, ArenaAllocator<EffectEntity> >::iterator i =
+            effects.begin();
             i != effects.end(); ++i) {
 
         if (tier != i->tier) {
@@ -916,7 +959,8 @@ void BattleField::tickEffects() {
         }
     }
 
-    vector<FieldEffectEntity> fieldEffects;
+    vector<FieldEffectEntity, ArenaAllocator<FieldEffectEntity> >
+            fieldEffects((ArenaAllocator<FieldEffectEntity>(m_impl->arena)));
     for (STATUSES::const_iterator i = m_impl->effects.begin();
             i != m_impl->effects.end(); ++i) {
         if (!(*i)->isActive(cx))
@@ -929,8 +973,9 @@ void BattleField::tickEffects() {
     sort(fieldEffects.begin(), fieldEffects.end(),
             boost::bind(fieldEffectComparator, _1, _2));
 
-    for (vector<FieldEffectEntity>::const_iterator i = fieldEffects.begin();
-            i != fieldEffects.end(); ++i) {
+    for (vector<FieldEffectEntity,
+                ArenaAllocator<FieldEffectEntity> >::const_iterator i =
+                fieldEffects.begin(); i != fieldEffects.end(); ++i) {
         StatusObject *effect = i->effect;
         if (!effect->isActive(cx))
             continue;
@@ -1032,6 +1077,8 @@ bool BattleField::determineVictory() {
  * Inform that one team won the battle.
  */
 void BattleField::informVictory(const int party) {
+    if (!isNarrationEnabled())
+        return;
     if (party != -1) {
         PokemonParty &obj = *m_impl->active[party];
         Log::out() << obj.getName() << " wins!" << endl;
@@ -1165,8 +1212,12 @@ bool BattleField::executePendingAction(Pokemon *p) {
  * Process a turn.
  */
 void BattleField::processTurn(vector<PokemonTurn> &turns) {
-    vector<Pokemon::PTR> pokemon, inactive;
-    getActivePokemon(pokemon, &inactive);
+    // Everything allocated from the arena during the turn is released when
+    // this scope ends.
+    TurnArena::Scope scope(m_impl->arena);
+    const ArenaAllocator<Pokemon::PTR> allocator(m_impl->arena);
+    BattleFieldImpl::ARRAY pokemon(allocator), inactive(allocator);
+    m_impl->getActivePokemon(pokemon, &inactive);
     const int count = pokemon.size();
     if (count != (int)turns.size())
         throw BattleFieldException();
@@ -1174,7 +1225,8 @@ void BattleField::processTurn(vector<PokemonTurn> &turns) {
     for_each(inactive.begin(), inactive.end(),
             boost::bind(&Pokemon::setTurn, _1, &PokemonTurn::NOP, false));
     
-    vector<const PokemonTurn *> ordered;
+    BattleFieldImpl::TURN_LIST ordered(allocator);
+    ordered.reserve(count);
     for (int i = 0; i < count; ++i) {
         Pokemon::PTR p = pokemon[i];
         PokemonTurn *turn = &turns[i];
@@ -1287,8 +1339,7 @@ void BattleField::getModifiers(Pokemon &user, Pokemon &target,
  * attacking a given target.
  */
 void BattleField::getImmunities(Pokemon *user, Pokemon *target,
-        set<const PokemonType *> &immunities,
-        set<const PokemonType *> &vulnerabilities) {
+        TYPE_MASK &immunities, TYPE_MASK &vulnerabilities) {
     for (int i = 0; i < TEAM_COUNT; ++i) {
         for (int j = 0; j < m_impl->partySize; ++j) {
             Pokemon::PTR p = (*m_impl->active[i])[j];
@@ -1299,6 +1350,22 @@ void BattleField::getImmunities(Pokemon *user, Pokemon *target,
     }
 }
 
+/**
+ * Determine whether any active pokemon has a status that transforms the
+ * effectiveness of moves. If none does, the transform path can be skipped.
+ */
+bool BattleField::hasEffectivenessTransform() {
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        for (int j = 0; j < m_impl->partySize; ++j) {
+            Pokemon::PTR p = (*m_impl->active[i])[j];
+            if (p && !p->isFainted() && p->hasEffectivenessTransform()) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
 /**
  * Get the transformed effectiveness of a move of a certain
  * type against a particular target
@@ -1373,6 +1440,68 @@ void BattleField::initialise(const BattleMechanics *mech,
     }
 }
 
+shared_ptr<BattleField> BattleField::fork(const BattleMechanics *mech,
+        ScriptContextPtr cx) {
+    if (!m_impl || !m_impl->context || !m_impl->executing.empty()
+            || !mech || (mech == m_impl->mech)) {
+        throw BattleFieldException();
+    }
+    shared_ptr<BattleField> ret(new BattleField());
+    ret->m_impl->fork(ret.get(), *m_impl, mech,
+            cx ? cx : m_impl->contextRef);
+    return ret;
+}
+
+void BattleFieldImpl::fork(BattleField *field, BattleFieldImpl &parent,
+        const BattleMechanics *mech, ScriptContextPtr cx) {
+    this->machine = parent.machine;
+    this->contextRef = cx;
+    this->context = this->contextRef.get();
+    this->object = context->newFieldObject(field);
+    this->mech = mech;
+    this->host = parent.host;
+    this->generation = parent.generation;
+    this->partySize = parent.partySize;
+    this->descendingSpeed = parent.descendingSpeed;
+    this->narration = false;
+
+    ForkMap map;
+    map.objects[parent.object->getObject()] = object->getObject();
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        const Pokemon::ARRAY &team = parent.teams[i];
+        for (Pokemon::ARRAY::const_iterator j = team.begin();
+                j != team.end(); ++j) {
+            teams[i].push_back((*j)->fork(field, contextRef, map));
+        }
+        active[i] = shared_ptr<PokemonParty>(
+                new PokemonParty(partySize, parent.active[i]->getName()));
+        for (int j = 0; j < partySize; ++j) {
+            Pokemon::PTR p = (*parent.active[i])[j];
+            if (p) {
+                (*active[i])[j] = teams[i][p->getPosition()];
+            }
+        }
+    }
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        const int size = teams[i].size();
+        for (int j = 0; j < size; ++j) {
+            teams[i][j]->forkState(*parent.teams[i][j], map);
+        }
+    }
+    // Field effects are shared with the pokemon they apply to, so most of
+    // them have already been copied above.
+    for (STATUSES::const_iterator i = parent.effects.begin();
+            i != parent.effects.end(); ++i) {
+        if ((*i)->isRemovable(context))
+            continue;
+        StatusObjectPtr effect = map.getStatus(context, *i);
+        effect->disableClone(context);
+        effects.push_back(effect);
+    }
+    lastMove = map.getMove(context, parent.lastMove);
+    context->copyProperties(parent.object.get(), object.get(), map.objects);
+}
+
 void BattleFieldImpl::initialise(BattleField *field,
         const BattleMechanics *mech,
         Generation *generation,
@@ -30,6 +30,7 @@
 #include <vector>
 #include <set>
 #include "Pokemon.h"
+#include "TurnArena.h"
 #include "../matchmaking/MetagameList.h"
 #include "../scripting/ObjectWrapper.h"
 
@@ -52,26 +53,49 @@ class BattleFieldException {
     
 };
 
+/**
+ * A message from the text database. The arguments are not copied, so they
+ * must outlive the message, which is normally used for a single print().
+ */
 class TextMessage {
 public:
+    TextMessage(const int category, const int msg):
+            m_category(category),
+            m_msg(msg),
+            m_args(NULL),
+            m_argc(0) { }
     TextMessage(const int category, const int msg,
-            const std::vector<std::string> &args = std::vector<std::string>()):
+            const std::string *args, const int argc):
             m_category(category),
             m_msg(msg),
-            m_args(args) { }
+            m_args(args),
+            m_argc(argc) { }
+    TextMessage(const int category, const int msg,
+            const std::vector<std::string> &args):
+            m_category(category),
+            m_msg(msg),
+            m_args(args.empty() ? NULL : &args[0]),
+            m_argc(args.size()) { }
     int getCategory() const {
         return m_category;
     }
     int getMessage() const {
         return m_msg;
     }
-    const std::vector<std::string> &getArgs() const {
+    int getArgCount() const {
+        return m_argc;
+    }
+    const std::string &getArg(const int i) const {
+        return m_args[i];
+    }
+    const std::string *getArgs() const {
         return m_args;
     }
 private:
     const int m_category;
     const int m_msg;
-    const std::vector<std::string> m_args;
+    const std::string *m_args;
+    const int m_argc;
 };
 
 enum TURN_TYPE {
@@ -150,6 +174,23 @@ public:
             const int activeParty,
             std::vector<StatusObject> &clauses);
 
+    /**
+     * Create an independent copy of the current state of this battle: the
+     * pokemon, their statuses (including script state) and field effects.
+     * Immutable data is shared with this battle rather than copied.
+     *
+     * The fork is a plain BattleField with narration disabled, so it can be
+     * played forward to look ahead without affecting this battle. It uses
+     * the given mechanics, which must not be those of this battle, so that
+     * the fork never draws from this battle's random numbers. If the script
+     * context is omitted, it is shared with this battle, in which case the
+     * fork must be used on the same thread. Forking is only possible between
+     * turns; otherwise BattleFieldException is thrown.
+     */
+    boost::shared_ptr<BattleField> fork(const BattleMechanics *mech,
+            boost::shared_ptr<ScriptContext> cx =
+                boost::shared_ptr<ScriptContext>());
+
     /**
      * Get the party size.
      */
@@ -170,6 +211,12 @@ public:
      */
     void processTurn(std::vector<PokemonTurn> &turn);
 
+    /**
+     * Sort pokemon and their pending turns into the order in which the turns
+     * will be executed.
+     */
+    void sortInTurnOrder(Pokemon::ARRAY &, std::vector<const PokemonTurn *> &);
+
     /**
      * Execute pokemon's pending action.
      */
@@ -251,11 +298,18 @@ public:
      */
     Pokemon *getRandomTarget(const int party) const;
 
+    typedef std::vector<Pokemon *, ArenaAllocator<Pokemon *> > TARGET_LIST;
+
     /**
      * Get a list of targets for a move.
      */
-    void getTargetList(TARGET, std::vector<Pokemon *> &,
-            Pokemon *, Pokemon *);
+    void getTargetList(TARGET, TARGET_LIST &, Pokemon *, Pokemon *);
+
+    /**
+     * Get the arena for containers that last no longer than a turn. See
+     * TurnArena::Scope.
+     */
+    TurnArena &getArena();
 
     /**
      * Determine whether the execution of a move should be vetoed.
@@ -331,8 +385,12 @@ public:
      * Get a list of special types to which a pokemon is immune or vulnerable.
      */
     void getImmunities(Pokemon *user, Pokemon *target,
-            std::set<const PokemonType *> &immunities,
-            std::set<const PokemonType *> &vulnerabilities);
+            TYPE_MASK &immunities, TYPE_MASK &vulnerabilities);
+
+    /**
+     * Determine whether any active status transforms type effectiveness.
+     */
+    bool hasEffectivenessTransform();
     
     /**
      * Get's the transformed effectiveness of a move type on a target
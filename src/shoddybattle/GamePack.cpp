@@ -0,0 +1,523 @@
+/* 
+ * File:   GamePack.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdint.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/thread/mutex.hpp>
+#include "GamePack.h"
+#include "../mechanics/PokemonNature.h"
+#include "../main/Log.h"
+
+using namespace std;
+
+namespace shoddybattle {
+
+namespace {
+
+const char PACK_MAGIC[8] = { 'S', 'B', '2', 'P', 'A', 'C', 'K', '\0' };
+
+/**
+ * The version of the pack format. This must be increased whenever the
+ * layout of any record changes, so that old packs are recompiled.
+ */
+const uint32_t PACK_VERSION = 1;
+
+// Written in the byte order of the machine that writes the pack.
+const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum SECTION_KIND {
+    SK_SPECIES = 0,
+    SK_MOVES = 1,
+    SK_GENERATIONS = 2
+};
+
+boost::mutex packMutex;
+string packPath = "resources/gamedata.pack";
+
+class PackFormatException {
+
+};
+
+/**
+ * Appends values to a buffer in the pack format.
+ */
+class PackWriter {
+public:
+    PackWriter(string &buffer): m_buffer(buffer) { }
+    template <class T>
+    void put(const T value) {
+        m_buffer.append(reinterpret_cast<const char *>(&value), sizeof(T));
+    }
+    void putString(const string &str) {
+        put<uint32_t>(str.length());
+        m_buffer.append(str);
+    }
+    template <class T>
+    void putStrings(const T &strings) {
+        put<uint32_t>(strings.size());
+        typename T::const_iterator i = strings.begin();
+        for (; i != strings.end(); ++i) {
+            putString(*i);
+        }
+    }
+private:
+    string &m_buffer;
+};
+
+/**
+ * Reads values in the pack format from a region of memory, throwing
+ * PackFormatException if the region ends too soon.
+ */
+class PackReader {
+public:
+    PackReader(const char *begin, const char *end):
+            m_pos(begin), m_end(end) { }
+    template <class T>
+    T get() {
+        T value;
+        memcpy(&value, take(sizeof(T)), sizeof(T));
+        return value;
+    }
+    string getString() {
+        const uint32_t length = get<uint32_t>();
+        return string(take(length), length);
+    }
+    /**
+     * Read a count of items that each take at least itemSize bytes, so
+     * that a corrupt count is rejected before anything is allocated.
+     */
+    uint32_t getCount(const size_t itemSize) {
+        const uint32_t count = get<uint32_t>();
+        if (count > size_t(m_end - m_pos) / itemSize)
+            throw PackFormatException();
+        return count;
+    }
+    template <class T>
+    void getStrings(T &strings) {
+        const uint32_t count = getCount(sizeof(uint32_t));
+        for (uint32_t i = 0; i < count; ++i) {
+            strings.insert(strings.end(), getString());
+        }
+    }
+    const char *take(const size_t bytes) {
+        if (bytes > size_t(m_end - m_pos))
+            throw PackFormatException();
+        const char *p = m_pos;
+        m_pos += bytes;
+        return p;
+    }
+    bool atEnd() const {
+        return (m_pos == m_end);
+    }
+private:
+    const char *m_pos;
+    const char *m_end;
+};
+
+/**
+ * A read-only memory mapping of a whole file.
+ */
+class MappedFile {
+public:
+    MappedFile(const string &file): m_data(NULL), m_size(0) {
+        const int fd = open(file.c_str(), O_RDONLY);
+        if (fd == -1)
+            return;
+        struct stat info;
+        if ((fstat(fd, &info) == 0) && (info.st_size > 0)) {
+            void *p = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (p != MAP_FAILED) {
+                m_data = static_cast<const char *>(p);
+                m_size = info.st_size;
+            }
+        }
+        close(fd);
+    }
+    ~MappedFile() {
+        if (m_data) {
+            munmap(const_cast<char *>(m_data), m_size);
+        }
+    }
+    const char *getData() const {
+        return m_data;
+    }
+    size_t getSize() const {
+        return m_size;
+    }
+private:
+    const char *m_data;
+    size_t m_size;
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+/**
+ * The size and modification time of a source file.
+ */
+struct FINGERPRINT {
+    int64_t size;
+    int64_t mtime;
+};
+
+bool getFingerprint(const string &file, FINGERPRINT &fingerprint) {
+    struct stat info;
+    if (stat(file.c_str(), &info) != 0)
+        return false;
+    fingerprint.size = info.st_size;
+    fingerprint.mtime = info.st_mtime;
+    return true;
+}
+
+struct SECTION {
+    uint32_t kind;
+    string source;
+    FINGERPRINT fingerprint;
+    const char *payload;
+    uint32_t length;
+};
+
+/**
+ * Read the table of sections in a pack. The payloads point into the pack.
+ */
+void readSections(const MappedFile &pack, vector<SECTION> &sections) {
+    PackReader reader(pack.getData(), pack.getData() + pack.getSize());
+    if (memcmp(reader.take(sizeof(PACK_MAGIC)), PACK_MAGIC,
+            sizeof(PACK_MAGIC)) != 0)
+        throw PackFormatException();
+    if (reader.get<uint32_t>() != PACK_VERSION)
+        throw PackFormatException();
+    if (reader.get<uint32_t>() != BYTE_ORDER_MARK)
+        throw PackFormatException();
+    const uint32_t count = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < count; ++i) {
+        SECTION section;
+        section.kind = reader.get<uint32_t>();
+        section.source = reader.getString();
+        section.fingerprint.size = reader.get<int64_t>();
+        section.fingerprint.mtime = reader.get<int64_t>();
+        section.length = reader.get<uint32_t>();
+        section.payload = reader.take(section.length);
+        sections.push_back(section);
+    }
+}
+
+void encode(PackWriter &writer, const SPECIES_DATA &p) {
+    writer.put<int32_t>(p.id);
+    writer.putString(p.name);
+    writer.putStrings(p.types);
+    writer.put<int32_t>(p.gender);
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        writer.put<int32_t>(p.base[i]);
+    }
+    writer.put<double>(p.mass);
+    writer.put<uint32_t>(p.moves.size());
+    for (MOVESET::const_iterator i = p.moves.begin(); i != p.moves.end();
+            ++i) {
+        writer.put<int32_t>(i->first);
+        writer.putStrings(i->second);
+    }
+    writer.put<uint32_t>(p.illegal.size());
+    for (COMBINATION_LIST::const_iterator i = p.illegal.begin();
+            i != p.illegal.end(); ++i) {
+        writer.put<int32_t>(i->nature ? i->nature->getInternalValue() : -1);
+        writer.putString(i->ability);
+        writer.put<uint32_t>(i->gender);
+        writer.putStrings(i->moves);
+    }
+    writer.putStrings(p.abilities);
+}
+
+void decode(PackReader &reader, SPECIES_DATA &p) {
+    p.id = reader.get<int32_t>();
+    p.name = reader.getString();
+    reader.getStrings(p.types);
+    p.gender = reader.get<int32_t>();
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        p.base[i] = reader.get<int32_t>();
+    }
+    p.mass = reader.get<double>();
+    const uint32_t origins = reader.get<uint32_t>();
+    for (uint32_t i = 0; i < origins; ++i) {
+        const MOVE_ORIGIN origin = (MOVE_ORIGIN)reader.get<int32_t>();
+        reader.getStrings(p.moves[origin]);
+    }
+    // nature, ability, gender and moves take at least four bytes each
+    const uint32_t combinations = reader.getCount(4 * sizeof(uint32_t));
+    p.illegal.resize(combinations);
+    for (uint32_t i = 0; i < combinations; ++i) {
+        Combination &combo = p.illegal[i];
+        combo.nature = PokemonNature::getNature(reader.get<int32_t>());
+        combo.ability = reader.getString();
+        combo.gender = reader.get<uint32_t>();
+        reader.getStrings(combo.moves);
+    }
+    reader.getStrings(p.abilities);
+}
+
+void encode(PackWriter &writer, const MOVE_DATA &p) {
+    writer.putString(p.name);
+    writer.put<int32_t>(p.id);
+    writer.putString(p.type);
+    writer.put<int32_t>(p.moveClass);
+    writer.put<int32_t>(p.targetClass);
+    writer.put<uint32_t>(p.power);
+    writer.put<uint32_t>(p.pp);
+    writer.put<int32_t>(p.priority);
+    writer.put<double>(p.accuracy);
+    writer.put<uint32_t>(p.flags.to_ulong());
+    writer.putString(p.initFunction);
+    writer.putString(p.useFunction);
+    writer.putString(p.attemptHit);
+}
+
+void decode(PackReader &reader, MOVE_DATA &p) {
+    p.name = reader.getString();
+    p.id = reader.get<int32_t>();
+    p.type = reader.getString();
+    p.moveClass = (MOVE_CLASS)reader.get<int32_t>();
+    p.targetClass = (TARGET)reader.get<int32_t>();
+    p.power = reader.get<uint32_t>();
+    p.pp = reader.get<uint32_t>();
+    p.priority = reader.get<int32_t>();
+    p.accuracy = reader.get<double>();
+    p.flags = bitset<FLAG_COUNT>(reader.get<uint32_t>());
+    p.initFunction = reader.getString();
+    p.useFunction = reader.getString();
+    p.attemptHit = reader.getString();
+}
+
+void encode(PackWriter &writer, const GENERATION_DATA &p) {
+    writer.putString(p.id);
+    writer.putString(p.name);
+    writer.put<uint32_t>(p.metagames.size());
+    vector<METAGAME_DATA>::const_iterator i = p.metagames.begin();
+    for (; i != p.metagames.end(); ++i) {
+        writer.putString(i->id);
+        writer.putString(i->name);
+        writer.putString(i->description);
+        writer.put<int32_t>(i->partySize);
+        writer.put<int32_t>(i->teamLength);
+        writer.putStrings(i->banList);
+        writer.putStrings(i->clauses);
+        writer.put<int32_t>(i->pool);
+        writer.put<int32_t>(i->periods);
+        writer.put<int32_t>(i->periodLength);
+    }
+}
+
+void decode(PackReader &reader, GENERATION_DATA &p) {
+    p.id = reader.getString();
+    p.name = reader.getString();
+    // three strings, two string lists and five integers
+    p.metagames.resize(reader.getCount(10 * sizeof(uint32_t)));
+    vector<METAGAME_DATA>::iterator i = p.metagames.begin();
+    for (; i != p.metagames.end(); ++i) {
+        i->id = reader.getString();
+        i->name = reader.getString();
+        i->description = reader.getString();
+        i->partySize = reader.get<int32_t>();
+        i->teamLength = reader.get<int32_t>();
+        reader.getStrings(i->banList);
+        reader.getStrings(i->clauses);
+        i->pool = reader.get<int32_t>();
+        i->periods = reader.get<int32_t>();
+        i->periodLength = reader.get<int32_t>();
+    }
+}
+
+template <class T>
+bool readSection(const SECTION_KIND kind, const string &source,
+        vector<T> &records) {
+    boost::mutex::scoped_lock lock(packMutex);
+    FINGERPRINT fingerprint;
+    if (packPath.empty() || !getFingerprint(source, fingerprint))
+        return false;
+    MappedFile pack(packPath);
+    if (!pack.getData())
+        return false;
+    try {
+        vector<SECTION> sections;
+        readSections(pack, sections);
+        vector<SECTION>::const_iterator i = sections.begin();
+        for (; i != sections.end(); ++i) {
+            if ((i->kind != (uint32_t)kind) || (i->source != source))
+                continue;
+            if ((i->fingerprint.size != fingerprint.size)
+                    || (i->fingerprint.mtime != fingerprint.mtime))
+                return false;   // the source has changed
+            PackReader reader(i->payload, i->payload + i->length);
+            records.resize(reader.getCount(sizeof(uint32_t)));
+            typename vector<T>::iterator j = records.begin();
+            for (; j != records.end(); ++j) {
+                decode(reader, *j);
+            }
+            if (!reader.atEnd())
+                throw PackFormatException();
+            return true;
+        }
+    } catch (PackFormatException &) {
+        Log::out() << "Warning: Ignoring invalid game data pack "
+                << packPath << "." << endl;
+    }
+    records.clear();
+    return false;
+}
+
+template <class T>
+bool writeSection(const SECTION_KIND kind, const string &source,
+        const vector<T> &records) {
+    boost::mutex::scoped_lock lock(packMutex);
+    FINGERPRINT fingerprint;
+    if (packPath.empty() || !getFingerprint(source, fingerprint))
+        return false;
+
+    string payload;
+    PackWriter payloadWriter(payload);
+    payloadWriter.put<uint32_t>(records.size());
+    typename vector<T>::const_iterator i = records.begin();
+    for (; i != records.end(); ++i) {
+        encode(payloadWriter, *i);
+    }
+
+    // Keep the sections for the other source files.
+    vector<SECTION> sections;
+    MappedFile pack(packPath);
+    if (pack.getData()) {
+        try {
+            readSections(pack, sections);
+        } catch (PackFormatException &) {
+            sections.clear();
+        }
+    }
+    SECTION section = { kind, source, fingerprint, payload.data(),
+            (uint32_t)payload.length() };
+    vector<SECTION>::iterator j = sections.begin();
+    for (; j != sections.end(); ++j) {
+        if ((j->kind == (uint32_t)kind) && (j->source == source)) {
+            *j = section;
+            break;
+        }
+    }
+    if (j == sections.end()) {
+        sections.push_back(section);
+    }
+
+    string buffer(PACK_MAGIC, sizeof(PACK_MAGIC));
+    PackWriter writer(buffer);
+    writer.put<uint32_t>(PACK_VERSION);
+    writer.put<uint32_t>(BYTE_ORDER_MARK);
+    writer.put<uint32_t>(sections.size());
+    for (j = sections.begin(); j != sections.end(); ++j) {
+        writer.put<uint32_t>(j->kind);
+        writer.putString(j->source);
+        writer.put<int64_t>(j->fingerprint.size);
+        writer.put<int64_t>(j->fingerprint.mtime);
+        writer.put<uint32_t>(j->length);
+        buffer.append(j->payload, j->length);
+    }
+
+    // Replace the pack atomically, so that a reader never sees half of it.
+    const string temporary = packPath + ".tmp";
+    {
+        ofstream file(temporary.c_str(), ios::out | ios::binary | ios::trunc);
+        file.write(buffer.data(), buffer.length());
+        if (!file) {
+            Log::out() << "Warning: Could not write the game data pack "
+                    << temporary << "." << endl;
+            return false;
+        }
+    }
+    if (rename(temporary.c_str(), packPath.c_str()) != 0) {
+        Log::out() << "Warning: Could not replace the game data pack "
+                << packPath << "." << endl;
+        remove(temporary.c_str());
+        return false;
+    }
+    return true;
+}
+
+template <class T>
+string getRecordEncoding(const T &record) {
+    string buffer;
+    PackWriter writer(buffer);
+    encode(writer, record);
+    return buffer;
+}
+
+} // anonymous namespace
+
+void GamePack::setPath(const string &path) {
+    boost::mutex::scoped_lock lock(packMutex);
+    packPath = path;
+}
+
+string GamePack::getPath() {
+    boost::mutex::scoped_lock lock(packMutex);
+    return packPath;
+}
+
+bool GamePack::read(const string &source, vector<SPECIES_DATA> &records) {
+    return readSection(SK_SPECIES, source, records);
+}
+
+bool GamePack::read(const string &source, vector<MOVE_DATA> &records) {
+    return readSection(SK_MOVES, source, records);
+}
+
+bool GamePack::read(const string &source, vector<GENERATION_DATA> &records) {
+    return readSection(SK_GENERATIONS, source, records);
+}
+
+bool GamePack::write(const string &source,
+        const vector<SPECIES_DATA> &records) {
+    return writeSection(SK_SPECIES, source, records);
+}
+
+bool GamePack::write(const string &source,
+        const vector<MOVE_DATA> &records) {
+    return writeSection(SK_MOVES, source, records);
+}
+
+bool GamePack::write(const string &source,
+        const vector<GENERATION_DATA> &records) {
+    return writeSection(SK_GENERATIONS, source, records);
+}
+
+string GamePack::getEncoding(const SPECIES_DATA &record) {
+    return getRecordEncoding(record);
+}
+
+string GamePack::getEncoding(const MOVE_DATA &record) {
+    return getRecordEncoding(record);
+}
+
+string GamePack::getEncoding(const GENERATION_DATA &record) {
+    return getRecordEncoding(record);
+}
+
+}
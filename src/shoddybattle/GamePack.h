@@ -0,0 +1,92 @@
+/* 
+ * File:   GamePack.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _GAME_PACK_H_
+#define _GAME_PACK_H_
+
+#include <string>
+#include <vector>
+#include "PokemonSpecies.h"
+#include "../moves/PokemonMove.h"
+#include "../matchmaking/MetagameList.h"
+
+namespace shoddybattle {
+
+/**
+ * The game data pack is a binary cache of the game data XML files: species,
+ * moves and metagames. The XML files remain the source of truth. The pack
+ * holds one section for each file that it was compiled from, recording the
+ * size and modification time of the file; a section is only used while the
+ * file is unchanged, and is otherwise recompiled from the XML.
+ *
+ * Reading the pack maps it into memory and decodes the records directly,
+ * without any XML parsing. The pack uses the byte order and layout of the
+ * machine that wrote it, and a pack from another machine or another version
+ * of the format is ignored.
+ */
+class GamePack {
+public:
+    /**
+     * Set the path of the pack. An empty path disables the pack. The default
+     * is resources/gamedata.pack.
+     */
+    static void setPath(const std::string &path);
+    static std::string getPath();
+
+    /**
+     * Read the records compiled from a source file, if the pack has an up to
+     * date section for it. Returns false if the records must be parsed from
+     * the source file instead.
+     */
+    static bool read(const std::string &source,
+            std::vector<SPECIES_DATA> &);
+    static bool read(const std::string &source,
+            std::vector<MOVE_DATA> &);
+    static bool read(const std::string &source,
+            std::vector<GENERATION_DATA> &);
+
+    /**
+     * Store the records parsed from a source file in the pack, replacing any
+     * previous section for that file. Returns false if the pack could not be
+     * written.
+     */
+    static bool write(const std::string &source,
+            const std::vector<SPECIES_DATA> &);
+    static bool write(const std::string &source,
+            const std::vector<MOVE_DATA> &);
+    static bool write(const std::string &source,
+            const std::vector<GENERATION_DATA> &);
+
+    /**
+     * Get a record as it is stored in the pack. Two records hold the same
+     * data exactly when their encodings are equal.
+     */
+    static std::string getEncoding(const SPECIES_DATA &);
+    static std::string getEncoding(const MOVE_DATA &);
+    static std::string getEncoding(const GENERATION_DATA &);
+
+private:
+    GamePack();
+};
+
+}
+
+#endif
@@ -0,0 +1,427 @@
+/* 
+ * File:   MonteCarloPolicy.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "MonteCarloPolicy.h"
+#include "RolloutPool.h"
+#include "../mechanics/JewelMechanics.h"
+#include "../scripting/ScriptMachine.h"
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle {
+
+namespace {
+
+/**
+ * Plays a fixed action for one active pokemon on the first turn of a
+ * rollout, and otherwise defers to another policy.
+ */
+class FirstTurnPolicy : public BattlePolicy {
+public:
+    FirstTurnPolicy(BattlePolicyPtr policy, const int slot,
+            const PokemonTurn &turn):
+            m_policy(policy),
+            m_slot(slot),
+            m_turn(turn),
+            m_used(false) { }
+    PokemonTurn selectTurn(BattleField &field, Pokemon *p) {
+        if (!m_used && (p->getSlot() == m_slot)) {
+            m_used = true;
+            return m_turn;
+        }
+        return m_policy->selectTurn(field, p);
+    }
+    int selectReplacement(BattleField &field, Pokemon *p,
+            const vector<bool> &switches) {
+        return m_policy->selectReplacement(field, p, switches);
+    }
+private:
+    BattlePolicyPtr m_policy;
+    const int m_slot;
+    const PokemonTurn m_turn;
+    bool m_used;
+};
+
+/**
+ * Get the fraction of its total hit points that a team has left.
+ */
+double getHealthFraction(const Pokemon::ARRAY &team) {
+    int hp = 0, total = 0;
+    for (Pokemon::ARRAY::const_iterator i = team.begin();
+            i != team.end(); ++i) {
+        if (!*i)
+            continue;
+        if (!(*i)->isFainted()) {
+            hp += (*i)->getHp();
+        }
+        total += (*i)->getRawStat(S_HP);
+    }
+    return (total == 0) ? 0.0 : (double(hp) / total);
+}
+
+/**
+ * Determine whether a set of flags allows the action with the given index.
+ */
+bool isAllowed(const vector<bool> &flags, const int i) {
+    return flags.empty() || ((i < (int)flags.size()) && flags[i]);
+}
+
+} // anonymous namespace
+
+MonteCarloSearch::MonteCarloSearch(RolloutPool *pool,
+        const FORK &fork,
+        const int party,
+        const int slot,
+        const MonteCarloOptions &options,
+        const RANDOM_SEED seed,
+        const PokemonTurn &fallback,
+        const LegalActions &legal,
+        const CALLBACK &callback,
+        shared_ptr<ScriptMachine> machine):
+        m_pool(pool),
+        m_fork(fork),
+        m_party(party),
+        m_slot(slot),
+        m_options(options),
+        m_seed(seed),
+        m_fallback(fallback),
+        m_legal(legal),
+        m_callback(callback),
+        m_machine(machine),
+        m_prepared(false),
+        m_cancelled(false),
+        m_next(0),
+        m_tasks(0),
+        m_rollouts(0),
+        m_stream(0) {
+    m_deadline = posix_time::microsec_clock::universal_time()
+            + posix_time::milliseconds(options.budget);
+}
+
+MonteCarloSearch::PTR MonteCarloSearch::begin(RolloutPool *pool,
+        const FORK &fork,
+        const int party,
+        const int slot,
+        const MonteCarloOptions &options,
+        const RANDOM_SEED seed,
+        const PokemonTurn &fallback,
+        const LegalActions &legal,
+        const CALLBACK &callback,
+        shared_ptr<ScriptMachine> machine) {
+    PTR search(new MonteCarloSearch(pool, fork, party, slot, options,
+            seed, fallback, legal, callback, machine));
+    const int tasks = pool->getThreadCount();
+    search->m_tasks = tasks;
+    for (int i = 0; i < tasks; ++i) {
+        pool->post(bind(&MonteCarloSearch::run, search, _1));
+    }
+    return search;
+}
+
+void MonteCarloSearch::cancel() {
+    lock_guard<mutex> guard(m_mutex);
+    m_cancelled = true;
+}
+
+int MonteCarloSearch::getRolloutCount() const {
+    lock_guard<mutex> guard(m_mutex);
+    return m_rollouts;
+}
+
+bool MonteCarloSearch::isExpired() const {
+    return (posix_time::microsec_clock::universal_time() >= m_deadline);
+}
+
+/**
+ * Determine the legal actions of the pokemon being searched for, using the
+ * first fork of the battle and the flags that the search was given. A forced
+ * action leaves only one candidate, in which case there is nothing to
+ * search.
+ */
+void MonteCarloSearch::prepare(BattleField &snapshot) {
+    m_prepared = true;
+    Pokemon::PTR p = snapshot.getActivePokemon(m_party, m_slot);
+    if (!p)
+        return;
+    p->determineLegalActions();
+    if (p->getForcedTurn()) {
+        m_candidates.push_back(Candidate(PokemonTurn()));
+        return;
+    }
+    const int moves = p->getMoveCount();
+    for (int i = 0; i < moves; ++i) {
+        if (p->isMoveLegal(i) && isAllowed(m_legal.moves, i)) {
+            MoveObjectPtr move = p->getMove(i);
+            m_candidates.push_back(Candidate(PokemonTurn(TT_MOVE, i,
+                    getDefaultTarget(snapshot, p.get(), move.get()))));
+        }
+    }
+    if (p->isSwitchLegal()) {
+        vector<bool> switches;
+        snapshot.getLegalSwitches(p.get(), switches);
+        const int size = switches.size();
+        for (int i = 0; i < size; ++i) {
+            if (switches[i] && isAllowed(m_legal.switches, i)) {
+                m_candidates.push_back(Candidate(PokemonTurn(TT_SWITCH, i)));
+            }
+        }
+    }
+}
+
+/**
+ * Play a single rollout on a fork of the snapshot, which draws on the given
+ * mechanics, starting with the given action, and score the result between
+ * 0 (a loss) and 1 (a win). A battle that is still undecided at the depth
+ * limit is scored by the difference in the health left on each team.
+ */
+double MonteCarloSearch::playOut(BattleField &snapshot,
+        const BattleMechanics &mech, const PokemonTurn &turn,
+        RandomGenerator &rand) {
+    shared_ptr<BattleField> field = snapshot.fork(&mech);
+    BattlePolicyPtr random(new RandomPolicy(rand.next()));
+    BattlePolicyPtr policies[TEAM_COUNT];
+    policies[m_party] = BattlePolicyPtr(
+            new FirstTurnPolicy(random, m_slot, turn));
+    policies[1 - m_party] = random;
+
+    double score = 0.5;
+    try {
+        int victor = -1;
+        bool decided = false;
+        for (int i = 0; i < m_options.depth; ++i) {
+            if (!playPolicyTurn(*field, policies)) {
+                decided = isBattleDecided(*field, victor);
+                break;
+            }
+        }
+        if (decided) {
+            score = (victor == -1) ? 0.5 : ((victor == m_party) ? 1.0 : 0.0);
+        } else {
+            score += 0.5 * (getHealthFraction(field->getTeam(m_party))
+                    - getHealthFraction(field->getTeam(1 - m_party)));
+        }
+    } catch (BattleFieldException &) {
+        // A rollout that breaks the engine counts as a draw.
+    }
+    field->terminate();
+    return score;
+}
+
+/**
+ * Run one batch of rollouts on a pool thread: fork the battle into a
+ * snapshot owned by this thread's context, try each candidate once from the
+ * snapshot, and then queue another batch if there is time left.
+ */
+void MonteCarloSearch::run(shared_ptr<ScriptContext> cx) {
+    CALLBACK callback;
+    PokemonTurn choice;
+    RANDOM_SEED seed = 0;
+    {
+        lock_guard<mutex> guard(m_mutex);
+        if (m_cancelled || isExpired() ||
+                (m_prepared && (m_candidates.size() < 2))) {
+            finishTask(callback, choice);
+        } else {
+            seed = RandomGenerator::deriveSeed(m_seed, m_stream++);
+        }
+    }
+    if (callback) {
+        callback(choice);
+        return;
+    }
+
+    // This context may not be freed on the thread that acquired it, so it is
+    // locked to this thread only for the duration of the batch.
+    shared_ptr<ScriptContextLock> cxLock;
+    if (m_machine) {
+        cx = m_machine->acquireContext();
+        cxLock = shared_ptr<ScriptContextLock>(new ScriptContextLock(cx));
+    }
+
+    // The snapshot and its rollouts draw on mechanics of their own, never on
+    // those of the battle being searched.
+    JewelMechanics snapshotMech(RandomGenerator::deriveSeed(seed, 0));
+    JewelMechanics mech(seed);
+    RandomGenerator rand(RandomGenerator::deriveSeed(seed, 1));
+    shared_ptr<BattleField> snapshot;
+    {
+        // The fork may wait for the battle's own lock, which is held by the
+        // battle when it cancels the search, so m_mutex is not held here.
+        lock_guard<mutex> forkGuard(m_forkMutex);
+        bool cancelled;
+        {
+            lock_guard<mutex> guard(m_mutex);
+            cancelled = m_cancelled;
+        }
+        if (!cancelled) {
+            try {
+                snapshot = m_fork(&snapshotMech, cx);
+            } catch (BattleFieldException &) {
+                // The battle is in the middle of a turn or has ended.
+            }
+        }
+    }
+    int candidates = 0;
+    {
+        lock_guard<mutex> guard(m_mutex);
+        if (!m_cancelled) {
+            if (snapshot && !m_prepared) {
+                prepare(*snapshot);
+            }
+            candidates = m_candidates.size();
+        }
+        if (!snapshot || (candidates < 2)) {
+            if (snapshot) {
+                snapshot->terminate();
+            }
+            finishTask(callback, choice);
+        }
+    }
+    if (!snapshot || (candidates < 2)) {
+        snapshot.reset();
+        cxLock.reset();
+        if (callback) {
+            callback(choice);
+        }
+        return;
+    }
+
+    int played = 0;
+    for (int i = 0; i < candidates; ++i) {
+        int idx;
+        PokemonTurn turn;
+        {
+            lock_guard<mutex> guard(m_mutex);
+            if (m_cancelled)
+                break;
+            idx = m_next;
+            m_next = (m_next + 1) % candidates;
+            turn = m_candidates[idx].turn;
+        }
+        const double score = playOut(*snapshot, mech, turn, rand);
+        ++played;
+        lock_guard<mutex> guard(m_mutex);
+        Candidate &c = m_candidates[idx];
+        ++c.visits;
+        c.score += score;
+        ++m_rollouts;
+    }
+    snapshot->terminate();
+    m_pool->addRollouts(played);
+
+    {
+        lock_guard<mutex> guard(m_mutex);
+        if (!m_cancelled && !isExpired()) {
+            m_pool->post(bind(&MonteCarloSearch::run, shared_from_this(), _1));
+        } else {
+            finishTask(callback, choice);
+        }
+    }
+    // The callback may run the battle's next turn on this thread, so the
+    // context acquired for the batch is given up first.
+    snapshot.reset();
+    cxLock.reset();
+    if (callback) {
+        callback(choice);
+    }
+}
+
+/**
+ * Record that a task has stopped. Once the last task has stopped, choose the
+ * action and hand back the callback, which the caller invokes after
+ * releasing the lock. Called with the lock held.
+ */
+void MonteCarloSearch::finishTask(CALLBACK &callback, PokemonTurn &turn) {
+    if ((--m_tasks != 0) || m_cancelled)
+        return;
+
+    turn = m_fallback;
+    if (m_candidates.size() == 1) {
+        turn = m_candidates[0].turn;
+    } else {
+        double best = -1.0;
+        for (vector<Candidate>::const_iterator i = m_candidates.begin();
+                i != m_candidates.end(); ++i) {
+            if (i->visits == 0)
+                continue;
+            const double mean = i->score / i->visits;
+            if (mean > best) {
+                best = mean;
+                turn = i->turn;
+            }
+        }
+    }
+    m_cancelled = true; // The search is over.
+    callback.swap(m_callback);
+}
+
+namespace {
+
+/**
+ * Receives the result of a search for a caller that waits for it.
+ */
+struct SearchResult {
+    mutex lock;
+    condition_variable condition;
+    PokemonTurn turn;
+    bool done;
+    SearchResult(): done(false) { }
+    void set(const PokemonTurn &t) {
+        lock_guard<mutex> guard(lock);
+        turn = t;
+        done = true;
+        condition.notify_all();
+    }
+};
+
+} // anonymous namespace
+
+PokemonTurn MonteCarloPolicy::selectTurn(BattleField &field, Pokemon *p) {
+    const PokemonTurn fallback = GreedyPolicy::selectTurn(field, p);
+    if (p->getForcedTurn())
+        return fallback;
+
+    shared_ptr<SearchResult> result(new SearchResult());
+    MonteCarloSearch::begin(m_pool,
+            bind(&BattleField::fork, &field, _1, _2),
+            p->getParty(), p->getSlot(),
+            m_options, m_seeds.next(), fallback, LegalActions(),
+            bind(&SearchResult::set, result, _1));
+
+    // Suspend any request on this thread, so that the pool threads can run
+    // scripts (and collect garbage) while this thread waits.
+    ScriptContext *cx = field.getContext();
+    const int depth = cx->clearContextThread();
+    {
+        unique_lock<mutex> lock(result->lock);
+        while (!result->done) {
+            result->condition.wait(lock);
+        }
+    }
+    cx->setContextThread(depth);
+    return result->turn;
+}
+
+}
@@ -0,0 +1,177 @@
+/* 
+ * File:   MonteCarloPolicy.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _MONTE_CARLO_POLICY_H_
+#define _MONTE_CARLO_POLICY_H_
+
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/enable_shared_from_this.hpp>
+#include <boost/utility.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include "SimulatedBattle.h"
+
+namespace shoddybattle {
+
+class RolloutPool;
+
+struct MonteCarloOptions {
+    int budget;     // milliseconds to spend choosing each move
+    int depth;      // maximum number of turns played by each rollout
+    MonteCarloOptions(): budget(1000), depth(20) { }
+};
+
+/**
+ * The actions that a client was offered in a request, as flags indexed by
+ * move and by position in the team. Empty flags restrict nothing, so a
+ * search without them tries every action that is legal in its fork.
+ */
+struct LegalActions {
+    std::vector<bool> moves;
+    std::vector<bool> switches;
+};
+
+/**
+ * A flat Monte Carlo search for the action of one active pokemon.
+ *
+ * Each legal action is tried in turn on a fork of the battle, which is then
+ * played forward by random policies until one party wins or the depth limit
+ * is reached. The action with the best average outcome when the time budget
+ * expires is chosen. Rollouts run on a RolloutPool, so the search does not
+ * block the thread that started it; the callback is invoked on a pool
+ * thread with the chosen turn.
+ *
+ * The battle is only read from through the fork function, which the pool
+ * threads call one at a time but without holding the lock of the search.
+ * The function must therefore keep the battle from advancing or ending while
+ * it forks, and must throw BattleFieldException if the battle can no longer
+ * be forked; NetworkBattle::forkLocked does both.
+ */
+class MonteCarloSearch :
+        public boost::enable_shared_from_this<MonteCarloSearch>,
+        boost::noncopyable {
+public:
+    typedef boost::shared_ptr<MonteCarloSearch> PTR;
+    typedef boost::function<void (const PokemonTurn &)> CALLBACK;
+    typedef boost::function<boost::shared_ptr<BattleField> (
+            const BattleMechanics *, boost::shared_ptr<ScriptContext>)> FORK;
+
+    /**
+     * Begin searching for the action of the pokemon in the given active
+     * slot of the battle forked by the given function. Only the actions that
+     * are legal in the fork and allowed by the given flags are tried. The
+     * fallback turn is chosen if no rollout could be played. If a machine
+     * is given, each batch of rollouts runs on a context acquired from it
+     * rather than on the context of the pool thread; the machine must be
+     * the battle's own.
+     */
+    static PTR begin(RolloutPool *pool,
+            const FORK &fork,
+            const int party,
+            const int slot,
+            const MonteCarloOptions &options,
+            const RANDOM_SEED seed,
+            const PokemonTurn &fallback,
+            const LegalActions &legal,
+            const CALLBACK &callback,
+            boost::shared_ptr<ScriptMachine> machine =
+                boost::shared_ptr<ScriptMachine>());
+
+    /**
+     * Stop the search without invoking the callback. A fork that has already
+     * been started may still run after this returns, but its snapshot is
+     * discarded.
+     */
+    void cancel();
+
+    /**
+     * Get the number of rollouts played so far.
+     */
+    int getRolloutCount() const;
+
+private:
+    struct Candidate {
+        PokemonTurn turn;
+        int visits;
+        double score;
+        Candidate(const PokemonTurn &t): turn(t), visits(0), score(0.0) { }
+    };
+
+    MonteCarloSearch(RolloutPool *, const FORK &, const int, const int,
+            const MonteCarloOptions &, const RANDOM_SEED,
+            const PokemonTurn &, const LegalActions &, const CALLBACK &,
+            boost::shared_ptr<ScriptMachine>);
+
+    void run(boost::shared_ptr<ScriptContext> cx);
+    void prepare(BattleField &snapshot);
+    double playOut(BattleField &snapshot, const BattleMechanics &mech,
+            const PokemonTurn &turn, RandomGenerator &rand);
+    bool isExpired() const;
+    void finishTask(CALLBACK &, PokemonTurn &);
+
+    RolloutPool *m_pool;
+    const FORK m_fork;
+    const int m_party;
+    const int m_slot;
+    const MonteCarloOptions m_options;
+    const RANDOM_SEED m_seed;
+    const PokemonTurn m_fallback;
+    const LegalActions m_legal;
+    CALLBACK m_callback;
+    boost::shared_ptr<ScriptMachine> m_machine;
+    boost::posix_time::ptime m_deadline;
+
+    boost::mutex m_forkMutex;   // serialises calls to m_fork
+    mutable boost::mutex m_mutex;
+    std::vector<Candidate> m_candidates;
+    bool m_prepared;
+    bool m_cancelled;
+    int m_next;
+    int m_tasks;
+    int m_rollouts;
+    boost::uint64_t m_stream;
+};
+
+/**
+ * A BattlePolicy which chooses each move with a MonteCarloSearch, waiting
+ * for the search to finish. Replacements are chosen in the same way as by
+ * a GreedyPolicy.
+ */
+class MonteCarloPolicy : public GreedyPolicy {
+public:
+    MonteCarloPolicy(RolloutPool *pool, const MonteCarloOptions &options,
+            const RANDOM_SEED seed):
+            GreedyPolicy(seed),
+            m_pool(pool),
+            m_options(options),
+            m_seeds(RandomGenerator::deriveSeed(seed, 1)) { }
+    PokemonTurn selectTurn(BattleField &, Pokemon *);
+private:
+    RolloutPool *m_pool;
+    const MonteCarloOptions m_options;
+    RandomGenerator m_seeds;
+};
+
+}
+
+#endif
@@ -0,0 +1,68 @@
+/* 
+ * File:   NameTable.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <boost/thread/locks.hpp>
+#include "NameTable.h"
+
+using namespace std;
+
+namespace shoddybattle {
+
+int NameTable::intern(const string &name) {
+    boost::unique_lock<boost::shared_mutex> lock(m_mutex);
+    ID_MAP::const_iterator i = m_ids.find(name);
+    if (i != m_ids.end())
+        return i->second;
+    const int id = m_names.size();
+    m_ids[name] = id;
+    m_names.push_back(name);
+    return id;
+}
+
+int NameTable::getId(const string &name) const {
+    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+    ID_MAP::const_iterator i = m_ids.find(name);
+    return (i == m_ids.end()) ? -1 : i->second;
+}
+
+string NameTable::getName(const int id) const {
+    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+    if ((id < 0) || (id >= (int)m_names.size()))
+        return string();
+    return m_names[id];
+}
+
+int NameTable::size() const {
+    boost::shared_lock<boost::shared_mutex> lock(m_mutex);
+    return m_names.size();
+}
+
+NameTable &NameTable::getAbilities() {
+    static NameTable table;
+    return table;
+}
+
+NameTable &NameTable::getItems() {
+    static NameTable table;
+    return table;
+}
+
+}
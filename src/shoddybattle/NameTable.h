@@ -0,0 +1,81 @@
+/* 
+ * File:   NameTable.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _NAME_TABLE_H_
+#define _NAME_TABLE_H_
+
+#include <string>
+#include <vector>
+#include <boost/unordered_map.hpp>
+#include <boost/thread/shared_mutex.hpp>
+#include <boost/noncopyable.hpp>
+
+namespace shoddybattle {
+
+/**
+ * Gives each name of a kind, such as an ability or an item, a dense integer
+ * ID. Names are interned while the game data and scripts load; after that,
+ * the rest of the server compares and indexes by ID and only turns IDs back
+ * into names at the protocol and log edges.
+ *
+ * Lookups of a name that was never interned return -1, so names sent by
+ * clients never grow the table.
+ */
+class NameTable : boost::noncopyable {
+public:
+    /**
+     * Get the ID of a name, giving it a new ID if it does not have one.
+     */
+    int intern(const std::string &name);
+
+    /**
+     * Get the ID of a name, or -1 if the name has not been interned.
+     */
+    int getId(const std::string &name) const;
+
+    /**
+     * Get the name of an ID, or an empty string if there is no such ID.
+     */
+    std::string getName(const int id) const;
+
+    /**
+     * Get the number of IDs.
+     */
+    int size() const;
+
+    /** The names of the abilities. **/
+    static NameTable &getAbilities();
+
+    /** The names of the hold items. **/
+    static NameTable &getItems();
+
+private:
+    NameTable() { }
+
+    typedef boost::unordered_map<std::string, int> ID_MAP;
+    ID_MAP m_ids;
+    std::vector<std::string> m_names;
+    mutable boost::shared_mutex m_mutex;
+};
+
+}
+
+#endif
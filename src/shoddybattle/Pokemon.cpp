@@ -37,6 +37,7 @@
 #include "../main/Log.h"
 #include "BattleField.h"
 #include "ObjectTeamFile.h"
+#include "NameTable.h"
 
 using namespace shoddybattle;
 using namespace std;
@@ -47,15 +48,15 @@ namespace shoddybattle {
 Pokemon::Pokemon(const PokemonSpecies *species,
         const string &nickname,
         const PokemonNature *nature,
-        const string &ability,
-        const string &item,
+        const int ability,
+        const int item,
         const int *iv,
         const int *ev,
         const int level,
         const int gender,
         const unsigned char happiness,
         const bool shiny,
-        const vector<string> &moves,
+        const vector<int> &moves,
         const vector<int> &ppUps) {
     memcpy(m_iv, iv, sizeof(int) * STAT_COUNT);
     memcpy(m_ev, ev, sizeof(int) * STAT_COUNT);
@@ -73,10 +74,11 @@ Pokemon::Pokemon(const PokemonSpecies *species,
     m_gender = gender;
     m_happiness = happiness;
     m_ppUps = ppUps;
-    m_abilityName = ability;
-    m_itemName = item;
+    m_abilityId = ability;
+    m_itemId = item;
+    m_activeAbilityId = -1;
     m_shiny = shiny;
-    vector<string>::const_iterator i = moves.begin();
+    vector<int>::const_iterator i = moves.begin();
     for (; i != moves.end(); ++i) {
         const MoveTemplate *move = species->getMove(*i);
         if (move) {
@@ -98,6 +100,52 @@ Pokemon::Pokemon(const PokemonSpecies *species,
     m_turn = NULL;
 }
 
+namespace {
+
+void appendSignature(string &sig, const int value) {
+    sig.append(reinterpret_cast<const char *>(&value), sizeof(int));
+}
+
+}
+
+string Pokemon::getSignature() const {
+    string sig;
+    appendSignature(sig, m_species->getSpeciesId());
+    appendSignature(sig, m_nature ? (int)m_nature->getInternalValue() : -1);
+    appendSignature(sig, m_abilityId);
+    appendSignature(sig, m_itemId);
+    appendSignature(sig, m_level);
+    appendSignature(sig, m_gender);
+    appendSignature(sig, m_happiness);
+    appendSignature(sig, m_shiny);
+    for (int i = 0; i < STAT_COUNT; ++i) {
+        appendSignature(sig, m_iv[i]);
+        appendSignature(sig, m_ev[i]);
+    }
+    appendSignature(sig, m_moveProto.size());
+    vector<const MoveTemplate *>::const_iterator i = m_moveProto.begin();
+    for (; i != m_moveProto.end(); ++i) {
+        appendSignature(sig, (*i)->getId());
+    }
+    appendSignature(sig, m_ppUps.size());
+    vector<int>::const_iterator j = m_ppUps.begin();
+    for (; j != m_ppUps.end(); ++j) {
+        appendSignature(sig, *j);
+    }
+    appendSignature(sig, m_nickname.size());
+    sig.append(m_nickname);
+    return sig;
+}
+
+vector<int> Pokemon::getOriginalMoveIds() const {
+    vector<int> ids;
+    vector<const MoveTemplate *>::const_iterator i = m_moveProto.begin();
+    for (; i != m_moveProto.end(); ++i) {
+        ids.push_back((*i)->getId());
+    }
+    return ids;
+}
+
 string Pokemon::getToken() const {
     stringstream ss;
     ss << "$p{" << getParty() << "," << getPosition() << "}";
@@ -141,7 +189,7 @@ string Pokemon::getItemName() const {
     if (item) {
         return item->getName(m_cx);
     }
-    return m_itemName;
+    return NameTable::getItems().getName(m_itemId);
 }
 
 string Pokemon::getAbilityName() const {
@@ -149,7 +197,18 @@ string Pokemon::getAbilityName() const {
     if (ability) {
         return ability->getName(m_cx);
     }
-    return m_abilityName;
+    return NameTable::getAbilities().getName(m_abilityId);
+}
+
+/**
+ * Get the ID of this pokemon's current ability, or of its original ability
+ * if it has no ability object.
+ */
+int Pokemon::getAbilityId() const {
+    if (getAbility()) {
+        return m_activeAbilityId;
+    }
+    return m_abilityId;
 }
 
 /**
@@ -175,8 +234,10 @@ void Pokemon::determineLegalActions() {
     m_legalMove.clear();
     m_legalMove.resize(count, false);
     for (int i = 0; i < count; ++i) {
-        MoveObjectPtr move = m_moves[i];
-        if (move && (m_pp[i] > 0)) {
+        if (m_pp[i] <= 0)
+            continue;
+        MoveObjectPtr move = getMove(i);
+        if (move) {
             if (m_legalMove[i] = !m_field->vetoSelection(this, move.get())) {
                 struggle = false;
             }
@@ -219,8 +280,7 @@ ScriptValue Pokemon::sendMessage(const string &name,
  * attacking a given target.
  */
 void Pokemon::getImmunities(Pokemon *user, Pokemon *target,
-        std::set<const PokemonType *> &immunities,
-        std::set<const PokemonType *> &vulnerabilities) {
+        TYPE_MASK &immunities, TYPE_MASK &vulnerabilities) {
     for (STATUSES::const_iterator i = m_effects.begin();
             i != m_effects.end(); ++i) {
         if (!(*i)->isActive(m_cx))
@@ -228,19 +288,35 @@ void Pokemon::getImmunities(Pokemon *user, Pokemon *target,
 
         const PokemonType *type = (*i)->getImmunity(m_cx, user, target);
         if (type) {
-            immunities.insert(type);
+            immunities |= type->getMask();
         }
         type = (*i)->getVulnerability(m_cx, user, target);
         if (type) {
-            if (immunities.find(type) != immunities.end()) {
-                immunities.erase(type);
+            const TYPE_MASK mask = type->getMask();
+            if (immunities & mask) {
+                immunities &= ~mask;
             } else {
-                vulnerabilities.insert(type);
+                vulnerabilities |= mask;
             }
         }
     }
 }
 
+/**
+ * Determine whether any active status on this pokemon transforms the
+ * effectiveness of moves.
+ */
+bool Pokemon::hasEffectivenessTransform() const {
+    for (STATUSES::const_iterator i = m_effects.begin();
+            i != m_effects.end(); ++i) {
+        if ((*i)->isActive(m_cx)
+                && m_cx->hasProperty(i->get(), "transformEffectiveness")) {
+            return true;
+        }
+    }
+    return false;
+}
+
 /**
  * Transform the effectiveness of a certain move type on a target
  */
@@ -343,7 +419,7 @@ void Pokemon::switchOut() {
     // Remove effects that do not survive switches.
     removeStatuses(m_effects, boost::bind(switchOutPredicate, _1, m_cx));   
     // Restore original ability.
-    setAbility(m_abilityName);
+    setAbility(NameTable::getAbilities().getName(m_abilityId));
     // Restore original type.
     m_types = m_species->getTypes();
     // Remove any forced moves
@@ -423,10 +499,8 @@ bool Pokemon::useMove(MoveObject *move,
     if (move->attemptHit(m_cx, m_field, this, target)) {
         move->use(m_cx, m_field, this, target, targets);
     } else {
-        vector<string> args;
-        args.push_back(getToken());
-        args.push_back(target->getToken());
-        TextMessage msg(4, 2, args); // attack missed
+        const string args[] = { getToken(), target->getToken() };
+        TextMessage msg(4, 2, args, 2); // attack missed
         m_field->print(msg);
     }
     return true;
@@ -470,9 +544,12 @@ Pokemon::FORCED_TYPE Pokemon::getForcedType() const {
  * Get the index of a named move, -1 if the pokemon does not know the move.
  */
 int Pokemon::getMove(const string &name) const {
+    const MoveTemplate *move = m_machine->getMoveDatabase()->getMove(name);
+    if (!move)
+        return -1;
     const int size = m_moves.size();
     for (int i = 0; i < size; ++i) {
-        if (m_moves[i]->getName(m_cx) == name)
+        if (getMoveTemplate(i) == move)
             return i;
     }
     return -1;
@@ -514,17 +591,37 @@ unsigned int Pokemon::getStat(const STAT stat) {
 }
 
 /**
- * Get a move by index, or -1 for the pokemon's forced move.
+ * Get a move by index, or -1 for the pokemon's forced move. The script
+ * object for the move is created the first time it is requested.
  */
 MoveObjectPtr Pokemon::getMove(const int i) {
     if (i == -1)
         return m_forcedMove;
     const int size = m_moves.size();
-    if (size <= i)
+    if ((i < 0) || (size <= i))
         return MoveObjectPtr();
+    if (!m_moves[i] && (i < (int)m_pendingMoves.size())
+            && m_pendingMoves[i]) {
+        m_moves[i] = m_cx->newMoveObject(m_pendingMoves[i]);
+        m_pendingMoves[i] = NULL;
+    }
     return m_moves[i];
 }
 
+/**
+ * Get the template of a move by index without creating its script object.
+ */
+const MoveTemplate *Pokemon::getMoveTemplate(const int i) const {
+    const int size = m_moves.size();
+    if ((i < 0) || (size <= i))
+        return NULL;
+    if (m_moves[i])
+        return m_moves[i]->getTemplate(m_cx);
+    if (i < (int)m_pendingMoves.size())
+        return m_pendingMoves[i];
+    return NULL;
+}
+
 /**
  * Execute an arbitrary move on a set of targets.
  */
@@ -560,7 +657,9 @@ bool Pokemon::executeMove(MoveObjectPtr move,
     }
     
     // Build a list of targets.
-    vector<Pokemon *> targets;
+    TurnArena::Scope scope(m_field->getArena());
+    BattleField::TARGET_LIST targets(
+            (ArenaAllocator<Pokemon *>(m_field->getArena())));
     m_field->getTargetList(tc, targets, this, target);
 
     if (tc == T_NONE) {
@@ -580,7 +679,7 @@ bool Pokemon::executeMove(MoveObjectPtr move,
     }
 
     if (inform) {
-        for (vector<Pokemon *>::iterator i = targets.begin();
+        for (BattleField::TARGET_LIST::iterator i = targets.begin();
                 i != targets.end(); ++i) {
             Pokemon *p = *i;
             if (p) {
@@ -596,7 +695,7 @@ bool Pokemon::executeMove(MoveObjectPtr move,
     move->prepareSelf(m_cx, m_field, this, target);
 
     if (isEnemyTarget(tc)) {
-        for (vector<Pokemon *>::iterator i = targets.begin();
+        for (BattleField::TARGET_LIST::iterator i = targets.begin();
                 i != targets.end(); ++i) {
             Pokemon *p = *i;
             if (p) {
@@ -639,6 +738,9 @@ void Pokemon::setMove(const int i, MoveObjectPtr move,
         m_moveUsed.resize(i + 1, false);
     }
     m_moves[i] = move;
+    if (i < (int)m_pendingMoves.size()) {
+        m_pendingMoves[i] = NULL;
+    }
     m_pp[i] = pp;
     m_maxPp[i] = maxPp;
     if (m_field) {
@@ -674,9 +776,13 @@ void Pokemon::removeStatuses() {
  * Return whether the pokemon has the specified ability.
  */
 bool Pokemon::hasAbility(const string &name) {
-    if (!m_ability || !m_ability->isActive(m_cx))
+    return hasAbility(NameTable::getAbilities().getId(name));
+}
+
+bool Pokemon::hasAbility(const int id) {
+    if ((id == -1) || (id != m_activeAbilityId) || !m_ability)
         return false;
-    return (m_ability->getId(m_cx) == name);
+    return m_ability->isActive(m_cx);
 }
 
 /**
@@ -952,6 +1058,8 @@ void Pokemon::setAbility(StatusObject *obj) {
         removeStatus(m_ability.get());
     }
     m_ability = applyStatus(NULL, obj);
+    m_activeAbilityId = m_ability
+            ? NameTable::getAbilities().intern(m_ability->getId(m_cx)) : -1;
 }
 
 /**
@@ -1003,7 +1111,7 @@ void Pokemon::deductPp(MoveObjectPtr move) {
     int j = 0;
     vector<MoveObjectPtr>::const_iterator i = m_moves.begin();
     for (; i != m_moves.end(); ++i) {
-        if (p == (*i)->getObject()) {
+        if (*i && (p == (*i)->getObject())) {
             deductPp(j);
             return;
         }
@@ -1058,91 +1166,178 @@ void Pokemon::initialise(BattleField *field, ScriptContextPtr cx,
     m_scx = cx;
     m_cx = m_scx.get();
 
-    // Create pokemon object.
-    m_object = m_cx->newPokemonObject(this);
-
-    // Create move objects.
+    // The pokemon and move objects are created on first use by getObject
+    // and getMove, because most of a team never leaves the bench in a
+    // short battle.
     if (m_moves.empty()) {
+        m_moves.resize(m_moveProto.size());
+        m_pendingMoves = m_moveProto;
         vector<const MoveTemplate *>::const_iterator i = m_moveProto.begin();
         int j = 0;
         for (; i != m_moveProto.end(); ++i) {
-            MoveObjectPtr obj = m_cx->newMoveObject(*i);
-            m_moves.push_back(obj);
-            m_maxPp[j] = m_pp[j] = obj->getPp(m_cx) * (5 + m_ppUps[j]) / 5;
+            m_maxPp[j] = m_pp[j] = (*i)->getPp() * (5 + m_ppUps[j]) / 5;
             ++j;
         }
     }
 
     // Create ability and item objects.
     if (field) {
-        setAbility(m_abilityName);
-        if (!m_itemName.empty()) {
-            setItem(m_itemName);
+        setAbility(NameTable::getAbilities().getName(m_abilityId));
+        if (m_itemId != -1) {
+            setItem(NameTable::getItems().getName(m_itemId));
         }
     }
 }
 
 /**
- * Checks a pokemon for legal move combinations.
+ * Get the script object for this pokemon, creating it on first use.
  */
-namespace {
-bool validateMoveCombinations(ScriptContext *cx, const PokemonSpecies *species,
-        Pokemon *p, const vector<MoveObjectPtr> &moves) {
-    COMBINATION_LIST list = species->getIllegalCombinations();
-    COMBINATION_LIST::iterator i = list.begin();
-
-    // This loop is triple nested, but the only loop of
-    // substantional size is the outer one
-    for (; i != list.end(); ++i) {
-        bool match = true;
-        Combination combo = *i;
-
-        // Check moves
-        vector<string> illegalMoves = combo.moves;
-        vector<string>::iterator j = illegalMoves.begin();
-        for (; j != illegalMoves.end(); ++j) {
-            const string move = *j;
-
-            bool found = false;
-            vector<MoveObjectPtr>::const_iterator k = moves.begin();
-            for (; k != moves.end(); ++k) {
-                const string name = (*k)->getName(cx);
-                if (name == move) {
-                    found = true;
-                    break;
-                }
-            }
-            if (!found) {
-                match = false;
-                break;
-            }
-        }
-        if (!match) {
-            continue;
+ScriptObject *Pokemon::getObject() {
+    if (!m_object) {
+        m_object = m_cx->newPokemonObject(this);
+    }
+    return m_object.get();
+}
+
+Pokemon *ForkMap::getPokemon(const Pokemon *p) const {
+    map<const Pokemon *, Pokemon *>::const_iterator i = pokemon.find(p);
+    if (i == pokemon.end())
+        return NULL;
+    return i->second;
+}
+
+MoveObjectPtr ForkMap::getMove(ScriptContext *cx, MoveObjectPtr move) {
+    if (!move)
+        return MoveObjectPtr();
+    void *key = move->getObject();
+    map<void *, MoveObjectPtr>::const_iterator i = moves.find(key);
+    if (i != moves.end())
+        return i->second;
+    MoveObjectPtr ret = cx->newMoveObject(move->getTemplate(cx));
+    moves[key] = ret;
+    objects[key] = ret->getObject();
+    return ret;
+}
+
+StatusObjectPtr ForkMap::getStatus(ScriptContext *cx, StatusObjectPtr status) {
+    if (!status)
+        return StatusObjectPtr();
+    void *key = status->getObject();
+    map<void *, StatusObjectPtr>::const_iterator i = statuses.find(key);
+    if (i != statuses.end())
+        return i->second;
+    StatusObjectPtr ret = status->forkAndRoot(cx, objects);
+    statuses[key] = ret;
+    objects[key] = ret->getObject();
+    return ret;
+}
+
+/**
+ * Copy the plain state of a pokemon onto a new field. Immutable data such as
+ * the species, nature and move templates is shared with the original.
+ */
+Pokemon::Pokemon(const Pokemon &p, BattleField *field, ScriptContextPtr cx):
+        m_species(p.m_species),
+        m_level(p.m_level),
+        m_hp(p.m_hp),
+        m_fainted(p.m_fainted),
+        m_gender(p.m_gender),
+        m_happiness(p.m_happiness),
+        m_shiny(p.m_shiny),
+        m_nature(p.m_nature),
+        m_types(p.m_types),
+        m_ppUps(p.m_ppUps),
+        m_moveProto(p.m_moveProto),
+        m_pendingMoves(p.m_pendingMoves),
+        m_pp(p.m_pp),
+        m_maxPp(p.m_maxPp),
+        m_moveUsed(p.m_moveUsed),
+        m_legalMove(p.m_legalMove),
+        m_legalSwitch(p.m_legalSwitch),
+        m_nickname(p.m_nickname),
+        m_itemId(p.m_itemId),
+        m_abilityId(p.m_abilityId),
+        m_activeAbilityId(p.m_activeAbilityId),
+        m_acted(p.m_acted),
+        m_damaged(p.m_damaged),
+        m_revealed(p.m_revealed),
+        m_machine(p.m_machine),
+        m_cx(cx.get()),
+        m_scx(cx),
+        m_field(field),
+        m_party(p.m_party),
+        m_position(p.m_position),
+        m_slot(p.m_slot),
+        m_executingForcedTurn(false),
+        m_turn(NULL),
+        m_forcedType(p.m_forcedType) {
+    memcpy(m_stat, p.m_stat, sizeof(m_stat));
+    memcpy(m_iv, p.m_iv, sizeof(m_iv));
+    memcpy(m_ev, p.m_ev, sizeof(m_ev));
+    memcpy(m_statLevel, p.m_statLevel, sizeof(m_statLevel));
+    if (p.m_object) {
+        m_object = m_cx->newPokemonObject(this);
+    }
+    const int count = p.m_moves.size();
+    m_moves.resize(count);
+    for (int i = 0; i < count; ++i) {
+        MoveObjectPtr move = p.m_moves[i];
+        if (move) {
+            m_moves[i] = m_cx->newMoveObject(move->getTemplate(m_cx));
         }
+    }
+}
 
-        
-        // Check nature/ability/gender
-        if ((combo.ability.size() != 0) &&
-                (p->getAbilityName() != combo.ability)) {
-            continue;
+Pokemon::PTR Pokemon::fork(BattleField *field, ScriptContextPtr cx,
+        ForkMap &map) const {
+    PTR ret(new Pokemon(*this, field, cx));
+    map.pokemon[this] = ret.get();
+    if (m_object) {
+        map.objects[m_object->getObject()] = ret->m_object->getObject();
+    }
+    const int count = m_moves.size();
+    for (int i = 0; i < count; ++i) {
+        if (m_moves[i]) {
+            void *key = m_moves[i]->getObject();
+            map.moves[key] = ret->m_moves[i];
+            map.objects[key] = ret->m_moves[i]->getObject();
         }
-        
-        if (combo.nature && (combo.nature != p->getNature())) {
+    }
+    return ret;
+}
+
+/**
+ * Copy the statuses, memory and forced turn of a pokemon onto its fork.
+ * Statuses are copied without being reapplied, so none of their effects
+ * are triggered again. Recent damage is not copied because it only lasts
+ * for the turn being executed.
+ */
+void Pokemon::forkState(const Pokemon &p, ForkMap &map) {
+    for (STATUSES::const_iterator i = p.m_effects.begin();
+            i != p.m_effects.end(); ++i) {
+        if ((*i)->isRemovable(m_cx))
             continue;
-        }
-        
-        // 0 gender is NONE, pokemon with NONE cannot have any other gender
-        // so we can treat 0 as unspecified
-        if ((combo.gender != 0) && (p->getGender() != combo.gender)) {
+        m_effects.push_back(map.getStatus(m_cx, *i));
+    }
+    m_item = map.getStatus(m_cx, p.m_item);
+    m_ability = map.getStatus(m_cx, p.m_ability);
+    for (list<MEMORY>::const_iterator i = p.m_memory.begin();
+            i != p.m_memory.end(); ++i) {
+        Pokemon *user = map.getPokemon(i->user);
+        if (!user)
             continue;
-        }
-
-        return false;
+        const MEMORY entry = { user, map.getMove(m_cx, i->move) };
+        m_memory.push_back(entry);
+    }
+    m_lastMove = map.getMove(m_cx, p.m_lastMove);
+    if (p.m_forcedTurn) {
+        m_forcedTurn = shared_ptr<PokemonTurn>(
+                new PokemonTurn(*p.m_forcedTurn));
+    }
+    m_forcedMove = map.getMove(m_cx, p.m_forcedMove);
+    if (p.m_object) {
+        m_cx->copyProperties(p.m_object.get(), m_object.get(), map.objects);
     }
-
-    return true;
-}
 }
 
 /**
@@ -1156,32 +1351,35 @@ bool validateMoveCombinations(ScriptContext *cx, const PokemonSpecies *species,
  * 6) The species must be able to be of the given gender
  * Whatever is broken is added to violations
  */
-bool Pokemon::validate(ScriptContext *cx, set<unsigned int> &violations) {
+bool Pokemon::validate(ScriptContext *, set<unsigned int> &violations) {
     // Test Condition 0 - 1-4 UNIQUE moves
-    int moveCount = m_moves.size();
+    int moveCount = m_moveProto.size();
     if ((moveCount <= 0) || (moveCount > P_MOVE_COUNT)) {
         violations.insert(0);
     }
-    set<string> moves;
-    vector<MoveObjectPtr>::iterator i = m_moves.begin();
-    for (; i != m_moves.end(); ++i) {
-        const string name = (*i)->getName(cx);
-        if (moves.count(name)) {
+    // The constructor only keeps moves that the species can learn, so every
+    // ID here is within the learnset.
+    MOVE_MASK moves(m_species->getLearnset().size());
+    vector<const MoveTemplate *>::const_iterator i = m_moveProto.begin();
+    for (; i != m_moveProto.end(); ++i) {
+        const int id = (*i)->getId();
+        if (moves.test(id)) {
             violations.insert(0);
             break;
         }
-        moves.insert(name);
+        moves.set(id);
     }
 
     // Test Condition 1 - Legal Learnsets
     // This only happens if there are illegal moves. This is because
     // the constructor skips over moves the pokemon can't learn
-    if (m_moves.size() != m_ppUps.size()) {
+    if (m_moveProto.size() != m_ppUps.size()) {
         violations.insert(1);
     }
 
     // Test Condition 2 - Legal move combinations
-    if (!validateMoveCombinations(cx, m_species, this, m_moves)) {
+    if (m_species->findIllegalCombination(moves, m_abilityId, m_nature,
+            m_gender)) {
         violations.insert(2);
     }
 
@@ -1197,10 +1395,7 @@ bool Pokemon::validate(ScriptContext *cx, set<unsigned int> &violations) {
     // TODO: Implement item validation
 
     // Test Condition 5 - Ability learnable
-    const ABILITY_LIST &abilities = m_species->getAbilities();
-    ABILITY_LIST::const_iterator ability = 
-        find(abilities.begin(), abilities.end(), m_abilityName);
-    if (ability == abilities.end()) {
+    if (!m_species->canHaveAbility(m_abilityId)) {
         violations.insert(5);
     }
 
@@ -33,6 +33,7 @@
 #include <stack>
 #include <set>
 #include "../mechanics/stat.h"
+#include "../mechanics/PokemonType.h"
 #include "../scripting/ObjectWrapper.h"
 
 namespace shoddybattle {
@@ -61,6 +62,27 @@ typedef std::map<int, double> PRIORITY_MAP;
 // map<position, map<priority, value>>
 typedef std::map<int, PRIORITY_MAP> MODIFIERS;
 
+class Pokemon;
+
+/**
+ * Records which objects of a forked BattleField correspond to which objects
+ * of the original, so that references between them (the subject of a status,
+ * a status shared by several pokemon, a remembered move) carry over to the
+ * fork. It is only needed while the fork is being built.
+ */
+struct ForkMap {
+    std::map<void *, void *> objects;
+    std::map<const Pokemon *, Pokemon *> pokemon;
+    std::map<void *, boost::shared_ptr<MoveObject> > moves;
+    std::map<void *, boost::shared_ptr<StatusObject> > statuses;
+
+    Pokemon *getPokemon(const Pokemon *) const;
+    boost::shared_ptr<MoveObject> getMove(ScriptContext *,
+            boost::shared_ptr<MoveObject>);
+    boost::shared_ptr<StatusObject> getStatus(ScriptContext *,
+            boost::shared_ptr<StatusObject>);
+};
+
 /**
  * The pokemon class contains all of the information about an arbitrary
  * Pokemon, including its stats, the moves it can use, its most recent actions,
@@ -81,22 +103,42 @@ public:
     Pokemon(const PokemonSpecies *species,
             const std::string &nickname,
             const PokemonNature *nature,
-            const std::string &ability,
-            const std::string &item,
+            const int ability,
+            const int item,
             const int *iv,
             const int *ev,
             const int level,
             const int gender,
             const unsigned char happiness,
             const bool shiny,
-            const std::vector<std::string> &moves,
+            const std::vector<int> &moves,
             const std::vector<int> &ppUps);
 
     void initialise(BattleField *field, boost::shared_ptr<ScriptContext>,
             const int i, const int j);
 
+    /**
+     * Create a copy of this pokemon, in its current state, for a fork of
+     * its BattleField. The statuses, memory and forced turn of the copy are
+     * filled in by forkState once every pokemon in the fork exists.
+     */
+    PTR fork(BattleField *, boost::shared_ptr<ScriptContext>, ForkMap &) const;
+    void forkState(const Pokemon &, ForkMap &);
+
     bool validate(ScriptContext *, std::set<unsigned int> &);
 
+    /**
+     * Get a string that holds everything a team validator can see about
+     * this pokemon as it was constructed. Two pokemon with the same
+     * signature pass or fail validation in the same way.
+     */
+    std::string getSignature() const;
+
+    /** The ability, item and moves this pokemon was constructed with. **/
+    int getOriginalAbilityId() const { return m_abilityId; }
+    int getOriginalItemId() const { return m_itemId; }
+    std::vector<int> getOriginalMoveIds() const;
+
     ScriptValue sendMessage(const std::string &, int, ScriptValue *);
 
     void setTurn(PokemonTurn *turn, const bool forced) {
@@ -139,6 +181,7 @@ public:
     static void removeStatuses(STATUSES &, T predicate);
     void removeStatuses();
     bool hasAbility(const std::string &);
+    bool hasAbility(const int id);
     bool transformStatus(Pokemon *, boost::shared_ptr<StatusObject> *);
 
     int transformHealthChange(int, Pokemon *, bool) const;
@@ -183,10 +226,11 @@ public:
     unsigned int getGender() const { return m_gender; }
     bool isShiny() const { return m_shiny; }
 
-    ScriptObject *getObject() { return (ScriptObject *)m_object.get(); }
+    ScriptObject *getObject();
     BattleField *getField() { return m_field; }
 
     boost::shared_ptr<MoveObject> getMove(const int i);
+    const MoveTemplate *getMoveTemplate(const int i) const;
 
     int getMove(const std::string &) const;
 
@@ -272,10 +316,12 @@ public:
 
     std::string getItemName() const;
     std::string getAbilityName() const;
+    int getAbilityId() const;
 
     void getImmunities(Pokemon *user, Pokemon *target,
-            std::set<const PokemonType *> &immunities,
-            std::set<const PokemonType *> &vulnerabilities);
+            TYPE_MASK &immunities, TYPE_MASK &vulnerabilities);
+
+    bool hasEffectivenessTransform() const;
             
     bool getTransformedEffectiveness(const PokemonType *moveType,
             const PokemonType *type, Pokemon *target, double &effectiveness);
@@ -326,14 +372,17 @@ private:
     std::vector<int> m_ppUps;
     std::vector<const MoveTemplate *> m_moveProto;
     std::vector<boost::shared_ptr<MoveObject> > m_moves;
+    // Template of each move whose script object has not been created yet.
+    std::vector<const MoveTemplate *> m_pendingMoves;
     std::vector<int> m_pp;
     std::vector<int> m_maxPp;
     std::vector<bool> m_moveUsed;
     std::vector<bool> m_legalMove;
     bool m_legalSwitch;
     std::string m_nickname;
-    std::string m_itemName;
-    std::string m_abilityName;
+    int m_itemId;           // Original item, from NameTable::getItems.
+    int m_abilityId;        // Original ability, from NameTable::getAbilities.
+    int m_activeAbilityId;  // ID of m_ability, or -1.
 
     typedef RECENT_MOVE MEMORY;
     std::list<MEMORY> m_memory;
@@ -365,6 +414,7 @@ private:
 
     boost::shared_ptr<PokemonObject> m_object;
 
+    Pokemon(const Pokemon &, BattleField *, boost::shared_ptr<ScriptContext>);
     Pokemon(const Pokemon &);
     Pokemon &operator=(const Pokemon &);
 };
@@ -23,10 +23,12 @@
  */
 
 #include <set>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <iostream>
 #include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
 
 #include <xercesc/parsers/XercesDOMParser.hpp>
 #include <xercesc/dom/DOM.hpp>
@@ -35,6 +37,9 @@
 #include <xercesc/util/PlatformUtils.hpp>
 
 #include "PokemonSpecies.h"
+#include "GamePack.h"
+#include "XmlStream.h"
+#include "NameTable.h"
 #include "../mechanics/PokemonType.h"
 #include "../mechanics/PokemonNature.h"
 #include "../moves/PokemonMove.h"
@@ -102,18 +107,6 @@ T getValueByName(pair<string, T> *pairs, int count, const string &name) {
     return (T)-1;
 }
 
-struct SPECIES {
-    int id;
-    string name;
-    vector<string> types;
-    int gender;
-    int base[6];
-    double mass;
-    map<MOVE_ORIGIN, set<string> > moves;
-    COMBINATION_LIST illegal;
-    ABILITY_LIST abilities;
-};
-
 class ShoddyHandler : public HandlerBase {
     void error(const SAXParseException& e) {
         fatalError(e);
@@ -184,7 +177,7 @@ int genderFromName(const string &txt) {
     return gender;
 }
 
-void getSpecies(DOMElement *node, SPECIES *pSpecies) {
+void getSpecies(DOMElement *node, SPECIES_DATA *pSpecies) {
     DOMNamedNodeMap *attributes = node->getAttributes();
     XMLCh tempStr[20];
 
@@ -367,7 +360,104 @@ void getSpecies(DOMElement *node, SPECIES *pSpecies) {
     }
 }
 
-bool PokemonSpecies::loadSpecies(const string file, SpeciesDatabase &set) {
+/**
+ * Streaming reader for the species file, which fills in each SPECIES_DATA as
+ * its elements are read. It follows the same rules as getSpecies.
+ */
+class SpeciesHandler : public XmlStreamHandler {
+public:
+    SpeciesHandler(vector<SPECIES_DATA> &species):
+            m_species(species),
+            m_stat(S_NONE),
+            m_origin(MO_NONE) { }
+
+protected:
+    void openElement(const string &name, const Attributes &attributes) {
+        if (name == "species") {
+            m_species.push_back(SPECIES_DATA());
+            SPECIES_DATA &species = m_species.back();
+            const string id = getAttribute(attributes, "id");
+            species.id = id.empty() ? -1 : atoi(id.c_str());
+            species.name = getAttribute(attributes, "name");
+        } else if (m_species.empty()) {
+            return;
+        } else if (name == "base") {
+            string stat = getAttribute(attributes, "stat");
+            m_stat = getValueByName(statNames, STAT_COUNT, lowercase(stat));
+        } else if ((name == "moves") && (getAncestor(1) == "moveset")) {
+            const string origin = getAttribute(attributes, "origin");
+            m_origin = getValueByName(originNames, ORIGIN_COUNT, origin);
+            if (m_origin != MO_NONE) {
+                m_species.back().moves[m_origin] = set<string>();
+            }
+        } else if ((name == "combo") && (getAncestor(1) == "illegal")) {
+            Combination combo;
+            combo.nature = NULL;
+            combo.gender = 0;
+            m_species.back().illegal.push_back(combo);
+        }
+    }
+
+    void closeElement(const string &name, const string &text) {
+        if (m_species.empty())
+            return;
+        SPECIES_DATA &species = m_species.back();
+        const string &parent = getAncestor(1);
+        if (parent == "combo") {
+            Combination &combo = species.illegal.back();
+            if (name == "move") {
+                if (!text.empty()) {
+                    combo.moves.push_back(text);
+                }
+            } else if (name == "nature") {
+                combo.nature = PokemonNature::getNatureByCanonicalName(text);
+            } else if (name == "ability") {
+                combo.ability = text;
+            } else if (name == "gender") {
+                string txt = text;
+                combo.gender = genderFromName(lowercase(txt));
+            }
+        } else if (name == "type") {
+            species.types.push_back(text);
+        } else if ((name == "gender") && (parent == "species")) {
+            string txt = text;
+            species.gender = genderFromName(lowercase(txt));
+        } else if ((name == "mass") && (parent == "stats")) {
+            species.mass = atof(text.c_str());
+        } else if ((name == "base") && (parent == "stats")) {
+            if ((m_stat != S_NONE) && !text.empty()) {
+                species.base[m_stat] = atoi(text.c_str());
+            }
+        } else if ((name == "ability") && (parent == "abilities")) {
+            species.abilities.push_back(text);
+        } else if ((name == "move") && (parent == "moves")) {
+            if ((m_origin != MO_NONE) && !text.empty()) {
+                species.moves[m_origin].insert(text);
+            }
+        }
+    }
+
+private:
+    vector<SPECIES_DATA> &m_species;
+    STAT m_stat;
+    MOVE_ORIGIN m_origin;
+};
+
+bool PokemonSpecies::parseSpecies(const string file,
+        vector<SPECIES_DATA> &species) {
+    species.clear();
+    SpeciesHandler handler(species);
+    if (!handler.parse(file)) {
+        Log::out() << "Error: Could not parse " << file << "." << endl;
+        species.clear();
+        return false;
+    }
+    return true;
+}
+
+bool PokemonSpecies::parseSpeciesDocument(const string file,
+        vector<SPECIES_DATA> &species) {
+    species.clear();
     XMLPlatformUtils::Initialize();
     XercesDOMParser parser;
     //parser.setDoSchema(true);
@@ -380,33 +470,79 @@ bool PokemonSpecies::loadSpecies(const string file, SpeciesDatabase &set) {
     parser.parse(file.c_str());
 
     DOMDocument *doc = parser.getDocument();
-    DOMElement *root = doc->getDocumentElement();
+    DOMElement *root = doc ? doc->getDocumentElement() : NULL;
+    if ((parser.getErrorCount() != 0) || !root) {
+        Log::out() << "Error: Could not parse " << file << "." << endl;
+        return false;
+    }
 
     XMLCh tempStr[12];
     XMLString::transcode("species", tempStr, 11);
     DOMNodeList *list = root->getElementsByTagName(tempStr);
 
     int length = list->getLength();
+    species.resize(length);
     for (int i = 0; i < length; ++i) {
         DOMElement *item = (DOMElement *)list->item(i);
-        SPECIES species;
-        getSpecies(item, &species);
-        if (set.m_set.find(species.id) != set.m_set.end()) {
-            Log::out() << "Warning: Duplicate species ID: " << species.id << endl;
+        getSpecies(item, &species[i]);
+    }
+    return true;
+}
+
+bool PokemonSpecies::readSpecies(const string file,
+        vector<SPECIES_DATA> &species) {
+    const boost::posix_time::ptime start =
+            boost::posix_time::microsec_clock::universal_time();
+
+    // A file that does not parse is never written to the pack, so that its
+    // partial records are not served on later starts.
+    const bool packed = GamePack::read(file, species);
+    if (!packed && parseSpecies(file, species)) {
+        GamePack::write(file, species);
+    }
+
+    const boost::posix_time::time_duration elapsed =
+            boost::posix_time::microsec_clock::universal_time() - start;
+    Log::out() << "Read " << species.size() << " species from "
+            << (packed ? "the game data pack" : file) << " in "
+            << elapsed.total_milliseconds() << " ms." << endl;
+
+    return !species.empty();
+}
+
+void PokemonSpecies::loadSpecies(const vector<SPECIES_DATA> &species,
+        SpeciesDatabase &set) {
+    vector<SPECIES_DATA>::const_iterator i = species.begin();
+    for (; i != species.end(); ++i) {
+        if (i->id < 0) {
+            Log::out() << "Warning: Invalid species ID: " << i->id << endl;
+            continue;
+        }
+        if (i->id >= (int)set.m_set.size()) {
+            set.m_set.resize(i->id + 1, NULL);
+        }
+        if (set.m_set[i->id] != NULL) {
+            Log::out() << "Warning: Duplicate species ID: " << i->id << endl;
             continue;
         }
-        PokemonSpecies *p = new PokemonSpecies((void *)&species);
-        set.m_set[species.id] = p;
+        PokemonSpecies *p = new PokemonSpecies(*i);
+        set.m_set[i->id] = p;
+        set.m_names.insert(SPECIES_NAME_INDEX::value_type(p->m_name, p));
     }
+}
 
-    return true;
+bool PokemonSpecies::loadSpecies(const string file, SpeciesDatabase &set) {
+    vector<SPECIES_DATA> species;
+    const bool read = readSpecies(file, species);
+    loadSpecies(species, set);
+    return read;
 }
 
 /**
- * Internally construct a new PokemonSpecies from a SPECIES structure.
+ * Internally construct a new PokemonSpecies from a SPECIES_DATA structure.
  */
-PokemonSpecies::PokemonSpecies(void *raw) {
-    SPECIES *p = (SPECIES *)raw;
+PokemonSpecies::PokemonSpecies(const SPECIES_DATA &data) {
+    const SPECIES_DATA *p = &data;
     m_name = p->name;
     m_id = p->id;
     m_gender = p->gender;
@@ -415,7 +551,21 @@ PokemonSpecies::PokemonSpecies(void *raw) {
     m_mass = p->mass;
     m_illegal = p->illegal;
     m_abilities = p->abilities;
-    vector<string>::iterator i = p->types.begin();
+    m_movelessCombination = false;
+
+    NameTable &abilities = NameTable::getAbilities();
+    ABILITY_LIST::const_iterator j = m_abilities.begin();
+    for (; j != m_abilities.end(); ++j) {
+        m_abilityIds.push_back(abilities.intern(*j));
+    }
+    COMBINATION_LIST::iterator k = m_illegal.begin();
+    for (; k != m_illegal.end(); ++k) {
+        if (!k->ability.empty()) {
+            k->abilityId = abilities.intern(k->ability);
+        }
+    }
+
+    vector<string>::const_iterator i = p->types.begin();
     for (; i != p->types.end(); ++i) {
         const PokemonType *type = PokemonType::getByCanonicalName(*i);
         if (type == NULL) {
@@ -431,7 +581,11 @@ PokemonSpecies::PokemonSpecies(void *raw) {
  */
 set<string> PokemonSpecies::populateMoveList(const MoveDatabase &p) {
     set<string> ret;
+    const int count = p.getMoveCount();
     m_moves.clear();
+    m_learnset.clear();
+    m_learnset.resize(count);
+    m_origins.assign(count, 0);
     for (int i = 0; i < ORIGIN_COUNT; ++i) {
         set<string> &moves = m_moveset[(MOVE_ORIGIN)i];
         set<string>::iterator j = moves.begin();
@@ -439,23 +593,97 @@ set<string> PokemonSpecies::populateMoveList(const MoveDatabase &p) {
             const string name = *j;
             const MoveTemplate *move = p.getMove(name);
             if (move) {
-                m_moves[name] = move;
+                const int id = move->getId();
+                m_moves[id] = move;
+                m_learnset.set(id);
+                m_origins[id] |= (1 << i);
             } else {
                 ret.insert(name);
             }
         }
     }
+
+    m_illegalMoves.clear();
+    m_illegalMoves.resize(count);
+    m_movelessCombination = false;
+    COMBINATION_LIST::iterator i = m_illegal.begin();
+    for (; i != m_illegal.end(); ++i) {
+        i->moveIds.clear();
+        i->moveMask.clear();
+        i->moveMask.resize(count);
+        i->possible = true;
+        vector<string>::const_iterator j = i->moves.begin();
+        for (; j != i->moves.end(); ++j) {
+            const MoveTemplate *move = p.getMove(*j);
+            if (move) {
+                i->moveIds.push_back(move->getId());
+                i->moveMask.set(move->getId());
+            } else {
+                i->moveIds.push_back(-1);
+                i->possible = false;
+            }
+        }
+        if (i->possible) {
+            m_illegalMoves |= i->moveMask;
+            if (i->moves.empty()) {
+                m_movelessCombination = true;
+            }
+        }
+    }
     return ret;
 }
 
+const Combination *PokemonSpecies::findIllegalCombination(
+        const MOVE_MASK &moves, const int ability,
+        const PokemonNature *nature, const unsigned int gender) const {
+    if (moves.size() != m_illegalMoves.size())
+        return NULL;
+    // Most teams share no moves with any illegal combination, so this one
+    // test usually settles the matter.
+    if (!m_movelessCombination && !moves.intersects(m_illegalMoves))
+        return NULL;
+    COMBINATION_LIST::const_iterator i = m_illegal.begin();
+    for (; i != m_illegal.end(); ++i) {
+        const Combination &combo = *i;
+        if (!combo.possible || !combo.moveMask.is_subset_of(moves))
+            continue;
+        if ((combo.abilityId != -1) && (ability != combo.abilityId))
+            continue;
+        if (combo.nature && (combo.nature != nature))
+            continue;
+        // 0 gender is NONE, pokemon with NONE cannot have any other gender
+        // so we can treat 0 as unspecified
+        if ((combo.gender != 0) && (gender != combo.gender))
+            continue;
+        return &combo;
+    }
+    return NULL;
+}
+
+const MoveTemplate *PokemonSpecies::getMove(const string &name) const {
+    MOVE_LIST::const_iterator i = m_moves.begin();
+    for (; i != m_moves.end(); ++i) {
+        if (i->second->getName() == name)
+            return i->second;
+    }
+    return NULL;
+}
+
+bool PokemonSpecies::canHaveAbility(const int id) const {
+    return (id != -1) && (find(m_abilityIds.begin(), m_abilityIds.end(), id)
+            != m_abilityIds.end());
+}
+
 /**
  * Verify that every ability is implemented.
  */
 void SpeciesDatabase::verifyAbilities(ScriptMachine *machine) const {
     set<string> abilities;
-    SPECIES_SET::iterator i = m_set.begin();
+    SPECIES_SET::const_iterator i = m_set.begin();
     for (; i != m_set.end(); ++i) {
-        const ABILITY_LIST &part = i->second->getAbilities();
+        if (*i == NULL)
+            continue;
+        const ABILITY_LIST &part = (*i)->getAbilities();
         ABILITY_LIST::const_iterator j = part.begin();
         for (; j != part.end(); ++j) {
             abilities.insert(*j);
@@ -30,6 +30,8 @@
 #include <vector>
 #include <map>
 #include <memory>
+#include <boost/unordered_map.hpp>
+#include <boost/dynamic_bitset.hpp>
 #include "../mechanics/stat.h"
 #include "../mechanics/PokemonNature.h"
 
@@ -57,12 +59,27 @@ enum GENDER {
 };
 
 class MoveTemplate;
-typedef std::map<std::string, const MoveTemplate *> MOVE_LIST;
+
+/** The moves a species can learn, keyed by move ID. **/
+typedef std::map<int, const MoveTemplate *> MOVE_LIST;
 
 typedef std::map<MOVE_ORIGIN, std::set<std::string> > MOVESET;
 
+/**
+ * A set of moves as a bitset indexed by move ID. Every mask built by a species
+ * has one bit for each ID in the MoveDatabase.
+ */
+typedef boost::dynamic_bitset<> MOVE_MASK;
+
+/** The origins of a move as a bit mask, with bit i set for MOVE_ORIGIN i. **/
+typedef unsigned char ORIGIN_MASK;
+
 class PokemonSpecies;
-typedef std::map<int, PokemonSpecies *> SPECIES_SET;
+
+/** Species indexed by ID. IDs with no species hold NULL. **/
+typedef std::vector<PokemonSpecies *> SPECIES_SET;
+typedef boost::unordered_map<std::string, const PokemonSpecies *>
+        SPECIES_NAME_INDEX;
 
 class PokemonType;
 typedef std::vector<const PokemonType *> TYPE_LIST;
@@ -72,15 +89,50 @@ struct Combination {
     std::string ability;
     unsigned int gender;
     std::vector<std::string> moves;
+
+    // The ability and moves as IDs, or -1 where there is no such ability or
+    // move. These are filled in when the species is built.
+    int abilityId;
+    std::vector<int> moveIds;
+
+    // The moves as a mask. If any of the moves is unknown, no pokemon can
+    // have them all and the combination can never match.
+    MOVE_MASK moveMask;
+    bool possible;
+
+    Combination(): nature(NULL), gender(0), abilityId(-1), possible(true) { }
 };
 
 typedef std::vector<std::string> ABILITY_LIST;
+typedef std::vector<int> ABILITY_ID_LIST;
 typedef std::vector<Combination> COMBINATION_LIST;
 
 class MoveDatabase;
 class SpeciesDatabase;
 class ScriptMachine;
 
+/**
+ * A species as read from the species XML file, before it is turned into a
+ * PokemonSpecies.
+ */
+struct SPECIES_DATA {
+    int id;
+    std::string name;
+    std::vector<std::string> types;
+    int gender;
+    int base[STAT_COUNT];
+    double mass;
+    MOVESET moves;
+    COMBINATION_LIST illegal;
+    ABILITY_LIST abilities;
+
+    SPECIES_DATA(): id(-1), gender(G_NONE), mass(0.0) {
+        for (int i = 0; i < STAT_COUNT; ++i) {
+            base[i] = 0;
+        }
+    }
+};
+
 /**
  * A species of pokemon. Each PokemonSpecies object is immutable and cannot be
  * copied or assigned to.
@@ -88,10 +140,42 @@ class ScriptMachine;
 class PokemonSpecies {
 public:
     /**
-     * Load a set of species by reading a species XML file.
+     * Load a set of species from a species XML file. The species are read
+     * from the game data pack if it is up to date with the file; otherwise
+     * the file is parsed and the pack is updated.
      */
     static bool loadSpecies(const std::string file, SpeciesDatabase &set);
 
+    /**
+     * Read the species from a species XML file without building them, using
+     * the game data pack in the same way as loadSpecies. This does not touch
+     * any SpeciesDatabase, so it can run on any thread. Returns false if no
+     * species were read.
+     */
+    static bool readSpecies(const std::string file,
+            std::vector<SPECIES_DATA> &species);
+
+    /**
+     * Build species that have already been read into a SpeciesDatabase.
+     */
+    static void loadSpecies(const std::vector<SPECIES_DATA> &species,
+            SpeciesDatabase &set);
+
+    /**
+     * Parse a species XML file, streaming it through a SAX2 reader. Returns
+     * false, with no species, if the file could not be parsed.
+     */
+    static bool parseSpecies(const std::string file,
+            std::vector<SPECIES_DATA> &species);
+
+    /**
+     * Parse a species XML file by building a DOM tree of the whole file.
+     * This was the original loader; it is kept to compare against the
+     * streaming parser. Returns false if the file could not be parsed.
+     */
+    static bool parseSpeciesDocument(const std::string file,
+            std::vector<SPECIES_DATA> &species);
+
     unsigned int getBaseStat(STAT i) const { return m_base[i]; }
     std::string getSpeciesName() const { return m_name; }
     unsigned int getSpeciesId() const { return m_id; }
@@ -99,18 +183,65 @@ public:
     const TYPE_LIST &getTypes() const { return m_types; }
     const MOVESET &getMoveset() const { return m_moveset; }
     const ABILITY_LIST &getAbilities() const { return m_abilities; }
+    const ABILITY_ID_LIST &getAbilityIds() const { return m_abilityIds; }
+    bool canHaveAbility(const int id) const;
     const MOVE_LIST &getMoveList() const { return m_moves; }
     double getMass() const { return m_mass; }
     bool hasRestrictedIvs() const;
     const COMBINATION_LIST &getIllegalCombinations() const { return m_illegal; }
 
     std::set<std::string> populateMoveList(const MoveDatabase &);
-    const MoveTemplate *getMove(const std::string name) const {
-        return m_moves[name];
+
+    /**
+     * Get the moves this species can learn as a mask. This is empty until
+     * populateMoveList has been called.
+     */
+    const MOVE_MASK &getLearnset() const { return m_learnset; }
+
+    /**
+     * Whether this species can learn a move, by ID.
+     */
+    bool canLearn(const int id) const {
+        return (id >= 0) && ((size_t)id < m_learnset.size())
+                && m_learnset.test(id);
+    }
+
+    /**
+     * Get the ways this species can learn a move, or 0 if it cannot learn it.
+     */
+    ORIGIN_MASK getMoveOrigins(const int id) const {
+        return canLearn(id) ? m_origins[id] : 0;
+    }
+
+    /**
+     * Check a set of moves, given as a mask the size of getLearnset(),
+     * against the moves of the illegal combinations. Returns the first
+     * combination whose moves are all in the set and which also has the
+     * given ability, nature and gender, or NULL if there is none.
+     */
+    const Combination *findIllegalCombination(const MOVE_MASK &moves,
+            const int ability, const PokemonNature *nature,
+            const unsigned int gender) const;
+
+    /**
+     * Get a move this species can learn by ID, or NULL if it cannot learn
+     * the move.
+     */
+    const MoveTemplate *getMove(const int id) const {
+        if (!canLearn(id))
+            return NULL;
+        MOVE_LIST::const_iterator i = m_moves.find(id);
+        return (i == m_moves.end()) ? NULL : i->second;
     }
 
+    /**
+     * Get a move this species can learn by name. This is a linear search,
+     * for reading teams by name only.
+     */
+    const MoveTemplate *getMove(const std::string &name) const;
+
 private:
-    PokemonSpecies(void *);
+    PokemonSpecies(const SPECIES_DATA &);
 
     PokemonSpecies(const PokemonSpecies &);
     PokemonSpecies &operator=(const PokemonSpecies &);
@@ -121,9 +252,14 @@ private:
     TYPE_LIST m_types;
     unsigned int m_base[STAT_COUNT];
     MOVESET m_moveset;
-    mutable MOVE_LIST m_moves;
+    MOVE_LIST m_moves;
+    MOVE_MASK m_learnset;
+    std::vector<ORIGIN_MASK> m_origins; // Indexed by move ID.
+    MOVE_MASK m_illegalMoves;   // Every move in any illegal combination.
+    bool m_movelessCombination; // Whether a combination has no moves.
     double m_mass;
     ABILITY_LIST m_abilities;
+    ABILITY_ID_LIST m_abilityIds;
     COMBINATION_LIST m_illegal;
     static const std::string m_restricted[];
 };
@@ -140,17 +276,23 @@ public:
     void loadSpecies(const std::string file) {
         PokemonSpecies::loadSpecies(file, *this);
     }
+    void loadSpecies(const std::vector<SPECIES_DATA> &species) {
+        PokemonSpecies::loadSpecies(species, *this);
+    }
+    /**
+     * Get a species by ID, or NULL if there is no species with that ID.
+     */
     const PokemonSpecies *getSpecies(const int id) const {
+        if ((id < 0) || (id >= (int)m_set.size()))
+            return NULL;
         return m_set[id];
     }
-    const PokemonSpecies *getSpecies(const std::string name) const {
-        SPECIES_SET::const_iterator i = m_set.begin();
-        for (; i != m_set.end(); ++i) {
-            const PokemonSpecies *p = i->second;
-            if (p->getSpeciesName() == name)
-                return p;
-        }
-        return NULL;
+    /**
+     * Get a species by name, or NULL if there is no species with that name.
+     */
+    const PokemonSpecies *getSpecies(const std::string &name) const {
+        SPECIES_NAME_INDEX::const_iterator i = m_names.find(name);
+        return (i == m_names.end()) ? NULL : i->second;
     }
     const SPECIES_SET &getSpeciesSet() const {
         return m_set;
@@ -164,7 +306,9 @@ public:
         std::set<std::string> ret;
         SPECIES_SET::iterator i = m_set.begin();
         for (; i != m_set.end(); ++i) {
-            std::set<std::string> set = i->second->populateMoveList(p);
+            if (*i == NULL)
+                continue;
+            std::set<std::string> set = (*i)->populateMoveList(p);
             ret.insert(set.begin(), set.end());
         }
         return ret;
@@ -176,15 +320,16 @@ public:
     ~SpeciesDatabase() {
         SPECIES_SET::iterator i = m_set.begin();
         for (; i != m_set.end(); ++i) {
-            delete i->second;
+            delete *i;
         }
     }
 private:
-    mutable SPECIES_SET m_set;
+    SPECIES_SET m_set;
+    SPECIES_NAME_INDEX m_names;
     SpeciesDatabase(const SpeciesDatabase &);
     SpeciesDatabase &operator=(const SpeciesDatabase &);
-    friend bool PokemonSpecies::loadSpecies(const std::string file,
-            SpeciesDatabase &set);
+    friend void PokemonSpecies::loadSpecies(
+            const std::vector<SPECIES_DATA> &species, SpeciesDatabase &set);
 };
 
 }
@@ -0,0 +1,185 @@
+/* 
+ * File:   RolloutPool.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include "RolloutPool.h"
+#include "../scripting/ScriptMachine.h"
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle {
+
+namespace {
+
+/**
+ * Lower the priority of the calling thread. On Linux, setpriority() with a
+ * thread id affects only that thread; elsewhere this does nothing rather
+ * than lowering the priority of the whole server.
+ */
+void lowerThreadPriority(const int niceness) {
+#if defined(__linux__) && defined(SYS_gettid)
+    if (niceness > 0) {
+        const int tid = syscall(SYS_gettid);
+        const int current = getpriority(PRIO_PROCESS, tid);
+        setpriority(PRIO_PROCESS, tid, current + niceness);
+    }
+#else
+    (void)niceness;
+#endif
+}
+
+} // anonymous namespace
+
+RolloutPool::RolloutPool(ScriptMachine *machine, const int threads,
+        const int niceness):
+        m_machine(machine),
+        m_niceness(niceness),
+        m_pending(0),
+        m_next(0),
+        m_stopped(false),
+        m_rollouts(0),
+        m_busy(0) {
+    const int count = (threads < 1) ? 1 : threads;
+    for (int i = 0; i < count; ++i) {
+        m_workers.push_back(shared_ptr<Worker>(new Worker()));
+    }
+    // Each worker is given its index before it starts, rather than being
+    // looked up by thread id, so that a post() never sees an unknown worker.
+    for (int i = 0; i < count; ++i) {
+        m_threads.create_thread(bind(&RolloutPool::run, this, i));
+    }
+}
+
+RolloutPool::~RolloutPool() {
+    {
+        lock_guard<mutex> guard(m_mutex);
+        m_stopped = true;
+    }
+    m_condition.notify_all();
+    m_threads.join_all();
+}
+
+void RolloutPool::post(const TASK &task) {
+    const int count = m_workers.size();
+    const int *worker = m_worker.get();
+    int idx = worker ? *worker : -1;
+    {
+        lock_guard<mutex> guard(m_mutex);
+        if (idx == -1) {
+            idx = m_next;
+            m_next = (m_next + 1) % count;
+        }
+        ++m_pending;
+    }
+    {
+        Worker &worker = *m_workers[idx];
+        lock_guard<mutex> guard(worker.mutex);
+        worker.tasks.push_back(task);
+    }
+    m_condition.notify_one();
+}
+
+void RolloutPool::addRollouts(const int count) {
+    lock_guard<mutex> guard(m_mutex);
+    m_rollouts += count;
+}
+
+long RolloutPool::getRolloutCount() const {
+    lock_guard<mutex> guard(const_cast<mutex &>(m_mutex));
+    return m_rollouts;
+}
+
+double RolloutPool::getRolloutsPerCoreSecond() const {
+    lock_guard<mutex> guard(const_cast<mutex &>(m_mutex));
+    if (m_busy == 0) {
+        return 0.0;
+    }
+    return m_rollouts * 1000000.0 / m_busy;
+}
+
+/**
+ * Take a task for the given worker: the newest task from its own queue if
+ * there is one, otherwise the oldest task from some other worker.
+ */
+bool RolloutPool::takeTask(const int idx, TASK &task) {
+    {
+        Worker &worker = *m_workers[idx];
+        lock_guard<mutex> guard(worker.mutex);
+        if (!worker.tasks.empty()) {
+            task = worker.tasks.back();
+            worker.tasks.pop_back();
+            return true;
+        }
+    }
+    const int count = m_workers.size();
+    for (int i = 1; i < count; ++i) {
+        Worker &victim = *m_workers[(idx + i) % count];
+        lock_guard<mutex> guard(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+void RolloutPool::run(const int idx) {
+    m_worker.reset(new int(idx));
+    lowerThreadPriority(m_niceness);
+    shared_ptr<ScriptContext> cx;
+    if (m_machine) {
+        cx = m_machine->acquireContext();
+    }
+
+    while (true) {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            while (!m_stopped && (m_pending == 0)) {
+                m_condition.wait(lock);
+            }
+            if (m_stopped) {
+                return;
+            }
+            --m_pending;
+        }
+        TASK task;
+        while (!takeTask(idx, task)) {
+            // The task counted by m_pending is still being pushed.
+            this_thread::yield();
+        }
+        const posix_time::ptime start =
+                posix_time::microsec_clock::universal_time();
+        task(cx);
+        const long elapsed = (posix_time::microsec_clock::universal_time()
+                - start).total_microseconds();
+        lock_guard<mutex> guard(m_mutex);
+        m_busy += elapsed;
+    }
+}
+
+}
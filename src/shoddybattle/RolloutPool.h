@@ -0,0 +1,114 @@
+/* 
+ * File:   RolloutPool.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _ROLLOUT_POOL_H_
+#define _ROLLOUT_POOL_H_
+
+#include <boost/shared_ptr.hpp>
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+#include <boost/utility.hpp>
+#include <deque>
+#include <vector>
+
+namespace shoddybattle {
+
+class ScriptMachine;
+class ScriptContext;
+
+/**
+ * A work-stealing thread pool for battle rollouts, shared by every AI player
+ * on the server. If the pool is given a ScriptMachine, each worker owns a
+ * ScriptContext of that machine for the lifetime of the pool, which is passed
+ * to the tasks that it runs. Otherwise the tasks are passed a null context
+ * and acquire their own, which lets one pool serve battles on several
+ * machines.
+ *
+ * Tasks posted from a worker go to the back of that worker's own queue and
+ * are taken from the back again, so a search keeps its working set on one
+ * core; idle workers steal from the front of other workers' queues. Workers
+ * run at a lower scheduling priority than the rest of the server so that
+ * rollouts use spare cores without delaying battles between human players.
+ */
+class RolloutPool : boost::noncopyable {
+public:
+    typedef boost::function<void (boost::shared_ptr<ScriptContext>)> TASK;
+
+    /**
+     * Start a pool of the given number of threads. The niceness is added to
+     * the scheduling priority of each worker, where the platform allows it.
+     */
+    RolloutPool(ScriptMachine *machine, const int threads,
+            const int niceness = 10);
+    ~RolloutPool();
+
+    /**
+     * Queue a task to run on one of the workers.
+     */
+    void post(const TASK &task);
+
+    /**
+     * Record that a task completed a number of rollouts.
+     */
+    void addRollouts(const int count);
+
+    int getThreadCount() const {
+        return m_workers.size();
+    }
+
+    /**
+     * Get the total number of rollouts completed.
+     */
+    long getRolloutCount() const;
+
+    /**
+     * Get the number of rollouts completed per second of time spent running
+     * tasks, which is the rate achieved by a single core.
+     */
+    double getRolloutsPerCoreSecond() const;
+
+private:
+    struct Worker {
+        std::deque<TASK> tasks;
+        boost::mutex mutex;
+    };
+
+    void run(const int idx);
+    bool takeTask(const int idx, TASK &task);
+
+    ScriptMachine *m_machine;
+    const int m_niceness;
+    std::vector<boost::shared_ptr<Worker> > m_workers;
+    boost::thread_specific_ptr<int> m_worker; // index of the calling worker
+    boost::thread_group m_threads;
+    boost::mutex m_mutex;
+    boost::condition_variable m_condition;
+    int m_pending;
+    int m_next;
+    bool m_stopped;
+    long m_rollouts;
+    long m_busy; // microseconds spent running tasks
+};
+
+}
+
+#endif
@@ -0,0 +1,317 @@
+/* 
+ * File:   SimulatedBattle.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <vector>
+#include "SimulatedBattle.h"
+#include "../mechanics/BattleMechanics.h"
+#include "../mechanics/PokemonType.h"
+#include "../scripting/ScriptMachine.h"
+
+using namespace std;
+using namespace boost;
+
+namespace shoddybattle {
+
+namespace {
+
+/**
+ * Get the first living pokemon in the opposing active party.
+ */
+Pokemon *getFirstOpponent(BattleField &field, Pokemon *user) {
+    const int enemy = 1 - user->getParty();
+    const int size = field.getPartySize();
+    for (int i = 0; i < size; ++i) {
+        Pokemon::PTR p = field.getActivePokemon(enemy, i);
+        if (p && !p->isFainted())
+            return p.get();
+    }
+    return NULL;
+}
+
+/**
+ * Choose the action of each active pokemon on a field.
+ */
+void chooseTurns(BattleField &field, BattlePolicyPtr policies[TEAM_COUNT],
+        vector<PokemonTurn> &turns) {
+    Pokemon::ARRAY pokemon;
+    field.getActivePokemon(pokemon);
+    for (Pokemon::ARRAY::const_iterator i = pokemon.begin();
+            i != pokemon.end(); ++i) {
+        Pokemon *p = i->get();
+        p->determineLegalActions();
+        turns.push_back(policies[p->getParty()]->selectTurn(field, p));
+    }
+}
+
+/**
+ * Choose a replacement for each fainted pokemon on a field. Returns false
+ * if some pokemon has no legal replacement.
+ */
+bool chooseReplacements(BattleField &field,
+        BattlePolicyPtr policies[TEAM_COUNT],
+        const Pokemon::ARRAY &fainted,
+        vector<PokemonTurn> &turns) {
+    vector<bool> chosen[TEAM_COUNT];
+    for (Pokemon::ARRAY::const_iterator i = fainted.begin();
+            i != fainted.end(); ++i) {
+        Pokemon *p = i->get();
+        const int party = p->getParty();
+        vector<bool> switches;
+        field.getLegalSwitches(p, switches);
+        // Two pokemon from the same party cannot choose the same
+        // replacement.
+        vector<bool> &taken = chosen[party];
+        taken.resize(switches.size(), false);
+        for (unsigned int j = 0; j < switches.size(); ++j) {
+            if (taken[j]) {
+                switches[j] = false;
+            }
+        }
+        const int idx = policies[party]->selectReplacement(field, p,
+                switches);
+        if (idx == -1)
+            return false;
+        taken[idx] = true;
+        turns.push_back(PokemonTurn(TT_SWITCH, idx));
+    }
+    return true;
+}
+
+}
+
+int getDefaultTarget(BattleField &field, Pokemon *user, MoveObject *move) {
+    const TARGET tc = move->getTargetClass(field.getContext());
+    if (!isTargeted(tc))
+        return -1;
+
+    const int size = field.getPartySize();
+    const int party = user->getParty();
+    if ((tc == T_ALLY) || (tc == T_USER_OR_ALLY)) {
+        for (int i = 0; i < size; ++i) {
+            Pokemon::PTR p = field.getActivePokemon(party, i);
+            if (!p || p->isFainted())
+                continue;
+            if ((p.get() != user) || (tc == T_USER_OR_ALLY) || (size == 1))
+                return party * size + i;
+        }
+        return -1;
+    }
+
+    const int enemy = 1 - party;
+    for (int i = 0; i < size; ++i) {
+        Pokemon::PTR p = field.getActivePokemon(enemy, i);
+        if (p && !p->isFainted())
+            return enemy * size + i;
+    }
+    return -1;
+}
+
+bool isBattleDecided(const BattleField &field, int &victor) {
+    const int alive0 = field.getAliveCount(0);
+    const int alive1 = field.getAliveCount(1);
+    if ((alive0 != 0) && (alive1 != 0))
+        return false;
+    victor = (alive0 != 0) ? 0 : ((alive1 != 0) ? 1 : -1);
+    return true;
+}
+
+bool playPolicyTurn(BattleField &field,
+        BattlePolicyPtr policies[TEAM_COUNT]) {
+    int victor = -1;
+    vector<PokemonTurn> turns;
+    chooseTurns(field, policies, turns);
+    field.processTurn(turns);
+    while (!isBattleDecided(field, victor)) {
+        Pokemon::ARRAY fainted;
+        field.getFaintedPokemon(fainted);
+        if (fainted.empty())
+            return true;
+        vector<PokemonTurn> replacements;
+        if (!chooseReplacements(field, policies, fainted, replacements))
+            throw BattleFieldException();
+        field.processReplacements(replacements);
+    }
+    return false;
+}
+
+PokemonTurn RandomPolicy::selectTurn(BattleField &field, Pokemon *p) {
+    if (p->getForcedTurn()) {
+        return PokemonTurn();
+    }
+
+    vector<PokemonTurn> choices;
+    const int moves = p->getMoveCount();
+    for (int i = 0; i < moves; ++i) {
+        if (p->isMoveLegal(i)) {
+            MoveObjectPtr move = p->getMove(i);
+            choices.push_back(PokemonTurn(TT_MOVE, i,
+                    getDefaultTarget(field, p, move.get())));
+        }
+    }
+    if (p->isSwitchLegal()) {
+        vector<bool> switches;
+        field.getLegalSwitches(p, switches);
+        const int size = switches.size();
+        for (int i = 0; i < size; ++i) {
+            if (switches[i]) {
+                choices.push_back(PokemonTurn(TT_SWITCH, i));
+            }
+        }
+    }
+
+    if (choices.empty()) {
+        // Nothing is legal; the BattleField will substitute Struggle.
+        return PokemonTurn();
+    }
+    return choices[getRandomInt(0, choices.size() - 1)];
+}
+
+int RandomPolicy::selectReplacement(BattleField &, Pokemon *,
+        const vector<bool> &switches) {
+    vector<int> choices;
+    const int size = switches.size();
+    for (int i = 0; i < size; ++i) {
+        if (switches[i]) {
+            choices.push_back(i);
+        }
+    }
+    if (choices.empty())
+        return -1;
+    return choices[getRandomInt(0, choices.size() - 1)];
+}
+
+PokemonTurn GreedyPolicy::selectTurn(BattleField &field, Pokemon *p) {
+    if (p->getForcedTurn()) {
+        return PokemonTurn();
+    }
+
+    ScriptContext *cx = field.getContext();
+    const BattleMechanics *mech = field.getMechanics();
+    Pokemon *target = getFirstOpponent(field, p);
+
+    int best = -1;
+    double bestScore = -1.0;
+    const int moves = p->getMoveCount();
+    for (int i = 0; i < moves; ++i) {
+        if (!p->isMoveLegal(i))
+            continue;
+        MoveObjectPtr move = p->getMove(i);
+        const PokemonType *type = move->getType(cx);
+        double score = move->getPower(cx);
+        if (target && (score > 0.0)) {
+            score *= mech->getEffectiveness(field, type, p, target, NULL);
+        }
+        if (p->isType(type)) {
+            score *= 1.5;
+        }
+        if (score > bestScore) {
+            best = i;
+            bestScore = score;
+        }
+    }
+
+    if (best == -1) {
+        return RandomPolicy::selectTurn(field, p);
+    }
+    MoveObjectPtr move = p->getMove(best);
+    return PokemonTurn(TT_MOVE, best, getDefaultTarget(field, p, move.get()));
+}
+
+int GreedyPolicy::selectReplacement(BattleField &, Pokemon *,
+        const vector<bool> &switches) {
+    const int size = switches.size();
+    for (int i = 0; i < size; ++i) {
+        if (switches[i])
+            return i;
+    }
+    return -1;
+}
+
+SimulatedBattle::SimulatedBattle(BattlePolicyPtr policies[TEAM_COUNT],
+        const int maxTurns):
+            m_maxTurns(maxTurns),
+            m_turnCount(0),
+            m_victor(-1),
+            m_over(false) {
+    for (int i = 0; i < TEAM_COUNT; ++i) {
+        m_policies[i] = policies[i];
+    }
+    setNarrationEnabled(false);
+}
+
+int SimulatedBattle::run() {
+    beginBattle();
+    while (playTurn()) { }
+    if (!m_over) {
+        // Hit the turn limit: call it a draw.
+        m_over = true;
+        m_victor = -1;
+    }
+    return m_victor;
+}
+
+bool SimulatedBattle::playTurn() {
+    if (m_over || (m_turnCount >= m_maxTurns))
+        return false;
+    ++m_turnCount;
+
+    vector<PokemonTurn> turns;
+    chooseTurns(*this, m_policies, turns);
+    processTurn(turns);
+    processReplacements();
+    return !m_over && (m_turnCount < m_maxTurns);
+}
+
+/**
+ * Replace fainted pokemon until there are none left to replace, in the same
+ * way as a NetworkBattle requests replacements after each turn.
+ */
+void SimulatedBattle::processReplacements() {
+    while (!m_over) {
+        Pokemon::ARRAY fainted;
+        getFaintedPokemon(fainted);
+        if (fainted.empty())
+            return;
+
+        vector<PokemonTurn> turns;
+        if (!chooseReplacements(*this, m_policies, fainted, turns))
+            throw BattleFieldException();
+        BattleField::processReplacements(turns);
+    }
+}
+
+Pokemon *SimulatedBattle::requestInactivePokemon(Pokemon *p) {
+    vector<bool> switches;
+    getLegalSwitches(p, switches);
+    const int idx = m_policies[p->getParty()]->selectReplacement(*this, p,
+            switches);
+    if (idx == -1)
+        return NULL;
+    return getTeam(p->getParty())[idx].get();
+}
+
+void SimulatedBattle::informVictory(const int party) {
+    m_over = true;
+    m_victor = party;
+    BattleField::informVictory(party);
+}
+
+}
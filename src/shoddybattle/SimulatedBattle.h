@@ -0,0 +1,171 @@
+/* 
+ * File:   SimulatedBattle.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _SIMULATED_BATTLE_H_
+#define _SIMULATED_BATTLE_H_
+
+#include <boost/shared_ptr.hpp>
+#include "BattleField.h"
+#include "../mechanics/RandomGenerator.h"
+
+namespace shoddybattle {
+
+/**
+ * A policy chooses the actions of one party in a battle that has no human
+ * players attached to it.
+ */
+class BattlePolicy {
+public:
+    virtual ~BattlePolicy() { }
+
+    /**
+     * Choose the action of an active pokemon at the start of a turn. The
+     * legal actions of the pokemon have already been determined.
+     */
+    virtual PokemonTurn selectTurn(BattleField &, Pokemon *) = 0;
+
+    /**
+     * Choose the index of the inactive pokemon to switch in for a pokemon
+     * that has fainted or is leaving the field. The switches vector gives
+     * the legal choices. Returns -1 if there is no legal choice.
+     */
+    virtual int selectReplacement(BattleField &, Pokemon *,
+            const std::vector<bool> &switches) = 0;
+};
+
+typedef boost::shared_ptr<BattlePolicy> BattlePolicyPtr;
+
+/**
+ * Chooses uniformly at random among the legal moves of a pokemon, switching
+ * only when no move is legal.
+ */
+class RandomPolicy : public BattlePolicy {
+public:
+    RandomPolicy(const RANDOM_SEED seed): m_rand(seed) { }
+    PokemonTurn selectTurn(BattleField &, Pokemon *);
+    int selectReplacement(BattleField &, Pokemon *, const std::vector<bool> &);
+protected:
+    int getRandomInt(const int lower, const int upper) {
+        return m_rand.getInt(lower, upper);
+    }
+private:
+    RandomGenerator m_rand;
+};
+
+/**
+ * Always uses the legal move with the highest expected base damage against
+ * the opposing pokemon, and brings in replacements in team order.
+ */
+class GreedyPolicy : public RandomPolicy {
+public:
+    GreedyPolicy(const RANDOM_SEED seed): RandomPolicy(seed) { }
+    PokemonTurn selectTurn(BattleField &, Pokemon *);
+    int selectReplacement(BattleField &, Pokemon *, const std::vector<bool> &);
+};
+
+/**
+ * Choose a target for a move: the first living opponent for moves aimed at
+ * an enemy, or the first eligible member of the user's party for moves
+ * aimed at an ally. Returns -1 if the move takes no target.
+ */
+int getDefaultTarget(BattleField &, Pokemon *user, MoveObject *move);
+
+/**
+ * Determine whether a battle has been decided by the pokemon left on each
+ * team, storing the victorious party (or -1 for a draw) in victor. Unlike
+ * SimulatedBattle::isOver, this works on any BattleField, such as a fork.
+ */
+bool isBattleDecided(const BattleField &, int &victor);
+
+/**
+ * Play a single turn of any BattleField, including any replacements that
+ * follow it, with the actions chosen by a pair of policies. Returns false
+ * if the battle has been decided.
+ */
+bool playPolicyTurn(BattleField &, BattlePolicyPtr policies[TEAM_COUNT]);
+
+/**
+ * A BattleField which is driven to completion in the calling thread by a
+ * pair of BattlePolicy objects, without any network clients. Nothing is
+ * printed unless narration is enabled.
+ *
+ * Usage:
+ *     SimulatedBattle battle(policies, 500);
+ *     battle.initialise(...);
+ *     const int victor = battle.run();
+ *     battle.terminate();
+ */
+class SimulatedBattle : public BattleField {
+public:
+    SimulatedBattle(BattlePolicyPtr policies[TEAM_COUNT], const int maxTurns);
+
+    /**
+     * Run the battle until one party wins or the turn limit is reached.
+     * Returns the victorious party, or -1 for a draw.
+     */
+    int run();
+
+    /**
+     * Play a single turn, including any replacements that follow it.
+     * beginBattle must be called before the first turn. Returns whether
+     * the battle can continue.
+     */
+    bool playTurn();
+
+    /**
+     * Get the number of turns played so far.
+     */
+    int getTurnCount() const {
+        return m_turnCount;
+    }
+
+    /**
+     * Get the victorious party, or -1 if the battle was drawn or has not
+     * ended.
+     */
+    int getVictor() const {
+        return m_victor;
+    }
+
+    /**
+     * Whether the battle has ended.
+     */
+    bool isOver() const {
+        return m_over;
+    }
+
+protected:
+    Pokemon *requestInactivePokemon(Pokemon *);
+    void informVictory(const int);
+
+private:
+    void processReplacements();
+
+    BattlePolicyPtr m_policies[TEAM_COUNT];
+    const int m_maxTurns;
+    int m_turnCount;
+    int m_victor;
+    bool m_over;
+};
+
+}
+
+#endif
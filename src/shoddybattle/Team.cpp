@@ -25,6 +25,8 @@
 #include "Team.h"
 #include "ObjectTeamFile.h"
 #include "PokemonSpecies.h"
+#include "NameTable.h"
+#include "../moves/PokemonMove.h"
 #include "../mechanics/PokemonNature.h"
 #include <iostream>
 
@@ -36,18 +38,19 @@ Pokemon::PTR getPokemon(const SpeciesDatabase *data, POKEMON &p) {
     const PokemonSpecies *species = data->getSpecies(p.species);
     const PokemonNature *nature = PokemonNature::getNature(p.nature);
 
-    vector<string> moves;
+    vector<int> moves;
     vector<int> ppUps;
     for (int i = 0; i < P_MOVE_COUNT; ++i) {
-        moves.push_back(p.moves[i]);
+        const MoveTemplate *move = species->getMove(p.moves[i]);
+        moves.push_back(move ? move->getId() : -1);
         ppUps.push_back(p.ppUp[i]);
     }
 
     return Pokemon::PTR(new Pokemon(species,
             p.nickname,
             nature,
-            p.ability,
-            p.item,
+            NameTable::getAbilities().getId(p.ability),
+            NameTable::getItems().getId(p.item),
             p.iv, p.ev,
             p.level,
             p.gender,
@@ -56,6 +59,17 @@ Pokemon::PTR getPokemon(const SpeciesDatabase *data, POKEMON &p) {
             moves, ppUps));
 }
 
+void createTeam(const vector<POKEMON> &data,
+        const SpeciesDatabase &species,
+        Pokemon::ARRAY &team) {
+    team.clear();
+    vector<POKEMON>::const_iterator i = data.begin();
+    for (; i != data.end(); ++i) {
+        POKEMON p = *i;
+        team.push_back(getPokemon(&species, p));
+    }
+}
+
 bool loadTeam(const std::string file,
         const SpeciesDatabase &data,
         Pokemon::ARRAY &team) {
@@ -26,12 +26,23 @@
 #define _TEAM_H_
 
 #include "Pokemon.h"
+#include "ObjectTeamFile.h"
 #include <string>
+#include <vector>
 
 namespace shoddybattle {
 
 class SpeciesDatabase;
 
+/**
+ * Create fresh Pokemon objects from team data that has already been read
+ * from disc, replacing the contents of the provided Pokemon::ARRAY. This
+ * allows one team file to be used for any number of battles.
+ */
+void createTeam(const std::vector<POKEMON> &data,
+        const SpeciesDatabase &species,
+        Pokemon::ARRAY &team);
+
 /**
  * Load a team from disc into the provided Pokemon::ARRAY.
  */
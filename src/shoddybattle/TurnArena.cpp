@@ -0,0 +1,119 @@
+/* 
+ * File:   TurnArena.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <new>
+#include <cassert>
+#include "TurnArena.h"
+
+using namespace std;
+
+namespace shoddybattle {
+
+namespace {
+
+// Every allocation is aligned to this many bytes.
+const size_t ALIGNMENT = 16;
+
+inline size_t align(const size_t bytes) {
+    return (bytes + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+
+} // anonymous namespace
+
+TurnArena::TurnArena(const size_t capacity):
+        m_retiredSize(0),
+        m_depth(0) {
+    const size_t size = align(capacity);
+    m_begin = m_top = static_cast<char *>(::operator new(size));
+    m_end = m_begin + size;
+}
+
+TurnArena::~TurnArena() {
+    assert(m_depth == 0);
+    for (vector<char *>::iterator i = m_retired.begin();
+            i != m_retired.end(); ++i) {
+        ::operator delete(*i);
+    }
+    ::operator delete(m_begin);
+}
+
+void *TurnArena::allocate(const size_t bytes) {
+    const size_t size = align(bytes);
+    if (size > size_t(m_end - m_top)) {
+        grow(size);
+    }
+    void *p = m_top;
+    m_top += size;
+    return p;
+}
+
+void TurnArena::deallocate(void *p, const size_t bytes) {
+    char *block = static_cast<char *>(p);
+    if (block + align(bytes) == m_top) {
+        m_top = block;
+    }
+}
+
+/**
+ * Retire the current block and start a new one at least twice as large.
+ */
+void TurnArena::grow(const size_t bytes) {
+    const size_t capacity = m_end - m_begin;
+    size_t size = 2 * capacity;
+    if (size < bytes) {
+        size = align(bytes);
+    }
+    m_retired.push_back(m_begin);
+    m_retiredSize += capacity;
+    m_begin = m_top = static_cast<char *>(::operator new(size));
+    m_end = m_begin + size;
+}
+
+/**
+ * Release every allocation. If the arena has grown since the last reset, the
+ * blocks are replaced by a single block as large as all of them together.
+ */
+void TurnArena::reset() {
+    assert(m_depth == 0);
+    if (!m_retired.empty()) {
+        const size_t size = m_retiredSize + (m_end - m_begin);
+        for (vector<char *>::iterator i = m_retired.begin();
+                i != m_retired.end(); ++i) {
+            ::operator delete(*i);
+        }
+        m_retired.clear();
+        m_retiredSize = 0;
+        ::operator delete(m_begin);
+        m_begin = static_cast<char *>(::operator new(size));
+        m_end = m_begin + size;
+    }
+    m_top = m_begin;
+}
+
+size_t TurnArena::getUsed() const {
+    return m_retiredSize + (m_top - m_begin);
+}
+
+size_t TurnArena::getCapacity() const {
+    return m_retiredSize + (m_end - m_begin);
+}
+
+}
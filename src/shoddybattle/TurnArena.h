@@ -0,0 +1,163 @@
+/* 
+ * File:   TurnArena.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _TURN_ARENA_H_
+#define _TURN_ARENA_H_
+
+#include <cstddef>
+#include <vector>
+#include <boost/utility.hpp>
+
+namespace shoddybattle {
+
+/**
+ * A bump allocator for the short-lived containers built while processing a
+ * turn: turn order, end of turn effects, target lists and so on. Memory is
+ * only returned to the arena as a whole, when the outermost Scope ends.
+ *
+ * The arena starts with a single block. If a turn needs more than that, the
+ * extra blocks are merged into one larger block when the arena is reset, so
+ * a battle soon stops allocating from the global heap at all.
+ *
+ * A TurnArena belongs to one BattleField and, like the BattleField, must be
+ * used by only one thread at a time.
+ */
+class TurnArena : boost::noncopyable {
+public:
+    explicit TurnArena(const size_t capacity = 8192);
+    ~TurnArena();
+
+    /**
+     * Allocate memory from the arena, aligned for any type.
+     */
+    void *allocate(const size_t bytes);
+
+    /**
+     * Return memory to the arena. Only the most recent allocation is actually
+     * reclaimed, which lets a growing vector reuse its space.
+     */
+    void deallocate(void *p, const size_t bytes);
+
+    /**
+     * Get the number of bytes taken from the arena since the last reset,
+     * including any space left over at the end of full blocks.
+     */
+    size_t getUsed() const;
+
+    /**
+     * Get the total capacity of the arena, in bytes.
+     */
+    size_t getCapacity() const;
+
+    /**
+     * Code that allocates from the arena holds a Scope for as long as its
+     * containers are alive. When the last Scope ends, every allocation is
+     * released at once, so a Scope must be constructed before any arena
+     * container that it protects.
+     */
+    class Scope : boost::noncopyable {
+    public:
+        explicit Scope(TurnArena &arena): m_arena(arena) {
+            ++m_arena.m_depth;
+        }
+        ~Scope() {
+            if (--m_arena.m_depth == 0) {
+                m_arena.reset();
+            }
+        }
+    private:
+        TurnArena &m_arena;
+    };
+
+private:
+    void reset();
+    void grow(const size_t bytes);
+
+    char *m_begin, *m_top, *m_end;
+    std::vector<char *> m_retired;  // full blocks since the last reset
+    size_t m_retiredSize;
+    int m_depth;
+};
+
+/**
+ * An STL allocator that allocates from a TurnArena.
+ */
+template <class T>
+class ArenaAllocator {
+public:
+    typedef T value_type;
+    typedef T *pointer;
+    typedef const T *const_pointer;
+    typedef T &reference;
+    typedef const T &const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template <class U>
+    struct rebind {
+        typedef ArenaAllocator<U> other;
+    };
+
+    explicit ArenaAllocator(TurnArena &arena): m_arena(&arena) { }
+    template <class U>
+    ArenaAllocator(const ArenaAllocator<U> &rhs): m_arena(rhs.getArena()) { }
+
+    pointer address(reference x) const {
+        return &x;
+    }
+    const_pointer address(const_reference x) const {
+        return &x;
+    }
+    pointer allocate(const size_type n, const void * = NULL) {
+        return static_cast<pointer>(m_arena->allocate(n * sizeof(T)));
+    }
+    void deallocate(pointer p, const size_type n) {
+        m_arena->deallocate(p, n * sizeof(T));
+    }
+    size_type max_size() const {
+        return size_t(-1) / sizeof(T);
+    }
+    void construct(pointer p, const T &val) {
+        new(static_cast<void *>(p)) T(val);
+    }
+    void destroy(pointer p) {
+        p->~T();
+    }
+    TurnArena *getArena() const {
+        return m_arena;
+    }
+private:
+    TurnArena *m_arena;
+};
+
+template <class T, class U>
+inline bool operator==(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return (a.getArena() == b.getArena());
+}
+
+template <class T, class U>
+inline bool operator!=(const ArenaAllocator<T> &a, const ArenaAllocator<U> &b) {
+    return (a.getArena() != b.getArena());
+}
+
+}
+
+#endif
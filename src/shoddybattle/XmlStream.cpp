@@ -0,0 +1,174 @@
+/* 
+ * File:   XmlStream.cpp
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#include <memory>
+#include <xercesc/sax2/SAX2XMLReader.hpp>
+#include <xercesc/sax2/XMLReaderFactory.hpp>
+#include <xercesc/sax/SAXParseException.hpp>
+#include <xercesc/util/XMLString.hpp>
+#include <xercesc/util/XMLUni.hpp>
+#include <xercesc/util/PlatformUtils.hpp>
+#include "XmlStream.h"
+#include "../main/Log.h"
+
+using namespace std;
+using namespace xercesc;
+
+namespace shoddybattle {
+
+namespace {
+
+/**
+ * Find the length of a null-terminated UTF-16 string.
+ */
+size_t getLength(const XMLCh *str) {
+    const XMLCh *p = str;
+    while (*p) {
+        ++p;
+    }
+    return p - str;
+}
+
+} // anonymous namespace
+
+bool XmlStreamHandler::parse(const string &file) {
+    XMLPlatformUtils::Initialize();
+    auto_ptr<SAX2XMLReader> reader(XMLReaderFactory::createXMLReader());
+    reader->setFeature(XMLUni::fgSAX2CoreNameSpaces, false);
+    reader->setFeature(XMLUni::fgSAX2CoreValidation, false);
+    reader->setContentHandler(this);
+    reader->setErrorHandler(this);
+    reader->setEntityResolver(this);
+
+    m_path.clear();
+    m_text.clear();
+    m_errors = 0;
+    try {
+        reader->parse(file.c_str());
+    } catch (const XMLException &e) {
+        string message;
+        appendUtf8(message, e.getMessage(), getLength(e.getMessage()));
+        Log::out() << message << endl;
+        return false;
+    } catch (const SAXException &) {
+        // Already reported to fatalError.
+        return false;
+    }
+    return (m_errors == 0);
+}
+
+const string &XmlStreamHandler::getAncestor(const int i) const {
+    static const string none;
+    const int depth = m_path.size();
+    if ((i < 0) || (i >= depth))
+        return none;
+    return m_path[depth - 1 - i];
+}
+
+string XmlStreamHandler::getAttribute(const Attributes &attributes,
+        const char *name) {
+    const XMLSize_t count = attributes.getLength();
+    for (XMLSize_t i = 0; i < count; ++i) {
+        const XMLCh *attr = attributes.getQName(i);
+        const char *p = name;
+        while (*p && (*attr == (XMLCh)*p)) {
+            ++attr;
+            ++p;
+        }
+        if (!*p && !*attr) {
+            const XMLCh *value = attributes.getValue(i);
+            string ret;
+            appendUtf8(ret, value, getLength(value));
+            return ret;
+        }
+    }
+    return string();
+}
+
+void XmlStreamHandler::appendUtf8(string &str, const XMLCh *chars,
+        const size_t length) {
+    for (size_t i = 0; i < length; ++i) {
+        unsigned long c = chars[i];
+        if ((c >= 0xd800) && (c < 0xdc00) && (i + 1 < length)) {
+            // surrogate pair
+            const unsigned long low = chars[i + 1];
+            if ((low >= 0xdc00) && (low < 0xe000)) {
+                c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+                ++i;
+            }
+        }
+        if (c < 0x80) {
+            str += (char)c;
+        } else if (c < 0x800) {
+            str += (char)(0xc0 | (c >> 6));
+            str += (char)(0x80 | (c & 0x3f));
+        } else if (c < 0x10000) {
+            str += (char)(0xe0 | (c >> 12));
+            str += (char)(0x80 | ((c >> 6) & 0x3f));
+            str += (char)(0x80 | (c & 0x3f));
+        } else {
+            str += (char)(0xf0 | (c >> 18));
+            str += (char)(0x80 | ((c >> 12) & 0x3f));
+            str += (char)(0x80 | ((c >> 6) & 0x3f));
+            str += (char)(0x80 | (c & 0x3f));
+        }
+    }
+}
+
+void XmlStreamHandler::startElement(const XMLCh *const,
+        const XMLCh *const, const XMLCh *const qname,
+        const Attributes &attrs) {
+    string name;
+    appendUtf8(name, qname, getLength(qname));
+    m_path.push_back(name);
+    m_text.push_back(string());
+    openElement(name, attrs);
+}
+
+void XmlStreamHandler::endElement(const XMLCh *const,
+        const XMLCh *const, const XMLCh *const) {
+    closeElement(m_path.back(), m_text.back());
+    m_path.pop_back();
+    m_text.pop_back();
+}
+
+void XmlStreamHandler::characters(const XMLCh *const chars,
+        const XMLSize_t length) {
+    if (!m_text.empty()) {
+        appendUtf8(m_text.back(), chars, length);
+    }
+}
+
+void XmlStreamHandler::error(const SAXParseException &e) {
+    fatalError(e);
+}
+
+void XmlStreamHandler::fatalError(const SAXParseException &e) {
+    ++m_errors;
+    const XMLFileLoc line = e.getLineNumber();
+    const XMLFileLoc column = e.getColumnNumber();
+    Log::out() << "Error at (" << line << "," << column << ")." << endl;
+    string message;
+    appendUtf8(message, e.getMessage(), getLength(e.getMessage()));
+    Log::out() << message << endl;
+}
+
+}
@@ -0,0 +1,106 @@
+/* 
+ * File:   XmlStream.h
+ *
+ * This file is a part of Shoddy Battle.
+ * Copyright (C) 2009  Catherine Fitzpatrick and Benjamin Gwin
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Affero General Public License
+ * as published by the Free Software Foundation; either version 3
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Affero General Public License for more details.
+ *
+ * You should have received a copy of the GNU Affero General Public License
+ * along with this program; if not, visit the Free Software Foundation, Inc.
+ * online at http://gnu.org.
+ */
+
+#ifndef _XML_STREAM_H_
+#define _XML_STREAM_H_
+
+#include <string>
+#include <vector>
+#include <xercesc/sax2/DefaultHandler.hpp>
+#include <xercesc/sax2/Attributes.hpp>
+
+namespace shoddybattle {
+
+/**
+ * Base class for streaming (SAX2) readers of the game data XML files, which
+ * build their records as the file is read rather than from a DOM tree of the
+ * whole file.
+ *
+ * The handler keeps the names of the open elements and collects the text
+ * directly inside each one. Names, attributes and text are converted from
+ * UTF-16 to UTF-8 strings directly rather than through XMLString::transcode.
+ */
+class XmlStreamHandler : public xercesc::DefaultHandler {
+public:
+    /**
+     * Parse a file, calling openElement and closeElement for each element.
+     * Returns false if the file could not be parsed.
+     */
+    bool parse(const std::string &file);
+
+protected:
+    XmlStreamHandler(): m_errors(0) { }
+
+    /**
+     * Called at the start of an element, which is already on the path.
+     */
+    virtual void openElement(const std::string &name,
+            const xercesc::Attributes &attributes) = 0;
+
+    /**
+     * Called at the end of an element, with the text directly inside it.
+     * The element is still on the path.
+     */
+    virtual void closeElement(const std::string &name,
+            const std::string &text) = 0;
+
+    /**
+     * Get the number of open elements, including the current one.
+     */
+    int getDepth() const {
+        return m_path.size();
+    }
+
+    /**
+     * Get the name of an open element: 0 is the current element, 1 is its
+     * parent, and so on. Returns an empty string past the root.
+     */
+    const std::string &getAncestor(const int i) const;
+
+    /**
+     * Get the value of an attribute, or an empty string if it is missing.
+     */
+    static std::string getAttribute(const xercesc::Attributes &attributes,
+            const char *name);
+
+    /**
+     * Append a UTF-16 string to a UTF-8 string.
+     */
+    static void appendUtf8(std::string &str, const XMLCh *chars,
+            const size_t length);
+
+private:
+    void startElement(const XMLCh *const uri, const XMLCh *const localname,
+            const XMLCh *const qname, const xercesc::Attributes &attrs);
+    void endElement(const XMLCh *const uri, const XMLCh *const localname,
+            const XMLCh *const qname);
+    void characters(const XMLCh *const chars, const XMLSize_t length);
+    void error(const xercesc::SAXParseException &e);
+    void fatalError(const xercesc::SAXParseException &e);
+
+    std::vector<std::string> m_path;
+    std::vector<std::string> m_text;
+    int m_errors;
+};
+
+}
+
+#endif
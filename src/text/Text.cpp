@@ -27,6 +27,8 @@
 #include <string>
 #include <sstream>
 #include <cstdarg>
+#include <cstring>
+#include <cctype>
 #include <iostream>
 
 using namespace std;
@@ -39,35 +41,113 @@ string trim(string &s, const string &space) {
     return r.erase(0, r.find_first_not_of(space));
 }
 
+namespace {
+
+size_t getLength(const char *arg) {
+    return strlen(arg);
+}
+
+size_t getLength(const string &arg) {
+    return arg.length();
+}
+
+}
+
 /**
- * Load a string from the table.
+ * Split a string into literal runs and $n argument slots.
  */
-string Text::getText(const int type, const int id, const int count,
-        const char **args) const {
+TextTemplate::TextTemplate(const string &text):
+        m_text(text),
+        m_literalLength(0) {
+    const size_t length = m_text.length();
+    size_t begin = 0;
+    size_t pos = 0;
+    while ((pos = m_text.find('$', pos)) != string::npos) {
+        size_t end = pos + 1;
+        int arg = 0;
+        while ((end < length) && isdigit(m_text[end])) {
+            arg = arg * 10 + (m_text[end] - '0');
+            ++end;
+        }
+        if ((end == pos + 1) || (arg < 1)) {
+            // Not an argument slot, so it is part of the literal text.
+            pos = end;
+            continue;
+        }
+        if (pos > begin) {
+            const SEGMENT literal = { -1, begin, pos - begin };
+            m_segments.push_back(literal);
+            m_literalLength += pos - begin;
+        }
+        const SEGMENT slot = { arg - 1, pos, end - pos };
+        m_segments.push_back(slot);
+        begin = pos = end;
+    }
+    if (length > begin) {
+        const SEGMENT literal = { -1, begin, length - begin };
+        m_segments.push_back(literal);
+        m_literalLength += length - begin;
+    }
+}
+
+template <class T>
+string TextTemplate::renderArgs(const int count, const T *args) const {
+    size_t size = m_literalLength;
+    vector<SEGMENT>::const_iterator i = m_segments.begin();
+    for (; i != m_segments.end(); ++i) {
+        if (i->arg == -1) {
+            continue;
+        }
+        size += (i->arg < count) ? getLength(args[i->arg]) : i->length;
+    }
+
+    string ret;
+    ret.reserve(size);
+    for (i = m_segments.begin(); i != m_segments.end(); ++i) {
+        if ((i->arg == -1) || (i->arg >= count)) {
+            ret.append(m_text, i->begin, i->length);
+        } else {
+            ret.append(args[i->arg]);
+        }
+    }
+    return ret;
+}
+
+string TextTemplate::render(const int count, const char **args) const {
+    return renderArgs(count, args);
+}
+
+string TextTemplate::render(const int count, const string *args) const {
+    return renderArgs(count, args);
+}
+
+const TextTemplate *Text::getTemplate(const int type, const int id) const {
     TEXT_MAP::const_iterator itr = m_text.find(type);
     if (itr == m_text.end()) {
-        return string();
+        return NULL;
     }
 
     const INDEX_MAP &j = itr->second;
     INDEX_MAP::const_iterator k = j.find(id);
     if (k == j.end()) {
-        return string();
-    }
-    string text = k->second;
-
-    // Replace $n entities in the string.
-    for (int i = 1; i <= count; ++i) {
-        stringstream ss;
-        ss << "$" << i;
-        string str = ss.str();
-        size_t pos = text.find(str);
-        if (pos != string::npos) {
-            text.replace(pos, str.length(), args[i - 1]);
-        }
+        return NULL;
     }
+    return &k->second;
+}
 
-    return text;
+/**
+ * Load a string from the table, replacing each $n with argument n.
+ */
+string Text::getText(const int type, const int id, const int count,
+        const char **args) const {
+    const TextTemplate *text = getTemplate(type, id);
+    return text ? text->render(count, args) : string();
+}
+
+string Text::getText(const int type, const int id, const int count,
+        const string *args) const {
+    const TextTemplate *text = getTemplate(type, id);
+    return text ? text->render(count, args) : string();
 }
 
 /**
@@ -79,6 +159,28 @@ bool Text::loadFile(const string path, LOOKUP_FUNCTION lookup)
     if (!ifs.is_open()) {
         return false;
     }
+    return load(ifs, lookup);
+}
+
+/**
+ * Read a language file into memory.
+ */
+bool Text::readFile(const string path, string &contents) {
+    ifstream ifs(path.c_str());
+    if (!ifs.is_open()) {
+        return false;
+    }
+    ostringstream oss;
+    oss << ifs.rdbuf();
+    contents = oss.str();
+    return true;
+}
+
+/**
+ * Load a language file that has already been opened or read.
+ */
+bool Text::load(istream &ifs, LOOKUP_FUNCTION lookup)
+        throw(SyntaxException) {
     int lineNumber = 0;
     int category = -1;
     map<string, int> categories;
@@ -145,7 +247,7 @@ bool Text::loadFile(const string path, LOOKUP_FUNCTION lookup)
         }
 
         string text = line.substr(pos + 1);
-        m_text[category][idx] = trim(text);
+        m_text[category][idx] = TextTemplate(trim(text));
 
     }
     return true;
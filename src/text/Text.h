@@ -27,7 +27,9 @@
 
 #include <boost/function.hpp>
 #include <string>
+#include <vector>
 #include <map>
+#include <istream>
 
 namespace shoddybattle {
 
@@ -41,7 +43,37 @@ private:
     unsigned int m_line;
 };
 
-typedef std::map<int, std::string> INDEX_MAP;
+/**
+ * A string from the string table, split when it is loaded into runs of
+ * literal text and $n argument slots, so that it can be rendered in a single
+ * pass. A slot with no matching argument is rendered as it was written.
+ */
+class TextTemplate {
+public:
+    TextTemplate(): m_literalLength(0) { }
+    explicit TextTemplate(const std::string &text);
+
+    std::string render(const int count, const char **args) const;
+    std::string render(const int count, const std::string *args) const;
+
+    const std::string &getSource() const { return m_text; }
+
+private:
+    struct SEGMENT {
+        int arg;            // Argument index from 0, or -1 for literal text.
+        size_t begin;       // The segment's position in m_text.
+        size_t length;
+    };
+
+    template <class T>
+    std::string renderArgs(const int count, const T *args) const;
+
+    std::string m_text;
+    std::vector<SEGMENT> m_segments;
+    size_t m_literalLength;
+};
+
+typedef std::map<int, TextTemplate> INDEX_MAP;
 typedef std::map<int, INDEX_MAP> TEXT_MAP;
 
 typedef boost::function<int (std::string)> LOOKUP_FUNCTION;
@@ -63,6 +95,13 @@ public:
      */
     std::string getText(const int type,
             const int id, const int count, const char **args) const;
+    std::string getText(const int type,
+            const int id, const int count, const std::string *args) const;
+
+    /**
+     * Get the compiled form of a string, or NULL if there is no such string.
+     */
+    const TextTemplate *getTemplate(const int type, const int id) const;
 
     /**
      * Populate the string table by reading a file.
@@ -70,6 +109,19 @@ public:
     bool loadFile(const std::string file, LOOKUP_FUNCTION lookup)
             throw(SyntaxException);
 
+    /**
+     * Populate the string table from a stream, such as the contents of a file
+     * read earlier by readFile.
+     */
+    bool load(std::istream &in, LOOKUP_FUNCTION lookup)
+            throw(SyntaxException);
+
+    /**
+     * Read the contents of a file into memory, so that it can be loaded
+     * later without touching the disk.
+     */
+    static bool readFile(const std::string file, std::string &contents);
+
 private:
     TEXT_MAP m_text;
 };